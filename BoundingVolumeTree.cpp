@@ -0,0 +1,786 @@
+//--------------------------------------------------------------------------------------
+//	BoundingVolumeTree.cpp
+//
+//	A dynamic bounding volume hierarchy (BVH) over axis-aligned bounding boxes. Used to
+//	find the models in a view frustum, hit by a ray or within a light's range without
+//	testing every model in the scene
+//--------------------------------------------------------------------------------------
+
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include "Defines.h"            // General definitions shared by all source files
+#include "CTimer.h"             // Timer class - not DirectX
+#include "BoundingVolumeTree.h" // Declaration of this class
+
+// Size of the stack used to walk the tree in queries. Balancing keeps the height close to log2 of the number of objects,
+// and the stack never holds more than height + 1 nodes, so this is far more than any scene will need
+static const int MAX_QUERY_STACK = 256;
+
+
+//-----------------------------------------------------------------------------
+// Box helpers
+//-----------------------------------------------------------------------------
+
+// Surface area of a box - the cost measure used to decide where to insert new objects
+static float BoxArea( const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds )
+{
+	D3DXVECTOR3 size = maxBounds - minBounds;
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+// Surface area of the box enclosing two boxes
+static float CombinedArea( const D3DXVECTOR3& min1, const D3DXVECTOR3& max1, const D3DXVECTOR3& min2, const D3DXVECTOR3& max2 )
+{
+	D3DXVECTOR3 minBounds, maxBounds;
+	D3DXVec3Minimize( &minBounds, &min1, &min2 );
+	D3DXVec3Maximize( &maxBounds, &max1, &max2 );
+	return BoxArea( minBounds, maxBounds );
+}
+
+// Does the outer box completely contain the inner one
+static bool BoxContains( const D3DXVECTOR3& outerMin, const D3DXVECTOR3& outerMax, const D3DXVECTOR3& innerMin, const D3DXVECTOR3& innerMax )
+{
+	return outerMin.x <= innerMin.x && outerMin.y <= innerMin.y && outerMin.z <= innerMin.z &&
+	       innerMax.x <= outerMax.x && innerMax.y <= outerMax.y && innerMax.z <= outerMax.z;
+}
+
+// Does a box overlap a sphere - find the closest point in the box to the sphere centre and check its distance
+static bool BoxOverlapsSphere( const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds, const D3DXVECTOR3& centre, float radius )
+{
+	float distanceSq = 0.0f;
+	const float* boxMin = minBounds;
+	const float* boxMax = maxBounds;
+	const float* point = centre;
+	for (int i = 0; i < 3; ++i)
+	{
+		if (point[i] < boxMin[i])
+		{
+			distanceSq += (boxMin[i] - point[i]) * (boxMin[i] - point[i]);
+		}
+		else if (point[i] > boxMax[i])
+		{
+			distanceSq += (point[i] - boxMax[i]) * (point[i] - boxMax[i]);
+		}
+	}
+	return distanceSq <= radius * radius;
+}
+
+
+// Test a ray against an axis-aligned box using the "slab" method - clip the ray's range against the pair of planes on each
+// axis in turn, if the range becomes empty the ray misses. Returns the distance where the ray enters the box
+bool RayIntersectsBox( const D3DXVECTOR3& origin, const D3DXVECTOR3& direction, float maxDistance,
+                       const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds, float* hitDistance )
+{
+	float nearDistance = 0.0f;
+	float farDistance = maxDistance;
+	const float* rayOrigin = origin;
+	const float* rayDirection = direction;
+	const float* boxMin = minBounds;
+	const float* boxMax = maxBounds;
+	for (int i = 0; i < 3; ++i)
+	{
+		if (fabsf( rayDirection[i] ) < 1e-8f)
+		{
+			// Ray parallel to this pair of planes - misses unless it starts between them
+			if (rayOrigin[i] < boxMin[i] || rayOrigin[i] > boxMax[i])
+			{
+				return false;
+			}
+		}
+		else
+		{
+			float invDirection = 1.0f / rayDirection[i];
+			float t1 = (boxMin[i] - rayOrigin[i]) * invDirection;
+			float t2 = (boxMax[i] - rayOrigin[i]) * invDirection;
+			if (t1 > t2)
+			{
+				float temp = t1; t1 = t2; t2 = temp;
+			}
+			if (t1 > nearDistance) nearDistance = t1;
+			if (t2 < farDistance)  farDistance = t2;
+			if (nearDistance > farDistance)
+			{
+				return false;
+			}
+		}
+	}
+	if (hitDistance)
+	{
+		*hitDistance = nearDistance;
+	}
+	return true;
+}
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+CBoundingVolumeTree::CBoundingVolumeTree( float margin, float displacementMultiplier )
+{
+	m_Root = NULL_NODE;
+	m_FreeList = NULL_NODE;
+	m_NumLeaves = 0;
+	m_Margin = margin;
+	m_DisplacementMultiplier = displacementMultiplier;
+}
+
+
+/////////////////////////////
+// Objects ("proxies")
+
+// Add an object with the given world space box. The box is fattened by the margin before it is stored
+int CBoundingVolumeTree::CreateProxy( const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds, void* userData )
+{
+	int proxy = AllocateNode();
+	D3DXVECTOR3 margin( m_Margin, m_Margin, m_Margin );
+	m_Nodes[proxy].minBounds = minBounds - margin;
+	m_Nodes[proxy].maxBounds = maxBounds + margin;
+	m_Nodes[proxy].userData = userData;
+	m_Nodes[proxy].height = 0;
+
+	InsertLeaf( proxy );
+	++m_NumLeaves;
+	return proxy;
+}
+
+// Remove an object from the tree
+void CBoundingVolumeTree::DestroyProxy( int proxy )
+{
+	RemoveLeaf( proxy );
+	FreeNode( proxy );
+	--m_NumLeaves;
+}
+
+// Update the box of an object after it moves. Nothing changes while the object stays inside its fattened box. Otherwise
+// it is reinserted with a new fattened box, extended in the direction it is moving so it will stay inside for longer
+bool CBoundingVolumeTree::MoveProxy( int proxy, const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds, const D3DXVECTOR3& displacement )
+{
+	if (BoxContains( m_Nodes[proxy].minBounds, m_Nodes[proxy].maxBounds, minBounds, maxBounds ))
+	{
+		return false;
+	}
+
+	RemoveLeaf( proxy );
+
+	D3DXVECTOR3 margin( m_Margin, m_Margin, m_Margin );
+	D3DXVECTOR3 fatMin = minBounds - margin;
+	D3DXVECTOR3 fatMax = maxBounds + margin;
+	D3DXVECTOR3 predicted = displacement * m_DisplacementMultiplier;
+	if (predicted.x < 0.0f) fatMin.x += predicted.x; else fatMax.x += predicted.x;
+	if (predicted.y < 0.0f) fatMin.y += predicted.y; else fatMax.y += predicted.y;
+	if (predicted.z < 0.0f) fatMin.z += predicted.z; else fatMax.z += predicted.z;
+	m_Nodes[proxy].minBounds = fatMin;
+	m_Nodes[proxy].maxBounds = fatMax;
+
+	InsertLeaf( proxy );
+	return true;
+}
+
+
+/////////////////////////////
+// Queries
+
+// Find the objects that may be visible in a view frustum. When a node is entirely inside the frustum all the objects below
+// it are visible and there is no need to test them individually
+void CBoundingVolumeTree::QueryFrustum( const CFrustum& frustum, vector<void*>& results ) const
+{
+	if (m_Root == NULL_NODE) return;
+
+	int stack[MAX_QUERY_STACK];
+	int stackSize = 0;
+	stack[stackSize++] = m_Root;
+	while (stackSize > 0)
+	{
+		const SNode& node = m_Nodes[stack[--stackSize]];
+		EFrustumTest test = frustum.ClassifyBox( node.minBounds, node.maxBounds );
+		if (test == Frustum_Outside)
+		{
+			continue;
+		}
+		if (node.IsLeaf())
+		{
+			results.push_back( node.userData );
+		}
+		else if (test == Frustum_Inside)
+		{
+			AddAllLeaves( node.child1, results );
+			AddAllLeaves( node.child2, results );
+		}
+		else
+		{
+			stack[stackSize++] = node.child1;
+			stack[stackSize++] = node.child2;
+		}
+	}
+}
+
+// Find the objects that may be hit by a ray within the given distance
+void CBoundingVolumeTree::QueryRay( const D3DXVECTOR3& origin, const D3DXVECTOR3& direction, float maxDistance, vector<void*>& results ) const
+{
+	if (m_Root == NULL_NODE) return;
+
+	int stack[MAX_QUERY_STACK];
+	int stackSize = 0;
+	stack[stackSize++] = m_Root;
+	while (stackSize > 0)
+	{
+		const SNode& node = m_Nodes[stack[--stackSize]];
+		if (!RayIntersectsBox( origin, direction, maxDistance, node.minBounds, node.maxBounds, 0 ))
+		{
+			continue;
+		}
+		if (node.IsLeaf())
+		{
+			results.push_back( node.userData );
+		}
+		else
+		{
+			stack[stackSize++] = node.child1;
+			stack[stackSize++] = node.child2;
+		}
+	}
+}
+
+// Find the objects that may overlap a sphere
+void CBoundingVolumeTree::QuerySphere( const D3DXVECTOR3& centre, float radius, vector<void*>& results ) const
+{
+	if (m_Root == NULL_NODE) return;
+
+	int stack[MAX_QUERY_STACK];
+	int stackSize = 0;
+	stack[stackSize++] = m_Root;
+	while (stackSize > 0)
+	{
+		const SNode& node = m_Nodes[stack[--stackSize]];
+		if (!BoxOverlapsSphere( node.minBounds, node.maxBounds, centre, radius ))
+		{
+			continue;
+		}
+		if (node.IsLeaf())
+		{
+			results.push_back( node.userData );
+		}
+		else
+		{
+			stack[stackSize++] = node.child1;
+			stack[stackSize++] = node.child2;
+		}
+	}
+}
+
+
+/////////////////////////////
+// Benchmark
+
+// Kinds of query timed by the benchmark
+enum EBenchmarkQuery
+{
+	BenchmarkQuery_Frustum,
+	BenchmarkQuery_Ray,
+	BenchmarkQuery_Sphere,
+	NumBenchmarkQueries
+};
+
+// A query made by the benchmark - a camera position and facing, used as a view frustum, a ray or the centre of a sphere
+struct SBenchmarkQuery
+{
+	D3DXVECTOR3 position;
+	D3DXVECTOR3 facing;
+	CFrustum    frustum;
+};
+
+// Length of the benchmark's view frustums and rays, and the radius of its spheres
+static const float BenchmarkQueryRange = 100.0f;
+static const float BenchmarkSphereRadius = 20.0f;
+
+// Random number from min to max, for the benchmark
+static float RandomRange( float min, float max )
+{
+	return min + (max - min) * rand() / static_cast<float>(RAND_MAX);
+}
+
+// Make a benchmark query using the tree
+static void TreeQuery( const CBoundingVolumeTree& tree, const SBenchmarkQuery& query, int type, vector<void*>& found )
+{
+	if (type == BenchmarkQuery_Frustum)
+	{
+		tree.QueryFrustum( query.frustum, found );
+	}
+	else if (type == BenchmarkQuery_Ray)
+	{
+		tree.QueryRay( query.position, query.facing, BenchmarkQueryRange, found );
+	}
+	else
+	{
+		tree.QuerySphere( query.position, BenchmarkSphereRadius, found );
+	}
+}
+
+// Make a benchmark query by testing every object's box in turn
+static void BruteForceQuery( const vector<D3DXVECTOR3>& minBounds, const vector<D3DXVECTOR3>& maxBounds, const vector<void*>& userData,
+                             const SBenchmarkQuery& query, int type, vector<void*>& found )
+{
+	for (size_t i = 0; i < minBounds.size(); ++i)
+	{
+		bool hit;
+		if (type == BenchmarkQuery_Frustum)
+		{
+			hit = query.frustum.ClassifyBox( minBounds[i], maxBounds[i] ) != Frustum_Outside;
+		}
+		else if (type == BenchmarkQuery_Ray)
+		{
+			hit = RayIntersectsBox( query.position, query.facing, BenchmarkQueryRange, minBounds[i], maxBounds[i], 0 );
+		}
+		else
+		{
+			hit = BoxOverlapsSphere( minBounds[i], maxBounds[i], query.position, BenchmarkSphereRadius );
+		}
+		if (hit)
+		{
+			found.push_back( userData[i] );
+		}
+	}
+}
+
+// Time building a tree of randomly placed boxes from 1 to 5 units across, moving every box for a few frames, then the given number
+// of each kind of query against testing every box. The boxes are scattered over an area that grows with their number, so each query
+// finds about the same number of objects however many there are. The brute force queries test the fattened boxes stored in the tree
+// so that the objects found can be compared exactly
+SBoundingVolumeTreeBenchmark CBoundingVolumeTree::Benchmark( unsigned int numObjects, int numQueries )
+{
+	const int NumRefitFrames = 10;
+	float areaSize = sqrtf( static_cast<float>(numObjects) ) * 20.0f;
+
+	srand( 1 );
+	vector<D3DXVECTOR3> minBounds( numObjects ), maxBounds( numObjects ), velocities( numObjects );
+	for (unsigned int i = 0; i < numObjects; ++i)
+	{
+		D3DXVECTOR3 centre( RandomRange( 0.0f, areaSize ), RandomRange( 0.0f, 10.0f ), RandomRange( 0.0f, areaSize ) );
+		D3DXVECTOR3 halfSize( RandomRange( 0.5f, 2.5f ), RandomRange( 0.5f, 2.5f ), RandomRange( 0.5f, 2.5f ) );
+		minBounds[i] = centre - halfSize;
+		maxBounds[i] = centre + halfSize;
+		velocities[i] = D3DXVECTOR3( RandomRange( -0.2f, 0.2f ), 0.0f, RandomRange( -0.2f, 0.2f ) );
+	}
+
+	// Cameras at eye height looking in random directions across the area
+	vector<SBenchmarkQuery> queries( numQueries );
+	D3DXMATRIX projMatrix;
+	D3DXMatrixPerspectiveFovLH( &projMatrix, ToRadians( 60.0f ), 16.0f / 9.0f, 1.0f, BenchmarkQueryRange );
+	for (int q = 0; q < numQueries; ++q)
+	{
+		SBenchmarkQuery& query = queries[q];
+		float angle = RandomRange( 0.0f, 2.0f * D3DX_PI );
+		query.position = D3DXVECTOR3( RandomRange( 0.0f, areaSize ), 5.0f, RandomRange( 0.0f, areaSize ) );
+		query.facing = D3DXVECTOR3( sinf( angle ), 0.0f, cosf( angle ) );
+
+		D3DXMATRIX viewMatrix;
+		D3DXVECTOR3 target = query.position + query.facing;
+		D3DXVECTOR3 up( 0.0f, 1.0f, 0.0f );
+		D3DXMatrixLookAtLH( &viewMatrix, &query.position, &target, &up );
+		query.frustum.ExtractFromMatrix( viewMatrix * projMatrix );
+	}
+
+	SBoundingVolumeTreeBenchmark results;
+	results.numObjects = numObjects;
+	CTimer timer;
+	timer.Start();
+
+	// Build, then refit as every object moves
+	CBoundingVolumeTree tree;
+	vector<int> proxies( numObjects );
+	vector<void*> userData( numObjects );
+	timer.GetLapTime();
+	for (unsigned int i = 0; i < numObjects; ++i)
+	{
+		userData[i] = &proxies[i];
+		proxies[i] = tree.CreateProxy( minBounds[i], maxBounds[i], userData[i] );
+	}
+	results.buildTime = timer.GetLapTime();
+
+	int numReinserted = 0;
+	for (int frame = 0; frame < NumRefitFrames; ++frame)
+	{
+		for (unsigned int i = 0; i < numObjects; ++i)
+		{
+			minBounds[i] += velocities[i];
+			maxBounds[i] += velocities[i];
+			if (tree.MoveProxy( proxies[i], minBounds[i], maxBounds[i], velocities[i] ))
+			{
+				++numReinserted;
+			}
+		}
+	}
+	results.refitTime = timer.GetLapTime() / NumRefitFrames;
+	results.reinsertedPerFrame = static_cast<float>(numReinserted) / NumRefitFrames;
+	results.height = tree.GetHeight();
+
+	// Brute force tests the same boxes as the tree
+	for (unsigned int i = 0; i < numObjects; ++i)
+	{
+		tree.GetFatBounds( proxies[i], &minBounds[i], &maxBounds[i] );
+	}
+
+	// Time each kind of query with and without the tree. Results are cleared each query, as a caller reusing its list would
+	float treeTimes[NumBenchmarkQueries], bruteTimes[NumBenchmarkQueries];
+	vector<void*> found, expected;
+	found.reserve( numObjects );
+	expected.reserve( numObjects );
+	for (int type = 0; type < NumBenchmarkQueries; ++type)
+	{
+		timer.GetLapTime();
+		for (int q = 0; q < numQueries; ++q)
+		{
+			found.clear();
+			TreeQuery( tree, queries[q], type, found );
+		}
+		treeTimes[type] = timer.GetLapTime();
+
+		for (int q = 0; q < numQueries; ++q)
+		{
+			expected.clear();
+			BruteForceQuery( minBounds, maxBounds, userData, queries[q], type, expected );
+		}
+		bruteTimes[type] = timer.GetLapTime();
+	}
+	float perQuery = (numQueries > 0) ? 1.0f / numQueries : 0.0f;
+	results.frustumTime = treeTimes[BenchmarkQuery_Frustum] * perQuery;
+	results.bruteFrustumTime = bruteTimes[BenchmarkQuery_Frustum] * perQuery;
+	results.rayTime = treeTimes[BenchmarkQuery_Ray] * perQuery;
+	results.bruteRayTime = bruteTimes[BenchmarkQuery_Ray] * perQuery;
+	results.sphereTime = treeTimes[BenchmarkQuery_Sphere] * perQuery;
+	results.bruteSphereTime = bruteTimes[BenchmarkQuery_Sphere] * perQuery;
+
+	// Compare the objects found, in any order, outside the timings
+	unsigned int numFound = 0;
+	results.matchesBruteForce = true;
+	for (int type = 0; type < NumBenchmarkQueries; ++type)
+	{
+		for (int q = 0; q < numQueries; ++q)
+		{
+			found.clear();
+			expected.clear();
+			TreeQuery( tree, queries[q], type, found );
+			BruteForceQuery( minBounds, maxBounds, userData, queries[q], type, expected );
+			sort( found.begin(), found.end() );
+			sort( expected.begin(), expected.end() );
+			results.matchesBruteForce = results.matchesBruteForce && (found == expected);
+			numFound += static_cast<unsigned int>(found.size());
+		}
+	}
+	results.resultsPerQuery = static_cast<float>(numFound) * perQuery / NumBenchmarkQueries;
+	return results;
+}
+
+
+/////////////////////////////
+// Private member functions
+
+// Get a node from the free list, growing the node array if there are none left
+int CBoundingVolumeTree::AllocateNode()
+{
+	if (m_FreeList == NULL_NODE)
+	{
+		SNode node;
+		node.parentOrNext = NULL_NODE;
+		node.height = -1;
+		m_Nodes.push_back( node );
+		m_FreeList = static_cast<int>(m_Nodes.size()) - 1;
+	}
+
+	int node = m_FreeList;
+	m_FreeList = m_Nodes[node].parentOrNext;
+	m_Nodes[node].parentOrNext = NULL_NODE;
+	m_Nodes[node].child1 = NULL_NODE;
+	m_Nodes[node].child2 = NULL_NODE;
+	m_Nodes[node].height = 0;
+	m_Nodes[node].userData = 0;
+	return node;
+}
+
+// Return a node to the free list
+void CBoundingVolumeTree::FreeNode( int node )
+{
+	m_Nodes[node].parentOrNext = m_FreeList;
+	m_Nodes[node].height = -1;
+	m_FreeList = node;
+}
+
+
+// Insert a leaf into the tree. Walk down from the root choosing the child that is cheapest to add the leaf to, where the
+// cost is the increase in surface area of the boxes (larger boxes are hit by more queries). Stop when it would be cheaper to
+// pair the leaf with the current node than to descend further, then create a new parent for the two
+void CBoundingVolumeTree::InsertLeaf( int leaf )
+{
+	if (m_Root == NULL_NODE)
+	{
+		m_Root = leaf;
+		m_Nodes[leaf].parentOrNext = NULL_NODE;
+		return;
+	}
+
+	D3DXVECTOR3 leafMin = m_Nodes[leaf].minBounds;
+	D3DXVECTOR3 leafMax = m_Nodes[leaf].maxBounds;
+	int index = m_Root;
+	while (!m_Nodes[index].IsLeaf())
+	{
+		const SNode& node = m_Nodes[index];
+		float area = BoxArea( node.minBounds, node.maxBounds );
+		float combinedArea = CombinedArea( node.minBounds, node.maxBounds, leafMin, leafMax );
+
+		// Cost of creating a new parent for this node and the new leaf
+		float cost = 2.0f * combinedArea;
+
+		// Minimum cost of pushing the leaf further down the tree - every ancestor box grows by the same amount
+		float inheritanceCost = 2.0f * (combinedArea - area);
+
+		float childCosts[2];
+		int children[2] = { node.child1, node.child2 };
+		for (int i = 0; i < 2; ++i)
+		{
+			const SNode& child = m_Nodes[children[i]];
+			float childCombinedArea = CombinedArea( child.minBounds, child.maxBounds, leafMin, leafMax );
+			if (child.IsLeaf())
+			{
+				childCosts[i] = childCombinedArea + inheritanceCost;
+			}
+			else
+			{
+				childCosts[i] = (childCombinedArea - BoxArea( child.minBounds, child.maxBounds )) + inheritanceCost;
+			}
+		}
+
+		if (cost < childCosts[0] && cost < childCosts[1])
+		{
+			break;
+		}
+		index = (childCosts[0] < childCosts[1]) ? children[0] : children[1];
+	}
+	int sibling = index;
+
+	// Create a new parent for the sibling and the leaf (may reallocate the node array, so look nodes up again afterwards)
+	int oldParent = m_Nodes[sibling].parentOrNext;
+	int newParent = AllocateNode();
+	m_Nodes[newParent].parentOrNext = oldParent;
+	D3DXVec3Minimize( &m_Nodes[newParent].minBounds, &m_Nodes[sibling].minBounds, &leafMin );
+	D3DXVec3Maximize( &m_Nodes[newParent].maxBounds, &m_Nodes[sibling].maxBounds, &leafMax );
+	m_Nodes[newParent].height = m_Nodes[sibling].height + 1;
+	m_Nodes[newParent].child1 = sibling;
+	m_Nodes[newParent].child2 = leaf;
+	m_Nodes[sibling].parentOrNext = newParent;
+	m_Nodes[leaf].parentOrNext = newParent;
+
+	if (oldParent != NULL_NODE)
+	{
+		if (m_Nodes[oldParent].child1 == sibling)
+		{
+			m_Nodes[oldParent].child1 = newParent;
+		}
+		else
+		{
+			m_Nodes[oldParent].child2 = newParent;
+		}
+	}
+	else
+	{
+		m_Root = newParent;
+	}
+
+	RefitAncestors( newParent );
+}
+
+// Remove a leaf from the tree. Its parent is removed too and the leaf's sibling takes the parent's place
+void CBoundingVolumeTree::RemoveLeaf( int leaf )
+{
+	if (leaf == m_Root)
+	{
+		m_Root = NULL_NODE;
+		return;
+	}
+
+	int parent = m_Nodes[leaf].parentOrNext;
+	int grandParent = m_Nodes[parent].parentOrNext;
+	int sibling = (m_Nodes[parent].child1 == leaf) ? m_Nodes[parent].child2 : m_Nodes[parent].child1;
+
+	if (grandParent != NULL_NODE)
+	{
+		if (m_Nodes[grandParent].child1 == parent)
+		{
+			m_Nodes[grandParent].child1 = sibling;
+		}
+		else
+		{
+			m_Nodes[grandParent].child2 = sibling;
+		}
+		m_Nodes[sibling].parentOrNext = grandParent;
+		FreeNode( parent );
+		RefitAncestors( grandParent );
+	}
+	else
+	{
+		m_Root = sibling;
+		m_Nodes[sibling].parentOrNext = NULL_NODE;
+		FreeNode( parent );
+	}
+}
+
+
+// Recalculate the box and height of every node from the given node up to the root, balancing on the way
+void CBoundingVolumeTree::RefitAncestors( int node )
+{
+	while (node != NULL_NODE)
+	{
+		node = Balance( node );
+
+		SNode& current = m_Nodes[node];
+		const SNode& child1 = m_Nodes[current.child1];
+		const SNode& child2 = m_Nodes[current.child2];
+		current.height = 1 + ((child1.height > child2.height) ? child1.height : child2.height);
+		D3DXVec3Minimize( &current.minBounds, &child1.minBounds, &child2.minBounds );
+		D3DXVec3Maximize( &current.maxBounds, &child1.maxBounds, &child2.maxBounds );
+
+		node = current.parentOrNext;
+	}
+}
+
+
+// If one child of node A is more than one level taller than the other, rotate the taller child (C below) up to take A's
+// place. A keeps the shorter child (B) and takes the shorter of C's children, C keeps its taller child:
+//
+//        A                 C
+//      /   \             /   \
+//     B     C    -->    A     F
+//          / \         / \
+//         F   G       B   G
+//
+// Returns the node now at the top of this subtree
+int CBoundingVolumeTree::Balance( int iA )
+{
+	SNode& A = m_Nodes[iA];
+	if (A.IsLeaf() || A.height < 2)
+	{
+		return iA;
+	}
+
+	int iB = A.child1;
+	int iC = A.child2;
+	SNode& B = m_Nodes[iB];
+	SNode& C = m_Nodes[iC];
+	int balance = C.height - B.height;
+
+	// Rotate C up
+	if (balance > 1)
+	{
+		int iF = C.child1;
+		int iG = C.child2;
+		SNode& F = m_Nodes[iF];
+		SNode& G = m_Nodes[iG];
+
+		// Swap A and C
+		C.child1 = iA;
+		C.parentOrNext = A.parentOrNext;
+		A.parentOrNext = iC;
+		if (C.parentOrNext != NULL_NODE)
+		{
+			if (m_Nodes[C.parentOrNext].child1 == iA)
+			{
+				m_Nodes[C.parentOrNext].child1 = iC;
+			}
+			else
+			{
+				m_Nodes[C.parentOrNext].child2 = iC;
+			}
+		}
+		else
+		{
+			m_Root = iC;
+		}
+
+		// C keeps its taller child, A takes the other
+		int iKeep = (F.height > G.height) ? iF : iG;
+		int iMove = (F.height > G.height) ? iG : iF;
+		SNode& keep = m_Nodes[iKeep];
+		SNode& move = m_Nodes[iMove];
+		C.child2 = iKeep;
+		A.child2 = iMove;
+		move.parentOrNext = iA;
+		D3DXVec3Minimize( &A.minBounds, &B.minBounds, &move.minBounds );
+		D3DXVec3Maximize( &A.maxBounds, &B.maxBounds, &move.maxBounds );
+		D3DXVec3Minimize( &C.minBounds, &A.minBounds, &keep.minBounds );
+		D3DXVec3Maximize( &C.maxBounds, &A.maxBounds, &keep.maxBounds );
+		A.height = 1 + ((B.height > move.height) ? B.height : move.height);
+		C.height = 1 + ((A.height > keep.height) ? A.height : keep.height);
+		return iC;
+	}
+
+	// Rotate B up - mirror image of the above
+	if (balance < -1)
+	{
+		int iD = B.child1;
+		int iE = B.child2;
+		SNode& D = m_Nodes[iD];
+		SNode& E = m_Nodes[iE];
+
+		// Swap A and B
+		B.child1 = iA;
+		B.parentOrNext = A.parentOrNext;
+		A.parentOrNext = iB;
+		if (B.parentOrNext != NULL_NODE)
+		{
+			if (m_Nodes[B.parentOrNext].child1 == iA)
+			{
+				m_Nodes[B.parentOrNext].child1 = iB;
+			}
+			else
+			{
+				m_Nodes[B.parentOrNext].child2 = iB;
+			}
+		}
+		else
+		{
+			m_Root = iB;
+		}
+
+		// B keeps its taller child, A takes the other
+		int iKeep = (D.height > E.height) ? iD : iE;
+		int iMove = (D.height > E.height) ? iE : iD;
+		SNode& keep = m_Nodes[iKeep];
+		SNode& move = m_Nodes[iMove];
+		B.child2 = iKeep;
+		A.child1 = iMove;
+		move.parentOrNext = iA;
+		D3DXVec3Minimize( &A.minBounds, &C.minBounds, &move.minBounds );
+		D3DXVec3Maximize( &A.maxBounds, &C.maxBounds, &move.maxBounds );
+		D3DXVec3Minimize( &B.minBounds, &A.minBounds, &keep.minBounds );
+		D3DXVec3Maximize( &B.maxBounds, &A.maxBounds, &keep.maxBounds );
+		A.height = 1 + ((C.height > move.height) ? C.height : move.height);
+		B.height = 1 + ((A.height > keep.height) ? A.height : keep.height);
+		return iB;
+	}
+
+	return iA;
+}
+
+
+// Add the user data of every leaf below the given node
+void CBoundingVolumeTree::AddAllLeaves( int node, vector<void*>& results ) const
+{
+	int stack[MAX_QUERY_STACK];
+	int stackSize = 0;
+	stack[stackSize++] = node;
+	while (stackSize > 0)
+	{
+		const SNode& current = m_Nodes[stack[--stackSize]];
+		if (current.IsLeaf())
+		{
+			results.push_back( current.userData );
+		}
+		else
+		{
+			stack[stackSize++] = current.child1;
+			stack[stackSize++] = current.child2;
+		}
+	}
+}
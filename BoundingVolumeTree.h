@@ -0,0 +1,194 @@
+//--------------------------------------------------------------------------------------
+//	BoundingVolumeTree.h
+//
+//	A dynamic bounding volume hierarchy (BVH) over axis-aligned bounding boxes. Used to
+//	find the models in a view frustum, hit by a ray or within a light's range without
+//	testing every model in the scene
+//--------------------------------------------------------------------------------------
+
+#ifndef BOUNDING_VOLUME_TREE_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define BOUNDING_VOLUME_TREE_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+#include <d3d10.h>
+#include <d3dx10.h>
+#include "Frustum.h"
+
+
+// Results of CBoundingVolumeTree::Benchmark. Times are in seconds - the brute force times are for testing every object's box
+// in a list instead of using the tree
+struct SBoundingVolumeTreeBenchmark
+{
+	unsigned int numObjects;
+	int          height;
+	float        buildTime;          // Inserting every object
+	float        refitTime;          // Moving every object a little, per frame
+	float        reinsertedPerFrame; // Objects that left their fattened box each frame, averaged
+	float        frustumTime;        // Per query
+	float        bruteFrustumTime;
+	float        rayTime;
+	float        bruteRayTime;
+	float        sphereTime;
+	float        bruteSphereTime;
+	float        resultsPerQuery;    // Objects found by each query, averaged over all three kinds
+	bool         matchesBruteForce;  // Did every query find exactly the objects that brute force did
+};
+
+
+// Each object is stored in a leaf of a binary tree, each parent node has a box that encloses both of its children. A query
+// only needs to visit the children of nodes that pass the test, so cost grows with the log of the number of objects. The
+// leaf boxes are "fattened" with a margin so that objects that move a little can stay where they are - only objects that
+// leave their fat box are removed and reinserted. Insertion picks the sibling that least increases the total surface area
+// of the tree and rotations keep the tree balanced (the same approach as the dynamic tree in the Box2D physics engine)
+class CBoundingVolumeTree
+{
+/////////////////////////////
+// Private types and member variables
+private:
+
+	static const int NULL_NODE = -1;
+
+	struct SNode
+	{
+		// Box enclosing this node and all its children. Fattened for leaves
+		D3DXVECTOR3 minBounds;
+		D3DXVECTOR3 maxBounds;
+
+		// Object stored in a leaf (unused in internal nodes)
+		void* userData;
+
+		// Parent node, or next free node when this node is in the free list
+		int parentOrNext;
+
+		// Child nodes, both NULL_NODE for leaves
+		int child1;
+		int child2;
+
+		// Height of this node in the tree - leaves are 0, free nodes -1
+		int height;
+
+		bool IsLeaf() const
+		{
+			return child1 == NULL_NODE;
+		}
+	};
+
+	// All nodes are kept in one array and referred to by index, so the array can grow without breaking links between nodes
+	vector<SNode> m_Nodes;
+	int           m_Root;
+	int           m_FreeList;
+	int           m_NumLeaves;
+
+	// Amount added around each object's box when it is inserted, and how far ahead to extend the box in the direction of motion
+	float m_Margin;
+	float m_DisplacementMultiplier;
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	// Constructor - margin is added around each object's box to allow small movements without updating the tree
+	CBoundingVolumeTree( float margin = 1.0f, float displacementMultiplier = 2.0f );
+
+
+	/////////////////////////////
+	// Objects ("proxies")
+
+	// Add an object with the given world space box. Returns an identifier (proxy) for the object used in the functions below
+	int CreateProxy( const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds, void* userData );
+
+	// Remove an object from the tree
+	void DestroyProxy( int proxy );
+
+	// Update the box of an object after it moves. Displacement is the movement since the last update and is used to predict
+	// where it is going. Returns true if the object had to be reinserted, false if it was still inside its fattened box
+	bool MoveProxy( int proxy, const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds, const D3DXVECTOR3& displacement );
+
+	// Get the data passed when the object was created
+	void* GetUserData( int proxy ) const
+	{
+		return m_Nodes[proxy].userData;
+	}
+
+	// Get the fattened box stored for an object
+	void GetFatBounds( int proxy, D3DXVECTOR3* minBounds, D3DXVECTOR3* maxBounds ) const
+	{
+		*minBounds = m_Nodes[proxy].minBounds;
+		*maxBounds = m_Nodes[proxy].maxBounds;
+	}
+
+
+	/////////////////////////////
+	// Queries
+	// Results are the user data of each object whose fattened box passes the test, added to the end of the given list.
+	// The caller should test its own tighter bounds if an exact answer is needed
+
+	// Find the objects that may be visible in a view frustum
+	void QueryFrustum( const CFrustum& frustum, vector<void*>& results ) const;
+
+	// Find the objects that may be hit by a ray within the given distance. The direction does not need to be normalised,
+	// distance is measured in multiples of its length
+	void QueryRay( const D3DXVECTOR3& origin, const D3DXVECTOR3& direction, float maxDistance, vector<void*>& results ) const;
+
+	// Find the objects that may overlap a sphere, e.g. the range of a light
+	void QuerySphere( const D3DXVECTOR3& centre, float radius, vector<void*>& results ) const;
+
+
+	/////////////////////////////
+	// Statistics
+
+	// Number of objects in the tree
+	int GetNumProxies() const
+	{
+		return m_NumLeaves;
+	}
+
+	// Height of the tree - the number of levels a query may need to visit. A balanced tree of N objects has height ~log2(N)
+	int GetHeight() const
+	{
+		return (m_Root == NULL_NODE) ? 0 : m_Nodes[m_Root].height;
+	}
+
+
+	/////////////////////////////
+	// Benchmark
+
+	// Time building a tree of the given number of randomly placed objects, moving them for a few frames and the given number of
+	// frustum, ray and sphere queries, against testing every object's box
+	static SBoundingVolumeTreeBenchmark Benchmark( unsigned int numObjects, int numQueries );
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	int  AllocateNode();
+	void FreeNode( int node );
+
+	void InsertLeaf( int leaf );
+	void RemoveLeaf( int leaf );
+
+	// Rotate the tree about the given node if its children's heights differ by more than one. Returns the new subtree root
+	int Balance( int node );
+
+	// Recalculate the box and height of every node from the given node up to the root
+	void RefitAncestors( int node );
+
+	// Add the user data of every leaf below the given node
+	void AddAllLeaves( int node, vector<void*>& results ) const;
+};
+
+
+// Test a ray against an axis-aligned box. Returns true if the ray enters the box within the given distance, and the
+// distance (in multiples of the direction length) where it enters. A ray starting inside the box hits at distance 0
+bool RayIntersectsBox( const D3DXVECTOR3& origin, const D3DXVECTOR3& direction, float maxDistance,
+                       const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds, float* hitDistance );
+
+
+#endif // End of header guard - see top of file
@@ -39,15 +39,62 @@ void CCamera::UpdateMatrices()
 	m_WorldMatrix = matrixZRot * matrixXRot * matrixYRot * matrixTranslation;
 
 	// The rendering pipeline actually needs the inverse of the camera world matrix - called the view matrix. Creating an inverse is easy with DirectX:
-	D3DXMatrixInverse( &m_ViewMatrix, NULL, &m_WorldMatrix );
+	D3DXMatrixInverse( &m_Next.viewMatrix, NULL, &m_WorldMatrix );
 
 	// Initialize the projection matrix. This determines viewing properties of the camera such as field of view (FOV) and near clip distance
 	// One other factor in the projection matrix is the aspect ratio of screen (width/height) - used to adjust FOV between horizontal and vertical
 	float aspect = (float)g_ViewportWidth / g_ViewportHeight; 
-	D3DXMatrixPerspectiveFovLH( &m_ProjMatrix, m_FOV, 1.33f, m_NearClip, m_FarClip );
+	D3DXMatrixPerspectiveFovLH( &m_Next.projMatrix, m_FOV, 1.33f, m_NearClip, m_FarClip );
 
 	// Combine the view and projection matrix into a single matrix - which can (optionally) be used in the vertex shaders to save one matrix multiply per vertex
+	m_Next.viewProjMatrix = m_Next.viewMatrix * m_Next.projMatrix;
+
+	// The view frustum planes can be read straight out of the combined matrix
+	m_Next.frustum.ExtractFromMatrix( m_Next.viewProjMatrix );
+	m_Next.position = m_Position;
+
+	// Render the new matrices - straight away, unless publishing is deferred until the update is finished
+	MarkForPublish();
+}
+
+// Make the matrices last updated the ones rendered, blended with the previous update step's. The camera's world matrix is blended
+// and the view matrix and frustum made from it again. The projection is not blended
+void CCamera::Publish( float blend )
+{
+	m_ProjMatrix = m_Next.projMatrix;
+	if (blend >= 1.0f || m_PreviousWorldMatrix == m_WorldMatrix)
+	{
+		m_ViewPosition = m_Next.position;
+		m_ViewMatrix = m_Next.viewMatrix;
+		m_ViewProjMatrix = m_Next.viewProjMatrix;
+		m_Frustum = m_Next.frustum;
+		return;
+	}
+
+	D3DXMATRIX worldMatrix;
+	BlendMatrices( &worldMatrix, m_PreviousWorldMatrix, m_WorldMatrix, blend );
+	m_ViewPosition = D3DXVECTOR3( worldMatrix._41, worldMatrix._42, worldMatrix._43 );
+	D3DXMatrixInverse( &m_ViewMatrix, NULL, &worldMatrix );
 	m_ViewProjMatrix = m_ViewMatrix * m_ProjMatrix;
+	m_Frustum.ExtractFromMatrix( m_ViewProjMatrix );
+}
+
+// Keep the world matrix last updated as the previous update step's
+void CCamera::SaveStep()
+{
+	m_PreviousWorldMatrix = m_WorldMatrix;
+}
+
+
+// Number of pixels on the viewport covered by one world unit at the given distance from the camera. The projection matrix
+// scales y by _22 and the result covers -1 to 1 over the viewport height, so one unit covers _22 * height / 2 pixels at distance 1
+float CCamera::GetPixelsPerUnit( float distance )
+{
+	if (distance < m_NearClip)
+	{
+		distance = m_NearClip;
+	}
+	return m_ProjMatrix._22 * 0.5f * g_ViewportHeight / distance;
 }
 
 
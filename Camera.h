@@ -8,12 +8,14 @@
 #define CAMERA_H_INCLUDED
 
 #include "Input.h"
+#include "Frustum.h"
+#include "FramePipeline.h" // CPublishable
 
 //-----------------------------------------------------------------------------
 // DirectX Camera Class Defintition
 //-----------------------------------------------------------------------------
 
-class CCamera
+class CCamera : public CPublishable
 {
 /////////////////////////////
 // Private member variables
@@ -34,6 +36,24 @@ private:
 	D3DXMATRIX m_ProjMatrix;     // Projection matrix to set field of view and near/far clip distances
 	D3DXMATRIX m_ViewProjMatrix; // Combine (multiply) the view and projection matrices together - saves a matrix multiply in the shader (optional optimisation)
 
+	// Clipping planes of the camera's view, extracted from the view-projection matrix - used to cull models that are out of view
+	CFrustum m_Frustum;
+
+	// The view, projection and view-projection matrices, frustum and position above are the ones rendered. The scene update builds
+	// the next frame's in m_Next, which are copied over them when published (see FramePipeline.h). The world matrix belongs to the
+	// update - it is only read when publishing, to blend the view with the world matrix of the previous update step
+	D3DXVECTOR3 m_ViewPosition;
+	D3DXMATRIX  m_PreviousWorldMatrix;
+	struct SView
+	{
+		D3DXVECTOR3 position;
+		D3DXMATRIX  viewMatrix;
+		D3DXMATRIX  projMatrix;
+		D3DXMATRIX  viewProjMatrix;
+		CFrustum    frustum;
+	};
+	SView m_Next;
+
 
 /////////////////////////////
 // Public member functions
@@ -58,6 +78,10 @@ public:
 	{
 		return m_Rotation;
 	}
+	D3DXVECTOR3 GetWorldPosition() // Position rendered from - GetPosition may already be a frame ahead (see FramePipeline.h)
+	{
+		return m_ViewPosition;
+	}
 
 	D3DXMATRIX GetViewMatrix()
 	{
@@ -71,6 +95,10 @@ public:
 	{
 		return m_ViewProjMatrix;
 	}
+	const CFrustum& GetFrustum()
+	{
+		return m_Frustum;
+	}
 
 	float GetFOV()
 	{
@@ -112,9 +140,19 @@ public:
 	/////////////////////////////
 	// Camera Usage
 
-	// Update the matrices used for the camera in the rendering pipeline
+	// Update the matrices used for the camera in the rendering pipeline. The new matrices are rendered once published
 	void UpdateMatrices();
 
+	// Make the matrices last updated the ones rendered, blended with the previous update step's
+	void Publish( float blend );
+
+	// Keep the world matrix last updated as the previous update step's
+	void SaveStep();
+
+	// Number of pixels on the viewport covered by one world unit at the given distance from the camera - used to judge how large
+	// something (e.g. the error in a simplified model) will look on screen
+	float GetPixelsPerUnit( float distance );
+
 	// Control the camera's position and rotation using keys provided
 	void Control( float frameTime, EKeyCode turnUp, EKeyCode turnDown, EKeyCode turnLeft, EKeyCode turnRight,  
 	              EKeyCode moveForward, EKeyCode moveBackward, EKeyCode moveLeft, EKeyCode moveRight);
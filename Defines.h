@@ -46,5 +46,10 @@ extern ID3D10Device* g_pd3dDevice;
 // Dimensions of viewport - shared between setup code and camera class (which needs this to create the projection matrix - see code there)
 extern int g_ViewportWidth, g_ViewportHeight;
 
+// Job system that shares work out between threads, used by any code with work to split up (see JobSystem.h). Created in Main.cpp
+// before anything else and destroyed after everything else
+class CJobSystem;
+extern CJobSystem* g_JobSystem;
+
 
 #endif // End of header guard - see top of file
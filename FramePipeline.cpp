@@ -0,0 +1,300 @@
+//--------------------------------------------------------------------------------------
+//	FramePipeline.cpp
+//
+//	Runs the scene update for the next frame as a job while the current frame is
+//	rendered on the main thread. The scene state that rendering reads is double-
+//	buffered: the update writes the next frame's copy, which is published (copied over
+//	the rendered copy) between frames. The update is run in fixed time steps, and the
+//	state published is blended between the last two steps
+//--------------------------------------------------------------------------------------
+
+#include <cmath>
+#include <algorithm>
+
+#include "Defines.h"       // General definitions shared by all source files
+#include "Profiler.h"      // Profiling scopes
+#include "FramePipeline.h" // Declaration of this class
+
+
+//-----------------------------------------------------------------------------
+// Publishable state
+//-----------------------------------------------------------------------------
+
+vector<CPublishable*> CPublishable::s_Pending;
+vector<CPublishable*> CPublishable::s_Stepped;
+bool                  CPublishable::s_Deferred = false;
+
+// An object destroyed while waiting to be published or changed in the last step is taken out of the lists
+CPublishable::~CPublishable()
+{
+	if (m_Pending)
+	{
+		s_Pending.erase( find( s_Pending.begin(), s_Pending.end(), this ) );
+	}
+	if (m_Stepped)
+	{
+		s_Stepped.erase( find( s_Stepped.begin(), s_Stepped.end(), this ) );
+	}
+}
+
+// Call after changing the state for the next frame. Each object is only listed once however many times it changes. When not
+// deferred there are no steps to blend between, so the previous step's state is the same as the new state
+void CPublishable::MarkForPublish()
+{
+	if (!s_Deferred)
+	{
+		SaveStep();
+		Publish( 1.0f );
+		return;
+	}
+
+	AddPending();
+	if (!m_Stepped)
+	{
+		m_Stepped = true;
+		s_Stepped.push_back( this );
+	}
+}
+
+// Call at the start of each update step - objects changed in the last step save their state as the previous step's. They are
+// published again even if not changed in this step, as the state they render changes
+void CPublishable::BeginStep()
+{
+	for (size_t i = 0; i < s_Stepped.size(); ++i)
+	{
+		s_Stepped[i]->m_Stepped = false;
+		s_Stepped[i]->SaveStep();
+		s_Stepped[i]->AddPending();
+	}
+	s_Stepped.clear();
+}
+
+// Publish every object marked since the last call and every object changed in the last step, which has a different blend of
+// its last two steps each frame
+void CPublishable::PublishAll( float blend /*= 1.0f*/ )
+{
+	for (size_t i = 0; i < s_Stepped.size(); ++i)
+	{
+		s_Stepped[i]->AddPending();
+	}
+	for (size_t i = 0; i < s_Pending.size(); ++i)
+	{
+		s_Pending[i]->m_Pending = false;
+		s_Pending[i]->Publish( blend );
+	}
+	s_Pending.clear();
+}
+
+// Defer publishing until PublishAll is called, or stop deferring (which publishes anything still waiting, at its last step)
+void CPublishable::SetDeferred( bool deferred )
+{
+	if (!deferred)
+	{
+		BeginStep();
+		PublishAll();
+	}
+	s_Deferred = deferred;
+}
+
+// Add the object to the list of objects waiting to be published if it is not already there
+void CPublishable::AddPending()
+{
+	if (!m_Pending)
+	{
+		m_Pending = true;
+		s_Pending.push_back( this );
+	}
+}
+
+
+// Blend between two world matrices made of scaling, rotation and translation. Each is split into its parts, the rotations are
+// blended with a spherical interpolation of quaternions and the other parts linearly, then the matrix is put back together. A
+// matrix that can't be split (e.g. a zero scale) is blended element by element instead
+void BlendMatrices( D3DXMATRIX* result, const D3DXMATRIX& from, const D3DXMATRIX& to, float blend )
+{
+	D3DXVECTOR3 fromScale, fromPosition, toScale, toPosition;
+	D3DXQUATERNION fromRotation, toRotation;
+	if (FAILED(D3DXMatrixDecompose( &fromScale, &fromRotation, &fromPosition, &from )) ||
+	    FAILED(D3DXMatrixDecompose( &toScale, &toRotation, &toPosition, &to )))
+	{
+		*result = from + (to - from) * blend;
+		return;
+	}
+
+	D3DXVECTOR3 scale, position;
+	D3DXQUATERNION rotation;
+	D3DXVec3Lerp( &scale, &fromScale, &toScale, blend );
+	D3DXQuaternionSlerp( &rotation, &fromRotation, &toRotation, blend );
+	D3DXVec3Lerp( &position, &fromPosition, &toPosition, blend );
+
+	D3DXMATRIX matrixScaling, matrixRotation;
+	D3DXMatrixScaling( &matrixScaling, scale.x, scale.y, scale.z );
+	D3DXMatrixRotationQuaternion( &matrixRotation, &rotation );
+	*result = matrixScaling * matrixRotation;
+	result->_41 = position.x;
+	result->_42 = position.y;
+	result->_43 = position.z;
+}
+
+
+//-----------------------------------------------------------------------------
+// Frame pipeline class
+//-----------------------------------------------------------------------------
+
+///////////////////////////////
+// Constructors / Destructors
+
+// Constructor - publishing is deferred from now on
+CFramePipeline::CFramePipeline( UpdateFunction update, PublishFunction publish, FrameFunction render,
+                                float timeStep /*= 1.0f / 60.0f*/, int maxSteps /*= 5*/ )
+{
+	m_Update = update;
+	m_Publish = publish;
+	m_Render = render;
+	m_Pipelined = true;
+
+	m_TimeStep = 0.0f;
+	m_MaxSteps = 1;
+	m_TimeAccumulated = 0.0f;
+	m_Blend = 1.0f;
+	m_NumSteps = 0;
+	SetTimeStep( timeStep, maxSteps );
+
+	m_Clock.Start();
+	m_UpdateInputTime = 0.0f;
+	m_PublishedInputTime = 0.0f;
+	m_UpdateTime = 0.0f;
+
+	m_NumFrames = 0;
+	m_TotalUpdateSteps = 0;
+	m_TotalUpdateTime = 0.0f;
+	m_TotalRenderTime = 0.0f;
+	m_TotalFrameTime = 0.0f;
+	m_TotalLatency = 0.0f;
+
+	CPublishable::SetDeferred( true );
+}
+
+// Destructor waits for any update still running and publishes anything still waiting
+CFramePipeline::~CFramePipeline()
+{
+	g_JobSystem->Wait( m_UpdateJob );
+	CPublishable::SetDeferred( false );
+}
+
+
+/////////////////////////////
+// Frames
+
+// Update, publish and render one frame. Pipelined, the update started here is for the frame after the one rendered here. The input
+// time of a frame is passed along with it, from the update that read the input, through publishing, to the render that shows it
+void CFramePipeline::RunFrame( float frameTime )
+{
+	PROFILE_SCOPE( "Frame" );
+	float frameStart = m_Clock.GetTime();
+
+	if (m_Pipelined)
+	{
+		// Start the next frame's update as a job on a worker thread - the main thread must not pick it up while it waits for jobs
+		// during the render...
+		g_JobSystem->RunOnWorkerThread( [this, frameTime]() { RunUpdate( frameTime ); }, m_UpdateJob );
+	}
+	else
+	{
+		RunUpdate( frameTime );
+		m_Publish( m_Blend );
+		m_PublishedInputTime = m_UpdateInputTime;
+	}
+
+	// Render the published frame - in the pipeline, while the update runs
+	float renderStart = m_Clock.GetTime();
+	m_Render();
+	float renderEnd = m_Clock.GetTime();
+	m_TotalRenderTime += renderEnd - renderStart;
+	m_TotalLatency += renderEnd - m_PublishedInputTime;
+
+	if (m_Pipelined)
+	{
+		// ...then wait for it (helping with any jobs it started) and publish it, ready to render next frame
+		g_JobSystem->Wait( m_UpdateJob );
+		m_Publish( m_Blend );
+		m_PublishedInputTime = m_UpdateInputTime;
+	}
+
+	m_TotalUpdateSteps += m_NumSteps;
+	m_TotalUpdateTime += m_UpdateTime;
+	m_TotalFrameTime += m_Clock.GetTime() - frameStart;
+	++m_NumFrames;
+	PROFILE_END_FRAME();
+}
+
+// Average timings since the last call
+SFrameTimings CFramePipeline::GetTimings()
+{
+	SFrameTimings timings;
+	timings.numFrames = m_NumFrames;
+	float frames = static_cast<float>(max( m_NumFrames, 1 ));
+	timings.updateSteps = m_TotalUpdateSteps / frames;
+	timings.updateTime = m_TotalUpdateTime / frames;
+	timings.renderTime = m_TotalRenderTime / frames;
+	timings.frameTime = m_TotalFrameTime / frames;
+	timings.latency = m_TotalLatency / frames;
+
+	m_NumFrames = 0;
+	m_TotalUpdateSteps = 0;
+	m_TotalUpdateTime = 0.0f;
+	m_TotalRenderTime = 0.0f;
+	m_TotalFrameTime = 0.0f;
+	m_TotalLatency = 0.0f;
+	return timings;
+}
+
+// Change the time step in seconds and the most steps run in one frame. Zero time step runs one update per frame with the frame
+// time. Takes effect at the next frame
+void CFramePipeline::SetTimeStep( float timeStep, int maxSteps )
+{
+	m_TimeStep = max( timeStep, 0.0f );
+	m_MaxSteps = max( maxSteps, 1 );
+	m_TimeAccumulated = 0.0f;
+}
+
+
+/////////////////////////////
+// Private functions
+
+// Run and time the update steps for a frame. The input for the frame is read as the update starts
+void CFramePipeline::RunUpdate( float frameTime )
+{
+	PROFILE_SCOPE( "Update" );
+	m_UpdateInputTime = m_Clock.GetTime();
+
+	if (m_TimeStep <= 0.0f)
+	{
+		// Variable time step - one update with the frame time, so the last step is rendered as it is
+		CPublishable::BeginStep();
+		m_Update( frameTime );
+		m_NumSteps = 1;
+		m_Blend = 1.0f;
+	}
+	else
+	{
+		// Fixed time step - run a step for each whole time step accumulated, up to the limit. Any time still left over beyond
+		// a step is dropped
+		m_TimeAccumulated += frameTime;
+		m_NumSteps = 0;
+		while (m_TimeAccumulated >= m_TimeStep && m_NumSteps < m_MaxSteps)
+		{
+			CPublishable::BeginStep();
+			m_Update( m_TimeStep );
+			m_TimeAccumulated -= m_TimeStep;
+			++m_NumSteps;
+		}
+		if (m_TimeAccumulated >= m_TimeStep)
+		{
+			m_TimeAccumulated = fmodf( m_TimeAccumulated, m_TimeStep );
+		}
+		m_Blend = m_TimeAccumulated / m_TimeStep;
+	}
+
+	m_UpdateTime = m_Clock.GetTime() - m_UpdateInputTime;
+}
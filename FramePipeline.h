@@ -0,0 +1,234 @@
+//--------------------------------------------------------------------------------------
+//	FramePipeline.h
+//
+//	Runs the scene update for the next frame as a job while the current frame is
+//	rendered on the main thread. The scene state that rendering reads is double-
+//	buffered: the update writes the next frame's copy, which is published (copied over
+//	the rendered copy) between frames. The update is run in fixed time steps, and the
+//	state published is blended between the last two steps
+//--------------------------------------------------------------------------------------
+
+#ifndef FRAME_PIPELINE_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define FRAME_PIPELINE_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+#include <d3dx10.h>
+
+#include "CTimer.h"
+#include "JobSystem.h"
+
+
+//-----------------------------------------------------------------------------
+// Publishable state
+//-----------------------------------------------------------------------------
+
+// Base class for objects that keep two copies of the state used for rendering - the copy rendered, and the copy the scene update
+// is preparing for the next frame (e.g. a model's world matrix). After changing the next copy an object calls MarkForPublish. While
+// publishing is deferred, marked objects are only published when PublishAll is called between frames, so the renderer never sees
+// half an update. Otherwise each object is published as soon as it is marked, which is how a single-threaded program behaves - all
+// startup code runs this way. Only one thread may change or publish objects at a time
+//
+// The update runs in fixed time steps, usually a different number each frame (see CFramePipeline). Rendering the state after the
+// last step would make movement judder, so objects also keep the state from the step before and publish a blend of the two - the
+// blend is how far the frame's time is into the next step. At the start of each step the objects changed in the previous step
+// save their state as the previous state (SaveStep). Objects changed in the last step are published every frame, even if the next
+// update has no steps, as the blend is different each frame
+class CPublishable
+{
+/////////////////////////////
+// Public member functions
+public:
+
+	virtual ~CPublishable();
+
+	// Copy the state prepared for the next frame over the state being rendered, blended with the previous step's state - blend 0
+	// gives the previous step, 1 the last step
+	virtual void Publish( float blend ) = 0;
+
+	// Keep the state prepared for the next frame as the previous step's state
+	virtual void SaveStep() = 0;
+
+	// Call at the start of each update step - objects changed in the last step save their state as the previous step's
+	static void BeginStep();
+
+	// Publish every object marked since the last call and every object changed in the last step, with the given blend between
+	// the last two steps. Must not be called while the update is running
+	static void PublishAll( float blend = 1.0f );
+
+	// Defer publishing until PublishAll is called, or stop deferring (which publishes anything still waiting)
+	static void SetDeferred( bool deferred );
+
+
+/////////////////////////////
+// Protected member functions
+protected:
+
+	// Copies are not marked even if the original is
+	CPublishable() : m_Pending( false ), m_Stepped( false ) {}
+	CPublishable( const CPublishable& ) : m_Pending( false ), m_Stepped( false ) {}
+	CPublishable& operator=( const CPublishable& )
+	{
+		return *this;
+	}
+
+	// Call after changing the state for the next frame
+	void MarkForPublish();
+
+
+/////////////////////////////
+// Private member variables
+private:
+
+	bool m_Pending; // Is this object in the list of objects waiting to be published
+	bool m_Stepped; // Is this object in the list of objects changed in the last step
+
+	static vector<CPublishable*> s_Pending;
+	static vector<CPublishable*> s_Stepped;
+	static bool                  s_Deferred;
+
+	// Add the object to the list of objects waiting to be published if it is not already there
+	void AddPending();
+};
+
+
+// Blend between two world matrices made of scaling, rotation and translation. The rotations are blended as quaternions, so the
+// result is still a rotation (blending the matrix elements would squash the model part way between two rotations)
+void BlendMatrices( D3DXMATRIX* result, const D3DXMATRIX& from, const D3DXMATRIX& to, float blend );
+
+
+//-----------------------------------------------------------------------------
+// Frame pipeline class
+//-----------------------------------------------------------------------------
+
+// Timings from CFramePipeline::GetTimings, averaged over the frames since it was last called
+struct SFrameTimings
+{
+	int   numFrames;
+	float updateSteps; // Update steps run each frame
+	float updateTime;  // Seconds spent in the scene update each frame, all steps together
+	float renderTime;  // Seconds spent rendering each frame, up to and including Present
+	float frameTime;   // Seconds from the start of one frame to the start of the next
+	float latency;     // Seconds from reading the input for a frame (the start of its update) to presenting it
+};
+
+
+// Runs the scene's update, publish and render functions once per frame, either one after another on the calling thread (serial)
+// or pipelined. Pipelined, the update for frame N + 1 runs as a job while frame N is rendered, then the calling thread
+// waits for it and publishes it, ready to be rendered next frame. A frame then takes about as long as the slower of the update and
+// the render instead of both together, but is shown one frame later after its input was read - the latency is measured to show
+// the cost. The update function must only change publishable state (see above) and state the render never reads. The publish
+// function runs between frames with nothing else running, so can safely do anything that reads update state and writes render state
+//
+// With a fixed time step, the frame times are added to an accumulator and the update is called once with the time step for each
+// whole step in it, so the simulation behaves the same whatever the frame rate. What is left over becomes the blend passed to the
+// publish function, to render the state part way between the last two steps (see CPublishable). If the update falls far behind
+// (e.g. a long frame loading something), only a limited number of steps are run and the rest of the time is dropped - the
+// simulation slows down for a moment rather than spending ever longer catching up. A time step of zero goes back to one update per
+// frame with the frame time
+class CFramePipeline
+{
+/////////////////////////////
+// Public types
+public:
+
+	typedef void (*UpdateFunction)( float frameTime );
+	typedef void (*PublishFunction)( float blend );
+	typedef void (*FrameFunction)();
+
+
+/////////////////////////////
+// Private member variables
+private:
+
+	UpdateFunction  m_Update;
+	PublishFunction m_Publish;
+	FrameFunction   m_Render;
+	bool            m_Pipelined;
+
+	// Fixed time step and the most steps run in one frame. The accumulator holds the time not yet simulated, less than a step
+	// after each update. The blend is the fraction of a step it holds and the steps are those run by the last update
+	float m_TimeStep;
+	int   m_MaxSteps;
+	float m_TimeAccumulated;
+	float m_Blend;
+	int   m_NumSteps;
+
+	// Counts the pipelined update job while it runs
+	CJobCounter m_UpdateJob;
+
+	// Clock read by the update and render for all timings. Input times are when the update of the frame in progress and of the frame
+	// published to render started
+	CTimer m_Clock;
+	float  m_UpdateInputTime;
+	float  m_PublishedInputTime;
+	float  m_UpdateTime; // Of the last update
+
+	// Totals since the timings were last read
+	int   m_NumFrames;
+	int   m_TotalUpdateSteps;
+	float m_TotalUpdateTime;
+	float m_TotalRenderTime;
+	float m_TotalFrameTime;
+	float m_TotalLatency;
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	// Constructor - publishing is deferred from now on (see CPublishable). The update is run with a fixed time step of the given
+	// number of seconds, at most maxSteps times a frame. Zero time step runs one update per frame with the frame time
+	CFramePipeline( UpdateFunction update, PublishFunction publish, FrameFunction render, float timeStep = 1.0f / 60.0f,
+	                int maxSteps = 5 );
+
+	// Destructor waits for any update still running and publishes anything still waiting
+	~CFramePipeline();
+
+
+	/////////////////////////////
+	// Frames
+
+	// Update, publish and render one frame. The frame time is passed to the update
+	void RunFrame( float frameTime );
+
+	// Switch between pipelined and serial frames. Takes effect at the next frame
+	void SetPipelined( bool pipelined )
+	{
+		m_Pipelined = pipelined;
+	}
+	bool IsPipelined() const
+	{
+		return m_Pipelined;
+	}
+
+	// Change the time step in seconds and the most steps run in one frame. Zero time step runs one update per frame with the frame
+	// time. Takes effect at the next frame
+	void SetTimeStep( float timeStep, int maxSteps );
+	float GetTimeStep() const
+	{
+		return m_TimeStep;
+	}
+
+	// Average timings since the last call
+	SFrameTimings GetTimings();
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	// Run and time the update steps for a frame, on whichever thread calls this
+	void RunUpdate( float frameTime );
+
+	// Disallow copying - the update job keeps a pointer to the object
+	CFramePipeline( const CFramePipeline& );
+	CFramePipeline& operator=( const CFramePipeline& );
+};
+
+
+#endif // End of header guard - see top of file
@@ -0,0 +1,147 @@
+//--------------------------------------------------------------------------------------
+//	Frustum.cpp
+//
+//	The frustum class holds the six clipping planes of a view (camera or light) and
+//	tests bounding volumes against them to cull models that cannot be seen
+//--------------------------------------------------------------------------------------
+
+#include <cfloat>
+#include <cmath>
+#include <xmmintrin.h> // SSE intrinsics
+
+#include "Defines.h" // General definitions shared by all source files
+#include "Frustum.h" // Declaration of this class
+
+///////////////////////////////
+// Constructors / Destructors
+
+// Constructor - all planes are set to pass everything until a matrix is provided
+CFrustum::CFrustum()
+{
+	for (int i = 0; i < NUM_PLANE_SLOTS; ++i)
+	{
+		m_PlaneA[i] = 0.0f;
+		m_PlaneB[i] = 0.0f;
+		m_PlaneC[i] = 0.0f;
+		m_PlaneD[i] = FLT_MAX;
+	}
+}
+
+
+/////////////////////////////
+// Frustum Usage
+
+// Extract the frustum planes from a combined view-projection matrix. DirectX uses row vectors, so a point p is projected
+// as p * M and each clip-space coordinate is a dot product of p with a *column* of the matrix. A point is inside the
+// frustum when -w <= x <= w, -w <= y <= w and 0 <= z <= w, which gives the planes below (e.g. left plane: x + w >= 0)
+void CFrustum::ExtractFromMatrix( const D3DXMATRIX& m )
+{
+	// Left, right, bottom, top, near, far
+	m_PlaneA[0] = m._14 + m._11;  m_PlaneB[0] = m._24 + m._21;  m_PlaneC[0] = m._34 + m._31;  m_PlaneD[0] = m._44 + m._41;
+	m_PlaneA[1] = m._14 - m._11;  m_PlaneB[1] = m._24 - m._21;  m_PlaneC[1] = m._34 - m._31;  m_PlaneD[1] = m._44 - m._41;
+	m_PlaneA[2] = m._14 + m._12;  m_PlaneB[2] = m._24 + m._22;  m_PlaneC[2] = m._34 + m._32;  m_PlaneD[2] = m._44 + m._42;
+	m_PlaneA[3] = m._14 - m._12;  m_PlaneB[3] = m._24 - m._22;  m_PlaneC[3] = m._34 - m._32;  m_PlaneD[3] = m._44 - m._42;
+	m_PlaneA[4] = m._13;          m_PlaneB[4] = m._23;          m_PlaneC[4] = m._33;          m_PlaneD[4] = m._43;
+	m_PlaneA[5] = m._14 - m._13;  m_PlaneB[5] = m._24 - m._23;  m_PlaneC[5] = m._34 - m._33;  m_PlaneD[5] = m._44 - m._43;
+
+	// Normalise the planes so the sphere test can compare distances against a radius
+	for (int i = 0; i < NUM_PLANES; ++i)
+	{
+		float length = sqrtf( m_PlaneA[i] * m_PlaneA[i] + m_PlaneB[i] * m_PlaneB[i] + m_PlaneC[i] * m_PlaneC[i] );
+		if (length > 0.0f)
+		{
+			m_PlaneA[i] /= length;
+			m_PlaneB[i] /= length;
+			m_PlaneC[i] /= length;
+			m_PlaneD[i] /= length;
+		}
+	}
+}
+
+
+// Test a bounding sphere against the frustum, four planes at a time. The sphere is outside if its centre is further
+// than its radius behind any one plane
+bool CFrustum::IsSphereVisible( const D3DXVECTOR3& centre, float radius ) const
+{
+	__m128 x = _mm_set1_ps( centre.x );
+	__m128 y = _mm_set1_ps( centre.y );
+	__m128 z = _mm_set1_ps( centre.z );
+	__m128 negRadius = _mm_set1_ps( -radius );
+
+	for (int i = 0; i < NUM_PLANE_SLOTS; i += 4)
+	{
+		// Signed distance of the centre from four planes
+		__m128 distance = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( &m_PlaneA[i] ), x ),
+		                                          _mm_mul_ps( _mm_loadu_ps( &m_PlaneB[i] ), y ) ),
+		                              _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( &m_PlaneC[i] ), z ),
+		                                          _mm_loadu_ps( &m_PlaneD[i] ) ) );
+		if (_mm_movemask_ps( _mm_cmplt_ps( distance, negRadius ) ) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// Test an axis-aligned bounding box against the frustum, four planes at a time. For each plane only the box corner
+// furthest along the plane normal needs testing - if that corner is behind the plane then the whole box is. Taking
+// the maximum of the min/max products on each axis selects that corner without any branches
+bool CFrustum::IsBoxVisible( const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds ) const
+{
+	__m128 minX = _mm_set1_ps( minBounds.x ), maxX = _mm_set1_ps( maxBounds.x );
+	__m128 minY = _mm_set1_ps( minBounds.y ), maxY = _mm_set1_ps( maxBounds.y );
+	__m128 minZ = _mm_set1_ps( minBounds.z ), maxZ = _mm_set1_ps( maxBounds.z );
+	__m128 zero = _mm_setzero_ps();
+
+	for (int i = 0; i < NUM_PLANE_SLOTS; i += 4)
+	{
+		__m128 a = _mm_loadu_ps( &m_PlaneA[i] );
+		__m128 b = _mm_loadu_ps( &m_PlaneB[i] );
+		__m128 c = _mm_loadu_ps( &m_PlaneC[i] );
+		__m128 distance = _mm_add_ps( _mm_add_ps( _mm_max_ps( _mm_mul_ps( a, minX ), _mm_mul_ps( a, maxX ) ),
+		                                          _mm_max_ps( _mm_mul_ps( b, minY ), _mm_mul_ps( b, maxY ) ) ),
+		                              _mm_add_ps( _mm_max_ps( _mm_mul_ps( c, minZ ), _mm_mul_ps( c, maxZ ) ),
+		                                          _mm_loadu_ps( &m_PlaneD[i] ) ) );
+		if (_mm_movemask_ps( _mm_cmplt_ps( distance, zero ) ) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// Classify an axis-aligned bounding box against the frustum. As above, the corner furthest along each plane normal decides
+// if the box is outside. The corner furthest *against* each normal (the minimum of the products) decides if it is entirely inside
+EFrustumTest CFrustum::ClassifyBox( const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds ) const
+{
+	__m128 minX = _mm_set1_ps( minBounds.x ), maxX = _mm_set1_ps( maxBounds.x );
+	__m128 minY = _mm_set1_ps( minBounds.y ), maxY = _mm_set1_ps( maxBounds.y );
+	__m128 minZ = _mm_set1_ps( minBounds.z ), maxZ = _mm_set1_ps( maxBounds.z );
+	__m128 zero = _mm_setzero_ps();
+
+	int crossesPlanes = 0;
+	for (int i = 0; i < NUM_PLANE_SLOTS; i += 4)
+	{
+		__m128 a = _mm_loadu_ps( &m_PlaneA[i] );
+		__m128 b = _mm_loadu_ps( &m_PlaneB[i] );
+		__m128 c = _mm_loadu_ps( &m_PlaneC[i] );
+		__m128 d = _mm_loadu_ps( &m_PlaneD[i] );
+		__m128 ax0 = _mm_mul_ps( a, minX ), ax1 = _mm_mul_ps( a, maxX );
+		__m128 by0 = _mm_mul_ps( b, minY ), by1 = _mm_mul_ps( b, maxY );
+		__m128 cz0 = _mm_mul_ps( c, minZ ), cz1 = _mm_mul_ps( c, maxZ );
+
+		__m128 furthest = _mm_add_ps( _mm_add_ps( _mm_max_ps( ax0, ax1 ), _mm_max_ps( by0, by1 ) ),
+		                              _mm_add_ps( _mm_max_ps( cz0, cz1 ), d ) );
+		if (_mm_movemask_ps( _mm_cmplt_ps( furthest, zero ) ) != 0)
+		{
+			return Frustum_Outside;
+		}
+
+		__m128 nearest = _mm_add_ps( _mm_add_ps( _mm_min_ps( ax0, ax1 ), _mm_min_ps( by0, by1 ) ),
+		                             _mm_add_ps( _mm_min_ps( cz0, cz1 ), d ) );
+		crossesPlanes |= _mm_movemask_ps( _mm_cmplt_ps( nearest, zero ) );
+	}
+	return (crossesPlanes != 0) ? Frustum_Intersecting : Frustum_Inside;
+}
@@ -0,0 +1,70 @@
+//--------------------------------------------------------------------------------------
+//	Frustum.h
+//
+//	The frustum class holds the six clipping planes of a view (camera or light) and
+//	tests bounding volumes against them to cull models that cannot be seen
+//--------------------------------------------------------------------------------------
+
+#ifndef FRUSTUM_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define FRUSTUM_H_INCLUDED
+
+#include <d3d10.h>
+#include <d3dx10.h>
+
+
+// Result of classifying a volume against a frustum
+enum EFrustumTest
+{
+	Frustum_Outside,      // Volume is entirely outside the frustum
+	Frustum_Intersecting, // Volume crosses one or more of the frustum planes
+	Frustum_Inside,       // Volume is entirely inside the frustum
+};
+
+
+class CFrustum
+{
+/////////////////////////////
+// Private member variables
+private:
+
+	// The six frustum planes (left, right, bottom, top, near, far) as ax + by + cz + d = 0, normals pointing inwards.
+	// Stored "structure of arrays" - all the a values together, then all the b values etc. - so that SSE can test four
+	// planes at once. There are eight slots, the last two are padding planes that everything passes
+	static const int NUM_PLANES = 6;
+	static const int NUM_PLANE_SLOTS = 8;
+	float m_PlaneA[NUM_PLANE_SLOTS];
+	float m_PlaneB[NUM_PLANE_SLOTS];
+	float m_PlaneC[NUM_PLANE_SLOTS];
+	float m_PlaneD[NUM_PLANE_SLOTS];
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	// Constructor - creates a frustum that contains everything
+	CFrustum();
+
+
+	/////////////////////////////
+	// Frustum Usage
+
+	// Extract the frustum planes from a combined view-projection matrix (camera or light "camera")
+	void ExtractFromMatrix( const D3DXMATRIX& viewProjMatrix );
+
+	// Test a bounding sphere against the frustum. Returns false only if the sphere is entirely outside
+	bool IsSphereVisible( const D3DXVECTOR3& centre, float radius ) const;
+
+	// Test an axis-aligned bounding box against the frustum. Returns false only if the box is entirely outside
+	bool IsBoxVisible( const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds ) const;
+
+	// Classify an axis-aligned bounding box as outside, intersecting or inside the frustum. Slightly more expensive than the
+	// test above, but knowing a box is entirely inside allows everything within it to be accepted without further tests
+	EFrustumTest ClassifyBox( const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds ) const;
+};
+
+
+#endif // End of header guard - see top of file
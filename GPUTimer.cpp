@@ -0,0 +1,256 @@
+//--------------------------------------------------------------------------------------
+//	GPUTimer.cpp
+//
+//	Times named render passes on the GPU with timestamp queries, read back a few frames
+//	later so the CPU never waits for the GPU. Results are given in the same form as the
+//	CPU profiler's
+//--------------------------------------------------------------------------------------
+
+#include <cstring>
+#include <algorithm>
+
+#include "Defines.h"  // General definitions shared by all source files
+#include "GPUTimer.h" // Declaration of this class
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+CGPUTimer::CGPUTimer()
+{
+	for (unsigned int f = 0; f < MAX_FRAMES_IN_FLIGHT; ++f)
+	{
+		m_Frames[f].disjoint = NULL;
+		for (unsigned int p = 0; p < MAX_PASSES; ++p)
+		{
+			m_Frames[f].passStart[p] = NULL;
+			m_Frames[f].passEnd[p] = NULL;
+		}
+		m_Frames[f].numPasses = 0;
+	}
+	m_Created = false;
+	m_Frame = 1;
+	m_CompletedFrame = 0;
+	m_InFrame = false;
+	m_InPass = false;
+	m_NumFrames = 0;
+	m_DroppedFrames = 0;
+}
+
+CGPUTimer::~CGPUTimer()
+{
+	ReleaseResources();
+}
+
+// Create the queries. Returns false on failure, in which case the timer reports zero times
+bool CGPUTimer::Create()
+{
+	ReleaseResources();
+	if (!g_pd3dDevice) return false;
+
+	D3D10_QUERY_DESC disjointDesc;
+	disjointDesc.Query = D3D10_QUERY_TIMESTAMP_DISJOINT;
+	disjointDesc.MiscFlags = 0;
+	D3D10_QUERY_DESC timestampDesc;
+	timestampDesc.Query = D3D10_QUERY_TIMESTAMP;
+	timestampDesc.MiscFlags = 0;
+	for (unsigned int f = 0; f < MAX_FRAMES_IN_FLIGHT; ++f)
+	{
+		if (FAILED( g_pd3dDevice->CreateQuery( &disjointDesc, &m_Frames[f].disjoint )))
+		{
+			ReleaseResources();
+			return false;
+		}
+		for (unsigned int p = 0; p < MAX_PASSES; ++p)
+		{
+			if (FAILED( g_pd3dDevice->CreateQuery( &timestampDesc, &m_Frames[f].passStart[p] )) ||
+			    FAILED( g_pd3dDevice->CreateQuery( &timestampDesc, &m_Frames[f].passEnd[p] )))
+			{
+				ReleaseResources();
+				return false;
+			}
+		}
+	}
+
+	m_Created = true;
+	m_Frame = 1;
+	m_CompletedFrame = 0;
+	return true;
+}
+
+// Release the queries
+void CGPUTimer::ReleaseResources()
+{
+	for (unsigned int f = 0; f < MAX_FRAMES_IN_FLIGHT; ++f)
+	{
+		SAFE_RELEASE( m_Frames[f].disjoint );
+		for (unsigned int p = 0; p < MAX_PASSES; ++p)
+		{
+			SAFE_RELEASE( m_Frames[f].passStart[p] );
+			SAFE_RELEASE( m_Frames[f].passEnd[p] );
+		}
+		m_Frames[f].numPasses = 0;
+	}
+	m_Created = false;
+	m_InFrame = false;
+	m_InPass = false;
+}
+
+
+/////////////////////////////
+// Timing
+
+// Collect the results of earlier frames that are ready, and start timing a frame. If the oldest frame in flight is using the queries
+// this frame needs, its results are dropped - the queries can be started again before their results are read, and timing should
+// not make the CPU wait for the GPU
+void CGPUTimer::BeginFrame()
+{
+	if (m_InFrame) EndFrame();
+	m_InFrame = true;
+	if (!m_Created) return;
+
+	while (PollOldestFrame()) {}
+	if (m_Frame - m_CompletedFrame > MAX_FRAMES_IN_FLIGHT)
+	{
+		++m_CompletedFrame;
+		++m_DroppedFrames;
+	}
+	m_Frames[m_Frame % MAX_FRAMES_IN_FLIGHT].numPasses = 0;
+	m_Frames[m_Frame % MAX_FRAMES_IN_FLIGHT].disjoint->Begin();
+}
+
+// End the frame's timing
+void CGPUTimer::EndFrame()
+{
+	if (!m_InFrame) return;
+	if (m_InPass) EndPass();
+	m_InFrame = false;
+
+	if (!m_Created)
+	{
+		++m_NumFrames; // No results to wait for
+		return;
+	}
+	m_Frames[m_Frame % MAX_FRAMES_IN_FLIGHT].disjoint->End();
+	++m_Frame;
+}
+
+// Start timing a pass, ending the one before if it is still open. Timestamp queries have no Begin, the GPU's clock is written when
+// the query ends
+void CGPUTimer::BeginPass( const char* name )
+{
+	if (!m_InFrame) return;
+	if (m_InPass) EndPass();
+
+	unsigned int pass = FindPass( name );
+	if (!m_Created)
+	{
+		++m_PassCalls[pass]; // Counted now, with no time
+		return;
+	}
+
+	SFrameQueries& frame = m_Frames[m_Frame % MAX_FRAMES_IN_FLIGHT];
+	if (frame.numPasses == MAX_PASSES) return;
+	frame.pass[frame.numPasses] = pass;
+	frame.passStart[frame.numPasses]->End();
+	m_InPass = true;
+}
+
+// End timing the current pass
+void CGPUTimer::EndPass()
+{
+	if (!m_InPass) return;
+	m_InPass = false;
+
+	SFrameQueries& frame = m_Frames[m_Frame % MAX_FRAMES_IN_FLIGHT];
+	frame.passEnd[frame.numPasses]->End();
+	++frame.numPasses;
+}
+
+
+/////////////////////////////
+// Results
+
+// Get the GPU time taken by each pass per frame, averaged over the frames whose results have come back since the last call. Any
+// results that are ready are collected first. The totals are reset
+void CGPUTimer::GetTimings( vector<SProfileTiming>& timings )
+{
+	if (m_Created)
+	{
+		while (PollOldestFrame()) {}
+	}
+
+	timings.clear();
+	float frames = static_cast<float>(max( m_NumFrames, 1u ));
+	for (unsigned int p = 0; p < m_PassNames.size(); ++p)
+	{
+		SProfileTiming timing;
+		timing.name = m_PassNames[p];
+		timing.time = static_cast<float>(m_PassTimes[p] / frames);
+		timing.calls = m_PassCalls[p] / frames;
+		timings.push_back( timing );
+
+		m_PassTimes[p] = 0.0;
+		m_PassCalls[p] = 0;
+	}
+	m_NumFrames = 0;
+}
+
+
+/////////////////////////////
+// Private functions
+
+// Index of a pass name in m_PassNames, added if new. Names are compared by text, as the same name may be given from different files
+unsigned int CGPUTimer::FindPass( const char* name )
+{
+	for (unsigned int p = 0; p < m_PassNames.size(); ++p)
+	{
+		if (m_PassNames[p] == name || strcmp( m_PassNames[p], name ) == 0)
+		{
+			return p;
+		}
+	}
+	m_PassNames.push_back( name );
+	m_PassTimes.push_back( 0.0 );
+	m_PassCalls.push_back( 0 );
+	return static_cast<unsigned int>(m_PassNames.size() - 1);
+}
+
+// Collect the results of the oldest frame in flight if they are ready, adding its pass times to the totals. The queries are read
+// without flushing the GPU's commands, so reading doesn't change the timings. A frame with an unreliable clock is dropped. Returns
+// true if the frame is finished with
+bool CGPUTimer::PollOldestFrame()
+{
+	if (m_CompletedFrame + 1 >= m_Frame) return false; // No frames in flight
+
+	SFrameQueries& frame = m_Frames[(m_CompletedFrame + 1) % MAX_FRAMES_IN_FLIGHT];
+	D3D10_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+	if (frame.disjoint->GetData( &disjoint, sizeof(disjoint), D3D10_ASYNC_GETDATA_DONOTFLUSH ) != S_OK) return false;
+
+	// The timestamps were written before the disjoint query ended, so they will almost always be ready too
+	UINT64 startTimes[MAX_PASSES];
+	UINT64 endTimes[MAX_PASSES];
+	for (unsigned int i = 0; i < frame.numPasses; ++i)
+	{
+		if (frame.passStart[i]->GetData( &startTimes[i], sizeof(UINT64), D3D10_ASYNC_GETDATA_DONOTFLUSH ) != S_OK ||
+		    frame.passEnd[i]->GetData( &endTimes[i], sizeof(UINT64), D3D10_ASYNC_GETDATA_DONOTFLUSH ) != S_OK)
+		{
+			return false;
+		}
+	}
+	++m_CompletedFrame;
+
+	if (disjoint.Disjoint || disjoint.Frequency == 0)
+	{
+		++m_DroppedFrames;
+		return true;
+	}
+	double secondsPerTick = 1.0 / static_cast<double>(disjoint.Frequency);
+	for (unsigned int i = 0; i < frame.numPasses; ++i)
+	{
+		m_PassTimes[frame.pass[i]] += static_cast<double>(endTimes[i] - startTimes[i]) * secondsPerTick;
+		++m_PassCalls[frame.pass[i]];
+	}
+	++m_NumFrames;
+	return true;
+}
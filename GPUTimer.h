@@ -0,0 +1,133 @@
+//--------------------------------------------------------------------------------------
+//	GPUTimer.h
+//
+//	Times named render passes on the GPU with timestamp queries, read back a few frames
+//	later so the CPU never waits for the GPU. Results are given in the same form as the
+//	CPU profiler's
+//--------------------------------------------------------------------------------------
+
+#ifndef GPU_TIMER_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define GPU_TIMER_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+#include <d3d10.h>
+#include "Profiler.h" // SProfileTiming
+
+
+// Each frame is bracketed by a "timestamp disjoint" query, which gives the frequency of the GPU's clock and tells us if the clock was
+// unreliable during the frame (e.g. the GPU changed speed or the display mode changed). Each pass has a timestamp query at its start
+// and end - the GPU writes its clock into them as it reaches that point in the commands. The queries take a few frames to come back,
+// so there is a set of queries for each of MAX_FRAMES_IN_FLIGHT frames, used in turn, and each frame's results are collected once
+// they are all ready. If the GPU falls so far behind that a frame's queries are needed again before their results arrive, that frame
+// is dropped rather than waiting for it
+//
+// If Create has not been called, or failed (e.g. there is no device), the timer does nothing on the GPU. Passes are still counted,
+// and are reported with zero time, so the code reading the timings works the same without a GPU
+class CGPUTimer
+{
+/////////////////////////////
+// Public types and constants
+public:
+
+	// Most passes timed in one frame - any more are not timed
+	static const unsigned int MAX_PASSES = 16;
+
+	// Frames of queries, i.e. how many frames results may take to come back
+	static const unsigned int MAX_FRAMES_IN_FLIGHT = 4;
+
+
+/////////////////////////////
+// Private types and member variables
+private:
+
+	// Queries for one frame
+	struct SFrameQueries
+	{
+		ID3D10Query* disjoint;
+		ID3D10Query* passStart[MAX_PASSES];
+		ID3D10Query* passEnd[MAX_PASSES];
+		unsigned int pass[MAX_PASSES]; // Index of each pass timed, in m_PassNames
+		unsigned int numPasses;
+	};
+	SFrameQueries m_Frames[MAX_FRAMES_IN_FLIGHT];
+	bool          m_Created;
+
+	// Frame numbers start at 1 - the current frame has not yet ended. Frames up to m_CompletedFrame have their results collected
+	unsigned int  m_Frame;
+	unsigned int  m_CompletedFrame;
+	bool          m_InFrame;
+	bool          m_InPass;
+
+	// Names of the passes seen so far, in the order first seen, and the totals for each since the timings were last read
+	vector<const char*> m_PassNames;
+	vector<double>      m_PassTimes; // Seconds
+	vector<unsigned int> m_PassCalls;
+	unsigned int        m_NumFrames;     // Frames whose results are in the totals
+	unsigned int        m_DroppedFrames; // Frames lost to a disjoint clock or results that arrived too late
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	CGPUTimer();
+	~CGPUTimer();
+
+	// Create the queries. Returns false on failure, in which case the timer reports zero times
+	bool Create();
+
+	// Release the queries - only call when the GPU is idle or shutting down
+	void ReleaseResources();
+
+
+	/////////////////////////////
+	// Timing
+
+	// Collect the results of earlier frames that are ready, and start timing a frame. Call before the frame's first pass
+	void BeginFrame();
+
+	// End the frame's timing. Call after its last pass
+	void EndFrame();
+
+	// Start and end timing a pass. Passes don't nest - starting a pass ends the one before. The name must be a string literal (or last
+	// as long as the timer). A pass may be timed more than once in a frame, the times are added together
+	void BeginPass( const char* name );
+	void EndPass();
+
+
+	/////////////////////////////
+	// Results
+
+	// Get the GPU time taken by each pass per frame, averaged over the frames whose results have come back since the last call.
+	// Passes are given in the order they were first timed
+	void GetTimings( vector<SProfileTiming>& timings );
+
+	// Number of frames whose results were lost since the timer was created
+	unsigned int GetDroppedFrames() const
+	{
+		return m_DroppedFrames;
+	}
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	// Index of a pass name in m_PassNames, added if new
+	unsigned int FindPass( const char* name );
+
+	// Collect the results of the oldest frame in flight if they are ready. Returns true if the frame is finished with
+	bool PollOldestFrame();
+
+	// Disallow copying - the queries can't be shared
+	CGPUTimer( const CGPUTimer& );
+	CGPUTimer& operator=( const CGPUTimer& );
+};
+
+
+#endif // End of header guard - see top of file
@@ -0,0 +1,225 @@
+//--------------------------------------------------------------------------------------
+//	GeometryPool.cpp
+//
+//	Large vertex and index buffers shared by all models with the same vertex layout.
+//	Each model's geometry is a range of the pool's buffers
+//--------------------------------------------------------------------------------------
+
+#include <cstring>
+using namespace std;
+
+#include "Defines.h"      // General definitions shared by all source files
+#include "GeometryPool.h" // Declaration of this class
+
+// Every pool created, and the one currently bound
+vector<CGeometryPool*> CGeometryPool::s_Pools;
+CGeometryPool* CGeometryPool::s_BoundPool = NULL;
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+// Constructor - no buffers are created until the first allocation
+CGeometryPool::CGeometryPool( const D3D10_INPUT_ELEMENT_DESC* vertexElts, unsigned int numVertexElts, unsigned int vertexSize )
+{
+	for (unsigned int i = 0; i < numVertexElts; ++i)
+	{
+		m_VertexElts[i] = vertexElts[i];
+	}
+	m_NumVertexElts = numVertexElts;
+	m_VertexSize = vertexSize;
+	m_VertexBuffer = NULL;
+	m_IndexBuffer = NULL;
+}
+
+CGeometryPool::~CGeometryPool()
+{
+	if (s_BoundPool == this) s_BoundPool = NULL;
+	SAFE_RELEASE( m_IndexBuffer );
+	SAFE_RELEASE( m_VertexBuffer );
+}
+
+
+// Get the pool for the given vertex layout, creating it if there isn't one yet
+CGeometryPool* CGeometryPool::GetPool( const D3D10_INPUT_ELEMENT_DESC* vertexElts, unsigned int numVertexElts, unsigned int vertexSize )
+{
+	if (numVertexElts > MAX_VERTEX_ELTS) return NULL;
+
+	for (unsigned int p = 0; p < s_Pools.size(); ++p)
+	{
+		if (s_Pools[p]->MatchesLayout( vertexElts, numVertexElts, vertexSize )) return s_Pools[p];
+	}
+	s_Pools.push_back( new CGeometryPool( vertexElts, numVertexElts, vertexSize ) );
+	return s_Pools.back();
+}
+
+// Release every pool. All models using the pools must have released their geometry first
+void CGeometryPool::ReleasePools()
+{
+	for (unsigned int p = 0; p < s_Pools.size(); ++p)
+	{
+		delete s_Pools[p];
+	}
+	s_Pools.clear();
+	s_BoundPool = NULL;
+}
+
+// Does this pool use the given vertex layout
+bool CGeometryPool::MatchesLayout( const D3D10_INPUT_ELEMENT_DESC* vertexElts, unsigned int numVertexElts, unsigned int vertexSize )
+{
+	if (numVertexElts != m_NumVertexElts || vertexSize != m_VertexSize) return false;
+	for (unsigned int i = 0; i < numVertexElts; ++i)
+	{
+		const D3D10_INPUT_ELEMENT_DESC& a = m_VertexElts[i];
+		const D3D10_INPUT_ELEMENT_DESC& b = vertexElts[i];
+		if (strcmp( a.SemanticName, b.SemanticName ) != 0 || a.SemanticIndex != b.SemanticIndex || a.Format != b.Format ||
+		    a.InputSlot != b.InputSlot || a.AlignedByteOffset != b.AlignedByteOffset || a.InputSlotClass != b.InputSlotClass ||
+		    a.InstanceDataStepRate != b.InstanceDataStepRate)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/////////////////////////////
+// Allocation
+
+// Allocate space for vertices and fill it with the given data. Returns a handle for the allocation or -1 on failure
+int CGeometryPool::AddVertices( const void* vertices, unsigned int numVertices )
+{
+	int handle = Allocate( m_VertexBuffer, m_VertexAllocator, numVertices, m_VertexSize, D3D10_BIND_VERTEX_BUFFER );
+	if (handle < 0) return -1;
+	Upload( m_VertexBuffer, m_VertexAllocator.GetOffset( handle ) * m_VertexSize, numVertices * m_VertexSize, vertices );
+	return handle;
+}
+
+// Allocate space for indices and fill it with the given data. Returns a handle for the allocation or -1 on failure
+int CGeometryPool::AddIndices( const unsigned short* indices, unsigned int numIndices )
+{
+	int handle = Allocate( m_IndexBuffer, m_IndexAllocator, numIndices, sizeof(unsigned short), D3D10_BIND_INDEX_BUFFER );
+	if (handle < 0) return -1;
+	Upload( m_IndexBuffer, m_IndexAllocator.GetOffset( handle ) * sizeof(unsigned short), numIndices * sizeof(unsigned short), indices );
+	return handle;
+}
+
+// Replace some of the indices in an allocation, starting from the given index within it
+void CGeometryPool::UpdateIndices( int handle, unsigned int firstIndex, const unsigned short* indices, unsigned int numIndices )
+{
+	if (firstIndex + numIndices > m_IndexAllocator.GetSize( handle )) return;
+	unsigned int offset = m_IndexAllocator.GetOffset( handle ) + firstIndex;
+	Upload( m_IndexBuffer, offset * sizeof(unsigned short), numIndices * sizeof(unsigned short), indices );
+}
+
+// Free allocations. The space is reused by later allocations, the buffers never shrink
+void CGeometryPool::FreeVertices( int handle )
+{
+	m_VertexAllocator.Free( handle );
+}
+void CGeometryPool::FreeIndices( int handle )
+{
+	m_IndexAllocator.Free( handle );
+}
+
+
+// Allocate a range from one of the buffers. If there is no free block large enough the buffer is repacked - into a buffer of the same
+// size if there is enough free space in total (it is just fragmented), otherwise into one at least twice the size
+int CGeometryPool::Allocate( ID3D10Buffer*& buffer, CRangeAllocator& allocator, unsigned int size, unsigned int elementSize, UINT bindFlags )
+{
+	if (size == 0) return -1;
+
+	int handle = allocator.Allocate( size );
+	if (handle >= 0) return handle;
+
+	unsigned int needed = allocator.GetUsed() + size;
+	unsigned int newCapacity = allocator.GetCapacity();
+	if (newCapacity < needed)
+	{
+		unsigned int initialCapacity = (bindFlags == D3D10_BIND_VERTEX_BUFFER) ? INITIAL_VERTICES : INITIAL_INDICES;
+		newCapacity = (newCapacity * 2 > initialCapacity) ? newCapacity * 2 : initialCapacity;
+		if (newCapacity < needed) newCapacity = needed;
+	}
+	if (!Repack( buffer, allocator, newCapacity, elementSize, bindFlags ))
+	{
+		return -1;
+	}
+	return allocator.Allocate( size );
+}
+
+// Replace one of the buffers with a new one of the given capacity, packing its allocations together at the start. The copies are
+// made on the GPU. A resource can't be copied to itself, which is why a new buffer is needed even if the size doesn't change
+bool CGeometryPool::Repack( ID3D10Buffer*& buffer, CRangeAllocator& allocator, unsigned int newCapacity, unsigned int elementSize,
+                            UINT bindFlags )
+{
+	D3D10_BUFFER_DESC bufferDesc;
+	bufferDesc.BindFlags = bindFlags;
+	bufferDesc.Usage = D3D10_USAGE_DEFAULT;
+	bufferDesc.ByteWidth = newCapacity * elementSize;
+	bufferDesc.CPUAccessFlags = 0;
+	bufferDesc.MiscFlags = 0;
+	ID3D10Buffer* newBuffer = NULL;
+	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &newBuffer )))
+	{
+		return false;
+	}
+
+	vector<CRangeAllocator::SMove> moves;
+	allocator.Defragment( moves );
+	if (buffer)
+	{
+		// Allocations before the first gap don't move, so they are copied in one go. All later allocations are in the list of moves
+		D3D10_BOX box;
+		box.top = 0;
+		box.bottom = 1;
+		box.front = 0;
+		box.back = 1;
+		box.left = 0;
+		box.right = (moves.empty() ? allocator.GetUsed() : moves[0].to) * elementSize;
+		if (box.right > 0)
+		{
+			g_pd3dDevice->CopySubresourceRegion( newBuffer, 0, 0, 0, 0, buffer, 0, &box );
+		}
+		for (unsigned int m = 0; m < moves.size(); ++m)
+		{
+			box.left = moves[m].from * elementSize;
+			box.right = (moves[m].from + moves[m].size) * elementSize;
+			g_pd3dDevice->CopySubresourceRegion( newBuffer, 0, moves[m].to * elementSize, 0, 0, buffer, 0, &box );
+		}
+		buffer->Release();
+	}
+	allocator.Grow( newCapacity );
+	buffer = newBuffer;
+
+	// The old buffer may have been bound
+	if (s_BoundPool == this) s_BoundPool = NULL;
+	return true;
+}
+
+// Copy data into part of one of the buffers
+void CGeometryPool::Upload( ID3D10Buffer* buffer, unsigned int byteOffset, unsigned int byteSize, const void* data )
+{
+	D3D10_BOX box;
+	box.left = byteOffset;
+	box.right = byteOffset + byteSize;
+	box.top = 0;
+	box.bottom = 1;
+	box.front = 0;
+	box.back = 1;
+	g_pd3dDevice->UpdateSubresource( buffer, 0, &box, data, 0, 0 );
+}
+
+
+/////////////////////////////
+// Usage
+
+// Bind the pool's buffers to the input assembler, skipped if they are already bound
+void CGeometryPool::Bind()
+{
+	if (s_BoundPool == this) return;
+
+	UINT offset = 0;
+	g_pd3dDevice->IASetVertexBuffers( 0, 1, &m_VertexBuffer, &m_VertexSize, &offset );
+	g_pd3dDevice->IASetIndexBuffer( m_IndexBuffer, DXGI_FORMAT_R16_UINT, 0 );
+	s_BoundPool = this;
+}
@@ -0,0 +1,143 @@
+//--------------------------------------------------------------------------------------
+//	GeometryPool.h
+//
+//	Large vertex and index buffers shared by all models with the same vertex layout.
+//	Each model's geometry is a range of the pool's buffers
+//--------------------------------------------------------------------------------------
+
+#ifndef GEOMETRY_POOL_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define GEOMETRY_POOL_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+#include <d3d10.h>
+#include "RangeAllocator.h"
+
+
+// A pool holds a vertex buffer and an index buffer, with ranges allocated from them by CRangeAllocator. Indices stay relative to
+// their model's first vertex, so they are still 16-bit however many vertices the pool holds - the model's vertex offset is passed
+// to DrawIndexed as the base vertex location. Models using the same pool can be drawn one after another without binding new
+// buffers. When a buffer is full its allocations are packed together into a new, larger buffer on the GPU (CopySubresourceRegion),
+// so there is no need to keep a system memory copy of the geometry
+class CGeometryPool
+{
+/////////////////////////////
+// Private member variables
+private:
+
+	// Layout of the vertices in this pool
+	static const unsigned int MAX_VERTEX_ELTS = 64;
+	D3D10_INPUT_ELEMENT_DESC  m_VertexElts[MAX_VERTEX_ELTS];
+	unsigned int              m_NumVertexElts;
+	unsigned int              m_VertexSize;
+
+	// The shared buffers and the allocators for their vertices and indices
+	ID3D10Buffer*             m_VertexBuffer;
+	ID3D10Buffer*             m_IndexBuffer;
+	CRangeAllocator           m_VertexAllocator;
+	CRangeAllocator           m_IndexAllocator;
+
+	// Every pool created, one for each vertex layout
+	static vector<CGeometryPool*> s_Pools;
+
+	// The pool whose buffers are currently bound to the input assembler, NULL if unknown
+	static CGeometryPool*     s_BoundPool;
+
+	// Initial buffer sizes - both grow as needed
+	static const unsigned int INITIAL_VERTICES = 65536;
+	static const unsigned int INITIAL_INDICES = 3 * 65536;
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	// Constructor - pools are only created by GetPool
+	CGeometryPool( const D3D10_INPUT_ELEMENT_DESC* vertexElts, unsigned int numVertexElts, unsigned int vertexSize );
+	~CGeometryPool();
+
+	// Does this pool use the given vertex layout
+	bool MatchesLayout( const D3D10_INPUT_ELEMENT_DESC* vertexElts, unsigned int numVertexElts, unsigned int vertexSize );
+
+	// Allocate a range from one of the buffers, making room if needed. Returns a handle for the range or -1 on failure
+	int Allocate( ID3D10Buffer*& buffer, CRangeAllocator& allocator, unsigned int size, unsigned int elementSize, UINT bindFlags );
+
+	// Replace one of the buffers with a new one of the given capacity, packing its allocations together at the start
+	bool Repack( ID3D10Buffer*& buffer, CRangeAllocator& allocator, unsigned int newCapacity, unsigned int elementSize, UINT bindFlags );
+
+	// Copy data into part of one of the buffers
+	void Upload( ID3D10Buffer* buffer, unsigned int byteOffset, unsigned int byteSize, const void* data );
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	// Get the pool for the given vertex layout, creating it if there isn't one yet
+	static CGeometryPool* GetPool( const D3D10_INPUT_ELEMENT_DESC* vertexElts, unsigned int numVertexElts, unsigned int vertexSize );
+
+	// Release every pool. All models using the pools must have released their geometry first
+	static void ReleasePools();
+
+
+	/////////////////////////////
+	// Allocation
+
+	// Allocate space for vertices or indices and fill it with the given data. Returns a handle for the allocation or -1 on failure.
+	// Offsets of allocations may change when the pool makes room for more, so look them up from the handle each time they are used
+	int AddVertices( const void* vertices, unsigned int numVertices );
+	int AddIndices( const unsigned short* indices, unsigned int numIndices );
+
+	// Replace some of the indices in an allocation, starting from the given index within it
+	void UpdateIndices( int handle, unsigned int firstIndex, const unsigned short* indices, unsigned int numIndices );
+
+	// Free allocations
+	void FreeVertices( int handle );
+	void FreeIndices( int handle );
+
+
+	/////////////////////////////
+	// Data access
+
+	unsigned int GetVertexOffset( int handle ) const
+	{
+		return m_VertexAllocator.GetOffset( handle );
+	}
+	unsigned int GetIndexOffset( int handle ) const
+	{
+		return m_IndexAllocator.GetOffset( handle );
+	}
+	const CRangeAllocator& GetVertexAllocator() const
+	{
+		return m_VertexAllocator;
+	}
+	const CRangeAllocator& GetIndexAllocator() const
+	{
+		return m_IndexAllocator;
+	}
+	static unsigned int GetNumPools()
+	{
+		return static_cast<unsigned int>(s_Pools.size());
+	}
+	static CGeometryPool* GetPoolByIndex( unsigned int pool )
+	{
+		return s_Pools[pool];
+	}
+
+
+	/////////////////////////////
+	// Usage
+
+	// Bind the pool's buffers to the input assembler, skipped if they are already bound
+	void Bind();
+
+	// Must be called when other buffers have been bound, so the next pool to be used binds its own again
+	static void ForgetBinding()
+	{
+		s_BoundPool = NULL;
+	}
+};
+
+
+#endif // End of header guard - see top of file
@@ -38,12 +38,30 @@
 #include "Input.h"   // Input functions - not DirectX
 #include "Light.h"
 #include "ModelHierarchy.h"
+#include "Frustum.h"
+#include "BoundingVolumeTree.h"
+#include "ShadowAtlas.h"
+#include "OcclusionCuller.h"
+#include "MeshCache.h"
+#include "GeometryPool.h"
+#include "StaticBatch.h"
+#include "UploadRing.h"
+#include "GPUTimer.h"
+#include "ShaderConstants.h"
+#include "LightManager.h"
+#include "LightAnimator.h"
+#include "Portal.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "CTimer.h"
+#include <stdio.h>
+#include <algorithm>
 //--------------------------------------------------------------------------------------
 // Global Scene Variables
 //--------------------------------------------------------------------------------------
 float g_WiggleVar;
 const int g_numTeapotLights = 3;
-const int g_numSpotLights = 2;
+const int g_numSpotLights = NumShadowConstants; // Every spot light casts shadows - set the number in ShaderConstants.h
 float g_parallaxDepth = 0.05f; // Overall depth of bumpiness for parallax mapping
 bool g_useParallax = false;  // Toggle for parallax 
 float g_clearColour[4] = { 0.2f, 0.2f, 0.3f, 1.0f }; // Good idea to match background to ambient colour
@@ -62,39 +80,59 @@ CModelHierarchy* Bike;
 CCamera* Camera;
 
 //**** Portal Data ****//
-// Dimensions of portal texture - controls quality of rendered scene in portal
+// Dimensions of portal texture - controls quality of rendered scene in portal. This is the largest size, when the portal is small
+// on screen it is rendered into one of the smaller textures instead (see Portal.h)
 int PortalWidth = 1024;
 int PortalHeight = 1024;
 
-CModel* Portal;       // The model on which the portal appears
-CCamera* PortalCamera; // The camera view shown in the portal
+// Models on which portals appear and the camera views shown in them. Each portal can be seen in the other
+CModel* Portal;
+CCamera* PortalCamera;
+CModel* Portal2;
+CCamera* Portal2Camera;
 
-// The portal texture and the view of it as a render target (see code comments)
-ID3D10Texture2D* PortalTexture = NULL;
-ID3D10RenderTargetView* PortalRenderTarget = NULL;
-ID3D10ShaderResourceView* PortalMap = NULL;
+// The portals, each holding its textures for every depth it can be seen at (see code comments)
+const int MaxPortals = 4;
+CPortal* Portals[MaxPortals];
+int NumPortals = 0;
 
-// Also need a depth/stencil buffer for the portal
-// NOTE: ***Can share the depth buffer between multiple portals of the same size***
-ID3D10Texture2D* PortalDepthStencil = NULL;
-ID3D10DepthStencilView* PortalDepthStencilView = NULL;
+// A portal texture is only rendered when the portal is in view and something seen through it has changed, and then no more than
+// PortalUpdateRate times a second (0 for no limit). Its size is chosen from the portal's size on screen - the smallest texture with
+// at least PortalResolutionScale texels for each pixel the portal covers
+float PortalUpdateRate = 30.0f;
+float PortalResolutionScale = 1.0f;
+bool g_usePortalThrottling = true; // Switched with key 4 - off renders every portal in view every frame
 
-//*********************//
+// Portals seen through portals are rendered down to PortalMaxDepth levels (at most CPortal::MAX_DEPTH) - portals any deeper are drawn
+// flat. A portal covering fewer than MinPortalPixels across is not rendered and keeps its old texture, as does any portal once
+// PortalTexelBudget texels have been rendered into portal textures in a frame
+int PortalMaxDepth = CPortal::MAX_DEPTH;
+float MinPortalPixels = 8.0f;
+float PortalTexelBudget = 2.0f * 1024 * 1024;
+
+//*********************////*********************//
 
 
 //**** Shadow Maps ****//
 // Very similar data to the render-to-texture (portal) lab
 
-// Width and height of shadow map - controls resolution/quality of shadows
-int ShadowMapSize = 1024;
+// All the spot light shadow maps share one large texture, the shadow atlas. Each frame every light is given a square tile of
+// the atlas sized by how much of the screen it affects. The atlas layout decides the tiles - atlas size 2048, tiles from 128 to
+// 1024 pixels (the largest tile has the resolution of the old per-light shadow maps). Resolution/quality of shadows depends on these
+CShadowAtlas ShadowAtlasLayout(2048, 128, 1024);
+SShadowAtlasTile ShadowTiles[g_numSpotLights];
+
+// The shadow atlas texture and the view of it as a depth buffer and shader resource (see code comments)
+ID3D10Texture2D* ShadowAtlasTexture = NULL;
+ID3D10DepthStencilView* ShadowAtlasDepthView = NULL;
+ID3D10ShaderResourceView* ShadowAtlas = NULL;
 
-// The shadow map textures and the view of it as a depth buffer and shader resource (see code comments)
-ID3D10Texture2D* ShadowMap1Texture = NULL;
-ID3D10DepthStencilView* ShadowMap1DepthView = NULL;
-ID3D10ShaderResourceView* ShadowMap1 = NULL;
-ID3D10Texture2D* ShadowMap2Texture = NULL;
-ID3D10DepthStencilView* ShadowMap2DepthView = NULL;
-ID3D10ShaderResourceView* ShadowMap2 = NULL;
+// A second atlas holds a cached layer for each light with the depths of just the static casters, in the same tile as the
+// light's shadow map. It is only rendered when the light or a static caster moves. Each frame the cached tile is copied into
+// the shadow atlas and the dynamic casters drawn on top
+ID3D10Texture2D* StaticShadowAtlasTexture = NULL;
+ID3D10DepthStencilView* StaticShadowAtlasDepthView = NULL;
+ID3D10ShaderResourceView* StaticShadowAtlas = NULL;
 
 //*********************//
 
@@ -118,9 +156,236 @@ float SpecularPower = 256.0f;
 CLight* CubeLight;
 CLight* TeapotLights[g_numTeapotLights];
 CLight* SpotLights[g_numSpotLights];
+char SpotLightNames[g_numSpotLights][32];
+
+// Where each spot light starts, its colour and the point it faces. One row per spot light - the number of spot lights is set in
+// ShaderConstants.h, as each has shadows
+struct SSpotLightSetup
+{
+	D3DXVECTOR3 position;
+	D3DXVECTOR3 colour;
+	D3DXVECTOR3 target;
+};
+SSpotLightSetup SpotLightSetups[] =
+{
+	{ D3DXVECTOR3(-60, 10, 50),  D3DXVECTOR3(0.8f, 0.8f, 0.8f) * 40, D3DXVECTOR3(0, 0, 0) }, // Faces the troll, set in InitScene
+	{ D3DXVECTOR3(-20, 30, 130), D3DXVECTOR3(1.0f, 0.8f, 0.2f) * 80, D3DXVECTOR3(0, 0, 0) },
+};
+static_assert(sizeof(SpotLightSetups) / sizeof(SpotLightSetups[0]) == g_numSpotLights, "A setup is needed for every spot light");
 CLight* CarLight;
 // Note: There are move & rotation speed constants in Defines.h
 
+
+//**** Culling ****//
+// Count of models drawn and culled for each view rendered in a frame - the main camera, the portal camera and each spot light's shadow map
+struct SCullStats
+{
+	int visible;
+	int culled;   // Includes models culled by occlusion
+	int occluded; // Main view only - models in the view frustum but hidden behind occluders
+	int triangles; // Triangles in the models drawn, at their selected LODs (hierarchies count their root only)
+	SClusterStats clusters; // Camera views only - clusters of the drawn models that were drawn or rejected
+	bool reused; // Shadow and portal views only - previous frame's shadow map or portal texture was still used so the pass was skipped
+};
+enum ECullView
+{
+	CullView_Main,
+	CullView_Portal,
+	CullView_SpotLight0, // One view per spot light follows
+	NumCullViews = CullView_SpotLight0 + g_numSpotLights
+};
+SCullStats CullStats[NumCullViews];
+
+// Every top-level model in the scene is held in a bounding volume tree, so views, rays and lights can find the models they
+// touch without testing every model. Moving models are updated in the tree in PublishScene
+CBoundingVolumeTree SceneTree;
+struct SSceneModel
+{
+	CModel*     model;
+	const char* name;
+	int         proxy;      // Identifier of the model in the tree
+	D3DXVECTOR3 lastCentre; // World bounds centre when last updated in the tree, used to predict movement
+};
+const int MaxSceneModels = 64;
+SSceneModel SceneModels[MaxSceneModels];
+int NumSceneModels = 0;
+
+// Each view query marks the models it finds with a new stamp (see CModel::MarkVisible)
+unsigned int VisibleStamp = 0;
+
+// Set to time loading a library of this many synthetic meshes from the mesh cache at startup, with and without compression (see
+// ReportMeshCacheBenchmark). Zero to skip - it takes a noticeable time
+const unsigned int MeshCacheBenchmarkSize = 0;
+
+// Set to time this many allocations with the ring allocator at startup (see ReportRingAllocatorBenchmark), e.g. 1000000. Zero to
+// skip - it delays every launch
+const unsigned int RingAllocatorBenchmarkSize = 0;
+
+// Set to time assigning this many lights to 1080p light clusters at startup, repeated the given number of times (see
+// ReportLightClusterBenchmark), e.g. 1000 lights and 100 builds. Zero lights to skip - it delays every launch
+const unsigned int LightClusterBenchmarkLights = 0;
+const int LightClusterBenchmarkBuilds = 0;
+
+// Set to time animating this many lights with the light animator at startup, for the given number of frames (see
+// ReportLightAnimatorBenchmark), e.g. 10000 lights and 100 frames. Zero lights to skip - it delays every launch. That the animator
+// matches CLight is checked by the tests (see Tests\LightAnimatorTests.cpp)
+const unsigned int LightAnimatorBenchmarkLights = 0;
+const int LightAnimatorBenchmarkFrames = 0;
+
+// Set to time starting this many empty jobs with the job system at startup, and a parallel for loop of the given number of items
+// with each number of threads (see ReportJobSystemBenchmark), e.g. 100000 jobs and 4096 items. Zero jobs to skip - it delays every
+// launch
+const unsigned int JobSystemBenchmarkJobs = 0;
+const int JobSystemBenchmarkItems = 0;
+
+// Set to time the scene's bounding volume tree against testing every object's box at startup, with 1000, 10000 and 100000 objects
+// and this many of each kind of query (see ReportBoundingVolumeTreeBenchmark), e.g. 1000. Zero to skip - it delays every launch.
+// That the tree finds the same objects as brute force is checked by the tests (see Tests\BoundingVolumeTreeTests.cpp)
+const int BoundingVolumeTreeBenchmarkQueries = 0;
+
+// The lights are collected into the light manager every frame, which packs the lights in each view for the shaders and gives each
+// light cluster of the view a list of the lights reaching it (see LightManager.h). MaxLightIndices is the total length of the
+// clusters' light lists in a view
+const unsigned int MaxVisibleLights = 512;
+const unsigned int MaxLightIndices = 256 * 1024;
+CLightManager* LightManager = NULL;
+const float SceneLightRange = 500.0f; // The scene's own lights are bright enough to reach everything
+
+// The lights' colour changes and orbits are all updated together by the light animator (see LightAnimator.h). These are the
+// animator's indices for each light
+CLightAnimator* LightAnimator = NULL;
+int CubeLightOrbit;
+int CarLightOrbit;
+int SpotLightOrbit;
+int TeapotLightPulse;
+int TeapotLightCycles[g_numTeapotLights - 1];
+
+// A swarm of small coloured lights circling over the scene and cycling through colours, to test large numbers of lights, switched
+// on and off with key 3. They have no models of their own, they are drawn as copies of CubeLight. Light i has the animator's orbit
+// FirstAnimatedOrbit + i and colour cycle FirstAnimatedCycle + i
+const int NumAnimatedLights = 256;
+const float AnimatedLightRange = 30.0f;
+const float AnimatedLightScale = 1.0f;
+int FirstAnimatedOrbit;
+int FirstAnimatedCycle;
+bool g_useAnimatedLights = false;
+
+// Positions and colours of the animated lights as rendered, copied from the light animator when the scene update is published (see
+// PublishScene) - the animator itself is a frame ahead while the next update runs. Positions are blended between the last two
+// update steps like the models
+D3DXVECTOR3 AnimatedLightPositions[NumAnimatedLights];
+D3DXVECTOR3 AnimatedLightColours[NumAnimatedLights];
+
+// Per-frame data that the GPU only needs for the frame it is written in is written into this ring buffer
+const unsigned int UploadRingSize = 256 * 1024;
+CUploadRing* UploadRing = NULL;
+
+// GPU time of each render pass in RenderScene, read back a few frames late. The shadow map passes are named by light
+CGPUTimer* GPUTimer = NULL;
+char ShadowPassNames[g_numSpotLights][32];
+
+// Per-instance data for drawing the light models with one instanced draw call, matching VS_INSTANCED_INPUT in the shader file.
+// The light models all share the geometry of CubeLight
+struct SLightInstance
+{
+	D3DXMATRIX  worldMatrix;
+	D3DXVECTOR3 tintColour;
+};
+const D3D10_INPUT_ELEMENT_DESC LightInstanceElts[] =
+{
+	{ "WORLD",      0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0,  D3D10_INPUT_PER_INSTANCE_DATA, 1 },
+	{ "WORLD",      1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16, D3D10_INPUT_PER_INSTANCE_DATA, 1 },
+	{ "WORLD",      2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32, D3D10_INPUT_PER_INSTANCE_DATA, 1 },
+	{ "WORLD",      3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 48, D3D10_INPUT_PER_INSTANCE_DATA, 1 },
+	{ "TINTCOLOUR", 0, DXGI_FORMAT_R32G32B32_FLOAT,    1, 64, D3D10_INPUT_PER_INSTANCE_DATA, 1 },
+};
+const int MaxLightModels = 2 + g_numTeapotLights + g_numSpotLights;
+bool LightInstancing = false; // Set if the instanced layout could be created, otherwise the lights are drawn one at a time
+
+// Models far from the camera are rendered with simplified LODs. A LOD is used if its error would cover no more than this many pixels
+const float MaxLODPixelError = 1.0f;
+
+// Models that cast shadows into the spot light shadow maps
+const int MaxShadowCasters = 32;
+CModel* ShadowCasters[MaxShadowCasters];
+int NumShadowCasters = 0;
+
+// A list of shadow casters for a light and the matrix version (CModel::GetMatrixVersion) and LOD of each when the list was made
+struct SShadowCasterList
+{
+	int          numCasters;
+	CModel*      casters[MaxShadowCasters];
+	unsigned int versions[MaxShadowCasters];
+	int          lods[MaxShadowCasters];
+};
+
+// What was rendered into each spot light's shadow map last time, kept separately for static and dynamic casters. If the
+// light's matrices and the static casters are unchanged then the cached static layer is still valid. If the dynamic casters
+// are unchanged too then the shadow map itself is still valid and doesn't need rendering again
+struct SShadowMapCache
+{
+	bool              valid;
+	bool              staticLayerValid; // Not kept up to date while the light itself is moving
+	D3DXMATRIX        viewProjMatrix;
+	SShadowAtlasTile  tile;
+	SShadowCasterList staticCasters;
+	SShadowCasterList dynamicCasters;
+};
+SShadowMapCache ShadowMapCaches[g_numSpotLights];
+
+// Number of shadow map passes rendered and skipped, and cached static layers rendered, since the statistics were last read
+int ShadowPassesRendered = 0;
+int ShadowPassesSkipped = 0;
+int StaticShadowLayersRendered = 0;
+
+// Clock for the time of each portal render (see SPortalViewCache)
+CTimer PortalClock;
+
+// Portal renders made and skipped since the statistics were last read, with the reason for skipping, and the deepest depth rendered.
+// The CPU time taken by the renders is totalled to estimate the time saved by the skipped ones, and the texels rendered to compare
+// with a full size render every frame
+int PortalRenders = 0;
+int PortalSkippedHidden = 0;
+int PortalSkippedUnchanged = 0;
+int PortalSkippedThrottled = 0;
+int PortalSkippedBudget = 0;
+int PortalDeepestDepth = 0;
+float PortalRenderTimeTotal = 0.0f;
+float PortalTexelsTotal = 0.0f;
+
+// Texels rendered into portal textures this frame, and which portals have been found at each depth this frame
+float PortalFrameTexels = 0.0f;
+bool PortalViewsFound[MaxPortals][CPortal::MAX_DEPTH];
+
+// Static models drawn with the same technique and texture are merged into static batches, each drawn with one draw call instead of
+// one per model (and subset). A model whose batch is no longer valid, e.g. because it has moved, is drawn individually again.
+// Batching can be switched off to compare the number of draw calls per frame
+vector<CStaticBatch*> StaticBatches;
+bool g_useStaticBatching = true;
+
+// Draw calls made by models and static batches, constant buffer updates, and the number of frames, since the statistics were last read
+unsigned int DrawCallsTotal = 0;
+unsigned int ConstantUploadsTotal = 0;
+float ClusterTimeTotal = 0.0f; // Seconds spent assigning lights to clusters
+int DrawCallFrames = 0;
+
+// Model last picked with the mouse (left button)
+const char* PickedModelName = "none";
+
+// Software occlusion culling for the main camera. Up to MaxOccluders of the largest static models on screen are rendered on the
+// CPU as occluders, models smaller than MinOccluderSize (bounding radius / distance from camera) are not worth rendering
+COcclusionCuller* OcclusionCuller = NULL;
+const int MaxOccluders = 6;
+const float MinOccluderSize = 0.1f;
+
+// Time spent on occlusion culling (seconds) by the jobs rendering occluders and by the main thread testing models, and the number of
+// frames, since the statistics were last read
+float OcclusionRenderTime = 0.0f;
+float OcclusionTestTime = 0.0f;
+int OcclusionFrames = 0;
+
+//*********************//
+
 //--------------------------------------------------------------------------------------
 // Shader Variables
 //--------------------------------------------------------------------------------------
@@ -133,35 +398,29 @@ ID3D10EffectTechnique* TintDiffuse = NULL;
 ID3D10EffectTechnique* WiggleTechnique = NULL;
 ID3D10EffectTechnique* VertexLitTechnique = NULL;
 ID3D10EffectTechnique* AdditiveTexTintTechnique = NULL;
+ID3D10EffectTechnique* AdditiveTexTintInstancedTechnique = NULL;
 ID3D10EffectTechnique* ParallaxMappingTechnique = NULL;
 ID3D10EffectTechnique* ShadowMappingTechnique = NULL;
 ID3D10EffectTechnique* DepthOnlyTechnique = NULL;
+ID3D10EffectTechnique* ClearDepthTileTechnique = NULL;
+ID3D10EffectTechnique* CopyDepthTileTechnique = NULL;
 ID3D10EffectTechnique* CellShadingTechnique = NULL;
 
-// Matrices
-ID3D10EffectMatrixVariable* WorldMatrixVar = NULL;
-ID3D10EffectMatrixVariable* ViewMatrixVar = NULL;
-ID3D10EffectMatrixVariable* ProjMatrixVar = NULL;
-ID3D10EffectMatrixVariable* ViewProjMatrixVar = NULL;
-ID3D10EffectScalarVariable* g_pCubeWiggleVar = NULL;
+// Constant buffers - matrices, lights and other values. Each is filled through a C++ struct and uploaded whole once its values for
+// the frame, view or object are set (see ShaderConstants.h)
+CConstantBlock<SPerFrameConstants>  PerFrameConstants;
+CConstantBlock<SPerViewConstants>   PerViewConstants;
+CConstantBlock<SPerObjectConstants> PerObjectConstants;
+CConstantBlock<SShadowConstants>    ShadowConstants;
 
 // Textures
 ID3D10EffectShaderResourceVariable* DiffuseMapVar = NULL;
 ID3D10EffectShaderResourceVariable* NormalMapVar = NULL;
-ID3D10EffectShaderResourceVariable* ShadowMap1Var = NULL;
-ID3D10EffectShaderResourceVariable* ShadowMap2Var = NULL; 
+ID3D10EffectShaderResourceVariable* ShadowAtlasVar = NULL;
+ID3D10EffectShaderResourceVariable* StaticShadowAtlasVar = NULL;
 ID3D10EffectShaderResourceVariable* CellMapVar = NULL;
 
 
-// Miscellaneous
-ID3D10EffectVectorVariable* ModelColourVar = NULL;
-ID3D10EffectScalarVariable* ParallaxDepthVar = NULL;
-
-// Light Effect Variables
-ID3D10EffectVectorVariable* TintColourVar = NULL;
-ID3D10EffectVectorVariable* AmbientColourVar = NULL;
-ID3D10EffectScalarVariable* SpecularPowerVar = NULL;
-
 
 //--------------------------------------------------------------------------------------
 // DirectX Variables
@@ -280,14 +539,20 @@ void ReleaseResources()
 	// Test each variable to see if it exists before deletion
 	if( g_pd3dDevice )     g_pd3dDevice->ClearState();
 
+	delete OcclusionCuller; // Wait for its jobs to finish before deleting the models they use
 	delete CubeLight;
 	delete Floor;
 	delete WiggleCube;
 	delete Box;
 	delete Camera;
 	delete Teapot;
+	for (int i = 0; i < NumPortals; i++) {
+		delete Portals[i];
+	}
 	delete Portal;
 	delete PortalCamera;
+	delete Portal2;
+	delete Portal2Camera;
 	delete Troll;
 	delete Sphere;
 	delete Car;
@@ -299,6 +564,19 @@ void ReleaseResources()
 	for (int i = 0; i < g_numSpotLights; i++) {
 		delete SpotLights[i];
 	}
+	for (unsigned int i = 0; i < StaticBatches.size(); i++) {
+		delete StaticBatches[i];
+	}
+	StaticBatches.clear();
+	CGeometryPool::ReleasePools(); // After the models, which free their geometry from the pools
+	delete UploadRing;
+	delete GPUTimer;
+	PerFrameConstants.ReleaseResources();
+	PerViewConstants.ReleaseResources();
+	PerObjectConstants.ReleaseResources();
+	ShadowConstants.ReleaseResources();
+	delete LightManager;
+	delete LightAnimator;
 
     if( FloorDiffuseMap )		FloorDiffuseMap->Release();
     if( CubeDiffuseMap )		CubeDiffuseMap->Release();
@@ -314,17 +592,12 @@ void ReleaseResources()
 	if( DepthStencil )			DepthStencil->Release();
 	if( SwapChain )				SwapChain->Release();
 	if( g_pd3dDevice )			g_pd3dDevice->Release();
-	if (PortalDepthStencilView) PortalDepthStencilView->Release();
-	if (PortalDepthStencil)     PortalDepthStencil->Release();
-	if (PortalMap)              PortalMap->Release();
-	if (PortalRenderTarget)     PortalRenderTarget->Release();
-	if (PortalTexture)          PortalTexture->Release();
-	if (ShadowMap1)             ShadowMap1->Release();
-	if (ShadowMap1DepthView)    ShadowMap1DepthView->Release();
-	if (ShadowMap1Texture)      ShadowMap1Texture->Release();
-	if (ShadowMap2)             ShadowMap2->Release();
-	if (ShadowMap2DepthView)    ShadowMap2DepthView->Release();
-	if (ShadowMap2Texture)      ShadowMap2Texture->Release();
+	if (ShadowAtlas)                ShadowAtlas->Release();
+	if (ShadowAtlasDepthView)       ShadowAtlasDepthView->Release();
+	if (ShadowAtlasTexture)         ShadowAtlasTexture->Release();
+	if (StaticShadowAtlas)          StaticShadowAtlas->Release();
+	if (StaticShadowAtlasDepthView) StaticShadowAtlasDepthView->Release();
+	if (StaticShadowAtlasTexture)   StaticShadowAtlasTexture->Release();
 	if (BikeDiffuseMap)			BikeDiffuseMap->Release();
 
 }
@@ -343,8 +616,13 @@ bool LoadEffectFile()
 	ID3D10Blob* pErrors; // This strangely typed variable collects any errors when compiling the effect file
 	DWORD dwShaderFlags = D3D10_SHADER_ENABLE_STRICTNESS; // These "flags" are used to set the compiler options
 
+	// The sizes of some shader arrays are given to the effect file as macros, so they always match the C++
+	char numShadowLights[16];
+	sprintf_s(numShadowLights, "%d", NumShadowConstants);
+	D3D10_SHADER_MACRO defines[] = { { "NUM_SHADOW_LIGHTS", numShadowLights }, { NULL, NULL } };
+
 	// Load and compile the effect file
-	HRESULT hr = D3DX10CreateEffectFromFile( L"GraphicsAssign1.fx", NULL, NULL, "fx_4_0", dwShaderFlags, 0, g_pd3dDevice, NULL, NULL, &Effect, &pErrors, NULL );
+	HRESULT hr = D3DX10CreateEffectFromFile( L"GraphicsAssign1.fx", defines, NULL, "fx_4_0", dwShaderFlags, 0, g_pd3dDevice, NULL, NULL, &Effect, &pErrors, NULL );
 	if( FAILED( hr ) )
 	{
 		if (pErrors != 0)  MessageBox( NULL, CA2CT(reinterpret_cast<char*>(pErrors->GetBufferPointer())), L"Error", MB_OK ); // Compiler error: display error message
@@ -358,30 +636,47 @@ bool LoadEffectFile()
 	WiggleTechnique = Effect->GetTechniqueByName("WiggleTechnique");
 	VertexLitTechnique = Effect->GetTechniqueByName("VertexLitTechnique");
 	AdditiveTexTintTechnique = Effect->GetTechniqueByName("AdditiveTexTint");
+	AdditiveTexTintInstancedTechnique = Effect->GetTechniqueByName("AdditiveTexTintInstanced");
 	ParallaxMappingTechnique = Effect->GetTechniqueByName("ParallaxMappingTechnique");
 	ShadowMappingTechnique = Effect->GetTechniqueByName("ShadowMappingTechnique");
 	DepthOnlyTechnique = Effect->GetTechniqueByName("DepthOnlyTechnique");
+	ClearDepthTileTechnique = Effect->GetTechniqueByName("ClearDepthTileTechnique");
+	CopyDepthTileTechnique = Effect->GetTechniqueByName("CopyDepthTileTechnique");
 	CellShadingTechnique = Effect->GetTechniqueByName("CellShadingTechnique");
 
-	// Create special variables to allow us to access global variables in the shaders from C++
-	WorldMatrixVar    = Effect->GetVariableByName( "WorldMatrix" )->AsMatrix();
-	ViewMatrixVar     = Effect->GetVariableByName( "ViewMatrix"  )->AsMatrix();
-	ProjMatrixVar     = Effect->GetVariableByName( "ProjMatrix"  )->AsMatrix();
+	// Give the constant buffers in the shaders their own buffers, so each can be uploaded in one go from C++
+	if (!PerFrameConstants.Create(Effect, "PerFrame") || !PerViewConstants.Create(Effect, "PerView") ||
+	    !PerObjectConstants.Create(Effect, "PerObject") || !ShadowConstants.Create(Effect, "Shadows"))
+	{
+		MessageBox(NULL, L"Error creating constant buffers", L"Error", MB_OK);
+		return false;
+	}
+	PerObjectConstants.Edit().positionDecode = D3DXVECTOR4(0.0f, 0.0f, 0.0f, 1.0f);
+
+	// Models upload the per-object constants when rendered, with how their vertex data is stored so the shaders can decode it
+	CModel::SetPerObjectConstants(&PerObjectConstants);
 
-	// We access the texture variable in the shader in the same way as we have before for matrices, light data etc.
-	// Only difference is that this variable is a "Shader Resource"
+	// We access the texture variables in the shader through the effect. These variables are "Shader Resources"
 	DiffuseMapVar = Effect->GetVariableByName( "DiffuseMap" )->AsShaderResource();
 	NormalMapVar  = Effect->GetVariableByName("NormalMap")->AsShaderResource();
-	ShadowMap1Var = Effect->GetVariableByName("ShadowMap1")->AsShaderResource();
-	ShadowMap2Var = Effect->GetVariableByName("ShadowMap2")->AsShaderResource();
+	ShadowAtlasVar = Effect->GetVariableByName("ShadowAtlas")->AsShaderResource();
+	StaticShadowAtlasVar = Effect->GetVariableByName("StaticShadowAtlas")->AsShaderResource();
 	CellMapVar = Effect->GetVariableByName("CellMap")->AsShaderResource();
 
-	// Other shader variables
-	ModelColourVar = Effect->GetVariableByName( "ModelColour"  )->AsVector();
-	g_pCubeWiggleVar = Effect->GetVariableByName("Wiggle")->AsScalar();
+	// The light data and light lists are read by the shaders from the light manager's buffers, which are rewritten for each view.
+	// Their views don't change so they are set once here
+	LightManager = new CLightManager;
+	int maxClusters = max(CLightClusterGrid::CountClusters(g_ViewportWidth, g_ViewportHeight),
+	                      CLightClusterGrid::CountClusters(PortalWidth, PortalHeight));
+	if (!LightManager->Create(MaxVisibleLights, maxClusters, MaxLightIndices))
+	{
+		MessageBox(NULL, L"Error creating light buffers", L"Error", MB_OK);
+		return false;
+	}
+	Effect->GetVariableByName("LightData")->AsShaderResource()->SetResource(LightManager->GetLightBufferView());
+	Effect->GetVariableByName("ClusterLights")->AsShaderResource()->SetResource(LightManager->GetClusterBufferView());
+	Effect->GetVariableByName("LightIndices")->AsShaderResource()->SetResource(LightManager->GetIndexBufferView());
 
-	// Access shader variables needed for lighting
-	
 	// Initialize light objects
 	CubeLight = new CLight;
 	CarLight = new CLight;
@@ -391,36 +686,6 @@ bool LoadEffectFile()
 	for (int i = 0; i < g_numSpotLights; i++) {
 		SpotLights[i] = new CLight;
 	}
-	CubeLight->SetColourVar(Effect->GetVariableByName("CubeLightColour")->AsVector());
-	CubeLight->SetPosVar(Effect->GetVariableByName("CubeLightPos")->AsVector());
-
-	CarLight->SetColourVar(Effect->GetVariableByName("CarLightColour")->AsVector());
-	CarLight->SetPosVar(Effect->GetVariableByName("CarLightPos")->AsVector());
-
-	SpotLights[0]->SetColourVar(Effect->GetVariableByName("SpotLight1Colour")->AsVector());
-	SpotLights[0]->SetPosVar(Effect->GetVariableByName("SpotLight1Pos")->AsVector());
-	SpotLights[0]->SetFacingVar(Effect->GetVariableByName("SpotLight1Facing")->AsVector());
-	SpotLights[0]->SetViewMatrixVar(Effect->GetVariableByName("SpotLight1ViewMatrix")->AsMatrix());
-	SpotLights[0]->SetProjMatrixVar(Effect->GetVariableByName("SpotLight1ProjMatrix")->AsMatrix());
-	SpotLights[0]->SetConeAngleVar(Effect->GetVariableByName("SpotLight1CosHalfAngle")->AsScalar());
-	SpotLights[1]->SetColourVar(Effect->GetVariableByName("SpotLight2Colour")->AsVector());
-	SpotLights[1]->SetPosVar(Effect->GetVariableByName("SpotLight2Pos")->AsVector());
-	SpotLights[1]->SetFacingVar(Effect->GetVariableByName("SpotLight2Facing")->AsVector());
-	SpotLights[1]->SetViewMatrixVar(Effect->GetVariableByName("SpotLight2ViewMatrix")->AsMatrix());
-	SpotLights[1]->SetProjMatrixVar(Effect->GetVariableByName("SpotLight2ProjMatrix")->AsMatrix());
-	SpotLights[1]->SetConeAngleVar(Effect->GetVariableByName("SpotLight2CosHalfAngle")->AsScalar());
-
-	TeapotLights[0]->SetColourVar(Effect->GetVariableByName("TeapotLight1Colour")->AsVector());
-	TeapotLights[0]->SetPosVar(Effect->GetVariableByName("TeapotLight1Pos")->AsVector());
-	TeapotLights[1]->SetColourVar(Effect->GetVariableByName("TeapotLight2Colour")->AsVector());
-	TeapotLights[1]->SetPosVar(Effect->GetVariableByName("TeapotLight2Pos")->AsVector());
-	TeapotLights[2]->SetColourVar(Effect->GetVariableByName("TeapotLight3Colour")->AsVector());
-	TeapotLights[2]->SetPosVar(Effect->GetVariableByName("TeapotLight3Pos")->AsVector());
-
-	TintColourVar = Effect->GetVariableByName("TintColour")->AsVector();
-	AmbientColourVar = Effect->GetVariableByName("AmbientColour")->AsVector();
-	SpecularPowerVar = Effect->GetVariableByName("SpecularPower")->AsScalar();
-	ParallaxDepthVar = Effect->GetVariableByName("ParallaxDepth")->AsScalar();
 
 	return true;
 }
@@ -431,9 +696,390 @@ bool LoadEffectFile()
 // Scene Setup / Update / Rendering
 //--------------------------------------------------------------------------------------
 
+// Split each scene model's geometry into clusters. Models are independent, so they are shared out between threads by the job
+// system, one model per job. Models loaded from the mesh cache already have their clusters. The index buffers can only be updated
+// on the main thread, once all the jobs are done - imported models write their mesh cache then too
+void BuildSceneClusters()
+{
+	g_JobSystem->ParallelFor(0, NumSceneModels, 1, [](int first, int last)
+	{
+		for (int i = first; i < last; i++) {
+			SceneModels[i].model->BuildClusters();
+		}
+	});
+
+	for (int i = 0; i < NumSceneModels; i++) {
+		SceneModels[i].model->UploadClusterIndices();
+	}
+}
+
+// Write the triangle count of each model's LODs to the debugger output, and the LOD (and so triangle count) that would be
+// rendered with the model at a few distances from the main camera
+void ReportModelLODs()
+{
+	const float distances[] = { 25.0f, 100.0f, 400.0f, 1600.0f };
+	const int numDistances = sizeof(distances) / sizeof(distances[0]);
+	char text[256];
+	for (int i = 0; i < NumSceneModels; i++) {
+		CModel* model = SceneModels[i].model;
+		if (model->GetNumLODs() == 1) continue;
+
+		int length = sprintf_s(text, "%s LOD triangles:", SceneModels[i].name);
+		for (int lod = 0; lod < model->GetNumLODs() && length >= 0; lod++) {
+			int added = sprintf_s(text + length, sizeof(text) - length, " %d (error %.3f)", model->GetLODNumTriangles(lod), model->GetLODError(lod));
+			length = (added < 0) ? -1 : length + added;
+		}
+		for (int d = 0; d < numDistances && length >= 0; d++) {
+			// Put a camera at the given distance from the model's bounding sphere and see which LOD is chosen
+			CCamera testCamera(*Camera);
+			testCamera.SetPosition(model->GetWorldCentre() - D3DXVECTOR3(0, 0, distances[d] + model->GetWorldRadius()));
+			testCamera.UpdateMatrices();
+			int lod = model->SelectLOD(&testCamera, MaxLODPixelError);
+			int added = sprintf_s(text + length, sizeof(text) - length, ", at %.0f: %d", distances[d], model->GetLODNumTriangles(lod));
+			length = (added < 0) ? -1 : length + added;
+		}
+		model->SetLOD(0);
+		OutputDebugStringA(text);
+		OutputDebugStringA("\n");
+	}
+}
+
+// Write the vertex memory used by each model that has compact vertex data, compared to the imported floats, along with the
+// encoding speed and the largest errors after decoding
+void ReportVertexFormats()
+{
+	char text[256];
+	unsigned int totalSource = 0, totalEncoded = 0;
+	for (int i = 0; i < NumSceneModels; i++) {
+		const SVertexEncodeStats& stats = SceneModels[i].model->GetVertexEncodeStats();
+		if (stats.encodedBytes == stats.sourceBytes) continue;
+
+		float rate = (stats.encodeTime > 0.0f) ? stats.sourceBytes / (stats.encodeTime * 1024.0f * 1024.0f) : 0.0f;
+		sprintf_s(text, "%s vertices: %u -> %u bytes, encoded at %.1f MB/s, max error position %.5f normal %.3f deg UV %.5f\n",
+		          SceneModels[i].name, stats.sourceBytes, stats.encodedBytes, rate, stats.maxPositionError, stats.maxNormalError, stats.maxUVError);
+		OutputDebugStringA(text);
+		totalSource += stats.sourceBytes;
+		totalEncoded += stats.encodedBytes;
+	}
+	sprintf_s(text, "Compact vertex data total: %u -> %u bytes\n", totalSource, totalEncoded);
+	OutputDebugStringA(text);
+}
+
+// Write the results of the mesh cache benchmark to the debugger output: the size of the cache files and the time to load them,
+// with and without compression
+void ReportMeshCacheBenchmark()
+{
+	if (MeshCacheBenchmarkSize == 0) return;
+
+	SMeshCacheBenchmark results = CMeshCache::Benchmark(MeshCacheBenchmarkSize);
+	char text[256];
+	sprintf_s(text, "Mesh cache, %u meshes, %u triangles: indices %u -> %u bytes (%.2f bits per index), files %u -> %u bytes\n",
+	          results.numMeshes, results.numTriangles, results.rawIndexBytes, results.compressedIndexBytes,
+	          results.compressedIndexBytes * 8.0f / (results.numTriangles * 3), results.rawTotalBytes, results.compressedTotalBytes);
+	OutputDebugStringA(text);
+	sprintf_s(text, "Mesh cache load time: uncompressed %.2fms, compressed %.2fms (decoded at %.2f GB/s)\n",
+	          results.rawLoadTime * 1000.0f, results.compressedLoadTime * 1000.0f,
+	          results.rawTotalBytes / (results.compressedLoadTime * 1024.0f * 1024.0f * 1024.0f));
+	OutputDebugStringA(text);
+}
+
+// Write the results of the ring allocator benchmark to the debugger output
+void ReportRingAllocatorBenchmark()
+{
+	if (RingAllocatorBenchmarkSize == 0) return;
+
+	SRingAllocatorBenchmark results = CRingAllocator::Benchmark(RingAllocatorBenchmarkSize);
+	char text[256];
+	sprintf_s(text, "Ring allocator: %u allocations in %.2fms (%.1f million per second), %u found the ring full\n",
+	          results.numAllocations, results.time * 1000.0f, results.allocationsPerSecond / 1000000.0f, results.numFailed);
+	OutputDebugStringA(text);
+}
+
+// Time assigning many lights to the light clusters of a 1080p view and output the results to the debugger
+void ReportLightClusterBenchmark()
+{
+	if (LightClusterBenchmarkLights == 0) return;
+
+	SLightClusterBenchmark results = CLightClusterGrid::Benchmark(LightClusterBenchmarkLights, LightClusterBenchmarkBuilds);
+	char text[256];
+	sprintf_s(text, "Light clusters: %u lights into %u clusters in %.3fms, %.1f lights per cluster, results %s\n",
+	          results.numLights, results.numClusters, results.buildTime * 1000.0f,
+	          static_cast<float>(results.numLightIndices) / results.numClusters, results.deterministic ? "repeatable" : "VARY BETWEEN BUILDS");
+	OutputDebugStringA(text);
+}
+
+// Time starting empty jobs with the job system, and a parallel for loop with one thread up to one per core, and output the results
+// to the debugger
+void ReportJobSystemBenchmark()
+{
+	if (JobSystemBenchmarkJobs == 0) return;
+
+	SJobSystemBenchmark results = CJobSystem::Benchmark(JobSystemBenchmarkJobs, JobSystemBenchmarkItems);
+	char text[256];
+	sprintf_s(text, "Job system: %u empty jobs at %.3fus each, parallel for results %s\n", results.numJobs, results.spawnTime * 1000000.0f,
+	          results.identical ? "identical" : "DIFFER");
+	OutputDebugStringA(text);
+	for (size_t i = 0; i < results.loopTimes.size(); i++) {
+		sprintf_s(text, "  %d threads: %.2fms, %.2f times one thread\n", static_cast<int>(i + 1), results.loopTimes[i] * 1000.0f,
+		          results.loopTimes[0] / results.loopTimes[i]);
+		OutputDebugStringA(text);
+	}
+}
+
+// Time animating many lights with the light animator against animating them one CLight at a time, and output the results to the
+// debugger
+void ReportLightAnimatorBenchmark()
+{
+	if (LightAnimatorBenchmarkLights == 0) return;
+
+	SLightAnimatorBenchmark results = CLightAnimator::Benchmark(LightAnimatorBenchmarkLights, LightAnimatorBenchmarkFrames);
+	char text[256];
+	sprintf_s(text, "Light animation: %u lights in %.3fms, one light at a time %.3fms, results %s\n",
+	          results.numLights, results.batchTime * 1000.0f, results.objectTime * 1000.0f,
+	          results.identical ? "identical" : "DIFFER");
+	OutputDebugStringA(text);
+}
+
+// Time building, refitting and querying the bounding volume tree against brute force at 1000, 10000 and 100000 objects, and output
+// the results to the debugger
+void ReportBoundingVolumeTreeBenchmark()
+{
+	if (BoundingVolumeTreeBenchmarkQueries == 0) return;
+
+	const unsigned int NumObjects[] = { 1000, 10000, 100000 };
+	char text[256];
+	for (int i = 0; i < sizeof(NumObjects) / sizeof(NumObjects[0]); i++) {
+		SBoundingVolumeTreeBenchmark results = CBoundingVolumeTree::Benchmark(NumObjects[i], BoundingVolumeTreeBenchmarkQueries);
+		sprintf_s(text, "Bounding volume tree, %u objects: height %d, build %.2fms, refit %.3fms per frame (%.0f reinserted), results %s\n",
+		          results.numObjects, results.height, results.buildTime * 1000.0f, results.refitTime * 1000.0f, results.reinsertedPerFrame,
+		          results.matchesBruteForce ? "match brute force" : "DIFFER FROM BRUTE FORCE");
+		OutputDebugStringA(text);
+		sprintf_s(text, "  frustum %.1fus (brute force %.1fus), ray %.1fus (%.1fus), sphere %.1fus (%.1fus), %.1f objects found per query\n",
+		          results.frustumTime * 1000000.0f, results.bruteFrustumTime * 1000000.0f, results.rayTime * 1000000.0f,
+		          results.bruteRayTime * 1000000.0f, results.sphereTime * 1000000.0f, results.bruteSphereTime * 1000000.0f,
+		          results.resultsPerQuery);
+		OutputDebugStringA(text);
+	}
+}
+
+// Write the use of each geometry pool to the debugger output - how full its buffers are and how fragmented their free space is
+void ReportGeometryPools()
+{
+	char text[256];
+	for (unsigned int p = 0; p < CGeometryPool::GetNumPools(); ++p) {
+		const CRangeAllocator& vertices = CGeometryPool::GetPoolByIndex(p)->GetVertexAllocator();
+		const CRangeAllocator& indices = CGeometryPool::GetPoolByIndex(p)->GetIndexAllocator();
+		sprintf_s(text, "Geometry pool %u: vertices %u / %u (fragmentation %.2f), indices %u / %u (fragmentation %.2f)\n", p,
+		          vertices.GetUsed(), vertices.GetCapacity(), vertices.GetFragmentation(),
+		          indices.GetUsed(), indices.GetCapacity(), indices.GetFragmentation());
+		OutputDebugStringA(text);
+	}
+}
+
+// Add a static model to the static batch for the given technique and texture, creating the batch if needed
+void AddToStaticBatch(CModel* model, ID3D10EffectTechnique* technique, ID3D10ShaderResourceView* texture)
+{
+	if (!model->IsStatic()) return;
+	for (unsigned int i = 0; i < StaticBatches.size(); i++) {
+		if (StaticBatches[i]->GetTechnique() == technique && StaticBatches[i]->GetTexture() == texture)
+		{
+			StaticBatches[i]->AddModel(model);
+			return;
+		}
+	}
+	StaticBatches.push_back(new CStaticBatch(technique, texture));
+	StaticBatches.back()->AddModel(model);
+}
+
+// Merge static models into static batches. In the camera views each static model has its own technique or texture (and some have
+// extra per-model settings), so there is nothing to merge. The shadow maps draw every caster with the depth-only technique and no
+// texture, so all the static casters go in one batch. Batches of a single model save nothing and are dropped
+void BuildStaticBatches()
+{
+	for (int i = 0; i < NumShadowCasters; i++) {
+		AddToStaticBatch(ShadowCasters[i], DepthOnlyTechnique, NULL);
+	}
+
+	for (unsigned int i = 0; i < StaticBatches.size(); ) {
+		if (StaticBatches[i]->GetNumModels() < 2 || !StaticBatches[i]->Build())
+		{
+			delete StaticBatches[i];
+			StaticBatches.erase(StaticBatches.begin() + i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+// Get the static batch that draws the given model with the given technique, or NULL if the model should be drawn individually
+CStaticBatch* FindStaticBatch(CModel* model, ID3D10EffectTechnique* technique)
+{
+	if (!g_useStaticBatching) return NULL;
+	for (unsigned int i = 0; i < StaticBatches.size(); i++) {
+		if (StaticBatches[i]->GetTechnique() == technique && StaticBatches[i]->Contains(model))
+		{
+			return StaticBatches[i]->IsValid() ? StaticBatches[i] : NULL;
+		}
+	}
+	return NULL;
+}
+
+// Write the static batches to the debugger output
+void ReportStaticBatches()
+{
+	char text[256];
+	for (unsigned int i = 0; i < StaticBatches.size(); i++) {
+		sprintf_s(text, "Static batch %u: %d models, %d triangles\n", i, StaticBatches[i]->GetNumModels(), StaticBatches[i]->GetNumTriangles());
+		OutputDebugStringA(text);
+	}
+}
+
+// Add a model to the scene's bounding volume tree. The model's matrix is updated first so its world bounds are current
+void AddSceneModel(CModel* model, const char* name)
+{
+	if (NumSceneModels >= MaxSceneModels) return;
+
+	model->UpdateMatrix();
+	SSceneModel& sceneModel = SceneModels[NumSceneModels++];
+	sceneModel.model = model;
+	sceneModel.name = name;
+	sceneModel.proxy = SceneTree.CreateProxy(model->GetWorldMinBounds(), model->GetWorldMaxBounds(), &sceneModel);
+	sceneModel.lastCentre = model->GetWorldCentre();
+}
+
+// Update the tree with the current bounds of every scene model. Models that have not left their (fattened) box in the tree
+// cost only a containment test
+void UpdateSceneTree()
+{
+	for (int i = 0; i < NumSceneModels; i++) {
+		SSceneModel& sceneModel = SceneModels[i];
+		D3DXVECTOR3 centre = sceneModel.model->GetWorldCentre();
+		SceneTree.MoveProxy(sceneModel.proxy, sceneModel.model->GetWorldMinBounds(), sceneModel.model->GetWorldMaxBounds(), centre - sceneModel.lastCentre);
+		sceneModel.lastCentre = centre;
+	}
+}
+
+// Find the models visible in a frustum and mark them with a new stamp, which is returned. The tree only holds fattened boxes
+// so each model it returns is tested again with its own bounds. If an occlusion culler is given, models hidden behind its
+// occluders are not marked either, and are counted in numOccluded
+unsigned int MarkVisibleModels(const CFrustum& frustum, const COcclusionCuller* occlusionCuller = NULL, int* numOccluded = NULL)
+{
+	CTimer timer;
+	timer.Start();
+
+	++VisibleStamp;
+	static vector<void*> results; // Keep memory between calls
+	results.clear();
+	SceneTree.QueryFrustum(frustum, results);
+	int occluded = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		CModel* model = static_cast<SSceneModel*>(results[i])->model;
+		if (model->IsVisible(frustum))
+		{
+			if (occlusionCuller && model->HasBounds() && !occlusionCuller->IsBoxVisible(model->GetWorldMinBounds(), model->GetWorldMaxBounds()))
+			{
+				++occluded;
+				continue;
+			}
+			model->MarkVisible(VisibleStamp);
+		}
+	}
+
+	if (occlusionCuller)
+	{
+		OcclusionTestTime += timer.GetTime();
+	}
+	if (numOccluded) *numOccluded = occluded;
+	return VisibleStamp;
+}
+
+// Find the nearest scene model under the mouse. A ray is fired from the camera through the mouse position: the position is
+// converted to the -1 to 1 range of the viewport, then into a direction in camera space using the projection matrix scaling,
+// and finally into world space with the camera's world matrix (the inverse of the view matrix)
+SSceneModel* PickSceneModel(CCamera* camera, unsigned int mouseX, unsigned int mouseY)
+{
+	D3DXMATRIX projMatrix = camera->GetProjectionMatrix();
+	D3DXMATRIX viewMatrix = camera->GetViewMatrix();
+	D3DXMATRIX cameraMatrix;
+	D3DXMatrixInverse(&cameraMatrix, NULL, &viewMatrix);
+
+	float x = 2.0f * mouseX / g_ViewportWidth - 1.0f;
+	float y = 1.0f - 2.0f * mouseY / g_ViewportHeight;
+	D3DXVECTOR3 cameraDirection(x / projMatrix._11, y / projMatrix._22, 1.0f);
+	D3DXVECTOR3 rayDirection;
+	D3DXVec3TransformNormal(&rayDirection, &cameraDirection, &cameraMatrix);
+	D3DXVECTOR3 rayOrigin = camera->GetWorldPosition();
+	float maxDistance = camera->GetFarClip();
+
+	vector<void*> candidates;
+	SceneTree.QueryRay(rayOrigin, rayDirection, maxDistance, candidates);
+
+	SSceneModel* nearestModel = 0;
+	float nearestDistance = maxDistance;
+	for (size_t i = 0; i < candidates.size(); i++) {
+		SSceneModel* sceneModel = static_cast<SSceneModel*>(candidates[i]);
+		float distance;
+		if (RayIntersectsBox(rayOrigin, rayDirection, nearestDistance, sceneModel->model->GetWorldMinBounds(), sceneModel->model->GetWorldMaxBounds(), &distance) &&
+		    distance < nearestDistance)
+		{
+			nearestModel = sceneModel;
+			nearestDistance = distance;
+		}
+	}
+	return nearestModel;
+}
+
+// Start the software occlusion culling for the main camera. The largest static models on screen are chosen as occluders, jobs
+// then render them while the next scene update starts. Only static models are used as the occluders must not move while the
+// jobs are running. The results are collected when the main view is rendered
+void StartOcclusionCulling()
+{
+	OcclusionCuller->BeginFrame(Camera->GetViewProjectionMatrix());
+
+	// Measure the size of each candidate on screen by its bounding radius over its distance from the camera
+	struct SOccluderCandidate
+	{
+		CModel* model;
+		float   screenSize;
+	};
+	SOccluderCandidate candidates[MaxSceneModels];
+	int numCandidates = 0;
+	D3DXVECTOR3 cameraPosition = Camera->GetWorldPosition();
+	for (int i = 0; i < NumSceneModels; i++) {
+		CModel* model = SceneModels[i].model;
+		if (!model->IsStatic() || model->GetCPUIndices().empty() || !model->IsVisible(Camera->GetFrustum())) continue;
+
+		D3DXVECTOR3 offset = model->GetWorldCentre() - cameraPosition;
+		float distance = D3DXVec3Length(&offset);
+		float screenSize = (distance > model->GetWorldRadius()) ? model->GetWorldRadius() / distance : 1.0f; // Camera inside bounds
+		if (screenSize < MinOccluderSize) continue;
+
+		// Insertion sort, largest first - only a handful of candidates
+		int insert = numCandidates++;
+		while (insert > 0 && candidates[insert - 1].screenSize < screenSize)
+		{
+			candidates[insert] = candidates[insert - 1];
+			--insert;
+		}
+		candidates[insert].model = model;
+		candidates[insert].screenSize = screenSize;
+	}
+
+	for (int i = 0; i < numCandidates && i < MaxOccluders; i++) {
+		CModel* model = candidates[i].model;
+		OcclusionCuller->AddOccluder(model->GetWorldMatrix(), &model->GetCPUVertices()[0], static_cast<unsigned int>(model->GetCPUVertices().size()),
+		                             &model->GetCPUIndices()[0], static_cast<unsigned int>(model->GetCPUIndices().size()));
+	}
+	OcclusionCuller->StartRendering();
+}
+
 // Create / load the camera, models and textures for the scene
 bool InitScene()
 {
+	PROFILE_SCOPE("InitScene");
+
 	//////////////////
 	// Create camera
 
@@ -446,6 +1092,11 @@ bool InitScene()
 	PortalCamera->SetPosition(D3DXVECTOR3(50, 15, 100));
 	PortalCamera->SetRotation(D3DXVECTOR3(0, ToRadians(-130.0f), 0.));
 
+	// The second portal stands in view of the first and looks back at it, so each can be seen inside the other
+	Portal2Camera = new CCamera();
+	Portal2Camera->SetPosition(D3DXVECTOR3(-15, 15, 55));
+	Portal2Camera->SetRotation(D3DXVECTOR3(0, ToRadians(55.0f), 0.));
+
 	///////////////////////
 	// Load/Create models
 
@@ -454,6 +1105,7 @@ bool InitScene()
 	Floor = new CModel;
 	Teapot = new CModel;
 	Portal = new CModel;
+	Portal2 = new CModel;
 	Troll = new CModel;
 	Sphere = new CLight;
 	Car = new CModel;
@@ -462,10 +1114,12 @@ bool InitScene()
 	// The model class can load ".X" files. It encapsulates (i.e. hides away from this code) the file loading/parsing and creation of vertex/index buffers
 	// We must pass an example technique used for each model. We can then only render models with techniques that uses matching vertex input data
 	if (!WiggleCube->  Load( "Cube.x", WiggleTechnique)) return false;
-	if (!Box->  Load( "CardboardBox.x", ParallaxMappingTechnique, true)) return false;
+	// Larger models use compact vertex data (see VertexEncoder.h). The floor keeps full floats as its UVs tile far beyond 0-1, where
+	// half floats lose too much precision
+	if (!Box->  Load( "CardboardBox.x", ParallaxMappingTechnique, true, VertexFormat_SNorm16)) return false;
 	if (!Floor-> Load( "Floor.x", ParallaxMappingTechnique, true )) return false;
 	if (!CubeLight->Load( "Light.x", AdditiveTexTintTechnique )) return false;
-	if (!Teapot->Load( "Teapot.x", VertexLitTechnique )) return false;
+	if (!Teapot->Load( "Teapot.x", VertexLitTechnique, false, VertexFormat_SNorm16 )) return false;
 	for (int i = 0; i < g_numTeapotLights; i++) {
 		if (!TeapotLights[i]->Load("Light.x", AdditiveTexTintTechnique)) return false;
 	}
@@ -473,11 +1127,12 @@ bool InitScene()
 		if (!SpotLights[i]->Load("Light.x", AdditiveTexTintTechnique)) return false;
 	}
 	if (!Portal->Load("Portal.x", AdditiveTexTintTechnique)) return false;
-	if (!Troll->Load("Troll.x", ShadowMappingTechnique)) return false;
+	if (!Portal2->Load("Portal.x", AdditiveTexTintTechnique)) return false;
+	if (!Troll->Load("Troll.x", ShadowMappingTechnique, false, VertexFormat_SNorm16)) return false;
 	if (!Sphere->Load("Sphere.x", PlainColourTechnique)) return false;
-	if (!Car->Load("AstonMartin.x", CellShadingTechnique)) return false;
+	if (!Car->Load("AstonMartin.x", CellShadingTechnique, false, VertexFormat_SNorm16)) return false;
 	if (!CarLight->Load("Light.x", AdditiveTexTintTechnique)) return false;
-	if (!Bike->Load("Bike.x", VertexLitTechnique)) return false;
+	if (!Bike->Load("Bike.x", VertexLitTechnique, false, VertexFormat_SNorm16)) return false;
 
 	// Initial positions
 	WiggleCube->SetPosition( D3DXVECTOR3(-20, 5, 0) );
@@ -491,14 +1146,14 @@ bool InitScene()
 	Troll->SetScale(5.0f);
 	Troll->SetRotation(D3DXVECTOR3(0.0f, ToRadians(215.0f), 0.0f));
 
-	SpotLights[0]->SetPosition(D3DXVECTOR3(-60, 10, 50));
-	SpotLights[0]->SetScale(4.0f);
-	SpotLights[0]->SetColour(D3DXVECTOR3(0.8f, 0.8f, 0.8f) * 40);
-	SpotLights[0]->FacePoint(Troll->GetPosition());
-	SpotLights[1]->SetPosition(D3DXVECTOR3(-20, 30, 130));
-	SpotLights[1]->SetScale(4.0f);
-	SpotLights[1]->SetColour(D3DXVECTOR3(1.0f, 0.8f, 0.2f) * 80);
-	SpotLights[1]->FacePoint(D3DXVECTOR3(0, 0, 0));
+	// Spot lights from the table at the top of the file. The first follows an orbit around the troll (see UpdateScene)
+	SpotLightSetups[0].target = Troll->GetPosition();
+	for (int i = 0; i < g_numSpotLights; i++) {
+		SpotLights[i]->SetPosition(SpotLightSetups[i].position);
+		SpotLights[i]->SetScale(4.0f);
+		SpotLights[i]->SetColour(SpotLightSetups[i].colour);
+		SpotLights[i]->FacePoint(SpotLightSetups[i].target);
+	}
 
 	Teapot->SetPosition(D3DXVECTOR3(0, 0, 80));
 	TeapotLights[0]->SetPosition(D3DXVECTOR3(0, 15, 80));
@@ -513,6 +1168,8 @@ bool InitScene()
 
 	Portal->SetPosition(D3DXVECTOR3(50, 15, 100));
 	Portal->SetRotation(D3DXVECTOR3(0.0f, ToRadians(-130.0f), 0.0f));
+	Portal2->SetPosition(D3DXVECTOR3(-15, 15, 55));
+	Portal2->SetRotation(D3DXVECTOR3(0.0f, ToRadians(55.0f), 0.0f));
 
 	Sphere->SetPosition(D3DXVECTOR3(20, 20, 30));
 	Sphere->SetColour(D3DXVECTOR3(0.3f, 0.3f, 1.0f));
@@ -528,6 +1185,48 @@ bool InitScene()
 	Bike->SetScale(2.0f);
 	Bike->SetRotation(D3DXVECTOR3(0.0f, ToRadians(135.0f), 0.0f));
 
+	// The light models are drawn together as instances of CubeLight, with their per-instance data in the upload ring
+	UploadRing = new CUploadRing;
+	if (!UploadRing->Create(UploadRingSize)) return false;
+
+	// Without its queries the GPU timer still runs but reports zero times, so don't fail if they can't be created
+	GPUTimer = new CGPUTimer;
+	GPUTimer->Create();
+	LightInstancing = CubeLight->CreateInstancedLayout(AdditiveTexTintInstancedTechnique, LightInstanceElts,
+	                                                   sizeof(LightInstanceElts) / sizeof(LightInstanceElts[0]));
+
+	// Animate the scene's lights - the orbits follow their models (see UpdateScene), the pulsing and colour cycles start from the
+	// colours set above
+	LightAnimator = new CLightAnimator;
+	CubeLightOrbit = LightAnimator->AddOrbit(Box->GetPosition(), CubeLight->GetOrbitRadius(), 5.0f, CubeLight->GetOrbitSpeed());
+	CarLightOrbit = LightAnimator->AddOrbit(Car->GetPosition(), CarLight->GetOrbitRadius(), 5.0f, CarLight->GetOrbitSpeed());
+	SpotLightOrbit = LightAnimator->AddOrbit(Troll->GetPosition(), SpotLights[0]->GetOrbitRadius(), 20.0f, SpotLights[0]->GetOrbitSpeed());
+	TeapotLightPulse = LightAnimator->AddPulse(TeapotLights[0]->GetColour(), D3DXVECTOR3(0, 0, 0), D3DXVECTOR3(5.0f, 0.0f, 3.5f));
+	for (int i = 1; i < g_numTeapotLights; i++) {
+		TeapotLightCycles[i - 1] = LightAnimator->AddCycle(TeapotLights[i]->GetColour(), static_cast<float>(i)); // Each one faster
+	}
+
+	// Scatter the animated lights over the scene with random circles and colours, each part way through its colour cycle. A fixed
+	// seed gives the same scene every run
+	srand(1);
+	for (int i = 0; i < NumAnimatedLights; i++) {
+		D3DXVECTOR3 centre(-80.0f + (rand() % 160), 4.0f + (rand() % 8), -20.0f + (rand() % 160));
+		float radius = 5.0f + (rand() % 15);
+		float speed = (0.2f + (rand() % 100) / 100.0f) * ((rand() % 2) ? 1.0f : -1.0f);
+		float angle = ToRadians(static_cast<float>(rand() % 360));
+		int orbit = LightAnimator->AddOrbit(centre, radius, 0.0f, speed, angle);
+
+		D3DXVECTOR3 colour((rand() % 100) / 100.0f, (rand() % 100) / 100.0f, (rand() % 100) / 100.0f);
+		colour = colour / max(max(colour.x, colour.y), max(colour.z, 0.01f)) * 5; // Full brightness in its strongest component
+		float cycleSpeed = 0.1f + (rand() % 100) / 200.0f;
+		int cycle = LightAnimator->AddCycle(colour, cycleSpeed, rand() % 6);
+		if (i == 0)
+		{
+			FirstAnimatedOrbit = orbit;
+			FirstAnimatedCycle = cycle;
+		}
+	}
+
 	//////////////////
 	// Load textures
 	if (FAILED( D3DX10CreateShaderResourceViewFromFile( g_pd3dDevice, L"StoneDiffuseSpecular.dds", NULL, NULL, &CubeDiffuseMap,  NULL ) )) return false;
@@ -543,69 +1242,24 @@ bool InitScene()
 	if (FAILED(D3DX10CreateShaderResourceViewFromFile(g_pd3dDevice, L"MetalDiffuseSpecular.dds", NULL, NULL, &BikeDiffuseMap, NULL))) return false;
 
 
-	//**** Portal Texture ****//
-
-	// Create the portal texture itself, above we used a D3DX... helper function to create a texture in one line. Here, we need to do things manually
-	// as we are creating a special kind of texture (one that we can render to). Many settings to prepare:
-	D3D10_TEXTURE2D_DESC portalDesc;
-	portalDesc.Width = PortalWidth;  // Size of the portal texture determines its quality
-	portalDesc.Height = PortalHeight;
-	portalDesc.MipLevels = 1; // No mip-maps when rendering to textures (or we would have to render every level)
-	portalDesc.ArraySize = 1;
-	portalDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM; // RGBA texture (8-bits each)
-	portalDesc.SampleDesc.Count = 1;
-	portalDesc.SampleDesc.Quality = 0;
-	portalDesc.Usage = D3D10_USAGE_DEFAULT;
-	portalDesc.BindFlags = D3D10_BIND_RENDER_TARGET | D3D10_BIND_SHADER_RESOURCE; // Indicate we will use texture as render target, and pass it to shaders
-	portalDesc.CPUAccessFlags = 0;
-	portalDesc.MiscFlags = 0;
-	if (FAILED(g_pd3dDevice->CreateTexture2D(&portalDesc, NULL, &PortalTexture))) return false;
-
-	// We created the portal texture above, now we get a "view" of it as a render target, i.e. get a special pointer to the texture that
-	// we use when rendering to it (see RenderScene function below)
-	if (FAILED(g_pd3dDevice->CreateRenderTargetView(PortalTexture, NULL, &PortalRenderTarget))) return false;
-
-	// We also need to send this texture (resource) to the shaders. To do that we must create a shader-resource "view"
-	D3D10_SHADER_RESOURCE_VIEW_DESC srDesc;
-	srDesc.Format = portalDesc.Format;
-	srDesc.ViewDimension = D3D10_SRV_DIMENSION_TEXTURE2D;
-	srDesc.Texture2D.MostDetailedMip = 0;
-	srDesc.Texture2D.MipLevels = 1;
-
-	if (FAILED(g_pd3dDevice->CreateShaderResourceView(PortalTexture, &srDesc, &PortalMap))) return false;
-
-	//**** Portal Depth Buffer ****//
-
-	// We also need a depth buffer to go with our portal
-	//**** This depth buffer can be shared with any other portals of the same size
-	portalDesc.Width = PortalWidth;
-	portalDesc.Height = PortalHeight;
-	portalDesc.MipLevels = 1;
-	portalDesc.ArraySize = 1;
-	portalDesc.Format = DXGI_FORMAT_D32_FLOAT;
-	portalDesc.SampleDesc.Count = 1;
-	portalDesc.SampleDesc.Quality = 0;
-	portalDesc.Usage = D3D10_USAGE_DEFAULT;
-	portalDesc.BindFlags = D3D10_BIND_DEPTH_STENCIL;
-	portalDesc.CPUAccessFlags = 0;
-	portalDesc.MiscFlags = 0;
-	if (FAILED(g_pd3dDevice->CreateTexture2D(&portalDesc, NULL, &PortalDepthStencil))) return false;
+	//**** Portal Textures ****//
 
-	// Create the depth stencil view, i.e. indicate that the texture just created is to be used as a depth buffer
-	D3D10_DEPTH_STENCIL_VIEW_DESC portalDescDSV;
-	portalDescDSV.Format = portalDesc.Format;
-	portalDescDSV.ViewDimension = D3D10_DSV_DIMENSION_TEXTURE2D;
-	portalDescDSV.Texture2D.MipSlice = 0;
-	if (FAILED(g_pd3dDevice->CreateDepthStencilView(PortalDepthStencil, &portalDescDSV, &PortalDepthStencilView))) return false;
+	// Each portal creates its own textures and depth buffers, a set of sizes for each depth it can be seen at (see Portal.cpp)
+	Portals[NumPortals++] = new CPortal(Portal, PortalCamera);
+	Portals[NumPortals++] = new CPortal(Portal2, Portal2Camera);
+	for (int i = 0; i < NumPortals; i++) {
+		if (!Portals[i]->Create(PortalWidth, g_clearColour)) return false;
+	}
+	PortalClock.Start();
 
 	////////////////////////
 	//**** Shadow Maps ****//
 
-	// Create the shadow map textures, above we used a D3DX... helper function to create basic textures in one line. Here, we need to
+	// Create the shadow atlas textures, above we used a D3DX... helper function to create basic textures in one line. Here, we need to
 	// do things manually as we are creating a special kind of texture (one that we can render to). Many settings to prepare:
 	D3D10_TEXTURE2D_DESC texDesc;
-	texDesc.Width = ShadowMapSize; // Size of the shadow map determines quality / resolution of shadows
-	texDesc.Height = ShadowMapSize;
+	texDesc.Width = ShadowAtlasLayout.GetAtlasSize(); // Size of the atlas and its tiles determines quality / resolution of shadows
+	texDesc.Height = ShadowAtlasLayout.GetAtlasSize();
 	texDesc.MipLevels = 1; // 1 level, means just the main texture, no additional mip-maps. Usually don't use mip-maps when rendering to textures (or we would have to render every level)
 	texDesc.ArraySize = 1;
 	texDesc.Format = DXGI_FORMAT_R32_TYPELESS; // The shadow map contains a single 32-bit value [tech gotcha: have to say typeless because depth buffer and texture see things slightly differently]
@@ -615,42 +1269,111 @@ bool InitScene()
 	texDesc.BindFlags = D3D10_BIND_DEPTH_STENCIL | D3D10_BIND_SHADER_RESOURCE; // Indicate we will use texture as render target, and will also pass it to shaders
 	texDesc.CPUAccessFlags = 0;
 	texDesc.MiscFlags = 0;
-	if (FAILED(g_pd3dDevice->CreateTexture2D(&texDesc, NULL, &ShadowMap1Texture))) return false;
-	if (FAILED(g_pd3dDevice->CreateTexture2D(&texDesc, NULL, &ShadowMap2Texture))) return false;
+	if (FAILED(g_pd3dDevice->CreateTexture2D(&texDesc, NULL, &ShadowAtlasTexture))) return false;
+	if (FAILED(g_pd3dDevice->CreateTexture2D(&texDesc, NULL, &StaticShadowAtlasTexture))) return false; // Cached static layers use the same layout so tiles line up
 
 	// Create the depth stencil view, i.e. indicate that the texture just created is to be used as a depth buffer
 	D3D10_DEPTH_STENCIL_VIEW_DESC descDSV;
 	descDSV.Format = DXGI_FORMAT_D32_FLOAT; // See "tech gotcha" above
 	descDSV.ViewDimension = D3D10_DSV_DIMENSION_TEXTURE2D;
 	descDSV.Texture2D.MipSlice = 0;
-	if (FAILED(g_pd3dDevice->CreateDepthStencilView(ShadowMap1Texture, &descDSV, &ShadowMap1DepthView))) return false;
-	if (FAILED(g_pd3dDevice->CreateDepthStencilView(ShadowMap2Texture, &descDSV, &ShadowMap2DepthView))) return false;
+	if (FAILED(g_pd3dDevice->CreateDepthStencilView(ShadowAtlasTexture, &descDSV, &ShadowAtlasDepthView))) return false;
+	if (FAILED(g_pd3dDevice->CreateDepthStencilView(StaticShadowAtlasTexture, &descDSV, &StaticShadowAtlasDepthView))) return false;
 
 	// We also need to send this texture (a GPU memory resource) to the shaders. To do that we must create a shader-resource "view"	
+	D3D10_SHADER_RESOURCE_VIEW_DESC srDesc;
 	srDesc.Format = DXGI_FORMAT_R32_FLOAT; // See "tech gotcha" above
 	srDesc.ViewDimension = D3D10_SRV_DIMENSION_TEXTURE2D;
 	srDesc.Texture2D.MostDetailedMip = 0;
 	srDesc.Texture2D.MipLevels = 1;
-	if (FAILED(g_pd3dDevice->CreateShaderResourceView(ShadowMap1Texture, &srDesc, &ShadowMap1))) return false;
-	if (FAILED(g_pd3dDevice->CreateShaderResourceView(ShadowMap2Texture, &srDesc, &ShadowMap2))) return false;
+	if (FAILED(g_pd3dDevice->CreateShaderResourceView(ShadowAtlasTexture, &srDesc, &ShadowAtlas))) return false;
+	if (FAILED(g_pd3dDevice->CreateShaderResourceView(StaticShadowAtlasTexture, &srDesc, &StaticShadowAtlas))) return false; // Read when copying cached tiles
 
 	//*****************************//
 
+	////////////////////////
+	// Scene tree
+
+	// Register the models with the scene's bounding volume tree now they are loaded and positioned
+	AddSceneModel(Bike, "Bike");
+	AddSceneModel(Portal, "Portal");
+	AddSceneModel(Portal2, "Portal2");
+	AddSceneModel(WiggleCube, "WiggleCube");
+	AddSceneModel(Box, "Box");
+	AddSceneModel(Floor, "Floor");
+	AddSceneModel(Teapot, "Teapot");
+	AddSceneModel(Troll, "Troll");
+	AddSceneModel(Sphere, "Sphere");
+	AddSceneModel(Car, "Car");
+	AddSceneModel(CubeLight, "CubeLight");
+	AddSceneModel(CarLight, "CarLight");
+	AddSceneModel(TeapotLights[0], "TeapotLight1");
+	AddSceneModel(TeapotLights[1], "TeapotLight2");
+	AddSceneModel(TeapotLights[2], "TeapotLight3");
+	for (int i = 0; i < g_numSpotLights; i++) {
+		sprintf_s(SpotLightNames[i], "SpotLight%d", i + 1);
+		AddSceneModel(SpotLights[i], SpotLightNames[i]);
+	}
+
+	// Models that can cast shadows. Light models are not included. Models that never move are marked static so their shadows
+	// can be cached - if one does move anyway the cache is still updated correctly, it just loses its benefit
+	CModel* shadowCasters[] = { Troll, WiggleCube, Floor, Teapot, Box, Sphere, Car, Bike, Portal, Portal2 };
+	CModel* staticModels[] = { Troll, Floor, Teapot, Box, Sphere, Car, Portal, Portal2 };
+	for (int i = 0; i < sizeof(staticModels) / sizeof(staticModels[0]); i++) {
+		staticModels[i]->SetStatic(true);
+	}
+	NumShadowCasters = sizeof(shadowCasters) / sizeof(shadowCasters[0]);
+	for (int i = 0; i < NumShadowCasters; i++) {
+		ShadowCasters[i] = shadowCasters[i];
+	}
+	for (int i = 0; i < g_numSpotLights; i++) {
+		ShadowMapCaches[i].valid = false;
+		ShadowMapCaches[i].staticLayerValid = false;
+		sprintf_s(ShadowPassNames[i], "Shadow map %d", i + 1);
+	}
+
+	// Split the models into clusters (before the occlusion culler starts reading their geometry)
+	BuildSceneClusters();
+
+	// Merge static models now they are all positioned
+	BuildStaticBatches();
+
+	// The occlusion culler renders its depth buffer with jobs, started for each frame in PublishScene
+	OcclusionCuller = new COcclusionCuller;
+
+	ReportModelLODs();
+	ReportVertexFormats();
+	ReportMeshCacheBenchmark();
+	ReportGeometryPools();
+	ReportStaticBatches();
+	ReportRingAllocatorBenchmark();
+	ReportLightClusterBenchmark();
+	ReportLightAnimatorBenchmark();
+	ReportJobSystemBenchmark();
+	ReportBoundingVolumeTreeBenchmark();
+
 	return true;
 }
 
 
-// Update the scene - move/rotate each model and the camera, then update their matrices
+// Update the scene by one step of the given time - move/rotate each model and the camera, then update their matrices. The frame
+// pipeline runs as many steps each frame as fit the time passed, usually as a job while the last update is rendered, so this only
+// changes state the render doesn't read - models' and cameras' positions and their next matrices, and the light animator.
+// Everything else is passed on to the render in PublishScene (see FramePipeline.h)
 void UpdateScene( float frameTime )
 {
+	PROFILE_SCOPE("UpdateScene");
+
 	// Control camera position and update its matrices (view matrix, projection matrix) each frame
 	// Don't be deceived into thinking that this is a new method to control models - the same code we used previously is in the camera class
 	Camera->Control( frameTime, Key_Up, Key_Down, Key_Left, Key_Right, Key_W, Key_S, Key_A, Key_D );
 	Camera->UpdateMatrices();
-	
+
 	PortalCamera->Control(frameTime, Key_Numpad5, Key_Numpad0, Key_Numpad1, Key_Numpad3, Key_U, Key_O, Key_Period, Key_Comma);
 	PortalCamera->UpdateMatrices();
 	Portal->UpdateMatrix();
+	Portal2Camera->UpdateMatrices();
+	Portal2->UpdateMatrix();
 
 	// Control cube position and update its world matrix each frame
 	WiggleCube->Control( frameTime, Key_I, Key_K, Key_J, Key_L, Key_U, Key_O, Key_Period, Key_Comma );
@@ -660,31 +1383,29 @@ void UpdateScene( float frameTime )
 
 	// Wiggle effect
 	g_WiggleVar += 6 * frameTime;
-	g_pCubeWiggleVar->SetFloat(g_WiggleVar);
 
-	// Update the orbiting lights - a bit of a cheat with the static variable [ask the tutor if you want to know what this is]
-	CubeLight->OrbitAround(Box, frameTime);
+	// Animate all the lights together - orbits around their models and changing colours, including the animated lights
+	const float colourUpdateSpeed = 5.0f * frameTime;
+	LightAnimator->SetOrbitCentre(CubeLightOrbit, Box->GetPosition());
+	LightAnimator->SetOrbitCentre(CarLightOrbit, Car->GetPosition());
+	LightAnimator->SetOrbitCentre(SpotLightOrbit, Troll->GetPosition());
+	LightAnimator->Update(colourUpdateSpeed, frameTime);
+
+	// Update the orbiting lights
+	CubeLight->SetPosition(LightAnimator->GetOrbitPosition(CubeLightOrbit));
 	CubeLight->UpdateMatrix();
 
-	CarLight->OrbitAround(Car, frameTime);
+	CarLight->SetPosition(LightAnimator->GetOrbitPosition(CarLightOrbit));
 	CarLight->UpdateMatrix();
 
 	// Update teapot lights
-	const float colourUpdateSpeed = 5.0f * frameTime;
-
-	TeapotLights[0]->Pulsate(D3DXVECTOR3(0, 0, 0), D3DXVECTOR3(5.0f, 0.0f, 3.5f), colourUpdateSpeed);
-	TeapotLights[1]->ChangeColour(colourUpdateSpeed);
-	TeapotLights[2]->ChangeColour(colourUpdateSpeed * 2);
-
 	Teapot->UpdateMatrix();
 	for (int i = 0; i < g_numTeapotLights; i++) {
 		TeapotLights[i]->UpdateMatrix();
 	}
 
 	// Update spot lights
-	static float SpotLightRotate = 0.0f;
-	SpotLights[0]->SetPosition(Troll->GetPosition() + D3DXVECTOR3(cos(SpotLightRotate) * SpotLights[0]->GetOrbitRadius(), 20, sin(SpotLightRotate) * SpotLights[0]->GetOrbitRadius()));
-	SpotLightRotate -= SpotLights[0]->GetOrbitSpeed() * frameTime;
+	SpotLights[0]->SetPosition(LightAnimator->GetOrbitPosition(SpotLightOrbit));
 	SpotLights[0]->FacePoint(Troll->GetPosition()); // The troll is in the spotlight...
 
 	for (int i = 0; i < g_numSpotLights; i++) {
@@ -696,13 +1417,77 @@ void UpdateScene( float frameTime )
 	Car->UpdateMatrix();
 
 	Bike->Control(frameTime, Key_I, Key_K, Key_J, Key_L);
-	Bike->UpdateMatrix();
+	Bike->UpdateHierarchyMatrices();
+}
+
 
+// Publish the last scene update, ready to be rendered, along with everything else the render needs from the update. Runs between
+// frames on the main thread, never at the same time as the update or the render (see FramePipeline.h). Movement is blended
+// between the last two update steps by the given amount, 0 to 1
+void PublishScene( float blend )
+{
+	PROFILE_SCOPE("PublishScene");
+
+	// Models and cameras
+	CPublishable::PublishAll(blend);
 
+	// Light colours and the animated lights from the light animator
+	TeapotLights[0]->SetColour(LightAnimator->GetPulseColour(TeapotLightPulse));
+	for (int i = 1; i < g_numTeapotLights; i++) {
+		TeapotLights[i]->SetColour(LightAnimator->GetCycleColour(TeapotLightCycles[i - 1]));
+	}
+	for (int i = 0; i < NumAnimatedLights; i++) {
+		AnimatedLightPositions[i] = LightAnimator->GetOrbitPosition(FirstAnimatedOrbit + i, blend);
+		AnimatedLightColours[i] = LightAnimator->GetCycleColour(FirstAnimatedCycle + i);
+	}
+
+	PerFrameConstants.Edit().wiggle = g_WiggleVar;
+
+	// Key presses are read here as they switch settings used by the render
 	if (KeyHit(Key_1))
 	{
 		g_useParallax = !g_useParallax;
 	}
+	if (KeyHit(Key_2))
+	{
+		g_useStaticBatching = !g_useStaticBatching;
+	}
+	if (KeyHit(Key_3))
+	{
+		g_useAnimatedLights = !g_useAnimatedLights;
+	}
+	if (KeyHit(Key_4))
+	{
+		g_usePortalThrottling = !g_usePortalThrottling;
+	}
+
+	// Keep the scene tree up to date with models that have moved
+	UpdateSceneTree();
+
+	// Select models by clicking on them
+	if (KeyHit(Mouse_LButton))
+	{
+		SSceneModel* picked = PickSceneModel(Camera, GetMouseX(), GetMouseY());
+		PickedModelName = picked ? picked->name : "none";
+	}
+
+	// Now the camera has moved, start the worker threads on occlusion culling for the frame. They run while the next update starts
+	StartOcclusionCulling();
+}
+
+
+// Check if a model was marked visible by the query for the view being rendered and count the result. Returns true if the
+// model should be drawn
+bool CullTest(CModel* model, unsigned int visibleStamp, SCullStats& cullStats)
+{
+	if (model->IsMarkedVisible(visibleStamp))
+	{
+		++cullStats.visible;
+		cullStats.triangles += model->GetNumTriangles();
+		return true;
+	}
+	++cullStats.culled;
+	return false;
 }
 
 
@@ -712,7 +1497,7 @@ void UpdateScene( float frameTime )
 // 2. Render the model passed to the function
 // 3. For every child:
 //    a. Get the child model pointer
-//    b. Update, then get the child's world matrix (stored *relative* to parent)
+//    b. Get the child's world matrix (stored *relative* to parent, updated with UpdateHierarchyMatrices)
 //    c. Create *absolute* child world matrix by combining this relative world matrix with
 //       the parent's world matrix
 //    c. Recursive call to this function with child model and absolute child world matrix
@@ -721,247 +1506,739 @@ void RenderHierarchicalModel(CModelHierarchy* pModel, D3DXMATRIX worldMatrix, ID
 {
 	// Render model
 
-	WorldMatrixVar->SetMatrix(worldMatrix);
+	PerObjectConstants.Edit().worldMatrix = worldMatrix;
 	pModel->Render(technique);
 
 	// Render children
 	for (int i = 0; i < pModel->GetNumChildren(); i++) {
 		CModelHierarchy* child = pModel->GetChild(i);
-		child->UpdateMatrix();
 		RenderHierarchicalModel(child, child->GetWorldMatrix() * worldMatrix, technique);
 	}
 }
 
-// Render all the models from the point of view of the given camera
-void RenderModels(CCamera* camera)
+// Choose the level of detail of each model found visible by a view query, from its size on screen in the given camera's view. The
+// camera is assumed to fill the back buffer - smaller views (the portal) will pick slightly more detailed LODs than they need.
+// Each model keeps the LOD chosen for the main camera between frames - shadow maps are rendered with it and the shadow map caches
+// compare it, so a portal view choosing for its own camera would invalidate the cached shadows every frame. Portal views pass an
+// array to save the main camera's LODs in, and put them back with RestoreModelLODs once the view is rendered
+void SelectModelLODs(CCamera* camera, unsigned int visibleStamp, int* savedLODs = NULL)
+{
+	for (int i = 0; i < NumSceneModels; i++) {
+		CModel* model = SceneModels[i].model;
+		if (savedLODs) savedLODs[i] = model->GetLOD();
+		if (model->IsMarkedVisible(visibleStamp))
+		{
+			model->SelectLOD(camera, MaxLODPixelError);
+		}
+	}
+}
+
+// Put back the LODs saved by SelectModelLODs
+void RestoreModelLODs(const int* savedLODs)
+{
+	for (int i = 0; i < NumSceneModels; i++) {
+		SceneModels[i].model->SetLOD(savedLODs[i]);
+	}
+}
+
+// Render the visible light models, including the animated lights if they are on. Their world matrices and colours are written into
+// the upload ring and they are all drawn with one instanced draw call. If instancing isn't available or the ring is full they are
+// drawn one at a time
+void RenderLightModels(CCamera* camera, unsigned int visibleStamp, SCullStats& cullStats)
+{
+	CLight* lights[MaxLightModels];
+	int numLights = 0;
+	if (CullTest(CubeLight, visibleStamp, cullStats)) lights[numLights++] = CubeLight;
+	if (CullTest(CarLight, visibleStamp, cullStats)) lights[numLights++] = CarLight;
+	for (int i = 0; i < g_numTeapotLights; i++) {
+		if (CullTest(TeapotLights[i], visibleStamp, cullStats)) lights[numLights++] = TeapotLights[i];
+	}
+	for (int i = 0; i < g_numSpotLights; i++) {
+		if (CullTest(SpotLights[i], visibleStamp, cullStats)) lights[numLights++] = SpotLights[i];
+	}
+
+	// The animated lights aren't in the scene tree, test them against the view frustum here. CubeLight's model radius is used
+	// as their bounds
+	int animatedLights[NumAnimatedLights];
+	int numAnimatedLights = 0;
+	if (g_useAnimatedLights)
+	{
+		float modelRadius = CubeLight->GetWorldRadius() * AnimatedLightScale / CubeLight->GetScale().x;
+		for (int i = 0; i < NumAnimatedLights; i++) {
+			if (camera->GetFrustum().IsSphereVisible(AnimatedLightPositions[i], modelRadius))
+			{
+				animatedLights[numAnimatedLights++] = i;
+			}
+		}
+	}
+	if (numLights + numAnimatedLights == 0) return;
+
+	DiffuseMapVar->SetResource(LightDiffuseMap);
+
+	// World matrix of each animated light - CubeLight's model scaled and moved to the light
+	D3DXMATRIX animatedMatrix;
+	D3DXMatrixScaling(&animatedMatrix, AnimatedLightScale, AnimatedLightScale, AnimatedLightScale);
+
+	unsigned int offset = 0;
+	SLightInstance* instances = NULL;
+	int numInstances = numLights + numAnimatedLights;
+	if (LightInstancing)
+	{
+		instances = static_cast<SLightInstance*>(UploadRing->Map(numInstances * sizeof(SLightInstance), 16, offset));
+	}
+	if (instances)
+	{
+		for (int i = 0; i < numLights; i++) {
+			instances[i].worldMatrix = lights[i]->GetWorldMatrix();
+			instances[i].tintColour = lights[i]->GetColour();
+		}
+		for (int i = 0; i < numAnimatedLights; i++) {
+			D3DXVECTOR3 position = AnimatedLightPositions[animatedLights[i]];
+			SLightInstance& instance = instances[numLights + i];
+			instance.worldMatrix = animatedMatrix;
+			instance.worldMatrix._41 = position.x;
+			instance.worldMatrix._42 = position.y;
+			instance.worldMatrix._43 = position.z;
+			instance.tintColour = AnimatedLightColours[animatedLights[i]];
+		}
+		UploadRing->Unmap();
+		CubeLight->RenderInstanced(AdditiveTexTintInstancedTechnique, UploadRing->GetBuffer(), sizeof(SLightInstance), offset, numInstances);
+		return;
+	}
+
+	for (int i = 0; i < numLights; i++) {
+		SPerObjectConstants& objectConstants = PerObjectConstants.Edit();
+		objectConstants.worldMatrix = lights[i]->GetWorldMatrix();
+		objectConstants.tintColour = lights[i]->GetColour();
+		lights[i]->RenderClusters(AdditiveTexTintTechnique, camera, false, cullStats.clusters);
+	}
+	for (int i = 0; i < numAnimatedLights; i++) {
+		D3DXVECTOR3 position = AnimatedLightPositions[animatedLights[i]];
+		SPerObjectConstants& objectConstants = PerObjectConstants.Edit();
+		objectConstants.worldMatrix = animatedMatrix;
+		objectConstants.worldMatrix._41 = position.x;
+		objectConstants.worldMatrix._42 = position.y;
+		objectConstants.worldMatrix._43 = position.z;
+		objectConstants.tintColour = AnimatedLightColours[animatedLights[i]];
+		CubeLight->Render(AdditiveTexTintTechnique);
+	}
+}
+
+// Render all the models from the point of view of the given camera. Models outside the camera's view frustum are skipped, as
+// are models hidden behind the occluders of the occlusion culler if one is given (it must have been rendered for this camera).
+// A cull frustum, if given, replaces the camera's frustum for skipping models, e.g. to draw only what is seen through a portal.
+// Portals are drawn with their textures for the given portal depth (see RenderPortalsInView)
+void RenderModels(CCamera* camera, SCullStats& cullStats, const COcclusionCuller* occlusionCuller = NULL,
+                  const CFrustum* cullFrustum = NULL, int portalDepth = 0)
 {
+	PROFILE_SCOPE("RenderModels");
+
 	// Clear the back buffer - before drawing the geometry clear the entire window to a fixed colour
 	g_pd3dDevice->ClearRenderTargetView(RenderTargetView, g_clearColour);
 	g_pd3dDevice->ClearDepthStencilView(DepthStencilView, D3D10_CLEAR_DEPTH, 1.0f, 0); // Clear the depth buffer too
 
 
-	// Pass the camera's matrices to the vertex shader
-	ViewMatrixVar->SetMatrix((float*)&camera->GetViewMatrix());
-	ProjMatrixVar->SetMatrix((float*)&camera->GetProjectionMatrix());
-
-	// Send the shadow maps rendered in the function below to the shader
-	ShadowMap1Var->SetResource(ShadowMap1);
-	ShadowMap2Var->SetResource(ShadowMap2);
+	// Pack the lights in the camera's view for the shaders and assign them to the view's light clusters, which are sized for the
+	// current viewport
+	D3D10_VIEWPORT viewport;
+	UINT numViewports = 1;
+	g_pd3dDevice->RSGetViewports(&numViewports, &viewport);
+	LightManager->PrepareView(camera, viewport.Width, viewport.Height);
+	ClusterTimeTotal += LightManager->GetClusters().GetBuildTime();
+
+	// Pass the camera's matrices and position, and the layout of the light clusters, to the shaders
+	const CLightClusterGrid& clusters = LightManager->GetClusters();
+	SPerViewConstants& viewConstants = PerViewConstants.Edit();
+	viewConstants.viewMatrix = camera->GetViewMatrix();
+	viewConstants.projMatrix = camera->GetProjectionMatrix();
+	viewConstants.cameraPos = camera->GetWorldPosition();
+	float tileScale = 1.0f / CLightClusterGrid::TILE_SIZE;
+	viewConstants.clusterScale = D3DXVECTOR4(tileScale, tileScale, clusters.GetSliceScale(), clusters.GetSliceBias());
+	viewConstants.clusterTilesX = clusters.GetTilesX();
+	viewConstants.clusterTilesY = clusters.GetTilesY();
+	viewConstants.clusterSlices = CLightClusterGrid::NUM_SLICES;
+	PerViewConstants.Upload();
+
+	// Send the shadow atlas rendered in the function below to the shader
+	ShadowAtlasVar->SetResource(ShadowAtlas);
+
+	// Portal views render with LODs chosen for their own camera, then put back the main camera's (see SelectModelLODs)
+	unsigned int visibleStamp = MarkVisibleModels(cullFrustum ? *cullFrustum : camera->GetFrustum(), occlusionCuller, &cullStats.occluded);
+	int mainCameraLODs[MaxSceneModels];
+	SelectModelLODs(camera, visibleStamp, (portalDepth > 0) ? mainCameraLODs : NULL);
+	cullStats.visible = 0;
+	cullStats.culled = 0;
+	cullStats.triangles = 0;
+	cullStats.clusters.drawn = 0;
+	cullStats.clusters.outsideFrustum = 0;
+	cullStats.clusters.backFacing = 0;
 
 	//****| Render animated model |***********************************************************
 // Don't set the world matrix - the hierarchy code will go through each child and do that
 // Do set the texture though (will use same texture for all child parts here)
-	DiffuseMapVar->SetResource(BikeDiffuseMap);
-	RenderHierarchicalModel(Bike, Bike->GetWorldMatrix(), VertexLitTechnique); // Pass root world matrix and rendering technique to function above
+	if (CullTest(Bike, visibleStamp, cullStats)) // Root bounds cover the whole hierarchy
+	{
+		DiffuseMapVar->SetResource(BikeDiffuseMap);
+		RenderHierarchicalModel(Bike, Bike->GetWorldMatrix(), VertexLitTechnique); // Pass root world matrix and rendering technique to function above
+	}
 	//****************************************************************************************
 
 	//---------------------------
 	// Render each model
 
+	// Models are drawn cluster by cluster, skipping clusters outside the view. Back-facing clusters are also skipped for techniques
+	// that cull back faces - but not for two-sided techniques, the cell shading outline (which draws back faces), or the wiggle
+	// cube (the vertex shader moves its vertices, so the clusters' bounds don't hold)
+
 	// Constant colours used for models in initial shaders
 	D3DXVECTOR3 Black(0.0f, 0.0f, 0.0f);
 	D3DXVECTOR3 Blue(0.0f, 0.0f, 1.0f);
 
-	// Portal
-	WorldMatrixVar->SetMatrix((float*)Portal->GetWorldMatrix());
-	DiffuseMapVar->SetResource(PortalMap);
-	Portal->Render(VertexLitTechnique);
+	// Portals, with the textures rendered for the depth they are seen at. Portals deeper than PortalMaxDepth have no texture and are
+	// drawn flat in the background colour
+	for (int i = 0; i < NumPortals; i++) {
+		CModel* portal = Portals[i]->GetModel();
+		if (CullTest(portal, visibleStamp, cullStats))
+		{
+			PerObjectConstants.Edit().worldMatrix = portal->GetWorldMatrix();
+			if (portalDepth < PortalMaxDepth)
+			{
+				DiffuseMapVar->SetResource(Portals[i]->GetTexture(portalDepth)); // Whichever size was last rendered
+				portal->RenderClusters(VertexLitTechnique, camera, true, cullStats.clusters);
+			}
+			else
+			{
+				PerObjectConstants.Edit().modelColour = D3DXVECTOR3(g_clearColour[0], g_clearColour[1], g_clearColour[2]);
+				portal->RenderClusters(PlainColourTechnique, camera, false, cullStats.clusters);
+			}
+		}
+	}
 
 	// WiggleCube
-	WorldMatrixVar->SetMatrix((float*)WiggleCube->GetWorldMatrix());  // Send the cube's world matrix to the shader
-	DiffuseMapVar->SetResource(CubeDiffuseMap);                 // Send the cube's diffuse/specular map to the shader
-	WiggleCube->Render(WiggleTechnique);                         // Pass rendering technique to the model class
+	if (CullTest(WiggleCube, visibleStamp, cullStats))
+	{
+		PerObjectConstants.Edit().worldMatrix = WiggleCube->GetWorldMatrix();  // Send the cube's world matrix to the shader
+		DiffuseMapVar->SetResource(CubeDiffuseMap);                 // Send the cube's diffuse/specular map to the shader
+		WiggleCube->Render(WiggleTechnique);                         // Pass rendering technique to the model class
+	}
 
 	// Box
-	WorldMatrixVar->SetMatrix((float*)Box->GetWorldMatrix());
-	DiffuseMapVar->SetResource(BoxDiffuseMap);
-	NormalMapVar->SetResource(BoxNormalMap);
-	Box->Render(ParallaxMappingTechnique);
+	if (CullTest(Box, visibleStamp, cullStats))
+	{
+		PerObjectConstants.Edit().worldMatrix = Box->GetWorldMatrix();
+		DiffuseMapVar->SetResource(BoxDiffuseMap);
+		NormalMapVar->SetResource(BoxNormalMap);
+		Box->RenderClusters(ParallaxMappingTechnique, camera, true, cullStats.clusters);
+	}
 
 	// Floor
-	WorldMatrixVar->SetMatrix((float*)Floor->GetWorldMatrix());
-	DiffuseMapVar->SetResource(FloorDiffuseMap);
-	NormalMapVar->SetResource(FloorNormalMap);
-	Floor->Render(ParallaxMappingTechnique);
+	if (CullTest(Floor, visibleStamp, cullStats))
+	{
+		PerObjectConstants.Edit().worldMatrix = Floor->GetWorldMatrix();
+		DiffuseMapVar->SetResource(FloorDiffuseMap);
+		NormalMapVar->SetResource(FloorNormalMap);
+		Floor->RenderClusters(ParallaxMappingTechnique, camera, true, cullStats.clusters);
+	}
 
 	// Teapot
-	WorldMatrixVar->SetMatrix((float*)Teapot->GetWorldMatrix());
-	DiffuseMapVar->SetResource(StoneDiffuseMap);
-	Teapot->Render(VertexLitTechnique);
+	if (CullTest(Teapot, visibleStamp, cullStats))
+	{
+		PerObjectConstants.Edit().worldMatrix = Teapot->GetWorldMatrix();
+		DiffuseMapVar->SetResource(StoneDiffuseMap);
+		Teapot->RenderClusters(VertexLitTechnique, camera, true, cullStats.clusters);
+	}
 
 	// Troll
-	WorldMatrixVar->SetMatrix(Troll->GetWorldMatrix());
-	DiffuseMapVar->SetResource(TrollDiffuseMap);
-	Troll->Render(ShadowMappingTechnique);
+	if (CullTest(Troll, visibleStamp, cullStats))
+	{
+		PerObjectConstants.Edit().worldMatrix = Troll->GetWorldMatrix();
+		DiffuseMapVar->SetResource(TrollDiffuseMap);
+		Troll->RenderClusters(ShadowMappingTechnique, camera, true, cullStats.clusters);
+	}
 
 	// Shere
-	WorldMatrixVar->SetMatrix(Sphere->GetWorldMatrix());
-	ModelColourVar->SetRawValue(Blue, 0, 12);
-	Sphere->Render(PlainColourTechnique);
+	if (CullTest(Sphere, visibleStamp, cullStats))
+	{
+		PerObjectConstants.Edit().worldMatrix = Sphere->GetWorldMatrix();
+		PerObjectConstants.Edit().modelColour = Blue;
+		Sphere->RenderClusters(PlainColourTechnique, camera, false, cullStats.clusters);
+	}
 
 	// Car
-	WorldMatrixVar->SetMatrix(Car->GetWorldMatrix());
-	DiffuseMapVar->SetResource(CarDiffuseMap);
-	ModelColourVar->SetRawValue(Black, 0, 12);
-	Car->Render(CellShadingTechnique);
+	if (CullTest(Car, visibleStamp, cullStats))
+	{
+		PerObjectConstants.Edit().worldMatrix = Car->GetWorldMatrix();
+		DiffuseMapVar->SetResource(CarDiffuseMap);
+		PerObjectConstants.Edit().modelColour = Black;
+		Car->RenderClusters(CellShadingTechnique, camera, false, cullStats.clusters); // Outline pass draws back faces
+	}
 
-	// CubeLight
-	WorldMatrixVar->SetMatrix((float*)CubeLight->GetWorldMatrix());
-	DiffuseMapVar->SetResource(LightDiffuseMap);
-	TintColourVar->SetRawValue(CubeLight->GetColour(), 0, 12);
-	CubeLight->Render(AdditiveTexTintTechnique);
+	// Lights
+	RenderLightModels(camera, visibleStamp, cullStats);
 
-	// CarLight
-	WorldMatrixVar->SetMatrix((float*)CarLight->GetWorldMatrix());
-	DiffuseMapVar->SetResource(LightDiffuseMap);
-	TintColourVar->SetRawValue(CarLight->GetColour(), 0, 12);
-	CarLight->Render(AdditiveTexTintTechnique);
+	if (portalDepth > 0) RestoreModelLODs(mainCameraLODs);
+}
 
-	// Teapot Lights (3)
-	for (int i = 0; i < g_numTeapotLights; i++) {
-		WorldMatrixVar->SetMatrix((float*)TeapotLights[i]->GetWorldMatrix());
-		DiffuseMapVar->SetResource(LightDiffuseMap);
-		TintColourVar->SetRawValue(TeapotLights[i]->GetColour(), 0, 12);
-		TeapotLights[i]->Render(AdditiveTexTintTechnique);
+
+// Are two shadow caster lists the same - same models in the same order, none of which have moved or changed LOD
+bool SameShadowCasters(const SShadowCasterList& list1, const SShadowCasterList& list2)
+{
+	if (list1.numCasters != list2.numCasters) return false;
+	for (int i = 0; i < list1.numCasters; i++) {
+		if (list1.casters[i] != list2.casters[i] || list1.versions[i] != list2.versions[i] || list1.lods[i] != list2.lods[i]) return false;
 	}
+	return true;
+}
 
-	// Spot Lights (2)
-	for (int i = 0; i < g_numSpotLights; i++) {
-		WorldMatrixVar->SetMatrix((float*)SpotLights[i]->GetWorldMatrix());
-		DiffuseMapVar->SetResource(LightDiffuseMap);
-		TintColourVar->SetRawValue(SpotLights[i]->GetColour(), 0, 12);
-		SpotLights[i]->Render(AdditiveTexTintTechnique);
+// Render a list of shadow casters using the depth-only technique. The bike hierarchy is rendered as its root only. Casters in a
+// static batch are drawn by drawing the whole batch once - the batch's other models may not be in the list, but anything they
+// add to the shadow map is outside the light's cone or view so it makes no difference
+void RenderShadowCasters(const SShadowCasterList& casterList)
+{
+	CStaticBatch* batches[MaxShadowCasters];
+	int numBatches = 0;
+	for (int i = 0; i < casterList.numCasters; i++) {
+		CStaticBatch* batch = FindStaticBatch(casterList.casters[i], DepthOnlyTechnique);
+		if (batch)
+		{
+			if (find(batches, batches + numBatches, batch) == batches + numBatches) batches[numBatches++] = batch;
+			continue;
+		}
+		PerObjectConstants.Edit().worldMatrix = casterList.casters[i]->GetWorldMatrix();
+		casterList.casters[i]->Render(DepthOnlyTechnique);
+	}
+
+	// Batched vertices are already in world space
+	D3DXMATRIX identity;
+	D3DXMatrixIdentity(&identity);
+	for (int i = 0; i < numBatches; i++) {
+		PerObjectConstants.Edit().worldMatrix = identity;
+		batches[i]->Render();
 	}
 }
 
+// Draw over the current viewport (a shadow atlas tile) with one of the depth tile techniques. The shader makes the triangle's
+// vertices itself, so there is no vertex buffer or input layout
+void DrawDepthTile(ID3D10EffectTechnique* technique)
+{
+	g_pd3dDevice->IASetInputLayout(NULL);
+	g_pd3dDevice->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	technique->GetPassByIndex(0)->Apply(0);
+	g_pd3dDevice->Draw(3, 0);
+}
 
-void RenderShadowMap(CLight* light)
+// Estimate how much of the screen a light affects (0->1), used to size its shadow atlas tile. The light's influence is treated
+// as a sphere around it, the size of this sphere on screen gives the fraction of the screen that can be lit (and shadowed) by the
+// light. If the sphere is out of view then nothing the light reaches can be seen and the light gets the smallest tile
+float CalculateShadowImportance(CLight* light, CCamera* camera)
 {
-	//---------------------------------
-	// Set "camera" matrices in shader
+	D3DXVECTOR3 centre = light->GetWorldPosition();
+	float radius = light->GetInfluenceRadius();
+	if (!camera->GetFrustum().IsSphereVisible(centre, radius)) return 0.0f;
+
+	D3DXMATRIX viewMatrix = camera->GetViewMatrix();
+	D3DXMATRIX projMatrix = camera->GetProjectionMatrix();
+	D3DXVECTOR3 viewPos;
+	D3DXVec3TransformCoord(&viewPos, &centre, &viewMatrix);
+	float distanceSq = D3DXVec3LengthSq(&viewPos);
+	if (distanceSq <= radius * radius) return 1.0f; // Camera is inside the light's influence
+
+	// Radius of the sphere on screen, where the screen is 2 units high (-1 to 1). Compare the area of the circle with the screen
+	float screenRadius = projMatrix._22 * radius / sqrtf(distanceSq - radius * radius);
+	float coverage = D3DX_PI * screenRadius * screenRadius / 4.0f;
+	return (coverage < 1.0f) ? coverage : 1.0f;
+}
 
-	// Pass the light's "camera" matrices to the vertex shader - use helper functions above to turn spotlight settings into "camera" matrices
-	ViewMatrixVar->SetMatrix(light->CalculateLightViewMatrix());
-	ProjMatrixVar->SetMatrix(light->CalculateLightProjMatrix());
+// Render the shadow casting models into the given light's tile of the shadow atlas. Casters must be in the light's frustum and
+// also touch its cone, anything else cannot cast a shadow into the map. The static casters are rendered into a cached layer
+// only when one of them has moved, or the light has just stopped moving. The shadow map is then made by copying the cached
+// layer and rendering the dynamic casters on top. If nothing at all has changed since last time, the shadow map is left as it
+// is. While the light is moving the cached layer would be out of date every frame, so everything is rendered directly instead.
+// The light's tile counts as part of the light - if the tile moves or changes size, everything is rendered again
+void RenderShadowMap(CLight* light, const SShadowAtlasTile& tile, SShadowMapCache& cache, SCullStats& cullStats)
+{
+	PROFILE_SCOPE("RenderShadowMap");
 
+	// A light that was given no tile has no shadows this frame
+	if (tile.size == 0)
+	{
+		cullStats.visible = 0;
+		cullStats.culled = 0;
+		cullStats.reused = false;
+		cache.valid = false;
+		return;
+	}
 
-	//-----------------------------------
-	// Render each model into shadow map
+	//---------------------------------
+	// Find shadow casters
+
+	D3DXMATRIX viewMatrix = light->CalculateLightViewMatrix();
+	D3DXMATRIX projMatrix = light->CalculateLightProjMatrix();
+	unsigned int visibleStamp = MarkVisibleModels(light->CalculateLightFrustum());
+	cullStats.visible = 0;
+	cullStats.culled = 0;
+
+	SShadowCasterList staticCasters, dynamicCasters;
+	staticCasters.numCasters = 0;
+	dynamicCasters.numCasters = 0;
+	for (int i = 0; i < NumShadowCasters; i++) {
+		CModel* model = ShadowCasters[i];
+		if (model->IsMarkedVisible(visibleStamp) && light->IsSphereInCone(model->GetWorldCentre(), model->GetWorldRadius()))
+		{
+			SShadowCasterList& casterList = model->IsStatic() ? staticCasters : dynamicCasters;
+			casterList.casters[casterList.numCasters] = model;
+			casterList.versions[casterList.numCasters] = model->GetMatrixVersion();
+			casterList.lods[casterList.numCasters] = model->GetLOD();
+			++casterList.numCasters;
+			++cullStats.visible;
+		}
+		else
+		{
+			++cullStats.culled;
+		}
+	}
+
+	//---------------------------------
+	// Check which parts of last time's rendering are still valid
 
-	// Render troll - no need to set its texture as shadow maps just render to the depth buffer
-	WorldMatrixVar->SetMatrix(Troll->GetWorldMatrix());
-	Troll->Render(DepthOnlyTechnique);  // Use special rendering technique to render depths only
+	D3DXMATRIX viewProjMatrix = viewMatrix * projMatrix;
+	bool lightUnchanged = cache.valid && cache.viewProjMatrix == viewProjMatrix && cache.tile == tile;
+	bool staticCastersUnchanged = lightUnchanged && SameShadowCasters(cache.staticCasters, staticCasters);
+	cullStats.reused = staticCastersUnchanged && SameShadowCasters(cache.dynamicCasters, dynamicCasters);
+	if (cullStats.reused)
+	{
+		++ShadowPassesSkipped;
+		return;
+	}
+	++ShadowPassesRendered;
 
-	// Same for the other models in the scene
-	WorldMatrixVar->SetMatrix(WiggleCube->GetWorldMatrix());
-	WiggleCube->Render(DepthOnlyTechnique);
+	cache.valid = true;
+	cache.viewProjMatrix = viewProjMatrix;
+	cache.tile = tile;
+	cache.staticCasters = staticCasters;
+	cache.dynamicCasters = dynamicCasters;
 
-	WorldMatrixVar->SetMatrix(Floor->GetWorldMatrix());
-	Floor->Render(DepthOnlyTechnique);
+	//---------------------------------
+	// Set "camera" matrices in shader
 
-	WorldMatrixVar->SetMatrix(Teapot->GetWorldMatrix());
-	Teapot->Render(DepthOnlyTechnique);
+	// Pass the light's "camera" matrices to the vertex shader - use helper functions above to turn spotlight settings into "camera" matrices
+	SPerViewConstants& viewConstants = PerViewConstants.Edit();
+	viewConstants.viewMatrix = viewMatrix;
+	viewConstants.projMatrix = projMatrix;
+	viewConstants.cameraPos = light->GetWorldPosition();
+	PerViewConstants.Upload();
 
-	WorldMatrixVar->SetMatrix(Box->GetWorldMatrix());
-	Box->Render(DepthOnlyTechnique);
+	// Setup the viewport - only render to the light's tile of the atlas
+	D3D10_VIEWPORT vp;
+	vp.Width = tile.size;
+	vp.Height = tile.size;
+	vp.MinDepth = 0.0f;
+	vp.MaxDepth = 1.0f;
+	vp.TopLeftX = tile.x;
+	vp.TopLeftY = tile.y;
+	g_pd3dDevice->RSSetViewports(1, &vp);
 
-	WorldMatrixVar->SetMatrix(Sphere->GetWorldMatrix());
-	Sphere->Render(DepthOnlyTechnique);
 
-	WorldMatrixVar->SetMatrix(Car->GetWorldMatrix());
-	Car->Render(DepthOnlyTechnique);
+	//-----------------------------------
+	// Render casters into shadow map
+
+	// Rendering a cached layer or shadow map:
+	// 1. Select the atlas texture as the current depth buffer. We will not be rendering any pixel colours
+	// 2. Clear the tile - or copy in the cached static layer. Clearing the depth buffer would clear the other lights' tiles too,
+	//    and depth buffers can only be copied whole, so both are done by drawing over the tile with a special technique
+	// 3. Render casters - no need to set textures as shadow maps just render to the depth buffer
+	if (!lightUnchanged)
+	{
+		g_pd3dDevice->OMSetRenderTargets(0, 0, ShadowAtlasDepthView);
+		DrawDepthTile(ClearDepthTileTechnique);
+		RenderShadowCasters(staticCasters);
+		RenderShadowCasters(dynamicCasters);
+		cache.staticLayerValid = false;
+		return;
+	}
 
-	WorldMatrixVar->SetMatrix(Bike->GetWorldMatrix());
-	Bike->Render(DepthOnlyTechnique);
+	if (!staticCastersUnchanged || !cache.staticLayerValid)
+	{
+		g_pd3dDevice->OMSetRenderTargets(0, 0, StaticShadowAtlasDepthView);
+		DrawDepthTile(ClearDepthTileTechnique);
+		RenderShadowCasters(staticCasters);
+		cache.staticLayerValid = true;
+		++StaticShadowLayersRendered;
+	}
 
-	WorldMatrixVar->SetMatrix(Portal->GetWorldMatrix());
-	Portal->Render(DepthOnlyTechnique);
+	g_pd3dDevice->OMSetRenderTargets(0, 0, ShadowAtlasDepthView);
+	StaticShadowAtlasVar->SetResource(StaticShadowAtlas);
+	DrawDepthTile(CopyDepthTileTechnique);
+	RenderShadowCasters(dynamicCasters);
 }
 
 
-// Render everything in the scene
-void RenderScene()
+// Record what a portal camera sees within a rectangle of its view - its matrices, the models in that part of its view and their matrix
+// versions, and the lights reaching into it. The models are marked with a new visible stamp, so RenderModels marks them again.
+// Returns true if an animated model is in view, which changes every frame
+bool RecordPortalView(CCamera* camera, const SPortalRect& rect, SPortalViewCache& contents)
 {
-	// Pass light information to the vertex shader
-	CubeLight->GetPosVar()->SetRawValue(CubeLight->GetPosition(), 0, 12);
-	CubeLight->GetColourVar()->SetRawValue(CubeLight->GetColour(), 0, 12);
-	
-	CarLight->GetPosVar()->SetRawValue(CarLight->GetPosition(), 0, 12);
-	CarLight->GetColourVar()->SetRawValue(CarLight->GetColour(), 0, 12);
+	contents.viewProjMatrix = camera->GetViewProjectionMatrix();
+	contents.viewRect = rect;
+	contents.parallax = g_useParallax;
+	contents.models.clear();
+	contents.versions.clear();
+	contents.lights.clear();
+	CFrustum frustum = CalculateRectFrustum(contents.viewProjMatrix, rect);
+	unsigned int visibleStamp = MarkVisibleModels(frustum);
+	bool animated = false;
+	for (int i = 0; i < NumSceneModels; i++) {
+		CModel* model = SceneModels[i].model;
+		if (model->IsMarkedVisible(visibleStamp))
+		{
+			contents.models.push_back(model);
+			contents.versions.push_back(model->GetMatrixVersion());
+			if (model == WiggleCube) animated = true; // The wiggle effect changes every frame
+		}
+	}
 
-	for (int i = 0; i < g_numTeapotLights; i++) {
-		TeapotLights[i]->GetPosVar()->SetRawValue(TeapotLights[i]->GetPosition(), 0, 12);
-		TeapotLights[i]->GetColourVar()->SetRawValue(TeapotLights[i]->GetColour(), 0, 12);
+	// Lights - the lights in the light manager, which are the same for every view this frame
+	const vector<SLightSource>& allLights = LightManager->GetLights();
+	for (size_t i = 0; i < allLights.size(); i++) {
+		if (frustum.IsSphereVisible(allLights[i].position, allLights[i].range)) contents.lights.push_back(allLights[i]);
 	}
-	
-	for (int i = 0; i < g_numSpotLights; i++) {
-		SpotLights[i]->GetPosVar()->SetRawValue(SpotLights[i]->GetPosition(), 0, 12);
-		SpotLights[i]->GetColourVar()->SetRawValue(SpotLights[i]->GetColour(), 0, 12);
-		SpotLights[i]->GetFacingVar()->SetRawValue(SpotLights[i]->GetFacing(), 0, 12);
-		SpotLights[i]->GetViewMatrixVar()->SetMatrix(SpotLights[i]->CalculateLightViewMatrix());
-		SpotLights[i]->GetProjMatrixVar()->SetMatrix(SpotLights[i]->CalculateLightProjMatrix());
-		SpotLights[i]->GetConeAngleVar()->SetFloat(cos(ToRadians(SpotLights[i]->GetConeAngle() * 0.5f)));
-	}
-
-	AmbientColourVar->SetRawValue(AmbientColour, 0, 12);
-	SpecularPowerVar->SetFloat(SpecularPower);
-	// Parallax mapping depth
-	ParallaxDepthVar->SetFloat(g_useParallax ? g_parallaxDepth : 0.0f);
-	CellMapVar->SetResource(CellMap);
+	return animated;
+}
 
-	//---------------------------
-	// Render portal scene
+// Is what a portal sees the same as what it saw when its texture was rendered
+bool SamePortalView(const SPortalViewCache& contents, const SPortalViewCache& cache)
+{
+	if (contents.viewProjMatrix != cache.viewProjMatrix || contents.parallax != cache.parallax || contents.models != cache.models ||
+	    contents.versions != cache.versions || contents.lights.size() != cache.lights.size()) return false;
+	return contents.lights.empty() || memcmp(&contents.lights[0], &cache.lights[0], contents.lights.size() * sizeof(SLightSource)) == 0;
+}
+
+// Render the view through a portal at the given depth into its texture of the given size, unless the texture rendered last time can
+// still be used. Only the part of the portal camera's view seen through the portal (the camera rect) is drawn - everything outside
+// it is culled. The texture can be reused if it was rendered for a part of the view covering the camera rect, nothing seen in that
+// part has changed, and no portal seen in it has just been rendered again (nested rendered). Otherwise it is rendered, unless it
+// was rendered too recently for the update rate. Returns true if it was rendered
+bool RenderPortalView(CPortal* portal, int depth, int size, const SPortalRect& cameraRect, bool nestedRendered)
+{
+	CCamera* camera = portal->GetCamera();
+	SPortalViewCache& cache = portal->GetCache(depth);
+	if (g_usePortalThrottling)
+	{
+		// Compare the part of the view that was rendered, if that covers what is needed now
+		static SPortalViewCache contents; // Keep memory between calls
+		bool covered = cache.valid && RectContains(cache.viewRect, cameraRect);
+		bool animated = RecordPortalView(camera, covered ? cache.viewRect : cameraRect, contents);
+		if (covered && size == cache.size && !nestedRendered && !animated && SamePortalView(contents, cache))
+		{
+			++PortalSkippedUnchanged;
+			return false;
+		}
+		float now = PortalClock.GetTime();
+		if (cache.valid && PortalUpdateRate > 0.0f && now - cache.renderTime < 1.0f / PortalUpdateRate)
+		{
+			++PortalSkippedThrottled;
+			return false;
+		}
+
+		if (covered) RecordPortalView(camera, cameraRect, contents); // Render only what is needed now
+		cache.viewProjMatrix = contents.viewProjMatrix;
+		cache.viewRect = contents.viewRect;
+		cache.parallax = contents.parallax;
+		cache.models = contents.models;
+		cache.versions = contents.versions;
+		cache.lights = contents.lights;
+		cache.renderTime = now;
+		cache.valid = true;
+	}
+	else
+	{
+		cache.valid = false; // Nothing is recorded while throttling is off
+	}
+	cache.size = size;
+
+	CTimer timer;
+	timer.Start();
 
 	// Setup the viewport - defines which part of the texture we will render to (usually all of it)
 	D3D10_VIEWPORT vp;
-	vp.Width = PortalWidth;
-	vp.Height = PortalHeight;
+	vp.Width = portal->GetTextureSize(size);
+	vp.Height = portal->GetTextureSize(size);
 	vp.MinDepth = 0.0f;
 	vp.MaxDepth = 1.0f;
 	vp.TopLeftX = 0;
 	vp.TopLeftY = 0;
 	g_pd3dDevice->RSSetViewports(1, &vp);
 
-	// Select the portal texture to use for rendering, will share the depth/stencil buffer with the backbuffer though
-	g_pd3dDevice->OMSetRenderTargets(1, &PortalRenderTarget, PortalDepthStencilView);
+	// Select the portal texture for this depth and size to use for rendering, with its own depth buffer
+	ID3D10RenderTargetView* renderTarget = portal->GetRenderTarget(depth, size);
+	ID3D10DepthStencilView* depthStencilView = portal->GetDepthStencilView(depth, size);
+	g_pd3dDevice->OMSetRenderTargets(1, &renderTarget, depthStencilView);
 
 	// Clear the back buffer - before drawing the geometry clear the entire window to a fixed colour
-	g_pd3dDevice->ClearRenderTargetView(PortalRenderTarget, g_clearColour);
-	g_pd3dDevice->ClearDepthStencilView(PortalDepthStencilView, D3D10_CLEAR_DEPTH, 1.0f, 0); // Clear the depth buffer too
+	g_pd3dDevice->ClearRenderTargetView(renderTarget, g_clearColour);
+	g_pd3dDevice->ClearDepthStencilView(depthStencilView, D3D10_CLEAR_DEPTH, 1.0f, 0); // Clear the depth buffer too
+
+	// Render everything seen through the portal from the portal camera's point of view (into the portal render target [texture] set
+	// above). Portals seen in this view are one level deeper
+	CFrustum cullFrustum = CalculateRectFrustum(camera->GetViewProjectionMatrix(), cameraRect);
+	SCullStats viewStats;
+	RenderModels(camera, viewStats, NULL, &cullFrustum, depth + 1);
+
+	// The portal statistics are totals over every portal view rendered this frame
+	SCullStats& cullStats = CullStats[CullView_Portal];
+	cullStats.visible += viewStats.visible;
+	cullStats.culled += viewStats.culled;
+	cullStats.triangles += viewStats.triangles;
+	cullStats.clusters.drawn += viewStats.clusters.drawn;
+	cullStats.clusters.outsideFrustum += viewStats.clusters.outsideFrustum;
+	cullStats.clusters.backFacing += viewStats.clusters.backFacing;
+	cullStats.reused = false;
+
+	++PortalRenders;
+	PortalDeepestDepth = max(PortalDeepestDepth, depth);
+	PortalRenderTimeTotal += timer.GetTime();
+	PortalTexelsTotal += static_cast<float>(vp.Width) * vp.Height;
+	PortalFrameTexels += static_cast<float>(vp.Width) * vp.Height;
+	return true;
+}
+
+// Render the textures of the portals seen within a rectangle of a view (of the given size in pixels), which is at the given depth -
+// the main view is depth 0. For each portal in view, the portals seen through it are rendered first, one level deeper and only within
+// the part of its camera's view seen through it, so their textures are ready to draw in its own. Portals too deep, too small on
+// screen, or beyond the frame's texel budget keep their old textures. Returns true if any texture was rendered
+bool RenderPortalsInView(const D3DXMATRIX& viewProjMatrix, const D3DXVECTOR3& viewPosition, const SPortalRect& viewRect,
+                         float viewWidth, float viewHeight, int depth)
+{
+	bool rendered = false;
+	for (int i = 0; i < NumPortals; i++) {
+		CPortal* portal = Portals[i];
+		SPortalRect screenRect, cameraRect;
+		if (!portal->FindInView(viewProjMatrix, viewPosition, viewRect, screenRect, cameraRect))
+		{
+			if (depth == 0) ++PortalSkippedHidden;
+			continue;
+		}
+
+		// A portal seen more than once at the same depth in a frame is only rendered for the first view it is found in
+		if (PortalViewsFound[i][depth]) continue;
+		PortalViewsFound[i][depth] = true;
+
+		// Size in pixels of the part of the portal in view
+		float width = (screenRect.maxX - screenRect.minX) * 0.5f * viewWidth;
+		float height = (screenRect.maxY - screenRect.minY) * 0.5f * viewHeight;
+		if (max(width, height) < MinPortalPixels || PortalFrameTexels >= PortalTexelBudget)
+		{
+			++PortalSkippedBudget;
+			continue;
+		}
+		int size = portal->ChooseSize(depth, max(width, height) * PortalResolutionScale);
+
+		// Portals seen through this one first
+		bool nestedRendered = false;
+		if (depth + 1 < PortalMaxDepth)
+		{
+			CCamera* camera = portal->GetCamera();
+			float textureSize = static_cast<float>(portal->GetTextureSize(size));
+			nestedRendered = RenderPortalsInView(camera->GetViewProjectionMatrix(), camera->GetWorldPosition(), cameraRect, textureSize,
+			                                     textureSize, depth + 1);
+		}
+		if (RenderPortalView(portal, depth, size, cameraRect, nestedRendered)) rendered = true;
+	}
+	return rendered;
+}
+
+
+// Render everything in the scene
+void RenderScene()
+{
+	PROFILE_SCOPE("RenderScene");
+
+	CModel::ResetDrawCalls();
+	CConstantBlockBase::ResetUploads();
+	UploadRing->BeginFrame(); // Recycle ring space from frames the GPU has finished
+	GPUTimer->BeginFrame();   // Collect pass timings from frames the GPU has finished
+
+	// Collect this frame's lights in the light manager, which packs them for each view in RenderModels. The spot lights cast
+	// shadows - each has its matrix and shadow atlas tile in the shadow constants
+	LightManager->Clear();
+	LightManager->AddPointLight(CubeLight->GetWorldPosition(), CubeLight->GetColour(), SceneLightRange);
+	LightManager->AddPointLight(CarLight->GetWorldPosition(), CarLight->GetColour(), SceneLightRange);
+	for (int i = 0; i < g_numTeapotLights; i++) {
+		LightManager->AddPointLight(TeapotLights[i]->GetWorldPosition(), TeapotLights[i]->GetColour(), SceneLightRange);
+	}
+	SShadowConstants& shadowConstants = ShadowConstants.Edit();
+	for (int i = 0; i < g_numSpotLights; i++) {
+		float cosHalfAngle = cos(ToRadians(SpotLights[i]->GetConeAngle() * 0.5f));
+		LightManager->AddSpotLight(SpotLights[i]->GetWorldPosition(), SpotLights[i]->GetFacing(), SpotLights[i]->GetColour(), SceneLightRange,
+		                           cosHalfAngle, i);
+		shadowConstants.shadowMatrices[i] = SpotLights[i]->CalculateLightViewMatrix() * SpotLights[i]->CalculateLightProjMatrix();
+	}
+	if (g_useAnimatedLights)
+	{
+		for (int i = 0; i < NumAnimatedLights; i++) {
+			LightManager->AddPointLight(AnimatedLightPositions[i], AnimatedLightColours[i], AnimatedLightRange);
+		}
+	}
+	ShadowConstants.Upload(); // The portal scene uses last frame's shadow atlas tiles, the shadows are uploaded again with new ones below
 
-	// Render everything from the portal camera's point of view (into the portal render target [texture] set above)
-	RenderModels(PortalCamera);
+	SPerFrameConstants& frameConstants = PerFrameConstants.Edit();
+	frameConstants.ambientColour = AmbientColour;
+	frameConstants.specularPower = SpecularPower;
+	frameConstants.parallaxDepth = g_useParallax ? g_parallaxDepth : 0.0f; // Parallax mapping depth
+	PerFrameConstants.Upload();
+	CellMapVar->SetResource(CellMap);
+
+	//---------------------------
+	// Render portal scene
+
+	// Render the portal textures that need it, starting with the portals seen from the main camera (see functions above)
+	CullStats[CullView_Portal].visible = 0;
+	CullStats[CullView_Portal].culled = 0;
+	CullStats[CullView_Portal].triangles = 0;
+	CullStats[CullView_Portal].clusters.drawn = 0;
+	CullStats[CullView_Portal].clusters.outsideFrustum = 0;
+	CullStats[CullView_Portal].clusters.backFacing = 0;
+	CullStats[CullView_Portal].reused = true;
+	memset(PortalViewsFound, 0, sizeof(PortalViewsFound));
+	PortalFrameTexels = 0.0f;
+	GPUTimer->BeginPass("Portals");
+	RenderPortalsInView(Camera->GetViewProjectionMatrix(), Camera->GetWorldPosition(), FullViewRect, static_cast<float>(g_ViewportWidth),
+	                    static_cast<float>(g_ViewportHeight), 0);
+	GPUTimer->EndPass();
 
 
 	//---------------------------
 	// Render shadow maps
 
-	// Setup the viewport - defines which part of the shadow map we will render to (usually all of it)
-	vp.Width = ShadowMapSize;
-	vp.Height = ShadowMapSize;
-	vp.MinDepth = 0.0f;
-	vp.MaxDepth = 1.0f;
-	vp.TopLeftX = 0;
-	vp.TopLeftY = 0;
-	g_pd3dDevice->RSSetViewports(1, &vp);
-
-	// Rendering a single shadow map for a light
-	// 1. Select the shadow map texture as the current depth buffer. We will not be rendering any pixel colours
-	// 2. Clear the shadow map texture (as a depth buffer)
-	// 3. Render everything from point of view of light 0
-	g_pd3dDevice->OMSetRenderTargets(0, 0, ShadowMap1DepthView);
-	g_pd3dDevice->ClearDepthStencilView(ShadowMap1DepthView, D3D10_CLEAR_DEPTH, 1.0f, 0);
-	RenderShadowMap(SpotLights[0]);
+	// Share out the shadow atlas between the spot lights, lights that affect more of the screen get larger tiles. The tiles are
+	// re-packed every frame - a light whose tile has moved or changed size will have its shadow map rendered again
+	float shadowImportance[g_numSpotLights];
+	for (int i = 0; i < g_numSpotLights; i++) {
+		shadowImportance[i] = CalculateShadowImportance(SpotLights[i], Camera);
+	}
+	ShadowAtlasLayout.Allocate(shadowImportance, g_numSpotLights, ShadowTiles);
 
-	g_pd3dDevice->OMSetRenderTargets(0, 0, ShadowMap2DepthView);
-	g_pd3dDevice->ClearDepthStencilView(ShadowMap2DepthView, D3D10_CLEAR_DEPTH, 1.0f, 0);
-	RenderShadowMap(SpotLights[1]);
+	// Render the shadow map for each light from its point of view into its tile, reusing cached work where possible (see function
+	// above). Tell the shader where the tile is as UV offset (xy) and scale (zw)
+	float atlasSize = static_cast<float>(ShadowAtlasLayout.GetAtlasSize());
+	for (int i = 0; i < g_numSpotLights; i++) {
+		const SShadowAtlasTile& tile = ShadowTiles[i];
+		D3DXVECTOR4 atlasRect(tile.x / atlasSize, tile.y / atlasSize, tile.size / atlasSize, tile.size / atlasSize);
+		ShadowConstants.Edit().shadowAtlasRects[i] = atlasRect;
+		GPUTimer->BeginPass(ShadowPassNames[i]);
+		RenderShadowMap(SpotLights[i], tile, ShadowMapCaches[i], CullStats[CullView_SpotLight0 + i]);
+		GPUTimer->EndPass();
+	}
+	ShadowConstants.Upload();
 
 
 	//---------------------------
 	// Render main scene
 
+	GPUTimer->BeginPass("Main");
+
 	// Setup the viewport - defines which part of the back-buffer we will render to (usually all of it)
+	D3D10_VIEWPORT vp;
 	vp.Width = g_ViewportWidth;
 	vp.Height = g_ViewportHeight;
 	vp.MinDepth = 0.0f;
@@ -977,12 +2254,118 @@ void RenderScene()
 	g_pd3dDevice->ClearRenderTargetView(RenderTargetView, g_clearColour);
 	g_pd3dDevice->ClearDepthStencilView(DepthStencilView, D3D10_CLEAR_DEPTH, 1.0f, 0);
 
+	// Collect the occlusion culling results started in PublishScene - the jobs will usually have finished already
+	OcclusionCuller->WaitForResults();
+	OcclusionRenderTime += OcclusionCuller->GetRenderTime();
+	++OcclusionFrames;
+
 	// Render everything from the main camera's point of view (into the portal render target [texture] set above)
-	RenderModels(Camera);
+	RenderModels(Camera, CullStats[CullView_Main], OcclusionCuller);
+	GPUTimer->EndPass();
+	GPUTimer->EndFrame();
 
 	//---------------------------
 	// Display the Scene
 
 	// After we've finished drawing to the off-screen back buffer, we "present" it to the front buffer (the screen)
 	SwapChain->Present(0, 0);
+	UploadRing->EndFrame();
+
+	DrawCallsTotal += CModel::GetNumDrawCalls();
+	ConstantUploadsTotal += CConstantBlockBase::GetNumUploads();
+	++DrawCallFrames;
+}
+
+
+// Write a summary of the last frame's scene statistics into the given string, used for the window title. Counters that
+// are totals rather than per-frame values are reset each time the statistics are read
+void GetSceneStatistics(wchar_t* text, int maxChars)
+{
+	// Start with the scene tree
+	int length = _snwprintf_s(text, maxChars, _TRUNCATE, L"Models %d (tree height %d), picked %S - ",
+	                          SceneTree.GetNumProxies(), SceneTree.GetHeight(), PickedModelName);
+	if (length < 0) return;
+	text += length;
+	maxChars -= length;
+
+	length = _snwprintf_s(text, maxChars, _TRUNCATE, L"Drawn/culled: main %d/%d (%d occluded, %d tris), portal %d/%d (%d tris)",
+	                          CullStats[CullView_Main].visible, CullStats[CullView_Main].culled, CullStats[CullView_Main].occluded,
+	                          CullStats[CullView_Main].triangles, CullStats[CullView_Portal].visible, CullStats[CullView_Portal].culled,
+	                          CullStats[CullView_Portal].triangles);
+	for (int i = 0; i < g_numSpotLights && length >= 0; i++) {
+		const SCullStats& spotStats = CullStats[CullView_SpotLight0 + i];
+		int added = _snwprintf_s(text + length, maxChars - length, _TRUNCATE, L", spot %d %d/%d %dpx%s", i + 1, spotStats.visible, spotStats.culled,
+		                         ShadowTiles[i].size, spotStats.reused ? L" (reused)" : L"");
+		length = (added < 0) ? -1 : length + added;
+	}
+	if (length >= 0)
+	{
+		int added = _snwprintf_s(text + length, maxChars - length, _TRUNCATE, L", shadow passes drawn %d skipped %d, static layers drawn %d",
+		                         ShadowPassesRendered, ShadowPassesSkipped, StaticShadowLayersRendered);
+		length = (added < 0) ? -1 : length + added;
+	}
+	for (int view = CullView_Main; view <= CullView_Portal && length >= 0; view++) {
+		const SClusterStats& clusterStats = CullStats[view].clusters;
+		int added = _snwprintf_s(text + length, maxChars - length, _TRUNCATE, L", %s clusters drawn %d rejected %d (%d outside, %d back-facing)",
+		                         (view == CullView_Main) ? L"main" : L"portal", clusterStats.drawn,
+		                         clusterStats.outsideFrustum + clusterStats.backFacing, clusterStats.outsideFrustum, clusterStats.backFacing);
+		length = (added < 0) ? -1 : length + added;
+	}
+	if (length >= 0 && DrawCallFrames > 0)
+	{
+		int added = _snwprintf_s(text + length, maxChars - length, _TRUNCATE, L", draws per frame %d (static batching %s), constant updates %d",
+		                         DrawCallsTotal / DrawCallFrames, g_useStaticBatching ? L"on" : L"off", ConstantUploadsTotal / DrawCallFrames);
+		length = (added < 0) ? -1 : length + added;
+	}
+	if (length >= 0)
+	{
+		int added = _snwprintf_s(text + length, maxChars - length, _TRUNCATE, L", lights %d (%d in view, %d in cluster lists, clusters %.2fms)",
+		                         LightManager->GetNumLights(), LightManager->GetNumVisibleLights(), LightManager->GetNumLightIndices(),
+		                         (DrawCallFrames > 0) ? 1000.0f * ClusterTimeTotal / DrawCallFrames : 0.0f);
+		length = (added < 0) ? -1 : length + added;
+	}
+	if (length >= 0)
+	{
+		int portalFrames = PortalRenders + PortalSkippedHidden + PortalSkippedUnchanged + PortalSkippedThrottled + PortalSkippedBudget;
+		float renderTime = (PortalRenders > 0) ? PortalRenderTimeTotal / PortalRenders : 0.0f;
+		float fullTexels = static_cast<float>(PortalWidth) * PortalHeight * portalFrames;
+		int added = _snwprintf_s(text + length, maxChars - length, _TRUNCATE,
+		                         L", portals %s renders %d (depth %d) skipped %d/%d/%d/%d (hidden/unchanged/throttled/budget), %.2fms each, saving %.2fms CPU per frame and %.0f%% of texels",
+		                         g_usePortalThrottling ? L"throttled" : L"unthrottled", PortalRenders, PortalDeepestDepth, PortalSkippedHidden,
+		                         PortalSkippedUnchanged, PortalSkippedThrottled, PortalSkippedBudget, 1000.0f * renderTime,
+		                         (portalFrames > 0) ? 1000.0f * renderTime * (portalFrames - PortalRenders) / portalFrames : 0.0f,
+		                         (fullTexels > 0.0f) ? 100.0f * (1.0f - PortalTexelsTotal / fullTexels) : 0.0f);
+		length = (added < 0) ? -1 : length + added;
+	}
+	if (length >= 0 && OcclusionFrames > 0)
+	{
+		_snwprintf_s(text + length, maxChars - length, _TRUNCATE, L", occluders %d, occlusion %.2fms workers + %.2fms tests",
+		             OcclusionCuller->GetNumOccluders(), 1000.0f * OcclusionRenderTime / OcclusionFrames, 1000.0f * OcclusionTestTime / OcclusionFrames);
+	}
+	ShadowPassesRendered = 0;
+	ShadowPassesSkipped = 0;
+	PortalRenders = 0;
+	PortalSkippedHidden = 0;
+	PortalSkippedUnchanged = 0;
+	PortalSkippedThrottled = 0;
+	PortalSkippedBudget = 0;
+	PortalDeepestDepth = 0;
+	PortalRenderTimeTotal = 0.0f;
+	PortalTexelsTotal = 0.0f;
+	StaticShadowLayersRendered = 0;
+	OcclusionRenderTime = 0.0f;
+	OcclusionTestTime = 0.0f;
+	OcclusionFrames = 0;
+	DrawCallsTotal = 0;
+	ConstantUploadsTotal = 0;
+	ClusterTimeTotal = 0.0f;
+	DrawCallFrames = 0;
+}
+
+
+// Get the GPU time of each render pass per frame, averaged since the last call (see CGPUTimer). Zero times if there are no queries
+void GetGPUTimings(vector<SProfileTiming>& timings)
+{
+	timings.clear();
+	if (GPUTimer) GPUTimer->GetTimings(timings);
 }
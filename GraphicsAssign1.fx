@@ -37,6 +37,28 @@ struct VS_LIGHTING_OUTPUT
 	float2 UV            : TEXCOORD0;
 };
 
+// Input for models drawn many times with one instanced draw call. The model's vertex data comes first, followed by data for each
+// instance read from a second vertex buffer: the rows of its world matrix and a tint colour
+struct VS_INSTANCED_INPUT
+{
+	float3 Pos        : POSITION;
+	float3 Normal     : NORMAL;
+	float2 UV         : TEXCOORD0;
+	float4 WorldRow0  : WORLD0;
+	float4 WorldRow1  : WORLD1;
+	float4 WorldRow2  : WORLD2;
+	float4 WorldRow3  : WORLD3;
+	float3 TintColour : TINTCOLOUR;
+};
+
+// Output from the instanced vertex shader - the tint colour is passed on to the pixel shader
+struct VS_TINT_OUTPUT
+{
+	float4 ProjPos    : SV_POSITION;
+	float2 UV         : TEXCOORD0;
+	float3 TintColour : TINTCOLOUR;
+};
+
 // ADDED
 struct VS_NORMALMAP_INPUT
 {
@@ -62,52 +84,68 @@ struct VS_NORMALMAP_OUTPUT
 //--------------------------------------------------------------------------------------
 // All these variables are created & manipulated in the C++ code and passed into the shader here
 
-// The matrices (4x4 matrix of floats) for transforming from 3D model to 2D projection (used in vertex shader)
-float4x4 WorldMatrix;
-float4x4 ViewMatrix;
-float4x4 ProjMatrix;
-
-// A single colour for an entire model - used for light models and the intial basic shader
-float3 ModelColour;
-// Variable used for the wiggle effect
-float Wiggle;
-
-// Lighting variables
-float3 CameraPos;
-float3 CubeLightPos;
-float3 CubeLightColour;
-float3 CarLightPos;
-float3 CarLightColour;
-float3 TeapotLight1Pos;
-float3 TeapotLight1Colour;
-float3 TeapotLight2Pos;
-float3 TeapotLight2Colour;
-float3 TeapotLight3Pos;
-float3 TeapotLight3Colour;
-float3   SpotLight1Pos;
-float3   SpotLight2Pos;
-float3   SpotLight1Facing;
-float3   SpotLight2Facing;
-float4x4 SpotLight1ViewMatrix;
-float4x4 SpotLight2ViewMatrix;
-float4x4 SpotLight1ProjMatrix;
-float4x4 SpotLight2ProjMatrix;
-float    SpotLight1CosHalfAngle;
-float    SpotLight2CosHalfAngle;
-float3   SpotLight1Colour;
-float3   SpotLight2Colour;
-
-float3 TintColour;
-float3 AmbientColour;
-float  SpecularPower;
-float ParallaxDepth;
+// The variables are grouped into constant buffers by how often they change. Each buffer is filled from a C++ struct with the same
+// layout and uploaded whole (see ShaderConstants.h - the offsets in the comments are checked there). Matrices are row_major so the
+// C++ matrices can be copied in as they are
+
+// Values that change at most once a frame
+cbuffer PerFrame
+{
+	float3 AmbientColour;  // 0
+	float  SpecularPower;  // 12
+	float  ParallaxDepth;  // 16
+	float  Wiggle;         // 20 - variable used for the wiggle effect
+};
+
+// The matrices for transforming from world space to 2D projection (used in vertex shader), and the position of the camera
+cbuffer PerView
+{
+	row_major float4x4 ViewMatrix; // 0
+	row_major float4x4 ProjMatrix; // 64
+	float3 CameraPos;              // 128
+	float4 ClusterScale;           // 144 - light clusters, see ClusterLights below
+	uint3  ClusterCount;           // 160 - tiles across and down, and depth slices
+};
+
+// The model being drawn. How the model's vertex data is stored (see CModel::Load): compact models store positions from -1 to 1
+// within their bounds, decoded as position * PositionDecode.w + PositionDecode.xyz, and store normals and tangents as two
+// octahedral coordinates
+cbuffer PerObject
+{
+	row_major float4x4 WorldMatrix; // 0
+	float4 PositionDecode;          // 64
+	float3 ModelColour;             // 80 - a single colour for an entire model, used for the initial basic shader
+	bool   OctahedralNormals;       // 92
+	float3 TintColour;              // 96 - colour of a light model
+};
+
+// The lights in view, packed by CLightManager for each view. Each light is three float4s:
+//   position in xyz, range in w - the light fades to nothing at this distance
+//   colour in rgb, cosine of half the cone angle in w - point lights use -2 so every direction is in their "cone"
+//   facing in xyz (spot lights only), index into the shadow arrays below in w, or -1 for no shadows
+Buffer<float4> LightData;
+
+// The view is divided into clusters - square screen tiles, each cut into slices by depth (see CLightClusterGrid). Each cluster
+// has a list of the lights reaching it, as indices into LightData, so the lighting cost of a pixel depends on the lights near it,
+// not on the number of lights in the scene. ClusterLights holds the start and length of each cluster's list in LightIndices.
+// A pixel's tile is its position times ClusterScale.xy, its slice is log2(depth) * ClusterScale.z + ClusterScale.w
+Buffer<uint2> ClusterLights;
+Buffer<uint>  LightIndices;
+
+// Lights with shadows - each light's view * projection matrix (as a camera), and where its shadow map is in the shadow atlas
+// (UV offset in xy, UV scale in zw)
+cbuffer Shadows
+{
+	row_major float4x4 ShadowMatrices[NUM_SHADOW_LIGHTS]; // 0 - NUM_SHADOW_LIGHTS is defined by the C++ when loading this file
+	float4 ShadowAtlasRects[NUM_SHADOW_LIGHTS];           // 64 * NUM_SHADOW_LIGHTS
+};
 
 // Diffuse texture map (the main texture colour) - may contain specular map in alpha channel
 Texture2D DiffuseMap;
 Texture2D CellMap;
 Texture2D NormalMap;
-Texture2D ShadowMap1;
-Texture2D ShadowMap2;
+Texture2D ShadowAtlas;       // All the spot light shadow maps, each in its own tile
+Texture2D StaticShadowAtlas; // Cached depths of static shadow casters, copied into the shadow atlas tile by tile
 
 // Sampler to use with the diffuse/normal maps. Specifies texture filtering and addressing mode to use when accessing texture pixels
 SamplerState TrilinearWrap
@@ -124,10 +162,102 @@ SamplerState PointClamp
 };
 
 
+// Look up a depth in a spot light's shadow map. Its shadow map is a tile of the shadow atlas, so the usual 0->1 shadow map UVs
+// are scaled and offset into the tile. The UVs are clamped so a lookup never strays into a neighbouring light's tile. A light
+// that was given no tile (scale of 0) has no shadows - return the far depth so nothing is in shadow
+float SampleShadowAtlas(float2 shadowUV, float4 atlasRect)
+{
+	if (atlasRect.z <= 0.0f) return 1.0f;
+	return ShadowAtlas.SampleLevel(PointClamp, saturate(shadowUV) * atlasRect.zw + atlasRect.xy, 0).r;
+}
+
+// Is a world position lit by a light with shadows - compare its depth from the light with the depth in the light's shadow map
+bool IsLitByShadowLight(float3 worldPos, int shadow)
+{
+	// Slight adjustment to calculated depth of pixels so they don't shadow themselves
+	const float DepthAdjust = 0.0005f;
+
+	// Find the 2D position of the pixel *as seen from the light*, then convert it into texture coordinates for the shadow map:
+	// x & y get the perspective divide, then are converted from range -1->1 to UV range 0->1 with the V axis flipped
+	float4 lightProjPos = mul(float4(worldPos, 1.0f), ShadowMatrices[shadow]);
+	float2 shadowUV = 0.5f * lightProjPos.xy / lightProjPos.w + float2(0.5f, 0.5f);
+	shadowUV.y = 1.0f - shadowUV.y;
+
+	// If the shadow map depth is less than the pixel's depth from the light then something is nearer the light than the pixel
+	float depthFromLight = lightProjPos.z / lightProjPos.w - DepthAdjust;
+	return depthFromLight < SampleShadowAtlas(shadowUV, ShadowAtlasRects[shadow]);
+}
+
+// Sum the diffuse and specular light reaching a pixel from each light in its cluster's light list, adding the ambient light to
+// the diffuse. The pixel position is the SV_Position input of the pixel shader - x and y in pixels, w the view space depth. Cell
+// shading clamps each light's levels to a few steps by looking them up in CellMap
+void CalculateLighting(float4 pixelPos, float3 worldPos, float3 worldNormal, float3 cameraDir, bool cellShading,
+                       out float3 diffuseLight, out float3 specularLight)
+{
+	uint2 tile = min((uint2)(pixelPos.xy * ClusterScale.xy), ClusterCount.xy - 1);
+	uint slice = (uint)clamp(floor(log2(pixelPos.w) * ClusterScale.z + ClusterScale.w), 0.0f, (float)(ClusterCount.z - 1));
+	uint2 lightList = ClusterLights.Load((slice * ClusterCount.y + tile.y) * ClusterCount.x + tile.x);
+
+	diffuseLight = AmbientColour;
+	specularLight = 0;
+	for (uint i = 0; i < lightList.y; i++)
+	{
+		int light = LightIndices.Load(lightList.x + i) * 3;
+		float4 positionRange = LightData.Load(light);
+		float4 colourCone    = LightData.Load(light + 1);
+		float4 facingShadow  = LightData.Load(light + 2);
+
+		// Skip pixels out of the light's range, outside its cone, or in its shadow
+		float3 toLight = positionRange.xyz - worldPos;
+		float lightDist = length(toLight);
+		float3 lightDir = toLight / lightDist;
+		if (lightDist >= positionRange.w || dot(facingShadow.xyz, -lightDir) <= colourCone.w) continue;
+		if (facingShadow.w >= 0.0f && !IsLitByShadowLight(worldPos, (int)facingShadow.w)) continue;
+
+		float diffuseLevel = max(dot(worldNormal, lightDir), 0);
+		float3 halfway = normalize(lightDir + cameraDir);
+		float specularLevel = pow(max(dot(worldNormal, halfway), 0), SpecularPower);
+		if (cellShading)
+		{
+			diffuseLevel = CellMap.SampleLevel(PointClamp, float2(diffuseLevel, 0.5f), 0).r;
+			specularLevel = CellMap.SampleLevel(PointClamp, float2(specularLevel, 0.5f), 0).r;
+		}
+
+		// Light falls off with distance, and fades to nothing approaching its range so it doesn't pop on and off
+		float fade = saturate(1.0f - pow(lightDist / positionRange.w, 4));
+		float3 diffuse = colourCone.rgb * diffuseLevel * fade * fade / lightDist;
+		diffuseLight += diffuse;
+		specularLight += diffuse * specularLevel;
+	}
+}
+
+
 //--------------------------------------------------------------------------------------
 // Vertex Shaders
 //--------------------------------------------------------------------------------------
 
+// Get the model space position from the vertex data
+float3 DecodePosition(float3 storedPos)
+{
+	return storedPos * PositionDecode.w + PositionDecode.xyz;
+}
+
+// Get a model space normal or tangent from the vertex data. Octahedral coordinates are a point on the square -1 to 1 - the inner
+// diamond is the top half of an octahedron seen from above, the corners fold back underneath to make the bottom half. Normalising
+// the point on the octahedron gives the direction (matches CVertexEncoder::DecodeOctahedral)
+float3 DecodeNormal(float3 storedNormal)
+{
+	if (!OctahedralNormals) return storedNormal;
+
+	float2 octahedral = storedNormal.xy;
+	float3 normal = float3(octahedral, 1.0f - abs(octahedral.x) - abs(octahedral.y));
+	if (normal.z < 0.0f)
+	{
+		normal.xy = (1.0f - abs(octahedral.yx)) * (octahedral.xy >= 0.0f ? 1.0f : -1.0f);
+	}
+	return normalize(normal);
+}
+
 // Basic vertex shader to transform 3D model vertices to 2D and pass UVs to the pixel shader
 //
 VS_BASIC_OUTPUT BasicTransform( VS_BASIC_INPUT vIn )
@@ -135,7 +265,7 @@ VS_BASIC_OUTPUT BasicTransform( VS_BASIC_INPUT vIn )
 	VS_BASIC_OUTPUT vOut;
 	
 	// Use world matrix passed from C++ to transform the input model vertex position into world space
-	float4 modelPos = float4(vIn.Pos, 1.0f); // Promote to 1x4 so we can multiply by 4x4 matrix, put 1.0 in 4th element for a point (0.0 for a vector)
+	float4 modelPos = float4(DecodePosition(vIn.Pos), 1.0f); // Promote to 1x4 so we can multiply by 4x4 matrix, put 1.0 in 4th element for a point (0.0 for a vector)
 	float4 worldPos = mul( modelPos, WorldMatrix );
 	float4 viewPos  = mul( worldPos, ViewMatrix );
 	vOut.ProjPos    = mul( viewPos,  ProjMatrix );
@@ -146,6 +276,23 @@ VS_BASIC_OUTPUT BasicTransform( VS_BASIC_INPUT vIn )
 	return vOut;
 }
 
+// Basic transform for instanced models, using the world matrix of the instance rather than the WorldMatrix variable
+//
+VS_TINT_OUTPUT InstancedTransform( VS_INSTANCED_INPUT vIn )
+{
+	VS_TINT_OUTPUT vOut;
+
+	float4x4 worldMatrix = float4x4(vIn.WorldRow0, vIn.WorldRow1, vIn.WorldRow2, vIn.WorldRow3);
+	float4 modelPos = float4(DecodePosition(vIn.Pos), 1.0f);
+	float4 worldPos = mul( modelPos, worldMatrix );
+	float4 viewPos  = mul( worldPos, ViewMatrix );
+	vOut.ProjPos    = mul( viewPos,  ProjMatrix );
+
+	vOut.UV = vIn.UV;
+	vOut.TintColour = vIn.TintColour;
+	return vOut;
+}
+
 // ADDED
 // The vertex shader will process each of the vertices in the model, typically transforming/projecting them into 2D at a minimum.
 // This vertex shader also calculates the light colour at each vertex and also passes on UVs so the later stages can use textures
@@ -155,7 +302,7 @@ VS_LIGHTING_OUTPUT VertexLightingTex(VS_BASIC_INPUT vIn)
 	VS_LIGHTING_OUTPUT vOut;
 
 	// Use world matrix passed from C++ to transform the input model vertex position into world space
-	float4 modelPos = float4(vIn.Pos, 1.0f); // Promote to 1x4 so we can multiply by 4x4 matrix, put 1.0 in 4th element for a point (0.0 for a vector)
+	float4 modelPos = float4(DecodePosition(vIn.Pos), 1.0f); // Promote to 1x4 so we can multiply by 4x4 matrix, put 1.0 in 4th element for a point (0.0 for a vector)
 	float4 worldPos = mul(modelPos, WorldMatrix);
 	vOut.WorldPos = worldPos;
 	// Use camera matrices to further transform the vertex from world space into view space (camera's point of view) and finally into 2D "projection" space for rendering
@@ -163,7 +310,7 @@ VS_LIGHTING_OUTPUT VertexLightingTex(VS_BASIC_INPUT vIn)
 	vOut.ProjPos = mul(viewPos, ProjMatrix);
 
 	// Transform the vertex normal from model space into world space (almost same as first lines of code above)
-	float4 modelNormal = float4(vIn.Normal, 0.0f); // Set 4th element to 0.0 this time as normals are vectors
+	float4 modelNormal = float4(DecodeNormal(vIn.Normal), 0.0f); // Set 4th element to 0.0 this time as normals are vectors
 	float4 worldNormal = mul(modelNormal, WorldMatrix);
 
 	// Can't guarantee the normals are length 1 now (because the world matrix may contain scaling), so renormalise
@@ -183,7 +330,7 @@ VS_NORMALMAP_OUTPUT NormalMapTransform(VS_NORMALMAP_INPUT vIn)
 	VS_NORMALMAP_OUTPUT vOut;
 
 	// Use world matrix passed from C++ to transform the input model vertex position into world space
-	float4 modelPos = float4(vIn.Pos, 1.0f); // Promote to 1x4 so we can multiply by 4x4 matrix, put 1.0 in 4th element for a point (0.0 for a vector)
+	float4 modelPos = float4(DecodePosition(vIn.Pos), 1.0f); // Promote to 1x4 so we can multiply by 4x4 matrix, put 1.0 in 4th element for a point (0.0 for a vector)
 	float4 worldPos = mul(modelPos, WorldMatrix);
 	vOut.WorldPos = worldPos.xyz;
 
@@ -192,8 +339,8 @@ VS_NORMALMAP_OUTPUT NormalMapTransform(VS_NORMALMAP_INPUT vIn)
 	vOut.ProjPos = mul(viewPos, ProjMatrix);
 
 	// Just send the model's normal and tangent untransformed (in model space). The pixel shader will do the matrix work on normals
-	vOut.ModelNormal = vIn.Normal;
-	vOut.ModelTangent = vIn.Tangent;
+	vOut.ModelNormal = DecodeNormal(vIn.Normal);
+	vOut.ModelTangent = DecodeNormal(vIn.Tangent);
 
 	// Pass texture coordinates (UVs) on to the pixel shader, the vertex shader doesn't need them
 	vOut.UV = vIn.UV;
@@ -207,7 +354,7 @@ VS_BASIC_OUTPUT ExpandOutline(VS_BASIC_INPUT vIn)
 	VS_BASIC_OUTPUT vOut;
 
 	// Transform model-space vertex position to world-space
-	float4 modelPos = float4(vIn.Pos, 1.0f); // Promote to 1x4 so we can multiply by 4x4 matrix, put 1.0 in 4th element for a point (0.0 for a vector)
+	float4 modelPos = float4(DecodePosition(vIn.Pos), 1.0f); // Promote to 1x4 so we can multiply by 4x4 matrix, put 1.0 in 4th element for a point (0.0 for a vector)
 	float4 worldPos = mul(modelPos, WorldMatrix);
 
 	// Next the usual transform from world space to camera space - but we don't go any further here - this will be used to help expand the outline
@@ -215,7 +362,7 @@ VS_BASIC_OUTPUT ExpandOutline(VS_BASIC_INPUT vIn)
 	float4 viewPos = mul(worldPos, ViewMatrix);
 
 	// Transform model normal to world space, using the normal to expand the geometry, not for lighting
-	float4 modelNormal = float4(vIn.Normal, 0.0f); // Set 4th element to 0.0 this time as normals are vectors
+	float4 modelNormal = float4(DecodeNormal(vIn.Normal), 0.0f); // Set 4th element to 0.0 this time as normals are vectors
 	float4 worldNormal = normalize(mul(modelNormal, WorldMatrix)); // Normalise in case of world matrix scaling
 
 	// Now we return to the world position of this vertex and expand it along the world normal - that will expand the geometry outwards.
@@ -258,6 +405,16 @@ float4 TintDiffuseMap(VS_BASIC_OUTPUT vOut) : SV_Target
 	return diffuseMapColour;
 }
 
+// The same for instanced models, with the tint colour of the instance
+//
+float4 InstancedTintDiffuseMap(VS_TINT_OUTPUT vOut) : SV_Target
+{
+	float4 diffuseMapColour = DiffuseMap.Sample(TrilinearWrap, vOut.UV);
+	diffuseMapColour.rgb *= vOut.TintColour / 10;
+
+	return diffuseMapColour;
+}
+
 // ADDED
 float3 WigglePixelShader(VS_BASIC_OUTPUT vOut) : SV_Target  // The ": SV_Target" bit just indicates that the returned float4 colour goes to the render target (i.e. it's a colour to render)
 {
@@ -288,127 +445,10 @@ float4 VertexLitDiffuseMap(VS_LIGHTING_OUTPUT vOut) : SV_Target  // The ": SV_Ta
 	// Calculate direction of camera
 	float3 CameraDir = normalize(CameraPos - vOut.WorldPos.xyz); // Position of camera - position of current vertex (or pixel) (in world space)
 
-	//// TEAPOT LIGHT 1
-	float3 Light1Dir = normalize(TeapotLight1Pos - vOut.WorldPos.xyz);   // Direction for each light is different
-	float3 Light1Dist = length(TeapotLight1Pos - vOut.WorldPos.xyz);
-	float3 DiffuseLight1 = TeapotLight1Colour * saturate(dot(worldNormal.xyz, Light1Dir)) / Light1Dist;
-	float3 halfway = normalize(Light1Dir + CameraDir);
-	float3 SpecularLight1 = DiffuseLight1 * pow(saturate(dot(worldNormal.xyz, halfway)), SpecularPower);
-
-	//// TEAPOT LIGHT 2
-	float3 Light2Dir = normalize(TeapotLight2Pos - vOut.WorldPos.xyz);
-	float3 Light2Dist = length(TeapotLight2Pos - vOut.WorldPos.xyz);
-	float3 DiffuseLight2 = TeapotLight2Colour * saturate(dot(worldNormal.xyz, Light2Dir)) / Light2Dist;
-	halfway = normalize(Light2Dir + CameraDir);
-	float3 SpecularLight2 = DiffuseLight2 * pow(saturate(dot(worldNormal.xyz, halfway)), SpecularPower);
-
-
-	//// TEAPOT LIGHT 3
-	float3 Light3Dir = normalize(TeapotLight3Pos - vOut.WorldPos.xyz);   // Direction for each light is different
-	float3 Light3Dist = length(TeapotLight3Pos - vOut.WorldPos.xyz);
-	float3 DiffuseLight3 = TeapotLight3Colour * saturate(dot(worldNormal.xyz, Light1Dir)) / Light3Dist;
-	halfway = normalize(Light3Dir + CameraDir);
-	float3 SpecularLight3 = DiffuseLight3 * pow(saturate(dot(worldNormal.xyz, halfway)), SpecularPower);
-
-	//// CUBE LIGHT
-	Light1Dir = normalize(CubeLightPos - vOut.WorldPos.xyz);   // Direction for each light is different
-	Light1Dist = length(CubeLightPos - vOut.WorldPos.xyz);
-	float3 CubeDiffuseLight = CubeLightColour * max(dot(worldNormal.xyz, Light1Dir), 0) / Light1Dist;
-	halfway = normalize(Light1Dir + CameraDir);
-	float3 CubeSpecularLight = CubeDiffuseLight * pow(max(dot(worldNormal.xyz, halfway), 0), SpecularPower);
-
-	//// CAR LIGHT
-	Light1Dir = normalize(CarLightPos - vOut.WorldPos.xyz);   // Direction for each light is different
-	Light1Dist = length(CarLightPos - vOut.WorldPos.xyz);
-	float3 CarDiffuseLight = CarLightColour * saturate(dot(worldNormal.xyz, Light1Dir)) / Light1Dist;
-	halfway = normalize(Light1Dir + CameraDir);
-	float3 CarSpecularLight = CarDiffuseLight * pow(saturate(dot(worldNormal.xyz, halfway)), SpecularPower);
-
-	//// SPOT LIGHT 1
-	// Slight adjustment to calculated depth of pixels so they don't shadow themselves
-	const float DepthAdjust = 0.0005f;
-
-	// Start with no light contribution from this light
-	float3 DiffuseSpotLight1 = 0;
-	float3 SpecularSpotLight1 = 0;
-
-	// Using the world position of the current pixel and the matrices of the light (as a camera), find the 2D position of the
-	// pixel *as seen from the light*. Will use this to find which part of the shadow map to look at.
-	// The usual view / projection matrix multiplies as we would see in a vertex shader (can improve performance by putting these lines in vertex shader)
-	float4 light1ViewPos = mul(float4(vOut.WorldPos), SpotLight1ViewMatrix);
-	float4 light1ProjPos = mul(light1ViewPos, SpotLight1ProjMatrix);
-
-	// Get direction from pixel to light
-	Light1Dir = normalize(SpotLight1Pos - vOut.WorldPos.xyz);
-
-	// Check if pixel is within light cone
-	if (dot(SpotLight1Facing, -Light1Dir) > SpotLight1CosHalfAngle) //**** This condition needs to be written as the first exercise to get spotlights working
-	{
-		// Convert 2D pixel position as viewed from light into texture coordinates for shadow map - an advanced topic related to the projection step
-		// Detail: 2D position x & y get perspective divide, then converted from range -1->1 to UV range 0->1. Also flip V axis
-		float2 shadowUV = 0.5f * light1ProjPos.xy / light1ProjPos.w + float2(0.5f, 0.5f);
-		shadowUV.y = 1.0f - shadowUV.y;
-
-		// Get depth of this pixel if it were visible from the light (another advanced projection step)
-		float depthFromLight = light1ProjPos.z / light1ProjPos.w - DepthAdjust; //*** Adjustment so polygons don't shadow themselves
-
-		// Compare pixel depth from light with depth held in shadow map of the light. If shadow map depth is less than something is nearer
-		// to the light than this pixel - so the pixel gets no effect from this light
-		if (depthFromLight < ShadowMap1.Sample(PointClamp, shadowUV).r)
-		{
-			// Remainder of standard per-pixel lighting code is unchanged
-			float3 light1Dist = length(SpotLight1Pos - vOut.WorldPos.xyz);
-			DiffuseSpotLight1 = SpotLight1Colour * max(dot(worldNormal.xyz, Light1Dir), 0) / light1Dist;
-			float3 halfway = normalize(Light1Dir + CameraDir);
-			SpecularSpotLight1 = DiffuseSpotLight1 * pow(max(dot(worldNormal.xyz, halfway), 0), SpecularPower);
-		}
-	}
-
-
-	//// SPOT LIGHT 2
-	float3 DiffuseSpotLight2 = 0;
-	float3 SpecularSpotLight2 = 0;
-
-	// Using the world position of the current pixel and the matrices of the light (as a camera), find the 2D position of the
-	// pixel *as seen from the light*. Will use this to find which part of the shadow map to look at.
-	// The usual view / projection matrix multiplies as we would see in a vertex shader (can improve performance by putting these lines in vertex shader)
-	float4 Light2ViewPos = mul(float4(vOut.WorldPos), SpotLight2ViewMatrix);
-	float4 Light2ProjPos = mul(Light2ViewPos, SpotLight2ProjMatrix);
-
-	// Get direction from pixel to light
-	Light2Dir = normalize(SpotLight2Pos - vOut.WorldPos.xyz);
-
-
-	// Check if pixel is within light cone
-	if (dot(SpotLight2Facing, -Light2Dir) > SpotLight2CosHalfAngle) //**** This condition needs to be written as the first exercise to get spotlights working
-	{
-		// Convert 2D pixel position as viewed from light into texture coordinates for shadow map - an advanced topic related to the projection step
-		// Detail: 2D position x & y get perspective divide, then converted from range -1->1 to UV range 0->1. Also flip V axis
-		float2 shadowUV = 0.5f * Light2ProjPos.xy / Light2ProjPos.w + float2(0.5f, 0.5f);
-		shadowUV.y = 1.0f - shadowUV.y;
+	// Sum the effect of the lights reaching this model (the ambient light is included)
+	float3 DiffuseLight, SpecularLight;
+	CalculateLighting(vOut.ProjPos, vOut.WorldPos.xyz, worldNormal, CameraDir, false, DiffuseLight, SpecularLight);
 
-		// Get depth of this pixel if it were visible from the light (another advanced projection step)
-		float depthFromLight = Light2ProjPos.z / Light2ProjPos.w - DepthAdjust; //*** Adjustment so polygons don't shadow themselves
-
-		// Compare pixel depth from light with depth held in shadow map of the light. If shadow map depth is less than something is nearer
-		// to the light than this pixel - so the pixel gets no effect from this light
-		if (depthFromLight < ShadowMap2.Sample(PointClamp, shadowUV).r)
-		{
-			// Remainder of standard per-pixel lighting code is unchanged
-			float3 Light2Dist = length(SpotLight2Pos - vOut.WorldPos.xyz);
-			DiffuseSpotLight2 = SpotLight2Colour * max(dot(worldNormal.xyz, Light2Dir), 0) / Light2Dist;
-			float3 halfway = normalize(Light2Dir + CameraDir);
-			SpecularSpotLight2 = DiffuseSpotLight2 * pow(max(dot(worldNormal.xyz, halfway), 0), SpecularPower);
-		}
-	}
-
-	// Sum the effect of all lights - add the ambient at this stage rather than for each light (or we will get twice the ambient level)
-	/*float3 DiffuseLight = AmbientColour + DiffuseLight1 + CarDiffuseLight + TeapotDiffuseLight1 + TeapotDiffuseLight2 + TeapotDiffuseLight3 + DiffuseSpotLight1 + DiffuseSpotLight2;
-	float3 SpecularLight = SpecularLight1 + CarSpecularLight + TeapotSpecularLight1 + TeapotSpecularLight2 + TeapotSpecularLight3 + SpecularSpotLight1 + SpecularSpotLight2;*/
-
-	// Sum the effect of all lights - add the ambient at this stage rather than for each light (or we will get twice the ambient level)
-	float3 DiffuseLight = AmbientColour + DiffuseLight1 + DiffuseLight2 + DiffuseLight3 + DiffuseSpotLight1 + DiffuseSpotLight2 + CubeDiffuseLight + CarDiffuseLight;
-	float3 SpecularLight = SpecularLight1 + SpecularLight2 + SpecularLight3 + SpecularSpotLight1 + SpecularSpotLight2 + CubeSpecularLight + CarSpecularLight;
 	////////////////////
 	// Sample texture
 
@@ -461,125 +501,9 @@ float4 NormalMapLighting(VS_NORMALMAP_OUTPUT vOut) : SV_Target
 	///////////////////////
 	// Calculate lighting
 
-	//// CUBE LIGHT
-	float3 Light1Dir = normalize(CubeLightPos - vOut.WorldPos.xyz);   // Direction for each light is different
-	float3 Light1Dist = length(CubeLightPos - vOut.WorldPos.xyz);
-	float3 DiffuseLight1 = CubeLightColour * max(dot(worldNormal.xyz, Light1Dir), 0) / Light1Dist;
-	float3 halfway = normalize(Light1Dir + CameraDir);
-	float3 SpecularLight1 = DiffuseLight1 * pow(max(dot(worldNormal.xyz, halfway), 0), SpecularPower);
-
-	//// CAR LIGHT
-	Light1Dir = normalize(CarLightPos - vOut.WorldPos.xyz);   // Direction for each light is different
-	Light1Dist = length(CarLightPos - vOut.WorldPos.xyz);
-	float3 CarDiffuseLight = CarLightColour * saturate(dot(worldNormal.xyz, Light1Dir)) / Light1Dist;
-	halfway = normalize(Light1Dir + CameraDir);
-	float3 CarSpecularLight = CarDiffuseLight * pow(saturate(dot(worldNormal.xyz, halfway)), SpecularPower);
-
-	//// TEAPOT LIGHT 1
-	Light1Dir = normalize(TeapotLight1Pos - vOut.WorldPos.xyz);   // Direction for each light is different
-	Light1Dist = length(TeapotLight1Pos - vOut.WorldPos.xyz);
-	float3 TeapotDiffuseLight1 = TeapotLight1Colour * saturate(dot(worldNormal.xyz, Light1Dir)) / Light1Dist;
-	halfway = normalize(Light1Dir + CameraDir);
-	float3 TeapotSpecularLight1 = TeapotDiffuseLight1 * pow(saturate(dot(worldNormal.xyz, halfway)), SpecularPower);
-
-	//// TEAPOT LIGHT 2
-	float3 Light2Dir = normalize(TeapotLight2Pos - vOut.WorldPos.xyz);
-	float3 Light2Dist = length(TeapotLight2Pos - vOut.WorldPos.xyz);
-	float3 TeapotDiffuseLight2 = TeapotLight2Colour * saturate(dot(worldNormal.xyz, Light2Dir)) / Light2Dist;
-	halfway = normalize(Light2Dir + CameraDir);
-	float3 TeapotSpecularLight2 = TeapotDiffuseLight2 * pow(saturate(dot(worldNormal.xyz, halfway)), SpecularPower);
-
-
-	//// TEAPOT LIGHT 3
-	float3 Light3Dir = normalize(TeapotLight3Pos - vOut.WorldPos.xyz);   // Direction for each light is different
-	float3 Light3Dist = length(TeapotLight3Pos - vOut.WorldPos.xyz);
-	float3 TeapotDiffuseLight3 = TeapotLight3Colour * saturate(dot(worldNormal.xyz, Light1Dir)) / Light3Dist;
-	halfway = normalize(Light3Dir + CameraDir);
-	float3 TeapotSpecularLight3 = TeapotDiffuseLight3 * pow(saturate(dot(worldNormal.xyz, halfway)), SpecularPower);
-	
-
-	//// SPOT LIGHT 1
-	// Slight adjustment to calculated depth of pixels so they don't shadow themselves
-	const float DepthAdjust = 0.0005f;
-
-	// Start with no light contribution from this light
-	float3 DiffuseSpotLight1 = 0;
-	float3 SpecularSpotLight1 = 0;
-
-	// Using the world position of the current pixel and the matrices of the light (as a camera), find the 2D position of the
-	// pixel *as seen from the light*. Will use this to find which part of the shadow map to look at.
-	// The usual view / projection matrix multiplies as we would see in a vertex shader (can improve performance by putting these lines in vertex shader)
-	float4 light1ViewPos = mul(float4(vOut.WorldPos, 1.0f), SpotLight1ViewMatrix);
-	float4 light1ProjPos = mul(light1ViewPos, SpotLight1ProjMatrix);
-
-	// Get direction from pixel to light
-	Light1Dir = normalize(SpotLight1Pos - vOut.WorldPos.xyz);
-
-	// Check if pixel is within light cone
-	if (dot(SpotLight1Facing, -Light1Dir) > SpotLight1CosHalfAngle) //**** This condition needs to be written as the first exercise to get spotlights working
-	{
-		// Convert 2D pixel position as viewed from light into texture coordinates for shadow map - an advanced topic related to the projection step
-		// Detail: 2D position x & y get perspective divide, then converted from range -1->1 to UV range 0->1. Also flip V axis
-		float2 shadowUV = 0.5f * light1ProjPos.xy / light1ProjPos.w + float2(0.5f, 0.5f);
-		shadowUV.y = 1.0f - shadowUV.y;
-
-		// Get depth of this pixel if it were visible from the light (another advanced projection step)
-		float depthFromLight = light1ProjPos.z / light1ProjPos.w - DepthAdjust; //*** Adjustment so polygons don't shadow themselves
-
-		// Compare pixel depth from light with depth held in shadow map of the light. If shadow map depth is less than something is nearer
-		// to the light than this pixel - so the pixel gets no effect from this light
-		if (depthFromLight < ShadowMap1.Sample(PointClamp, shadowUV).r)
-		{
-			// Remainder of standard per-pixel lighting code is unchanged
-			float3 light1Dist = length(SpotLight1Pos - vOut.WorldPos.xyz);
-			DiffuseSpotLight1 = SpotLight1Colour * max(dot(worldNormal.xyz, Light1Dir), 0) / light1Dist;
-			float3 halfway = normalize(Light1Dir + CameraDir);
-			SpecularSpotLight1 = DiffuseSpotLight1 * pow(max(dot(worldNormal.xyz, halfway), 0), SpecularPower);
-		}
-	}
-
-
-	//// SPOT LIGHT 2
-
-	float3 DiffuseSpotLight2 = 0;
-	float3 SpecularSpotLight2 = 0;
-
-	// Using the world position of the current pixel and the matrices of the light (as a camera), find the 2D position of the
-	// pixel *as seen from the light*. Will use this to find which part of the shadow map to look at.
-	// The usual view / projection matrix multiplies as we would see in a vertex shader (can improve performance by putting these lines in vertex shader)
-	float4 Light2ViewPos = mul(float4(vOut.WorldPos, 1.0f), SpotLight2ViewMatrix);
-	float4 Light2ProjPos = mul(Light2ViewPos, SpotLight2ProjMatrix);
-
-	// Get direction from pixel to light
-	Light2Dir = normalize(SpotLight2Pos - vOut.WorldPos.xyz);
-
-
-	// Check if pixel is within light cone
-	if (dot(SpotLight2Facing, -Light2Dir) > SpotLight2CosHalfAngle) //**** This condition needs to be written as the first exercise to get spotlights working
-	{
-		// Convert 2D pixel position as viewed from light into texture coordinates for shadow map - an advanced topic related to the projection step
-		// Detail: 2D position x & y get perspective divide, then converted from range -1->1 to UV range 0->1. Also flip V axis
-		float2 shadowUV = 0.5f * Light2ProjPos.xy / Light2ProjPos.w + float2(0.5f, 0.5f);
-		shadowUV.y = 1.0f - shadowUV.y;
-
-		// Get depth of this pixel if it were visible from the light (another advanced projection step)
-		float depthFromLight = Light2ProjPos.z / Light2ProjPos.w - DepthAdjust; //*** Adjustment so polygons don't shadow themselves
-
-		// Compare pixel depth from light with depth held in shadow map of the light. If shadow map depth is less than something is nearer
-		// to the light than this pixel - so the pixel gets no effect from this light
-		if (depthFromLight < ShadowMap2.Sample(PointClamp, shadowUV).r)
-		{
-			// Remainder of standard per-pixel lighting code is unchanged
-			float3 Light2Dist = length(SpotLight2Pos - vOut.WorldPos.xyz);
-			DiffuseSpotLight2 = SpotLight2Colour * max(dot(worldNormal.xyz, Light2Dir), 0) / Light2Dist;
-			float3 halfway = normalize(Light2Dir + CameraDir);
-			SpecularSpotLight2 = DiffuseSpotLight2 * pow(max(dot(worldNormal.xyz, halfway), 0), SpecularPower);
-		}
-	}
-
-	// Sum the effect of all lights - add the ambient at this stage rather than for each light (or we will get twice the ambient level)
-	float3 DiffuseLight = AmbientColour + DiffuseLight1 + CarDiffuseLight + TeapotDiffuseLight1 + TeapotDiffuseLight2 + TeapotDiffuseLight3 + DiffuseSpotLight1 + DiffuseSpotLight2;
-	float3 SpecularLight = SpecularLight1 + CarSpecularLight + TeapotSpecularLight1 + TeapotSpecularLight2 + TeapotSpecularLight3 + SpecularSpotLight1 + SpecularSpotLight2;
+	// Sum the effect of the lights reaching this model (the ambient light is included)
+	float3 DiffuseLight, SpecularLight;
+	CalculateLighting(vOut.ProjPos, vOut.WorldPos.xyz, worldNormal, CameraDir, false, DiffuseLight, SpecularLight);
 
 
 	////////////////////
@@ -605,9 +529,6 @@ float4 NormalMapLighting(VS_NORMALMAP_OUTPUT vOut) : SV_Target
 
 float4 ShadowMapTex( VS_LIGHTING_OUTPUT vOut ) : SV_Target  // The ": SV_Target" bit just indicates that the returned float4 colour goes to the render target (i.e. it's a colour to render)
 {
-	// Slight adjustment to calculated depth of pixels so they don't shadow themselves
-	const float DepthAdjust = 0.0005f;
-
 	// Can't guarantee the normals are length 1 now (because the world matrix may contain scaling), so renormalise
 	// If lighting in the pixel shader, this is also because the interpolation from vertex shader to pixel shader will also rescale normals
 	float3 worldNormal = normalize(vOut.WorldNormal); 
@@ -618,90 +539,9 @@ float4 ShadowMapTex( VS_LIGHTING_OUTPUT vOut ) : SV_Target  // The ": SV_Target"
 	// Calculate direction of camera
 	float3 cameraDir = normalize(CameraPos - vOut.WorldPos.xyz); // Position of camera - position of current vertex (or pixel) (in world space)
 
-	//----------
-	// LIGHT 1
-
-	// Start with no light contribution from this light
-	float3 diffuseLight1 = 0;
-	float3 specularLight1 = 0;
-
-	// Using the world position of the current pixel and the matrices of the light (as a camera), find the 2D position of the
-	// pixel *as seen from the light*. Will use this to find which part of the shadow map to look at.
-	// The usual view / projection matrix multiplies as we would see in a vertex shader (can improve performance by putting these lines in vertex shader)
-	float4 light1ViewPos = mul( float4(vOut.WorldPos), SpotLight1ViewMatrix ); 
-	float4 light1ProjPos = mul( light1ViewPos, SpotLight1ProjMatrix );
-
-	// Get direction from pixel to light
-	float3 light1Dir = normalize(SpotLight1Pos - vOut.WorldPos.xyz);
-
-
-	// Check if pixel is within light cone
-	if ( dot(SpotLight1Facing, -light1Dir ) > SpotLight1CosHalfAngle) //**** This condition needs to be written as the first exercise to get spotlights working
-	{
-		// Convert 2D pixel position as viewed from light into texture coordinates for shadow map - an advanced topic related to the projection step
-		// Detail: 2D position x & y get perspective divide, then converted from range -1->1 to UV range 0->1. Also flip V axis
-		float2 shadowUV = 0.5f * light1ProjPos.xy / light1ProjPos.w + float2( 0.5f, 0.5f );
-		shadowUV.y = 1.0f - shadowUV.y;
-
-		// Get depth of this pixel if it were visible from the light (another advanced projection step)
-		float depthFromLight = light1ProjPos.z / light1ProjPos.w - DepthAdjust; //*** Adjustment so polygons don't shadow themselves
-		
-		// Compare pixel depth from light with depth held in shadow map of the light. If shadow map depth is less than something is nearer
-		// to the light than this pixel - so the pixel gets no effect from this light
-		if (depthFromLight < ShadowMap1.Sample( PointClamp, shadowUV ).r)
-		{
-			// Remainder of standard per-pixel lighting code is unchanged
-			float3 light1Dist = length(SpotLight1Pos - vOut.WorldPos.xyz); 
-			diffuseLight1 = SpotLight1Colour * max( dot(worldNormal.xyz, light1Dir), 0 ) / light1Dist;
-			float3 halfway = normalize(light1Dir + cameraDir);
-			specularLight1 = diffuseLight1 * pow( max( dot(worldNormal.xyz, halfway), 0 ), SpecularPower );
-		}
-	}
-
-
-	//----------
-	// LIGHT 2
-
-	// Start with no light contribution from this light
-	float3 diffuseLight2 = 0;
-	float3 specularLight2 = 0;
-
-	// Using the world position of the current pixel and the matrices of the light (as a camera), find the 2D position of the
-	// pixel *as seen from the light*. Will use this to find which part of the shadow map to look at.
-	// The usual view / projection matrix multiplies as we would see in a vertex shader (can improve performance by putting these lines in vertex shader)
-	float4 Light2ViewPos = mul(float4(vOut.WorldPos), SpotLight2ViewMatrix);
-	float4 Light2ProjPos = mul(Light2ViewPos, SpotLight2ProjMatrix);
-
-	// Get direction from pixel to light
-	float3 Light2Dir = normalize(SpotLight2Pos - vOut.WorldPos.xyz);
-
-
-	// Check if pixel is within light cone
-	if (dot(SpotLight2Facing, -Light2Dir) > SpotLight2CosHalfAngle) //**** This condition needs to be written as the first exercise to get spotlights working
-	{
-		// Convert 2D pixel position as viewed from light into texture coordinates for shadow map - an advanced topic related to the projection step
-		// Detail: 2D position x & y get perspective divide, then converted from range -1->1 to UV range 0->1. Also flip V axis
-		float2 shadowUV = 0.5f * Light2ProjPos.xy / Light2ProjPos.w + float2(0.5f, 0.5f);
-		shadowUV.y = 1.0f - shadowUV.y;
-
-		// Get depth of this pixel if it were visible from the light (another advanced projection step)
-		float depthFromLight = Light2ProjPos.z / Light2ProjPos.w - DepthAdjust; //*** Adjustment so polygons don't shadow themselves
-
-		// Compare pixel depth from light with depth held in shadow map of the light. If shadow map depth is less than something is nearer
-		// to the light than this pixel - so the pixel gets no effect from this light
-		if (depthFromLight < ShadowMap2.Sample(PointClamp, shadowUV).r)
-		{
-			// Remainder of standard per-pixel lighting code is unchanged
-			float3 Light2Dist = length(SpotLight2Pos - vOut.WorldPos.xyz);
-			diffuseLight2 = SpotLight2Colour * max(dot(worldNormal.xyz, Light2Dir), 0) / Light2Dist;
-			float3 halfway = normalize(Light2Dir + cameraDir);
-			specularLight2 = diffuseLight2 * pow(max(dot(worldNormal.xyz, halfway), 0), SpecularPower);
-		}
-	}
-
-	// Sum the effect of the two lights - add the ambient at this stage rather than for each light (or we will get twice the ambient level)
-	float3 diffuseLight = AmbientColour + diffuseLight1 + diffuseLight2;
-	float3 specularLight = specularLight1 + specularLight2;
+	// Sum the effect of the lights reaching this model (the ambient light is included)
+	float3 diffuseLight, specularLight;
+	CalculateLighting(vOut.ProjPos, vOut.WorldPos.xyz, worldNormal, cameraDir, false, diffuseLight, specularLight);
 
 
 	////////////////////
@@ -719,7 +559,7 @@ float4 ShadowMapTex( VS_LIGHTING_OUTPUT vOut ) : SV_Target  // The ": SV_Target"
 	
 	// Combine maps and lighting for final pixel colour
 	float4 combinedColour;
-	combinedColour.rgb = diffuseMaterial * (diffuseLight + diffuseLight2)+ specularMaterial * (specularLight + specularLight2);
+	combinedColour.rgb = diffuseMaterial * diffuseLight + specularMaterial * specularLight;
 	combinedColour.a = 1.0f; // No alpha processing in this shader, so just set it to 1
 
 	return combinedColour;
@@ -734,6 +574,27 @@ float4 PixelDepth(VS_BASIC_OUTPUT vOut) : SV_Target
 	return vOut.ProjPos.z / vOut.ProjPos.w;
 }
 
+// Vertex shader for the shadow atlas tile techniques - outputs one triangle that covers the whole viewport (i.e. the tile
+// being rendered). The corners are made from the vertex number, so no vertex buffer is needed (draw 3 vertices with no input layout)
+float4 FullScreenTriangle(uint vertexId : SV_VertexID) : SV_Position
+{
+	float2 uv = float2((vertexId << 1) & 2, vertexId & 2); // (0,0), (2,0), (0,2)
+	return float4(uv * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f), 0.0f, 1.0f);
+}
+
+// Clear a shadow atlas tile to the far depth. Clearing the depth buffer would clear the whole atlas, including other lights' tiles
+float ClearDepthTile(float4 pixelPos : SV_Position) : SV_Depth
+{
+	return 1.0f;
+}
+
+// Copy the cached static caster depths for this tile from the static atlas. Depth buffers cannot be copied part at a time, so the
+// depths are read in a shader and written out as depth. The tile is in the same place in both atlases
+float CopyDepthTile(float4 pixelPos : SV_Position) : SV_Depth
+{
+	return StaticShadowAtlas.Load(int3(pixelPos.xy, 0)).r;
+}
+
 float4 CellShadingVertexLitDiffuseMap(VS_LIGHTING_OUTPUT vOut) : SV_Target  // The ": SV_Target" bit just indicates that the returned float4 colour goes to the render target (i.e. it's a colour to render)
 {
 	// Can't guarantee the normals are length 1 now (because the world matrix may contain scaling), so renormalise
@@ -745,107 +606,14 @@ float4 CellShadingVertexLitDiffuseMap(VS_LIGHTING_OUTPUT vOut) : SV_Target  // T
 	///////////////////////
 	// Calculate lighting
 
-	//// SPOT LIGHT 1
-	// Slight adjustment to calculated depth of pixels so they don't shadow themselves
-	const float DepthAdjust = 0.0005f;
-
-	// Start with no light contribution from this light
-	float3 DiffuseSpotLight1 = 0;
-	float3 SpecularSpotLight1 = 0;
-
-	// Using the world position of the current pixel and the matrices of the light (as a camera), find the 2D position of the
-	// pixel *as seen from the light*. Will use this to find which part of the shadow map to look at.
-	// The usual view / projection matrix multiplies as we would see in a vertex shader (can improve performance by putting these lines in vertex shader)
-	float4 light1ViewPos = mul(float4(vOut.WorldPos), SpotLight1ViewMatrix);
-	float4 light1ProjPos = mul(light1ViewPos, SpotLight1ProjMatrix);
-
-	// Get direction from pixel to light
-	float3 Light1Dir = normalize(SpotLight1Pos - vOut.WorldPos.xyz);
-
-	// Check if pixel is within light cone
-	if (dot(SpotLight1Facing, -Light1Dir) > SpotLight1CosHalfAngle) //**** This condition needs to be written as the first exercise to get spotlights working
-	{
-		// Convert 2D pixel position as viewed from light into texture coordinates for shadow map - an advanced topic related to the projection step
-		// Detail: 2D position x & y get perspective divide, then converted from range -1->1 to UV range 0->1. Also flip V axis
-		float2 shadowUV = 0.5f * light1ProjPos.xy / light1ProjPos.w + float2(0.5f, 0.5f);
-		shadowUV.y = 1.0f - shadowUV.y;
-
-		// Get depth of this pixel if it were visible from the light (another advanced projection step)
-		float depthFromLight = light1ProjPos.z / light1ProjPos.w - DepthAdjust; //*** Adjustment so polygons don't shadow themselves
-
-		// Compare pixel depth from light with depth held in shadow map of the light. If shadow map depth is less than something is nearer
-		// to the light than this pixel - so the pixel gets no effect from this light
-		if (depthFromLight < ShadowMap1.Sample(PointClamp, shadowUV).r)
-		{
-			// Remainder of standard per-pixel lighting code is unchanged
-			float3 light1Dist = length(SpotLight1Pos - vOut.WorldPos.xyz);
-			DiffuseSpotLight1 = SpotLight1Colour * max(dot(worldNormal.xyz, Light1Dir), 0) / light1Dist;
-			float3 halfway = normalize(Light1Dir + CameraDir);
-			SpecularSpotLight1 = DiffuseSpotLight1 * pow(max(dot(worldNormal.xyz, halfway), 0), SpecularPower);
-		}
-	}
-
-	//// SPOT LIGHT 2
-	float3 DiffuseSpotLight2 = 0;
-	float3 SpecularSpotLight2 = 0;
-
-	// Using the world position of the current pixel and the matrices of the light (as a camera), find the 2D position of the
-	// pixel *as seen from the light*. Will use this to find which part of the shadow map to look at.
-	// The usual view / projection matrix multiplies as we would see in a vertex shader (can improve performance by putting these lines in vertex shader)
-	float4 Light2ViewPos = mul(float4(vOut.WorldPos), SpotLight2ViewMatrix);
-	float4 Light2ProjPos = mul(Light2ViewPos, SpotLight2ProjMatrix);
-
-	// Get direction from pixel to light
-	float3 Light2Dir = normalize(SpotLight2Pos - vOut.WorldPos.xyz);
-
-
-	// Check if pixel is within light cone
-	if (dot(SpotLight2Facing, -Light2Dir) > SpotLight2CosHalfAngle) //**** This condition needs to be written as the first exercise to get spotlights working
-	{
-		// Convert 2D pixel position as viewed from light into texture coordinates for shadow map - an advanced topic related to the projection step
-		// Detail: 2D position x & y get perspective divide, then converted from range -1->1 to UV range 0->1. Also flip V axis
-		float2 shadowUV = 0.5f * Light2ProjPos.xy / Light2ProjPos.w + float2(0.5f, 0.5f);
-		shadowUV.y = 1.0f - shadowUV.y;
-
-		// Get depth of this pixel if it were visible from the light (another advanced projection step)
-		float depthFromLight = Light2ProjPos.z / Light2ProjPos.w - DepthAdjust; //*** Adjustment so polygons don't shadow themselves
-
-		// Compare pixel depth from light with depth held in shadow map of the light. If shadow map depth is less than something is nearer
-		// to the light than this pixel - so the pixel gets no effect from this light
-		if (depthFromLight < ShadowMap2.Sample(PointClamp, shadowUV).r)
-		{
-			// Remainder of standard per-pixel lighting code is unchanged
-			float3 Light2Dist = length(SpotLight2Pos - vOut.WorldPos.xyz);
-			DiffuseSpotLight2 = SpotLight2Colour * max(dot(worldNormal.xyz, Light2Dir), 0) / Light2Dist;
-			float3 halfway = normalize(Light2Dir + CameraDir);
-			SpecularSpotLight2 = DiffuseSpotLight2 * pow(max(dot(worldNormal.xyz, halfway), 0), SpecularPower);
-		}
-	}
-
-	//// CAR LIGHT 
-	float3 CarLightDir = normalize(CarLightPos - vOut.WorldPos.xyz);  
-	float3 CarLightDist = length(CarLightPos - vOut.WorldPos.xyz);
-
 	//****| INFO |*************************************************************************************//
 	// To make a cartoon look to the lighting, we clamp the basic light level to just a small range of
 	// colours. This is done by using the light level itself as the U texture coordinate to look up
 	// a colour in a special 1D texture (a single line). This could be done with if statements, but
 	// GPUs are much faster at looking up small textures than if statements
 	//*************************************************************************************************//
-	float DiffuseLevel = max(dot(worldNormal.xyz, CarLightDir), 0);
-	float CellDiffuseLevel = CellMap.Sample(PointClamp, DiffuseLevel).r;
-	float3 CarDiffuseLight = CarLightColour * CellDiffuseLevel / CarLightDist;
-
-	// Do same for specular light and further lights
-	float3 halfway = normalize(CarLightDir + CameraDir);
-	float SpecularLevel = pow(max(dot(worldNormal.xyz, halfway), 0), SpecularPower);
-	float CellSpecularLevel = CellMap.Sample(PointClamp, SpecularLevel).r;
-	float3 CarSpecularLight = CarDiffuseLight * CellSpecularLevel;
-
-
-	// Sum the effect of the two lights - add the ambient at this stage rather than for each light (or we will get twice the ambient level)
-	float3 DiffuseLight = AmbientColour + CarDiffuseLight + DiffuseSpotLight1 + DiffuseSpotLight2;
-	float3 SpecularLight = CarSpecularLight + CarSpecularLight + SpecularSpotLight1 + SpecularSpotLight2;
+	float3 DiffuseLight, SpecularLight;
+	CalculateLighting(vOut.ProjPos, vOut.WorldPos.xyz, worldNormal, CameraDir, true, DiffuseLight, SpecularLight);
 
 
 	////////////////////
@@ -900,6 +668,13 @@ DepthStencilState DepthWritesOn  // Write to the depth buffer - normal behaviour
 	DepthWriteMask = ALL;
 };
 
+DepthStencilState DepthAlways // Overwrite the depth buffer whatever is there already - used to clear or copy depths
+{
+	DepthEnable = TRUE;
+	DepthFunc = ALWAYS;
+	DepthWriteMask = ALL;
+};
+
 BlendState NoBlending // Switch off blending - pixels will be opaque
 {
 	BlendEnable[0] = FALSE;
@@ -956,6 +731,21 @@ technique10 AdditiveTexTint
 	}
 }
 
+// Additive tinted texture for instanced models (the light models are all drawn together)
+technique10 AdditiveTexTintInstanced
+{
+	pass P0
+	{
+		SetVertexShader(CompileShader(vs_4_0, InstancedTransform()));
+		SetGeometryShader(NULL);
+		SetPixelShader(CompileShader(ps_4_0, InstancedTintDiffuseMap()));
+
+		SetBlendState(AdditiveBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetRasterizerState(CullNone);
+		SetDepthStencilState(DepthWritesOff, 0);
+	}
+}
+
 // ADDED
 technique10 WiggleTechnique
 {
@@ -1033,6 +823,36 @@ technique10 DepthOnlyTechnique
 	}
 }
 
+// Clear the shadow atlas tile selected by the viewport. Draw 3 vertices with no input layout
+technique10 ClearDepthTileTechnique
+{
+	pass P0
+	{
+		SetVertexShader(CompileShader(vs_4_0, FullScreenTriangle()));
+		SetGeometryShader(NULL);
+		SetPixelShader(CompileShader(ps_4_0, ClearDepthTile()));
+
+		SetBlendState(NoBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetRasterizerState(CullNone);
+		SetDepthStencilState(DepthAlways, 0);
+	}
+}
+
+// Copy the static atlas into the shadow atlas tile selected by the viewport. Draw 3 vertices with no input layout
+technique10 CopyDepthTileTechnique
+{
+	pass P0
+	{
+		SetVertexShader(CompileShader(vs_4_0, FullScreenTriangle()));
+		SetGeometryShader(NULL);
+		SetPixelShader(CompileShader(ps_4_0, CopyDepthTile()));
+
+		SetBlendState(NoBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetRasterizerState(CullNone);
+		SetDepthStencilState(DepthAlways, 0);
+	}
+}
+
 technique10 CellShadingTechnique
 {
 	pass P0
@@ -22,6 +22,7 @@ using namespace std;
 #include <rmxftmpl.h>
 
 #include "CImportXFile.h"
+#include "../Profiler.h" // Profiling scopes (from the main project)
 
 namespace gen
 {
@@ -77,6 +78,7 @@ EImportError CImportXFile::ImportFile
 )
 {
 	GEN_GUARD;
+	PROFILE_SCOPE( "CImportXFile::ImportFile" );
 
 	// Wipe any existing data
 	m_Frames.clear();
@@ -126,6 +128,10 @@ EImportError CImportXFile::ImportFile
 	// Uncommenting this line will partialy render the Matrix Hierarchy models
 	//SplitMeshes();
 
+	// Instead keep each mesh whole, with faces sorted by material - each material becomes a
+	// subset of the mesh's faces (see GetSubMesh)
+	SortFacesByMaterial();
+
 	// Mark file as loaded
 	m_bImported = true;
 
@@ -178,6 +184,7 @@ EImportError CImportXFile::GetSubMesh
 ) const
 {
 	GEN_GUARD;
+	PROFILE_SCOPE( "CImportXFile::GetSubMesh" );
 
 	// Set sub-mesh owner node
 	pOutSubMesh->node = m_Meshes[iSubMesh].iParentFrame;
@@ -322,9 +329,6 @@ EImportError CImportXFile::GetSubMesh
 	pOutSubMesh->numFaces = static_cast<TUInt32>(m_Meshes[iSubMesh].faces.size());
 	pOutSubMesh->faces = new SMeshFace[pOutSubMesh->numFaces];
 
-	// Get material from material map (all faces in sub-mesh have the same material at this point)
-	pOutSubMesh->material = m_Meshes[iSubMesh].materialMap.front();
-
 	// Loop through faces outputing to given sub-mesh
 	TXFileFaces::const_iterator itFace = m_Meshes[iSubMesh].faces.begin();
 	TXFileFaces::const_iterator itFaceEnd = m_Meshes[iSubMesh].faces.end();
@@ -336,6 +340,34 @@ EImportError CImportXFile::GetSubMesh
 		++itFace;
 	}
 
+	// Faces are sorted by material (see SortFacesByMaterial), output each run of faces with the
+	// same global material as a subset. A mesh without a material list is a single subset
+	const SXFileMesh& mesh = m_Meshes[iSubMesh];
+	vector<SSubMeshSubset> subsets;
+	for (TUInt32 iFace = 0; iFace < pOutSubMesh->numFaces; ++iFace)
+	{
+		TUInt32 iMaterial = 0;
+		if (mesh.materialMap.size() > 0)
+		{
+			iMaterial = (iFace < mesh.faceMaterials.size()) ? mesh.materialMap[mesh.faceMaterials[iFace]] :
+			                                                  mesh.materialMap.front();
+		}
+		if (subsets.empty() || subsets.back().material != iMaterial)
+		{
+			SSubMeshSubset subset = { iMaterial, iFace, 0 };
+			subsets.push_back( subset );
+		}
+		++subsets.back().numFaces;
+	}
+	pOutSubMesh->numSubsets = static_cast<TUInt32>(subsets.size());
+	pOutSubMesh->subsets = new SSubMeshSubset[subsets.size() > 0 ? subsets.size() : 1];
+	for (TUInt32 iSubset = 0; iSubset < subsets.size(); ++iSubset)
+	{
+		pOutSubMesh->subsets[iSubset] = subsets[iSubset];
+	}
+	pOutSubMesh->material = (subsets.size() > 0) ? subsets.front().material :
+	                        ((mesh.materialMap.size() > 0) ? mesh.materialMap.front() : 0);
+
 	return kSuccess;
 
 	GEN_ENDGUARD;
@@ -566,6 +598,7 @@ EImportError CImportXFile::ParseXFile
 )
 {
 	GEN_GUARD;
+	PROFILE_SCOPE( "CImportXFile::ParseXFile" );
 
 	// Create new root frame
 	m_Frames.push_back( SXFileFrame() );
@@ -2076,6 +2109,53 @@ void CImportXFile::SplitMeshes()
 }
 
 
+// Sort the faces of each mesh by material, so each material's faces are together in the face
+// list. Faces are sorted by global material, so local materials that are duplicates of each other
+// are merged. The sort is stable to keep the original (vertex cache friendly) order of the faces
+// within each material
+void CImportXFile::SortFacesByMaterial()
+{
+	GEN_GUARD;
+	PROFILE_SCOPE( "CImportXFile::SortFacesByMaterial" );
+
+	for (TUInt32 iMesh = 0; iMesh < m_Meshes.size(); ++iMesh)
+	{
+		SXFileMesh& mesh = m_Meshes[iMesh];
+		if (mesh.faceMaterials.size() != mesh.faces.size() || mesh.materialMap.size() == 0)
+		{
+			continue;
+		}
+
+		// Count the faces using each global material, then find where each material's faces start
+		TUInt32 iNumMaterials = static_cast<TUInt32>(m_Materials.size());
+		TXFileInts materialStart( iNumMaterials + 1, 0 );
+		for (TUInt32 iFace = 0; iFace < mesh.faces.size(); ++iFace)
+		{
+			++materialStart[mesh.materialMap[mesh.faceMaterials[iFace]] + 1];
+		}
+		for (TUInt32 iMaterial = 0; iMaterial < iNumMaterials; ++iMaterial)
+		{
+			materialStart[iMaterial + 1] += materialStart[iMaterial];
+		}
+
+		// Place each face after the earlier faces with the same material. A face keeps one of its
+		// local materials that maps to the same global material
+		TXFileFaces sortedFaces( mesh.faces.size() );
+		TXFileInts sortedFaceMaterials( mesh.faces.size() );
+		for (TUInt32 iFace = 0; iFace < mesh.faces.size(); ++iFace)
+		{
+			TUInt32 iSorted = materialStart[mesh.materialMap[mesh.faceMaterials[iFace]]]++;
+			sortedFaces[iSorted] = mesh.faces[iFace];
+			sortedFaceMaterials[iSorted] = mesh.faceMaterials[iFace];
+		}
+		mesh.faces.swap( sortedFaces );
+		mesh.faceMaterials.swap( sortedFaceMaterials );
+	}
+
+	GEN_ENDGUARD;
+}
+
+
 // Create a list of tangent vectors for the given mesh. The tangent vector is the direction of
 // a vertex's texture U axis in model-space. Returns true on success
 bool CImportXFile::CalculateTangents
@@ -2084,6 +2164,8 @@ bool CImportXFile::CalculateTangents
 	TXFileVectors* pTangents
 ) const
 {
+	PROFILE_SCOPE( "CImportXFile::CalculateTangents" );
+
 	// Normals and UVs are required for tangent calculation
 	if (!m_Meshes[iMesh].normals.size() || !m_Meshes[iMesh].textureCoords.size())
 	{
@@ -576,6 +576,10 @@ private:
 	// Split each mesh into a set of meshes - each of which contains only a single material
 	void SplitMeshes();
 
+	// Sort the faces of each mesh by material, so each material's faces are together in the face
+	// list. The meshes keep their vertices, so the materials share one set of vertex data
+	void SortFacesByMaterial();
+
 	// Create a list of tangent vectors for the given mesh. The tangent vector is the direction of
 	// a vertex's texture U axis in model-space. Returns true on success
 	bool CalculateTangents
@@ -60,13 +60,22 @@ struct SMeshFace
 };
 typedef vector<SMeshFace> TMeshFaces;
 
-// A sub-mesh is a single block of geometry that uses the same material. It contains a set of faces
-// and vertices and is controlled by a single node. The vertices are pointed to as raw bytes,
-// because of the flexibility of vertex data
+// A range of faces in a sub-mesh that all use the same material
+struct SSubMeshSubset
+{
+	TUInt32 material;       // Index of material used by these faces
+	TUInt32 firstFace;
+	TUInt32 numFaces;
+};
+
+// A sub-mesh is a single block of geometry controlled by a single node. It contains a set of faces
+// and vertices. The vertices are pointed to as raw bytes, because of the flexibility of vertex data.
+// The faces are sorted by material, each material's faces forming a subset. All subsets share the
+// vertex data
 struct SSubMesh
 {
 	TUInt32    node;        // Node in heirarchy controlling this submesh
-	TUInt32    material;    // Index of material used by this submesh
+	TUInt32    material;    // Index of material used by the first subset
 	TUInt32    numVertices;
 	TUInt8*    vertices;    // Pointer to raw vertex data as a byte stream
 	TUInt32    vertexSize;  // Size in bytes of a single vertex
@@ -74,6 +83,8 @@ struct SSubMesh
 	           hasTextureCoords, hasVertexColours;       // (Vertex coordinate assumed)
 	TUInt32    numFaces;
 	SMeshFace* faces;
+	TUInt32         numSubsets;
+	SSubMeshSubset* subsets;
 };
 
 
@@ -11,7 +11,14 @@
 //////////////////////////////////
 // Globals
 
-EKeyState  g_aiKeyStates[kMaxKeyCodes];
+// Live input, changed by the events
+EKeyState    g_aiKeyStates[kMaxKeyCodes];
+bool         g_abKeyHits[kMaxKeyCodes]; // Keys pressed since the last snapshot
+unsigned int g_uiMouseX, g_uiMouseY;
+
+// Snapshot of the input read by the input functions (see SnapshotInput)
+EKeyState    g_aiSnapshotKeyStates[kMaxKeyCodes];
+unsigned int g_uiSnapshotMouseX, g_uiSnapshotMouseY;
 
 
 //////////////////////////////////
@@ -23,7 +30,31 @@ void InitInput()
 	for (int i = 0; i < kMaxKeyCodes; ++i)
 	{
 		g_aiKeyStates[i] = kNotPressed;
+		g_abKeyHits[i] = false;
+		g_aiSnapshotKeyStates[i] = kNotPressed;
+	}
+	g_uiMouseX = g_uiMouseY = 0;
+	g_uiSnapshotMouseX = g_uiSnapshotMouseY = 0;
+}
+
+// Take a snapshot of the input for the input functions to read. A key hit since the last snapshot is kept in the snapshot until
+// KeyHit reads it, even if the key has since been lifted, so no hit is missed if no update reads the snapshot
+void SnapshotInput()
+{
+	for (int i = 0; i < kMaxKeyCodes; ++i)
+	{
+		if (g_abKeyHits[i] || g_aiSnapshotKeyStates[i] == kPressed)
+		{
+			g_aiSnapshotKeyStates[i] = kPressed;
+		}
+		else
+		{
+			g_aiSnapshotKeyStates[i] = (g_aiKeyStates[i] == kNotPressed) ? kNotPressed : kHeld;
+		}
+		g_abKeyHits[i] = false;
 	}
+	g_uiSnapshotMouseX = g_uiMouseX;
+	g_uiSnapshotMouseY = g_uiMouseY;
 }
 
 
@@ -36,6 +67,7 @@ void KeyDownEvent(EKeyCode Key)
 	if (g_aiKeyStates[Key] == kNotPressed)
 	{
 		g_aiKeyStates[Key] = kPressed;
+		g_abKeyHits[Key] = true;
 	}
 	else
 	{
@@ -49,6 +81,13 @@ void KeyUpEvent(EKeyCode Key)
 	g_aiKeyStates[Key] = kNotPressed;
 }
 
+// Event called to indicate that the mouse has moved
+void MouseMoveEvent(unsigned int X, unsigned int Y)
+{
+	g_uiMouseX = X;
+	g_uiMouseY = Y;
+}
+
 
 //////////////////////////////////
 // Input functions
@@ -58,9 +97,9 @@ void KeyUpEvent(EKeyCode Key)
 // Mouse_LButton, see input.h for a full list.
 bool KeyHit(EKeyCode eKeyCode)
 {
-	if (g_aiKeyStates[eKeyCode] == kPressed)
+	if (g_aiSnapshotKeyStates[eKeyCode] == kPressed)
 	{
-		g_aiKeyStates[eKeyCode] = kHeld;
+		g_aiSnapshotKeyStates[eKeyCode] = kHeld;
 		return true;
 	}
 	return false;
@@ -71,12 +110,22 @@ bool KeyHit(EKeyCode eKeyCode)
 // Mouse_LButton, see input.h for a full list.
 bool KeyHeld(EKeyCode eKeyCode)
 {
-	if (g_aiKeyStates[eKeyCode] == kNotPressed)
+	if (g_aiSnapshotKeyStates[eKeyCode] == kNotPressed)
 	{
 		return false;
 	}
-	g_aiKeyStates[eKeyCode] = kHeld;
+	g_aiSnapshotKeyStates[eKeyCode] = kHeld;
 	return true;
 }
 
+// Returns the mouse position in the window in pixels
+unsigned int GetMouseX()
+{
+	return g_uiSnapshotMouseX;
+}
+unsigned int GetMouseY()
+{
+	return g_uiSnapshotMouseY;
+}
+
 		
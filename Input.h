@@ -167,6 +167,11 @@ enum EKeyCode
 // Initialise the input system
 void InitInput();
 
+// Take a snapshot of the input for the input functions below to read. The events change the live input on the main thread, but the
+// scene update may be running on another thread - it must only read the snapshot. Call on the main thread before each frame's
+// update is started, so the snapshot doesn't change while an update runs. A key hit is kept in the snapshots until it is read
+void SnapshotInput();
+
 
 //////////////////////////////////
 // Events
@@ -177,6 +182,9 @@ void KeyDownEvent(EKeyCode Key);
 // Event called to indicate that a key has been lifted up
 void KeyUpEvent(EKeyCode Key);
 
+// Event called to indicate that the mouse has moved, position in the window in pixels
+void MouseMoveEvent(unsigned int X, unsigned int Y);
+
 
 //////////////////////////////////
 // Input functions
@@ -190,3 +198,7 @@ bool KeyHit(EKeyCode eKeyCode);
 // continuous action or motion. Example key codes: Key_A or
 // Mouse_LButton, see input.h for a full list.
 bool KeyHeld(EKeyCode eKeyCode);
+
+// Returns the mouse position in the window in pixels, e.g. to pick models in the scene
+unsigned int GetMouseX();
+unsigned int GetMouseY();
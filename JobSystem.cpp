@@ -0,0 +1,428 @@
+//--------------------------------------------------------------------------------------
+//	JobSystem.cpp
+//
+//	Shares work out between a fixed set of threads. Work is split into small jobs, each
+//	thread keeps its own queue of jobs and threads with nothing to do take jobs from the
+//	others' queues (work stealing)
+//--------------------------------------------------------------------------------------
+
+#include <cmath>
+#include <string>
+#include <algorithm>
+
+#include "CTimer.h"    // Timer class - not DirectX
+#include "Profiler.h"  // Profiling scopes
+#include "JobSystem.h" // Declaration of this class
+
+
+// Index of the calling thread and the job system it belongs to. Threads that are not worker threads have no job system and
+// index 0, the same as the main thread
+static thread_local int               s_ThreadIndex = 0;
+static thread_local const CJobSystem* s_ThreadJobSystem = NULL;
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+// Constructor starts the worker threads. The number of threads includes the main thread, zero means one per core
+CJobSystem::CJobSystem( int numThreads /*= 0*/ )
+{
+	if (numThreads <= 0)
+	{
+		numThreads = static_cast<int>(thread::hardware_concurrency());
+	}
+	m_NumThreads = min( max( numThreads, 1 ), MAX_THREADS );
+	m_MainThread = this_thread::get_id();
+	m_NumQueued = 0;
+	m_NumMainThreadQueued = 0;
+	m_NumWorkerThreadQueued = 0;
+	m_NumSleeping = 0;
+	m_Quit = false;
+	for (int t = 1; t < m_NumThreads; ++t)
+	{
+		m_Threads[t] = thread( &CJobSystem::WorkerThread, this, t );
+	}
+}
+
+// Destructor stops the worker threads. All jobs must have finished
+CJobSystem::~CJobSystem()
+{
+	{
+		unique_lock<mutex> lock( m_SleepLock );
+		m_Quit = true;
+	}
+	m_WakeSignal.notify_all();
+	for (int t = 1; t < m_NumThreads; ++t)
+	{
+		m_Threads[t].join();
+	}
+}
+
+
+/////////////////////////////
+// Jobs
+
+// Start a job, counted by the given counter. If a dependency is given and is not yet done, the job is held back. The dependency
+// is checked again once the held jobs are locked - the last job of the dependency releases held jobs after its counter reaches
+// zero, so either that sees this job or this sees the zero
+void CJobSystem::Run( const JobFunction& job, CJobCounter& counter, const CJobCounter* dependency /*= NULL*/ )
+{
+	SJob newJob;
+	newJob.function = job;
+	newJob.counter = &counter;
+	newJob.mainThread = false;
+	newJob.workerThread = false;
+	++counter.m_Count;
+
+	if (dependency && !dependency->IsDone())
+	{
+		unique_lock<mutex> lock( m_HeldLock );
+		if (!dependency->IsDone())
+		{
+			SHeldJob heldJob;
+			heldJob.job = newJob;
+			heldJob.dependency = dependency;
+			m_HeldJobs.push_back( heldJob );
+			return;
+		}
+	}
+	Queue( newJob );
+}
+
+// Start a job that may only run on the main thread
+void CJobSystem::RunOnMainThread( const JobFunction& job, CJobCounter& counter )
+{
+	SJob newJob;
+	newJob.function = job;
+	newJob.counter = &counter;
+	newJob.mainThread = true;
+	newJob.workerThread = false;
+	++counter.m_Count;
+	Queue( newJob );
+}
+
+// Start a job that may only run on a worker thread
+void CJobSystem::RunOnWorkerThread( const JobFunction& job, CJobCounter& counter )
+{
+	SJob newJob;
+	newJob.function = job;
+	newJob.counter = &counter;
+	newJob.mainThread = false;
+	newJob.workerThread = (m_NumThreads > 1); // Otherwise nothing could run it
+	++counter.m_Count;
+	Queue( newJob );
+}
+
+// Wait until the jobs counted by the counter are done, running other jobs meanwhile. If there are none to run, sleep until a job is
+// queued or a counter is done
+void CJobSystem::Wait( CJobCounter& counter )
+{
+	int index = GetQueueIndex();
+	bool mainThread = (this_thread::get_id() == m_MainThread);
+	while (!counter.IsDone())
+	{
+		SJob job;
+		if (FindJob( index, mainThread, job ))
+		{
+			RunJob( job );
+			continue;
+		}
+
+		unique_lock<mutex> lock( m_SleepLock );
+		++m_NumSleeping;
+		while (!counter.IsDone() && m_NumQueued == 0 && !(mainThread ? m_NumMainThreadQueued > 0 : m_NumWorkerThreadQueued > 0))
+		{
+			m_WakeSignal.wait( lock );
+		}
+		--m_NumSleeping;
+	}
+}
+
+// Run any jobs waiting for the main thread
+void CJobSystem::RunMainThreadJobs()
+{
+	if (this_thread::get_id() != m_MainThread) return;
+
+	SJob job;
+	while (m_NumMainThreadQueued > 0 && FindJob( 0, true, job )) // Only this thread takes main thread jobs, so one is found first
+	{
+		RunJob( job );
+	}
+}
+
+// Call body( first, last ) for ranges of at most grainSize indices, spread over the threads. All but the first range are queued,
+// then the calling thread runs the first and waits for the rest - running them itself, last first, unless other threads steal
+// them from the front of its queue
+void CJobSystem::ParallelFor( int begin, int end, int grainSize, const function<void( int first, int last )>& body )
+{
+	if (end <= begin) return;
+	if (grainSize < 1) grainSize = 1;
+
+	CJobCounter counter;
+	for (int first = begin + grainSize; first < end; first += grainSize)
+	{
+		int last = min( first + grainSize, end );
+		Run( [&body, first, last]() { body( first, last ); }, counter );
+	}
+	body( begin, min( begin + grainSize, end ) );
+	Wait( counter );
+}
+
+
+/////////////////////////////
+// Threads
+
+// Index of the calling thread, 0 for the main thread and threads that are not part of a job system
+int CJobSystem::GetThreadIndex()
+{
+	return s_ThreadIndex;
+}
+
+// Index of the calling thread's queue - 0 for any thread that is not one of this job system's workers
+int CJobSystem::GetQueueIndex() const
+{
+	return (s_ThreadJobSystem == this) ? s_ThreadIndex : 0;
+}
+
+
+/////////////////////////////
+// Private functions
+
+// Worker thread function - runs jobs, sleeping when there are none to find
+void CJobSystem::WorkerThread( int index )
+{
+	s_ThreadIndex = index;
+	s_ThreadJobSystem = this;
+	PROFILE_THREAD_NAME( ("Job worker " + to_string( index )).c_str() );
+	while (true)
+	{
+		SJob job;
+		if (FindJob( index, false, job ))
+		{
+			RunJob( job );
+			continue;
+		}
+
+		unique_lock<mutex> lock( m_SleepLock );
+		++m_NumSleeping;
+		while (!m_Quit && m_NumQueued == 0 && m_NumWorkerThreadQueued == 0)
+		{
+			m_WakeSignal.wait( lock );
+		}
+		--m_NumSleeping;
+		if (m_Quit)
+		{
+			return;
+		}
+	}
+}
+
+// Add a job to the calling thread's queue, or the main thread's job queue, and wake a thread to run it. The count of queued jobs
+// is raised before the count of sleeping threads is read, and sleeping threads do the opposite, so one side always sees the other
+void CJobSystem::Queue( const SJob& job )
+{
+	if (job.mainThread)
+	{
+		{
+			unique_lock<mutex> lock( m_MainThreadJobs.lock );
+			m_MainThreadJobs.jobs.push_back( job );
+		}
+		++m_NumMainThreadQueued;
+		Wake( true ); // Only the main thread can run it, so make sure it is woken
+		return;
+	}
+	if (job.workerThread)
+	{
+		{
+			unique_lock<mutex> lock( m_WorkerThreadJobs.lock );
+			m_WorkerThreadJobs.jobs.push_back( job );
+		}
+		++m_NumWorkerThreadQueued;
+		Wake( true ); // A sleeping main thread could take the only signal and go back to sleep, so wake every thread
+		return;
+	}
+
+	SJobQueue& queue = m_Queues[GetQueueIndex()];
+	{
+		unique_lock<mutex> lock( queue.lock );
+		queue.jobs.push_back( job );
+	}
+	++m_NumQueued;
+	Wake( false );
+}
+
+// Find a job for the given thread to run - from the main thread queue if it is the main thread, or the worker thread queue if not
+// (these jobs are usually long, so are started first), then from the back of its own queue, then by stealing from the front of the
+// other queues, starting with the next thread's
+bool CJobSystem::FindJob( int index, bool mainThread, SJob& job )
+{
+	if (mainThread && m_NumMainThreadQueued > 0)
+	{
+		unique_lock<mutex> lock( m_MainThreadJobs.lock );
+		if (!m_MainThreadJobs.jobs.empty())
+		{
+			job = m_MainThreadJobs.jobs.front();
+			m_MainThreadJobs.jobs.pop_front();
+			--m_NumMainThreadQueued;
+			return true;
+		}
+	}
+	if (!mainThread && m_NumWorkerThreadQueued > 0)
+	{
+		unique_lock<mutex> lock( m_WorkerThreadJobs.lock );
+		if (!m_WorkerThreadJobs.jobs.empty())
+		{
+			job = m_WorkerThreadJobs.jobs.front();
+			m_WorkerThreadJobs.jobs.pop_front();
+			--m_NumWorkerThreadQueued;
+			return true;
+		}
+	}
+
+	if (m_NumQueued == 0) return false;
+	{
+		SJobQueue& queue = m_Queues[index];
+		unique_lock<mutex> lock( queue.lock );
+		if (!queue.jobs.empty())
+		{
+			job = queue.jobs.back();
+			queue.jobs.pop_back();
+			--m_NumQueued;
+			return true;
+		}
+	}
+	for (int t = 1; t < m_NumThreads; ++t)
+	{
+		SJobQueue& queue = m_Queues[(index + t) % m_NumThreads];
+		unique_lock<mutex> lock( queue.lock );
+		if (!queue.jobs.empty())
+		{
+			job = queue.jobs.front();
+			queue.jobs.pop_front();
+			--m_NumQueued;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Run a job and count it as finished. The last job of a counter starts any jobs held back waiting for it, and wakes threads that
+// may be waiting for it
+void CJobSystem::RunJob( SJob& job )
+{
+	job.function();
+	if (--job.counter->m_Count == 0)
+	{
+		ReleaseHeldJobs( job.counter );
+		Wake( true );
+	}
+}
+
+// Start the held jobs that depend on a counter that is done
+void CJobSystem::ReleaseHeldJobs( const CJobCounter* counter )
+{
+	SJob released[16];
+	int numReleased;
+	do
+	{
+		// Released jobs are queued after the lock is let go, a few at a time
+		numReleased = 0;
+		{
+			unique_lock<mutex> lock( m_HeldLock );
+			for (size_t i = 0; i < m_HeldJobs.size() && numReleased < 16; )
+			{
+				if (m_HeldJobs[i].dependency == counter)
+				{
+					released[numReleased++] = m_HeldJobs[i].job;
+					m_HeldJobs.erase( m_HeldJobs.begin() + i );
+				}
+				else
+				{
+					++i;
+				}
+			}
+		}
+		for (int i = 0; i < numReleased; ++i)
+		{
+			Queue( released[i] );
+		}
+	} while (numReleased == 16);
+}
+
+// Wake sleeping threads - one if a job is queued for any thread, all if something else has changed (a counter is done or a job
+// is queued for the main thread). Nothing is done if no thread is asleep
+void CJobSystem::Wake( bool all )
+{
+	if (m_NumSleeping == 0) return;
+
+	unique_lock<mutex> lock( m_SleepLock );
+	if (all)
+	{
+		m_WakeSignal.notify_all();
+	}
+	else
+	{
+		m_WakeSignal.notify_one();
+	}
+}
+
+
+/////////////////////////////
+// Benchmark
+
+// Time starting and waiting for the given number of empty jobs, then time a parallel for loop with job systems of one thread up
+// to one per core. Each item of the loop is a little arithmetic written to its own result, so the results can be compared
+SJobSystemBenchmark CJobSystem::Benchmark( unsigned int numJobs, int numLoopItems )
+{
+	SJobSystemBenchmark results;
+	results.numJobs = numJobs;
+	results.identical = true;
+
+	{
+		CJobSystem jobs;
+		CJobCounter counter;
+		CTimer timer;
+		timer.Start();
+		for (unsigned int job = 0; job < numJobs; ++job)
+		{
+			jobs.Run( [](){}, counter );
+		}
+		jobs.Wait( counter );
+		results.spawnTime = (numJobs > 0) ? timer.GetTime() / numJobs : 0.0f;
+	}
+
+	vector<float> firstResults( numLoopItems );
+	vector<float> loopResults( numLoopItems );
+	auto loopBody = [&loopResults]( int first, int last )
+	{
+		for (int item = first; item < last; ++item)
+		{
+			float value = static_cast<float>(item);
+			for (int step = 0; step < 1000; ++step)
+			{
+				value = sqrtf( value * value + 1.0f ) * 0.999f;
+			}
+			loopResults[item] = value;
+		}
+	};
+
+	int maxThreads = min( max( static_cast<int>(thread::hardware_concurrency()), 1 ), MAX_THREADS );
+	for (int numThreads = 1; numThreads <= maxThreads; ++numThreads)
+	{
+		CJobSystem jobs( numThreads );
+		CTimer timer;
+		timer.Start();
+		jobs.ParallelFor( 0, numLoopItems, 16, loopBody );
+		results.loopTimes.push_back( timer.GetTime() );
+
+		if (numThreads == 1)
+		{
+			firstResults = loopResults;
+		}
+		else if (loopResults != firstResults)
+		{
+			results.identical = false;
+		}
+	}
+	return results;
+}
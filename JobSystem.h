@@ -0,0 +1,218 @@
+//--------------------------------------------------------------------------------------
+//	JobSystem.h
+//
+//	Shares work out between a fixed set of threads. Work is split into small jobs, each
+//	thread keeps its own queue of jobs and threads with nothing to do take jobs from the
+//	others' queues (work stealing)
+//--------------------------------------------------------------------------------------
+
+#ifndef JOB_SYSTEM_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define JOB_SYSTEM_H_INCLUDED
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+using namespace std;
+
+
+// Counts jobs started and not yet finished. Each job is given a counter when it is started, which is used to wait for the jobs
+// (CJobSystem::Wait) or to hold back other jobs until they are done (their dependencies). A counter can be reused once it is done,
+// but must not be destroyed while its jobs are running or other jobs depend on it
+class CJobCounter
+{
+	friend class CJobSystem;
+
+private:
+	atomic<int> m_Count;
+
+public:
+	CJobCounter() : m_Count( 0 ) {}
+
+	bool IsDone() const
+	{
+		return m_Count == 0;
+	}
+
+private:
+	// Disallow copying - jobs keep pointers to their counters
+	CJobCounter( const CJobCounter& );
+	CJobCounter& operator=( const CJobCounter& );
+};
+
+
+// Results of CJobSystem::Benchmark
+struct SJobSystemBenchmark
+{
+	unsigned int  numJobs;
+	float         spawnTime; // Seconds to start and run one empty job, averaged over all the jobs
+	vector<float> loopTimes; // Seconds for the same parallel for loop with 1, 2, 3... threads, up to one per core
+	bool          identical; // Did the loop give exactly the same results with every number of threads
+};
+
+
+// The thread creating the job system is its main thread, the others are worker threads. Each thread has its own queue (a deque):
+// a thread adds jobs to the back of its own queue and runs jobs from the back, so it tends to work on what it has just started
+// while its data is still in the cache. A thread whose queue is empty steals from the front of another queue, taking the oldest
+// job, which for a split up loop is the largest remaining piece of work. Worker threads with no jobs to find sleep until more are
+// started. A thread waiting for jobs to finish runs other jobs meanwhile rather than sleeping, so jobs may start and wait for
+// other jobs without tying up a thread. Jobs that must run on the main thread (e.g. those calling the Direct3D device) have a
+// queue of their own that only the main thread runs. Long jobs that the main thread must not pick up while it waits for something
+// else (e.g. the next frame's update, while the main thread renders) have another queue that only worker threads run. Jobs should
+// not block on anything other than CJobSystem::Wait
+class CJobSystem
+{
+/////////////////////////////
+// Public types and constants
+public:
+
+	typedef function<void()> JobFunction;
+
+	static const int MAX_THREADS = 64;
+
+
+/////////////////////////////
+// Private types and member variables
+private:
+
+	struct SJob
+	{
+		JobFunction  function;
+		CJobCounter* counter;
+		bool         mainThread;   // Only the main thread may run the job
+		bool         workerThread; // Only a worker thread may run the job
+	};
+
+	// Queue of each thread, index 0 is the main thread's. Threads that are not part of the job system also use queue 0
+	struct SJobQueue
+	{
+		mutex       lock;
+		deque<SJob> jobs;
+	};
+	int       m_NumThreads;
+	SJobQueue m_Queues[MAX_THREADS];
+	thread    m_Threads[MAX_THREADS]; // Index 0 unused
+
+	// Jobs that only the main thread runs, and jobs that only worker threads run
+	thread::id m_MainThread;
+	SJobQueue  m_MainThreadJobs;
+	SJobQueue  m_WorkerThreadJobs;
+
+	// Jobs held back until a counter is done, with the counter they depend on
+	struct SHeldJob
+	{
+		SJob               job;
+		const CJobCounter* dependency;
+	};
+	mutex            m_HeldLock;
+	vector<SHeldJob> m_HeldJobs;
+
+	// Idle threads sleep until jobs are queued, a counter is done or the system is shutting down. The counts let threads adding
+	// jobs or finishing counters skip the signal when nobody is asleep
+	mutex              m_SleepLock;
+	condition_variable m_WakeSignal;
+	atomic<int>        m_NumQueued;
+	atomic<int>        m_NumMainThreadQueued;
+	atomic<int>        m_NumWorkerThreadQueued;
+	atomic<int>        m_NumSleeping;
+	bool               m_Quit;
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	// Constructor starts the worker threads. The number of threads includes the main thread (the one calling this), zero means
+	// one per core
+	CJobSystem( int numThreads = 0 );
+
+	// Destructor stops the worker threads. All jobs must have finished
+	~CJobSystem();
+
+
+	/////////////////////////////
+	// Jobs
+
+	// Start a job, counted by the given counter. If a dependency is given, the job is held back until that counter is done
+	void Run( const JobFunction& job, CJobCounter& counter, const CJobCounter* dependency = NULL );
+
+	// Start a job that may only run on the main thread, which runs it next time it waits for jobs or calls RunMainThreadJobs
+	void RunOnMainThread( const JobFunction& job, CJobCounter& counter );
+
+	// Start a job that may only run on a worker thread, so the main thread never runs it while waiting for other jobs. With no worker
+	// threads it is started as a normal job
+	void RunOnWorkerThread( const JobFunction& job, CJobCounter& counter );
+
+	// Wait until the jobs counted by the counter are done, running other jobs meanwhile
+	void Wait( CJobCounter& counter );
+
+	// Run any jobs waiting for the main thread. Only call from the main thread
+	void RunMainThreadJobs();
+
+	// Call body( first, last ) for ranges covering the indices from begin to end - 1, each of at most grainSize indices, spread
+	// over the threads. Returns when all the ranges are done. The calling thread works on them too
+	void ParallelFor( int begin, int end, int grainSize, const function<void( int first, int last )>& body );
+
+
+	/////////////////////////////
+	// Threads
+
+	// Number of threads, including the main thread
+	int GetNumThreads() const
+	{
+		return m_NumThreads;
+	}
+
+	// Index of the calling thread, 0 for the main thread (and threads that are not part of the job system) and 1 up for worker
+	// threads. Lets jobs use per-thread working space - a thread only runs one job at a time, apart from jobs it runs while
+	// waiting, which must not be using the same space
+	static int GetThreadIndex();
+
+
+	/////////////////////////////
+	// Benchmark
+
+	// Time starting and waiting for the given number of empty jobs, then time a parallel for loop over the given number of items
+	// (each a little arithmetic) with job systems of one thread up to one per core
+	static SJobSystemBenchmark Benchmark( unsigned int numJobs, int numLoopItems );
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	// Worker thread function - runs jobs, sleeping when there are none to find
+	void WorkerThread( int index );
+
+	// Add a job to the calling thread's queue, or the main thread's job queue, and wake a thread to run it
+	void Queue( const SJob& job );
+
+	// Find a job for the given thread to run - from the main thread queue if it is the main thread (or the worker thread queue if
+	// not), then its own queue, then by stealing from the other queues. Returns false if there are no jobs
+	bool FindJob( int index, bool mainThread, SJob& job );
+
+	// Index of the calling thread's queue
+	int GetQueueIndex() const;
+
+	// Run a job and count it as finished, then start any jobs that were waiting for its counter
+	void RunJob( SJob& job );
+
+	// Start the held jobs that depend on a counter that is done
+	void ReleaseHeldJobs( const CJobCounter* counter );
+
+	// Wake sleeping threads - one if a job is queued for any thread, all if something else has changed
+	void Wake( bool all );
+
+	// Disallow copying - the class owns threads
+	CJobSystem( const CJobSystem& );
+	CJobSystem& operator=( const CJobSystem& );
+};
+
+
+#endif // End of header guard - see top of file
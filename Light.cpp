@@ -1,5 +1,6 @@
 
 #include "Light.h"
+#include "LightAnimator.h" // OrbitOffset
 #include "CImportXFile.h"    // Class to load meshes (taken from a full graphics engine)
 using namespace gen;
 D3DXVECTOR3 CLight::GetColour()
@@ -100,6 +101,16 @@ void CLight::SetConeAngle(float coneAngle)
 	m_ConeAngle = coneAngle;
 }
 
+float CLight::GetInfluenceRadius()
+{
+	return m_InfluenceRadius;
+}
+
+void CLight::SetInfluenceRadius(float influenceRadius)
+{
+	m_InfluenceRadius = influenceRadius;
+}
+
 // Make the model face a given point
 //void CLight::FacePoint(D3DXVECTOR3 point)
 //{
@@ -126,54 +137,45 @@ D3DXMATRIXA16 CLight::CalculateLightProjMatrix()
 	D3DXMATRIXA16 projMatrix;
 
 	// Create a projection matrix for the light. Use the spotlight cone angle as an FOV, just set default values for everything else.
-	D3DXMatrixPerspectiveFovLH(&projMatrix, ToRadians(this->m_ConeAngle), 1, 0.1f, 1000.0f);
+	D3DXMatrixPerspectiveFovLH(&projMatrix, ToRadians(this->m_ConeAngle), 1, 0.1f, m_ShadowRange);
 
 	return projMatrix;
 }
 
-ID3D10EffectVectorVariable* CLight::GetFacingVar()
+// Get the frustum of the spot light's "camera" - used to cull models that cannot cast a shadow into the shadow map
+CFrustum CLight::CalculateLightFrustum()
 {
-	return m_FacingVar;
+	CFrustum frustum;
+	D3DXMATRIXA16 viewProjMatrix = CalculateLightViewMatrix() * CalculateLightProjMatrix();
+	frustum.ExtractFromMatrix(viewProjMatrix);
+	return frustum;
 }
 
-void CLight::SetFacingVar(ID3D10EffectVectorVariable* facingVar)
+// Test if a bounding sphere is at least partly inside the spot light's cone (up to the shadow range). The light frustum is a
+// square pyramid around the cone, so this is tighter - it rejects models in the corners of the frustum that the light never reaches.
+// Find the distance from the sphere centre to the nearest point on the cone's surface: split the offset from the light into
+// distances along and away from the light's facing axis, then rotate by the half angle to measure across the cone surface
+bool CLight::IsSphereInCone(const D3DXVECTOR3& centre, float radius)
 {
-	m_FacingVar = facingVar;
-}
-
-ID3D10EffectMatrixVariable* CLight::GetViewMatrixVar()
-{
-	return m_ViewMatrixVar;
-}
-
-void CLight::SetViewMatrixVar(ID3D10EffectMatrixVariable* viewMatrix)
-{
-	m_ViewMatrixVar = viewMatrix;
-}
-
-ID3D10EffectMatrixVariable* CLight::GetProjMatrixVar()
-{
-	return m_ProjMatrixVar;
-}
-
-void CLight::SetProjMatrixVar(ID3D10EffectMatrixVariable* projMatrix)
-{
-	m_ProjMatrixVar = projMatrix;
-}
-
-ID3D10EffectScalarVariable* CLight::GetConeAngleVar()
-{
-	return m_ConeAngleVar;
-}
+	D3DXVECTOR3 facing = GetFacing();
+	D3DXVECTOR3 offset = centre - GetWorldPosition();
+	float alongAxis = D3DXVec3Dot(&offset, &facing);
+	if (alongAxis < -radius || alongAxis > m_ShadowRange + radius)
+	{
+		return false; // Behind the light or beyond its range
+	}
 
-void CLight::SetConeAngleVar(ID3D10EffectScalarVariable* coneAngleVar)
-{
-	m_ConeAngleVar = coneAngleVar;
+	float distanceSq = D3DXVec3LengthSq(&offset);
+	float awayFromAxisSq = distanceSq - alongAxis * alongAxis;
+	float awayFromAxis = (awayFromAxisSq > 0.0f) ? sqrtf(awayFromAxisSq) : 0.0f;
+	float halfAngle = ToRadians(m_ConeAngle * 0.5f);
+	float distanceFromCone = cosf(halfAngle) * awayFromAxis - sinf(halfAngle) * alongAxis;
+	return distanceFromCone <= radius;
 }
 
 void CLight::OrbitAround(CModel* model, float frameTime)
 {
-	SetPosition(model->GetPosition() + D3DXVECTOR3(cos(m_CubeLightRotate) * GetOrbitRadius(), 5, sin(m_CubeLightRotate) * GetOrbitRadius()));
+	SetPosition(model->GetPosition() + OrbitOffset(m_CubeLightRotate, GetOrbitRadius(), 5.0f)); // Shared with CLightAnimator
 	m_CubeLightRotate -= GetOrbitSpeed() * frameTime;
 }
 
@@ -10,11 +10,9 @@ private:
     float m_OrbitSpeed = 0.7f;
     int m_FSM = 1;
     float m_ConeAngle = 90.0f;
+    float m_ShadowRange = 1000.0f; // Far clip distance of the light's "camera" when rendering shadows
+    float m_InfluenceRadius = 150.0f; // Distance beyond which the light's contribution is insignificant - sizes its shadow atlas tile
     float m_CubeLightRotate = 0.0f;
-    ID3D10EffectVectorVariable* m_FacingVar = NULL;
-    ID3D10EffectMatrixVariable* m_ViewMatrixVar = NULL;
-    ID3D10EffectMatrixVariable* m_ProjMatrixVar = NULL;
-    ID3D10EffectScalarVariable* m_ConeAngleVar = NULL;
 public:
     D3DXVECTOR3 GetColour();
     void SetColour(D3DXVECTOR3 colour);
@@ -28,14 +26,10 @@ public:
     void CLight::SetConeAngle(float coneAngle);
     D3DXMATRIXA16 CLight::CalculateLightViewMatrix();
     D3DXMATRIXA16 CLight::CalculateLightProjMatrix();
-    ID3D10EffectVectorVariable* CLight::GetFacingVar();
-    void CLight::SetFacingVar(ID3D10EffectVectorVariable* facingVar);
-    ID3D10EffectMatrixVariable* CLight::GetViewMatrixVar();
-    void CLight::SetViewMatrixVar(ID3D10EffectMatrixVariable* viewMatrix);
-    ID3D10EffectMatrixVariable* CLight::GetProjMatrixVar();
-    void CLight::SetProjMatrixVar(ID3D10EffectMatrixVariable* projMatrix);
-    ID3D10EffectScalarVariable* CLight::GetConeAngleVar();
-    void CLight::SetConeAngleVar(ID3D10EffectScalarVariable* coneAngleVar);
+    float CLight::GetInfluenceRadius();
+    void CLight::SetInfluenceRadius(float influenceRadius);
+    CFrustum CLight::CalculateLightFrustum();
+    bool CLight::IsSphereInCone(const D3DXVECTOR3& centre, float radius);
     void CLight::OrbitAround(CModel* model, float frameTime);
 };
 
@@ -0,0 +1,364 @@
+//--------------------------------------------------------------------------------------
+//	LightAnimator.cpp
+//
+//	Animates the colours and orbits of many lights at once - the same animations as
+//	CLight::Pulsate, CLight::ChangeColour and CLight::OrbitAround, stored as structure
+//	of arrays and advanced four lights at a time with SSE
+//--------------------------------------------------------------------------------------
+
+#include <cstring>
+#include <emmintrin.h> // SSE2 intrinsics - integer compares are needed for the states
+
+#include "Defines.h"       // General definitions shared by all source files
+#include "CTimer.h"        // Timer class - not DirectX
+#include "Light.h"         // The per-object animations, for the benchmark
+#include "LightAnimator.h" // Declaration of this class
+
+
+// Random number from min to max, for the benchmark
+static float RandomRange( float min, float max )
+{
+	return min + (max - min) * rand() / static_cast<float>(RAND_MAX);
+}
+
+// Pick a from lanes where the mask is set and b from the others
+static inline __m128 Select( __m128 mask, __m128 a, __m128 b )
+{
+	return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) );
+}
+static inline __m128i Select( __m128i mask, __m128i a, __m128i b )
+{
+	return _mm_or_si128( _mm_and_si128( mask, a ), _mm_andnot_si128( mask, b ) );
+}
+
+// Mask of the lanes in the given state
+static inline __m128 StateMask( __m128i state, int value )
+{
+	return _mm_castsi128_ps( _mm_cmpeq_epi32( state, _mm_set1_epi32( value ) ) );
+}
+
+// Make room for one more light in a set of arrays, adding four padding lights if the arrays are full. Padding lights have a state
+// that matches nothing, so they never change
+static void AddSlot( vector<float>* arrays[], int numArrays, vector<int>* states, unsigned int numUsed )
+{
+	if (numUsed % 4 != 0) return;
+	for (int array = 0; array < numArrays; ++array)
+	{
+		arrays[array]->resize( numUsed + 4, 0.0f );
+	}
+	if (states) states->resize( numUsed + 4, -1 );
+}
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+CLightAnimator::CLightAnimator()
+{
+	m_NumPulses = 0;
+	m_NumCycles = 0;
+	m_NumOrbits = 0;
+}
+
+
+/////////////////////////////
+// Adding lights
+
+// Add a light pulsing between the given colours, returning its index. Speed scales the colour speed passed to Update. The initial
+// state matches a new CLight
+int CLightAnimator::AddPulse( const D3DXVECTOR3& colour, const D3DXVECTOR3& minColour, const D3DXVECTOR3& maxColour,
+                              float speed /*= 1.0f*/, int state /*= 1*/ )
+{
+	vector<float>* arrays[] = { &m_PulseR, &m_PulseG, &m_PulseB, &m_PulseMinR, &m_PulseMinG, &m_PulseMinB,
+	                            &m_PulseMaxR, &m_PulseMaxG, &m_PulseMaxB, &m_PulseSpeed };
+	AddSlot( arrays, sizeof(arrays) / sizeof(arrays[0]), &m_PulseState, m_NumPulses );
+
+	unsigned int pulse = m_NumPulses++;
+	m_PulseR[pulse] = colour.x;
+	m_PulseG[pulse] = colour.y;
+	m_PulseB[pulse] = colour.z;
+	m_PulseMinR[pulse] = minColour.x;
+	m_PulseMinG[pulse] = minColour.y;
+	m_PulseMinB[pulse] = minColour.z;
+	m_PulseMaxR[pulse] = maxColour.x;
+	m_PulseMaxG[pulse] = maxColour.y;
+	m_PulseMaxB[pulse] = maxColour.z;
+	m_PulseSpeed[pulse] = speed;
+	m_PulseState[pulse] = state;
+	return pulse;
+}
+
+// Add a light cycling through colours, returning its index
+int CLightAnimator::AddCycle( const D3DXVECTOR3& colour, float speed /*= 1.0f*/, int state /*= 1*/ )
+{
+	vector<float>* arrays[] = { &m_CycleR, &m_CycleG, &m_CycleB, &m_CycleSpeed };
+	AddSlot( arrays, sizeof(arrays) / sizeof(arrays[0]), &m_CycleState, m_NumCycles );
+
+	unsigned int cycle = m_NumCycles++;
+	m_CycleR[cycle] = colour.x;
+	m_CycleG[cycle] = colour.y;
+	m_CycleB[cycle] = colour.z;
+	m_CycleSpeed[cycle] = speed;
+	m_CycleState[cycle] = state;
+	return cycle;
+}
+
+// Add a light circling a centre point at the given radius and height above the centre, returning its index. The angle goes down
+// by speed radians per second, as in CLight::OrbitAround
+int CLightAnimator::AddOrbit( const D3DXVECTOR3& centre, float radius, float height, float speed, float angle /*= 0.0f*/ )
+{
+	vector<float>* arrays[] = { &m_CentreX, &m_CentreY, &m_CentreZ, &m_Radius, &m_Height, &m_OrbitSpeed, &m_Angle,
+	                            &m_PositionX, &m_PositionY, &m_PositionZ, &m_PreviousX, &m_PreviousY, &m_PreviousZ };
+	AddSlot( arrays, sizeof(arrays) / sizeof(arrays[0]), NULL, m_NumOrbits );
+
+	unsigned int orbit = m_NumOrbits++;
+	SetOrbitCentre( orbit, centre );
+	m_Radius[orbit] = radius;
+	m_Height[orbit] = height;
+	m_OrbitSpeed[orbit] = speed;
+	m_Angle[orbit] = angle;
+	D3DXVECTOR3 position = centre + OrbitOffset( angle, radius, height );
+	m_PositionX[orbit] = m_PreviousX[orbit] = position.x;
+	m_PositionY[orbit] = m_PreviousY[orbit] = position.y;
+	m_PositionZ[orbit] = m_PreviousZ[orbit] = position.z;
+	return orbit;
+}
+
+// Move the centre of an orbit, e.g. to follow a model
+void CLightAnimator::SetOrbitCentre( int orbit, const D3DXVECTOR3& centre )
+{
+	m_CentreX[orbit] = centre.x;
+	m_CentreY[orbit] = centre.y;
+	m_CentreZ[orbit] = centre.z;
+}
+
+
+/////////////////////////////
+// Update
+
+// Advance every animation by one frame. The colour speed is the value passed to CLight::Pulsate / ChangeColour
+void CLightAnimator::Update( float colourUpdateSpeed, float frameTime )
+{
+	UpdatePulses( colourUpdateSpeed );
+	UpdateCycles( colourUpdateSpeed );
+	UpdateOrbits( frameTime );
+}
+
+// CLight::Pulsate - state 0 brightens all three components until they are all above the maximum colour, then state 1 dims them
+// until they are all below the minimum
+void CLightAnimator::UpdatePulses( float colourUpdateSpeed )
+{
+	const __m128 colourSpeed = _mm_set1_ps( colourUpdateSpeed );
+	const __m128 half = _mm_set1_ps( 0.5f );
+	for (unsigned int i = 0; i < m_PulseState.size(); i += 4)
+	{
+		__m128i state = _mm_loadu_si128( reinterpret_cast<const __m128i*>(&m_PulseState[i]) );
+		__m128 rising  = StateMask( state, 0 );
+		__m128 falling = StateMask( state, 1 );
+
+		// The light's speed is applied first, as by a caller passing a faster speed to Pulsate
+		__m128 step = _mm_mul_ps( half, _mm_mul_ps( colourSpeed, _mm_loadu_ps( &m_PulseSpeed[i] ) ) );
+
+		__m128 r = _mm_loadu_ps( &m_PulseR[i] );
+		__m128 g = _mm_loadu_ps( &m_PulseG[i] );
+		__m128 b = _mm_loadu_ps( &m_PulseB[i] );
+		r = Select( rising, _mm_add_ps( r, step ), Select( falling, _mm_sub_ps( r, step ), r ) );
+		g = Select( rising, _mm_add_ps( g, step ), Select( falling, _mm_sub_ps( g, step ), g ) );
+		b = Select( rising, _mm_add_ps( b, step ), Select( falling, _mm_sub_ps( b, step ), b ) );
+		_mm_storeu_ps( &m_PulseR[i], r );
+		_mm_storeu_ps( &m_PulseG[i], g );
+		_mm_storeu_ps( &m_PulseB[i], b );
+
+		__m128 aboveMax = _mm_and_ps( _mm_and_ps( _mm_cmpgt_ps( r, _mm_loadu_ps( &m_PulseMaxR[i] ) ),
+		                                          _mm_cmpgt_ps( g, _mm_loadu_ps( &m_PulseMaxG[i] ) ) ),
+		                                          _mm_cmpgt_ps( b, _mm_loadu_ps( &m_PulseMaxB[i] ) ) );
+		__m128 belowMin = _mm_and_ps( _mm_and_ps( _mm_cmplt_ps( r, _mm_loadu_ps( &m_PulseMinR[i] ) ),
+		                                          _mm_cmplt_ps( g, _mm_loadu_ps( &m_PulseMinG[i] ) ) ),
+		                                          _mm_cmplt_ps( b, _mm_loadu_ps( &m_PulseMinB[i] ) ) );
+		__m128i toFalling = _mm_castps_si128( _mm_and_ps( rising, aboveMax ) );
+		__m128i toRising  = _mm_castps_si128( _mm_and_ps( falling, belowMin ) );
+		state = Select( toFalling, _mm_set1_epi32( 1 ), Select( toRising, _mm_setzero_si128(), state ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>(&m_PulseState[i]), state );
+	}
+}
+
+// CLight::ChangeColour - six states, each raising or lowering one or two components until one of them passes 0 or 5, then moving
+// on to the next state. The change for every state is worked out and each light keeps the one for its own state
+void CLightAnimator::UpdateCycles( float colourUpdateSpeed )
+{
+	const __m128 colourSpeed = _mm_set1_ps( colourUpdateSpeed );
+	const __m128 half = _mm_set1_ps( 0.5f );
+	const __m128 quarter = _mm_set1_ps( 0.25f );
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 five = _mm_set1_ps( 5.0f );
+	for (unsigned int i = 0; i < m_CycleState.size(); i += 4)
+	{
+		__m128i state = _mm_loadu_si128( reinterpret_cast<const __m128i*>(&m_CycleState[i]) );
+		__m128 inState[6];
+		for (int s = 0; s < 6; ++s)
+		{
+			inState[s] = StateMask( state, s );
+		}
+
+		__m128 speed = _mm_mul_ps( colourSpeed, _mm_loadu_ps( &m_CycleSpeed[i] ) );
+		__m128 halfStep = _mm_mul_ps( half, speed );
+		__m128 quarterStep = _mm_mul_ps( quarter, speed );
+
+		// Each component is only touched in the states that change it, so the others keep exactly their old value
+		__m128 r = _mm_loadu_ps( &m_CycleR[i] );
+		__m128 g = _mm_loadu_ps( &m_CycleG[i] );
+		__m128 b = _mm_loadu_ps( &m_CycleB[i] );
+		r = Select( inState[0], _mm_sub_ps( r, halfStep ),
+		    Select( inState[1], _mm_add_ps( r, halfStep ),
+		    Select( inState[3], _mm_sub_ps( r, quarterStep ), r ) ) );
+		g = Select( inState[2], _mm_sub_ps( g, halfStep ),
+		    Select( inState[3], _mm_add_ps( g, halfStep ),
+		    Select( inState[5], _mm_sub_ps( g, quarterStep ), g ) ) );
+		b = Select( inState[4], _mm_sub_ps( b, halfStep ),
+		    Select( inState[5], _mm_add_ps( b, halfStep ), b ) );
+		_mm_storeu_ps( &m_CycleR[i], r );
+		_mm_storeu_ps( &m_CycleG[i], g );
+		_mm_storeu_ps( &m_CycleB[i], b );
+
+		// Even states end when their component drops below 0, odd states when it rises above 5
+		__m128 done = _mm_or_ps( _mm_or_ps( _mm_and_ps( inState[0], _mm_cmplt_ps( r, zero ) ),
+		                                    _mm_and_ps( inState[1], _mm_cmpgt_ps( r, five ) ) ),
+		              _mm_or_ps( _mm_or_ps( _mm_and_ps( inState[2], _mm_cmplt_ps( g, zero ) ),
+		                                    _mm_and_ps( inState[3], _mm_cmpgt_ps( g, five ) ) ),
+		                         _mm_or_ps( _mm_and_ps( inState[4], _mm_cmplt_ps( b, zero ) ),
+		                                    _mm_and_ps( inState[5], _mm_cmpgt_ps( b, five ) ) ) ) );
+		__m128i nextState = _mm_andnot_si128( _mm_castps_si128( inState[5] ), _mm_add_epi32( state, _mm_set1_epi32( 1 ) ) );
+		state = Select( _mm_castps_si128( done ), nextState, state );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>(&m_CycleState[i]), state );
+	}
+}
+
+// CLight::OrbitAround - place each light on its circle then move its angle on, keeping the last positions as the previous ones. The
+// sines and cosines are taken from the C library as OrbitOffset does - an SSE approximation would be quicker but would not match
+// it to the bit
+void CLightAnimator::UpdateOrbits( float frameTime )
+{
+	const __m128 time = _mm_set1_ps( frameTime );
+	for (unsigned int i = 0; i < m_Angle.size(); i += 4)
+	{
+		float cosAngle[4];
+		float sinAngle[4];
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			cosAngle[lane] = cosf( m_Angle[i + lane] );
+			sinAngle[lane] = sinf( m_Angle[i + lane] );
+		}
+
+		__m128 radius = _mm_loadu_ps( &m_Radius[i] );
+		__m128 x = _mm_add_ps( _mm_loadu_ps( &m_CentreX[i] ), _mm_mul_ps( _mm_loadu_ps( cosAngle ), radius ) );
+		__m128 y = _mm_add_ps( _mm_loadu_ps( &m_CentreY[i] ), _mm_loadu_ps( &m_Height[i] ) );
+		__m128 z = _mm_add_ps( _mm_loadu_ps( &m_CentreZ[i] ), _mm_mul_ps( _mm_loadu_ps( sinAngle ), radius ) );
+		_mm_storeu_ps( &m_PreviousX[i], _mm_loadu_ps( &m_PositionX[i] ) );
+		_mm_storeu_ps( &m_PreviousY[i], _mm_loadu_ps( &m_PositionY[i] ) );
+		_mm_storeu_ps( &m_PreviousZ[i], _mm_loadu_ps( &m_PositionZ[i] ) );
+		_mm_storeu_ps( &m_PositionX[i], x );
+		_mm_storeu_ps( &m_PositionY[i], y );
+		_mm_storeu_ps( &m_PositionZ[i], z );
+
+		__m128 angle = _mm_sub_ps( _mm_loadu_ps( &m_Angle[i] ), _mm_mul_ps( _mm_loadu_ps( &m_OrbitSpeed[i] ), time ) );
+		_mm_storeu_ps( &m_Angle[i], angle );
+	}
+}
+
+
+/////////////////////////////
+// Benchmark
+
+// Time animating the given number of lights for a number of frames, a third each pulsing, cycling at single speed and cycling at
+// double speed, and all orbiting one of a few centre models. The same lights are also animated one CLight at a time, the way the
+// scene used to, and the colours and positions compared bit for bit
+SLightAnimatorBenchmark CLightAnimator::Benchmark( unsigned int numLights, int numFrames )
+{
+	const D3DXVECTOR3 MinColour( 0.0f, 0.0f, 0.0f );
+	const D3DXVECTOR3 MaxColour( 5.0f, 0.0f, 3.5f );
+	const float OrbitHeight = 5.0f; // As used by CLight::OrbitAround
+	const int NumCentres = 16;
+
+	srand( 1 );
+	CModel centres[NumCentres];
+	for (int centre = 0; centre < NumCentres; ++centre)
+	{
+		centres[centre].SetPosition( D3DXVECTOR3( RandomRange( -100.0f, 100.0f ), 0.0f, RandomRange( -100.0f, 100.0f ) ) );
+	}
+
+	// Uneven frame times, the same for both runs
+	vector<float> frameTimes( numFrames );
+	for (int frame = 0; frame < numFrames; ++frame)
+	{
+		frameTimes[frame] = RandomRange( 0.005f, 0.05f );
+	}
+
+	CLight* lights = new CLight[numLights];
+	CLightAnimator animator;
+	vector<int> colours( numLights ), orbits( numLights );
+	for (unsigned int light = 0; light < numLights; ++light)
+	{
+		D3DXVECTOR3 colour( RandomRange( 0.0f, 5.0f ), RandomRange( 0.0f, 5.0f ), RandomRange( 0.0f, 5.0f ) );
+		lights[light].SetColour( colour );
+		if (light % 3 == 0)
+		{
+			colours[light] = animator.AddPulse( colour, MinColour, MaxColour );
+		}
+		else
+		{
+			colours[light] = animator.AddCycle( colour, (light % 3 == 1) ? 1.0f : 2.0f );
+		}
+		orbits[light] = animator.AddOrbit( centres[light % NumCentres].GetPosition(), lights[light].GetOrbitRadius(), OrbitHeight,
+		                                   lights[light].GetOrbitSpeed() );
+	}
+
+	// One light at a time
+	CTimer timer;
+	timer.Start();
+	for (int frame = 0; frame < numFrames; ++frame)
+	{
+		float colourUpdateSpeed = 5.0f * frameTimes[frame];
+		for (unsigned int light = 0; light < numLights; ++light)
+		{
+			switch (light % 3)
+			{
+			case 0:
+				lights[light].Pulsate( MinColour, MaxColour, colourUpdateSpeed );
+				break;
+			case 1:
+				lights[light].ChangeColour( colourUpdateSpeed );
+				break;
+			default:
+				lights[light].ChangeColour( colourUpdateSpeed * 2 );
+				break;
+			}
+			lights[light].OrbitAround( &centres[light % NumCentres], frameTimes[frame] );
+		}
+	}
+	float objectTime = timer.GetTime();
+
+	// All together
+	timer.Start();
+	for (int frame = 0; frame < numFrames; ++frame)
+	{
+		animator.Update( 5.0f * frameTimes[frame], frameTimes[frame] );
+	}
+	float batchTime = timer.GetTime();
+
+	SLightAnimatorBenchmark results;
+	results.numLights = numLights;
+	results.batchTime = (numFrames > 0) ? batchTime / numFrames : 0.0f;
+	results.objectTime = (numFrames > 0) ? objectTime / numFrames : 0.0f;
+	results.identical = true;
+	for (unsigned int light = 0; light < numLights && results.identical; ++light)
+	{
+		D3DXVECTOR3 colour = (light % 3 == 0) ? animator.GetPulseColour( colours[light] ) : animator.GetCycleColour( colours[light] );
+		D3DXVECTOR3 objectColour = lights[light].GetColour();
+		D3DXVECTOR3 position = animator.GetOrbitPosition( orbits[light] );
+		D3DXVECTOR3 objectPosition = lights[light].GetPosition();
+		results.identical = (memcmp( &colour, &objectColour, sizeof(D3DXVECTOR3) ) == 0 &&
+		                     memcmp( &position, &objectPosition, sizeof(D3DXVECTOR3) ) == 0);
+	}
+	delete[] lights;
+	return results;
+}
@@ -0,0 +1,151 @@
+//--------------------------------------------------------------------------------------
+//	LightAnimator.h
+//
+//	Animates the colours and orbits of many lights at once - the same animations as
+//	CLight::Pulsate, CLight::ChangeColour and CLight::OrbitAround, stored as structure
+//	of arrays and advanced four lights at a time with SSE
+//--------------------------------------------------------------------------------------
+
+#ifndef LIGHT_ANIMATOR_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define LIGHT_ANIMATOR_H_INCLUDED
+
+#include <cmath>
+#include <vector>
+using namespace std;
+
+#include <d3dx10.h>
+
+
+// Offset of an orbiting light from the centre of its orbit at the given angle. CLight::OrbitAround and CLightAnimator both use
+// this so an orbit gives exactly the same positions either way
+inline D3DXVECTOR3 OrbitOffset( float angle, float radius, float height )
+{
+	return D3DXVECTOR3( cosf( angle ) * radius, height, sinf( angle ) * radius );
+}
+
+// Results of CLightAnimator::Benchmark
+struct SLightAnimatorBenchmark
+{
+	unsigned int numLights;
+	float        batchTime;  // Seconds per frame to update every light with CLightAnimator, averaged
+	float        objectTime; // Seconds per frame to update every light one CLight at a time, averaged
+	bool         identical;  // Did both give exactly the same colours and positions
+};
+
+
+// Each light animation is a small state machine (see CLight). Updating one light at a time, the switch on its state is a branch
+// the CPU can't predict when neighbouring lights are in different states. Here each kind of animation keeps its own arrays of
+// colours, states, speeds and so on, and four lights are updated at once: every state's change is calculated for all four and the
+// one matching each light's state is picked out with masks, so there are no branches at all. The calculations are exactly those of
+// the CLight functions in the same order, so the results are identical to the bit. Lights are added once and referred to by index.
+// Arrays are padded to a multiple of four with lights that never change state
+class CLightAnimator
+{
+/////////////////////////////
+// Private member variables
+private:
+
+	// Lights pulsing between two colours (CLight::Pulsate)
+	vector<float> m_PulseR, m_PulseG, m_PulseB;
+	vector<float> m_PulseMinR, m_PulseMinG, m_PulseMinB;
+	vector<float> m_PulseMaxR, m_PulseMaxG, m_PulseMaxB;
+	vector<float> m_PulseSpeed; // Multiplies the speed passed to Update
+	vector<int>   m_PulseState;
+	unsigned int  m_NumPulses;
+
+	// Lights cycling through colours (CLight::ChangeColour)
+	vector<float> m_CycleR, m_CycleG, m_CycleB;
+	vector<float> m_CycleSpeed;
+	vector<int>   m_CycleState;
+	unsigned int  m_NumCycles;
+
+	// Lights circling a centre point (CLight::OrbitAround). Positions are those at the start of the last update, as OrbitAround
+	// places the light before advancing its angle. The positions from the update before are kept to blend between the two
+	vector<float> m_CentreX, m_CentreY, m_CentreZ;
+	vector<float> m_Radius, m_Height, m_OrbitSpeed, m_Angle;
+	vector<float> m_PositionX, m_PositionY, m_PositionZ;
+	vector<float> m_PreviousX, m_PreviousY, m_PreviousZ;
+	unsigned int  m_NumOrbits;
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	CLightAnimator();
+
+
+	/////////////////////////////
+	// Adding lights
+
+	// Add a light pulsing between the given colours, returning its index. Speed scales the colour speed passed to Update. The
+	// initial state matches a new CLight
+	int AddPulse( const D3DXVECTOR3& colour, const D3DXVECTOR3& minColour, const D3DXVECTOR3& maxColour, float speed = 1.0f,
+	              int state = 1 );
+
+	// Add a light cycling through colours, returning its index
+	int AddCycle( const D3DXVECTOR3& colour, float speed = 1.0f, int state = 1 );
+
+	// Add a light circling a centre point at the given radius and height above the centre, returning its index. The angle goes
+	// down by speed radians per second, as in CLight::OrbitAround
+	int AddOrbit( const D3DXVECTOR3& centre, float radius, float height, float speed, float angle = 0.0f );
+
+	// Move the centre of an orbit, e.g. to follow a model
+	void SetOrbitCentre( int orbit, const D3DXVECTOR3& centre );
+
+
+	/////////////////////////////
+	// Update
+
+	// Advance every animation by one frame. The colour speed is the value passed to CLight::Pulsate / ChangeColour
+	void Update( float colourUpdateSpeed, float frameTime );
+
+
+	/////////////////////////////
+	// Results
+
+	D3DXVECTOR3 GetPulseColour( int pulse ) const
+	{
+		return D3DXVECTOR3( m_PulseR[pulse], m_PulseG[pulse], m_PulseB[pulse] );
+	}
+	D3DXVECTOR3 GetCycleColour( int cycle ) const
+	{
+		return D3DXVECTOR3( m_CycleR[cycle], m_CycleG[cycle], m_CycleB[cycle] );
+	}
+	D3DXVECTOR3 GetOrbitPosition( int orbit ) const
+	{
+		return D3DXVECTOR3( m_PositionX[orbit], m_PositionY[orbit], m_PositionZ[orbit] );
+	}
+
+	// Orbit position blended between the last two updates - blend 0 gives the previous update's position, 1 the last (see
+	// CFramePipeline)
+	D3DXVECTOR3 GetOrbitPosition( int orbit, float blend ) const
+	{
+		return D3DXVECTOR3( m_PreviousX[orbit] + (m_PositionX[orbit] - m_PreviousX[orbit]) * blend,
+		                    m_PreviousY[orbit] + (m_PositionY[orbit] - m_PreviousY[orbit]) * blend,
+		                    m_PreviousZ[orbit] + (m_PositionZ[orbit] - m_PreviousZ[orbit]) * blend );
+	}
+
+
+	/////////////////////////////
+	// Benchmark
+
+	// Time animating the given number of lights for a number of frames, a third each pulsing, cycling at single speed and cycling
+	// at double speed, and all orbiting. The same lights are also animated one CLight at a time and the results compared
+	static SLightAnimatorBenchmark Benchmark( unsigned int numLights, int numFrames );
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	void UpdatePulses( float colourUpdateSpeed );
+	void UpdateCycles( float colourUpdateSpeed );
+	void UpdateOrbits( float frameTime );
+};
+
+
+#endif // End of header guard - see top of file
@@ -0,0 +1,365 @@
+//--------------------------------------------------------------------------------------
+//	LightClusters.cpp
+//
+//	Clustered light assignment - the view frustum is divided into a grid of small boxes
+//	(clusters) and each cluster is given a list of the lights that reach it. Runs on
+//	the CPU only, no GPU resources are used
+//--------------------------------------------------------------------------------------
+
+#include <cmath>
+#include <algorithm>
+#include <xmmintrin.h> // SSE intrinsics
+
+#include "Defines.h"       // General definitions shared by all source files
+#include "CTimer.h"        // Timer class - not DirectX
+#include "JobSystem.h"     // Shares work out between threads
+#include "LightClusters.h" // Declaration of this class
+
+
+const float CLightClusterGrid::MIN_SLICE_DEPTH = 1.0f;
+
+// Light indices are 16-bit, lights beyond this are left out
+static const unsigned int MAX_CLUSTER_LIGHTS = 65536;
+
+// Random number from min to max, for the benchmark
+static float RandomRange( float min, float max )
+{
+	return min + (max - min) * rand() / static_cast<float>(RAND_MAX);
+}
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+// Constructor
+CLightClusterGrid::CLightClusterGrid()
+{
+	m_TilesX = 0;
+	m_TilesY = 0;
+	m_SliceScale = 0.0f;
+	m_SliceBias = 0.0f;
+	m_ProjX = 0.0f;
+	m_ProjY = 0.0f;
+	m_NearClip = 0.0f;
+	m_FarClip = 0.0f;
+	m_ViewportWidth = 0;
+	m_ViewportHeight = 0;
+	for (int slice = 0; slice < NUM_SLICES; ++slice)
+	{
+		m_SliceNear[slice] = 0.0f;
+		m_SliceFar[slice] = 0.0f;
+	}
+	D3DXMatrixIdentity( &m_ViewMatrix );
+	m_NumLights = 0;
+	m_BuildTime = 0.0f;
+}
+
+
+/////////////////////////////
+// Building
+
+// Set the view to build clusters for. The cluster bounds are only recalculated if the projection or viewport have changed
+void CLightClusterGrid::SetView( const D3DXMATRIX& viewMatrix, const D3DXMATRIX& projMatrix, float nearClip, float farClip,
+                                 int viewportWidth, int viewportHeight )
+{
+	m_ViewMatrix = viewMatrix;
+	if (projMatrix._11 == m_ProjX && projMatrix._22 == m_ProjY && nearClip == m_NearClip && farClip == m_FarClip &&
+	    viewportWidth == m_ViewportWidth && viewportHeight == m_ViewportHeight)
+	{
+		return;
+	}
+	m_ProjX = projMatrix._11;
+	m_ProjY = projMatrix._22;
+	m_NearClip = nearClip;
+	m_FarClip = farClip;
+	m_ViewportWidth = viewportWidth;
+	m_ViewportHeight = viewportHeight;
+	m_TilesX = (viewportWidth + TILE_SIZE - 1) / TILE_SIZE;
+	m_TilesY = (viewportHeight + TILE_SIZE - 1) / TILE_SIZE;
+
+	// Slices are spaced evenly in log2(depth) from MIN_SLICE_DEPTH to the far clip. The first slice reaches in to the near clip
+	float sliceStart = max( nearClip, MIN_SLICE_DEPTH );
+	float sliceEnd = max( farClip, sliceStart * 2.0f );
+	m_SliceScale = NUM_SLICES / log2f( sliceEnd / sliceStart );
+	m_SliceBias = -log2f( sliceStart ) * m_SliceScale;
+	for (int slice = 0; slice < NUM_SLICES; ++slice)
+	{
+		m_SliceNear[slice] = (slice == 0) ? nearClip : sliceStart * powf( sliceEnd / sliceStart, static_cast<float>(slice) / NUM_SLICES );
+		m_SliceFar[slice] = (slice == NUM_SLICES - 1) ? farClip : sliceStart * powf( sliceEnd / sliceStart, static_cast<float>(slice + 1) / NUM_SLICES );
+	}
+
+	// A tile's edges in view space are x = ndcX * depth / projX and y = ndcY * depth / projY, so the box around the tile between
+	// two depths has its corners at one depth or the other
+	int numClusters = GetNumClusters();
+	m_MinX.resize( numClusters );
+	m_MaxX.resize( numClusters );
+	m_MinY.resize( numClusters );
+	m_MaxY.resize( numClusters );
+	m_ClusterRanges.resize( numClusters );
+	for (int slice = 0; slice < NUM_SLICES; ++slice)
+	{
+		float nearDepth = m_SliceNear[slice];
+		float farDepth = m_SliceFar[slice];
+		for (int tileY = 0; tileY < m_TilesY; ++tileY)
+		{
+			float ndcTop = 1.0f - 2.0f * tileY * TILE_SIZE / viewportHeight;
+			float ndcBottom = 1.0f - 2.0f * (tileY + 1) * TILE_SIZE / viewportHeight;
+			for (int tileX = 0; tileX < m_TilesX; ++tileX)
+			{
+				float ndcLeft = 2.0f * tileX * TILE_SIZE / viewportWidth - 1.0f;
+				float ndcRight = 2.0f * (tileX + 1) * TILE_SIZE / viewportWidth - 1.0f;
+
+				int cluster = (slice * m_TilesY + tileY) * m_TilesX + tileX;
+				m_MinX[cluster] = min( ndcLeft * nearDepth, ndcLeft * farDepth ) / m_ProjX;
+				m_MaxX[cluster] = max( ndcRight * nearDepth, ndcRight * farDepth ) / m_ProjX;
+				m_MinY[cluster] = min( ndcBottom * nearDepth, ndcBottom * farDepth ) / m_ProjY;
+				m_MaxY[cluster] = max( ndcTop * nearDepth, ndcTop * farDepth ) / m_ProjY;
+			}
+		}
+	}
+}
+
+// Make the light list of every cluster from the given world space lights. The lists hold indices into this array
+void CLightClusterGrid::Build( const SLightSource* lights, unsigned int numLights )
+{
+	CTimer timer;
+	timer.Start();
+
+	// Move the lights into view space
+	m_NumLights = min( numLights, MAX_CLUSTER_LIGHTS );
+	m_LightX.resize( m_NumLights );
+	m_LightY.resize( m_NumLights );
+	m_LightZ.resize( m_NumLights );
+	m_LightRange.resize( m_NumLights );
+	m_LightFacing.resize( m_NumLights );
+	m_LightCosHalfAngle.resize( m_NumLights );
+	for (unsigned int light = 0; light < m_NumLights; ++light)
+	{
+		D3DXVECTOR3 viewPos;
+		D3DXVec3TransformCoord( &viewPos, &lights[light].position, &m_ViewMatrix );
+		m_LightX[light] = viewPos.x;
+		m_LightY[light] = viewPos.y;
+		m_LightZ[light] = viewPos.z;
+		m_LightRange[light] = lights[light].range;
+		D3DXVec3TransformNormal( &m_LightFacing[light], &lights[light].facing, &m_ViewMatrix );
+		m_LightCosHalfAngle[light] = lights[light].cosHalfAngle;
+	}
+
+	// Share out the slices between the job system's threads, each using its own working space. Without a job system (e.g. in the
+	// tests) the slices are all processed on this thread
+	if (g_JobSystem)
+	{
+		if (m_SliceLights.size() < static_cast<unsigned int>(g_JobSystem->GetNumThreads()))
+		{
+			m_SliceLights.resize( g_JobSystem->GetNumThreads() );
+		}
+		g_JobSystem->ParallelFor( 0, NUM_SLICES, 1, [this]( int first, int last )
+		{
+			for (int slice = first; slice < last; ++slice)
+			{
+				ProcessSlice( slice, m_SliceLights[CJobSystem::GetThreadIndex()] );
+			}
+		} );
+	}
+	else
+	{
+		if (m_SliceLights.empty())
+		{
+			m_SliceLights.resize( 1 );
+		}
+		for (int slice = 0; slice < NUM_SLICES; ++slice)
+		{
+			ProcessSlice( slice, m_SliceLights[0] );
+		}
+	}
+
+	// Join the slices' lists in slice order
+	m_LightIndices.clear();
+	int clustersPerSlice = m_TilesX * m_TilesY;
+	for (int slice = 0; slice < NUM_SLICES; ++slice)
+	{
+		UINT sliceStart = static_cast<UINT>(m_LightIndices.size());
+		for (int cluster = slice * clustersPerSlice; cluster < (slice + 1) * clustersPerSlice; ++cluster)
+		{
+			m_ClusterRanges[cluster].start += sliceStart;
+		}
+		m_LightIndices.insert( m_LightIndices.end(), m_SliceIndices[slice].begin(), m_SliceIndices[slice].end() );
+	}
+
+	m_BuildTime = timer.GetTime();
+}
+
+
+// Build the light lists of one slice
+void CLightClusterGrid::ProcessSlice( int slice, SSliceLights& sliceLights )
+{
+	float nearDepth = m_SliceNear[slice];
+	float farDepth = m_SliceFar[slice];
+
+	// Gather the lights overlapping the slice's depth range, padded to a multiple of four with lights that reach nothing (a
+	// negative squared range fails every test)
+	sliceLights.index.clear();
+	sliceLights.x.clear();
+	sliceLights.y.clear();
+	sliceLights.z.clear();
+	sliceLights.rangeSq.clear();
+	for (unsigned int light = 0; light < m_NumLights; ++light)
+	{
+		float range = m_LightRange[light];
+		if (m_LightZ[light] + range >= nearDepth && m_LightZ[light] - range <= farDepth)
+		{
+			sliceLights.index.push_back( static_cast<unsigned short>(light) );
+			sliceLights.x.push_back( m_LightX[light] );
+			sliceLights.y.push_back( m_LightY[light] );
+			sliceLights.z.push_back( m_LightZ[light] );
+			sliceLights.rangeSq.push_back( range * range );
+		}
+	}
+	unsigned int numSliceLights = static_cast<unsigned int>(sliceLights.index.size());
+	while (sliceLights.rangeSq.size() % 4 != 0)
+	{
+		sliceLights.index.push_back( 0 );
+		sliceLights.x.push_back( 0.0f );
+		sliceLights.y.push_back( 0.0f );
+		sliceLights.z.push_back( 0.0f );
+		sliceLights.rangeSq.push_back( -1.0f );
+	}
+
+	// Test the lights against each cluster box in the slice, four at a time. The distance from a sphere's centre to a box along
+	// each axis is how far the centre is below the box minimum or above the maximum (at most one is positive). The sphere touches
+	// the box if the squared distance is no more than the squared radius
+	vector<unsigned short>& indices = m_SliceIndices[slice];
+	indices.clear();
+	__m128 zero = _mm_setzero_ps();
+	__m128 minZ = _mm_set1_ps( nearDepth );
+	__m128 maxZ = _mm_set1_ps( farDepth );
+	int firstCluster = slice * m_TilesX * m_TilesY;
+	for (int cluster = firstCluster; cluster < firstCluster + m_TilesX * m_TilesY; ++cluster)
+	{
+		SClusterRange& range = m_ClusterRanges[cluster];
+		range.start = static_cast<UINT>(indices.size());
+		if (numSliceLights > 0)
+		{
+			__m128 minX = _mm_set1_ps( m_MinX[cluster] );
+			__m128 maxX = _mm_set1_ps( m_MaxX[cluster] );
+			__m128 minY = _mm_set1_ps( m_MinY[cluster] );
+			__m128 maxY = _mm_set1_ps( m_MaxY[cluster] );
+
+			// Bounding sphere of the box, for the spot light cone test
+			D3DXVECTOR3 boxCentre( (m_MinX[cluster] + m_MaxX[cluster]) * 0.5f, (m_MinY[cluster] + m_MaxY[cluster]) * 0.5f,
+			                       (nearDepth + farDepth) * 0.5f );
+			D3DXVECTOR3 boxExtent( m_MaxX[cluster] - boxCentre.x, m_MaxY[cluster] - boxCentre.y, farDepth - boxCentre.z );
+			float boxRadius = D3DXVec3Length( &boxExtent );
+
+			for (unsigned int i = 0; i < numSliceLights; i += 4)
+			{
+				__m128 x = _mm_loadu_ps( &sliceLights.x[i] );
+				__m128 y = _mm_loadu_ps( &sliceLights.y[i] );
+				__m128 z = _mm_loadu_ps( &sliceLights.z[i] );
+				__m128 dx = _mm_add_ps( _mm_max_ps( _mm_sub_ps( minX, x ), zero ), _mm_max_ps( _mm_sub_ps( x, maxX ), zero ) );
+				__m128 dy = _mm_add_ps( _mm_max_ps( _mm_sub_ps( minY, y ), zero ), _mm_max_ps( _mm_sub_ps( y, maxY ), zero ) );
+				__m128 dz = _mm_add_ps( _mm_max_ps( _mm_sub_ps( minZ, z ), zero ), _mm_max_ps( _mm_sub_ps( z, maxZ ), zero ) );
+				__m128 distanceSq = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) ), _mm_mul_ps( dz, dz ) );
+				int touching = _mm_movemask_ps( _mm_cmple_ps( distanceSq, _mm_loadu_ps( &sliceLights.rangeSq[i] ) ) );
+				if (touching == 0) continue;
+
+				for (int lane = 0; lane < 4; ++lane)
+				{
+					if ((touching & (1 << lane)) == 0) continue;
+					unsigned short light = sliceLights.index[i + lane];
+
+					// Spot lights - skip clusters outside the cone, as CLight::IsSphereInCone
+					float cosHalfAngle = m_LightCosHalfAngle[light];
+					if (cosHalfAngle > -1.0f)
+					{
+						D3DXVECTOR3 offset( boxCentre.x - m_LightX[light], boxCentre.y - m_LightY[light], boxCentre.z - m_LightZ[light] );
+						float alongAxis = D3DXVec3Dot( &offset, &m_LightFacing[light] );
+						if (alongAxis < -boxRadius) continue;
+						float awayFromAxisSq = D3DXVec3LengthSq( &offset ) - alongAxis * alongAxis;
+						float awayFromAxis = (awayFromAxisSq > 0.0f) ? sqrtf( awayFromAxisSq ) : 0.0f;
+						float sinHalfAngle = sqrtf( max( 1.0f - cosHalfAngle * cosHalfAngle, 0.0f ) );
+						if (cosHalfAngle * awayFromAxis - sinHalfAngle * alongAxis > boxRadius) continue;
+					}
+					indices.push_back( light );
+				}
+			}
+		}
+		range.count = static_cast<UINT>(indices.size()) - range.start;
+	}
+}
+
+
+/////////////////////////////
+// Results
+
+// Number of clusters for a viewport of the given size
+int CLightClusterGrid::CountClusters( int viewportWidth, int viewportHeight )
+{
+	return ((viewportWidth + TILE_SIZE - 1) / TILE_SIZE) * ((viewportHeight + TILE_SIZE - 1) / TILE_SIZE) * NUM_SLICES;
+}
+
+// Slice containing the given view space depth - matches the shaders
+int CLightClusterGrid::GetSlice( float depth ) const
+{
+	int slice = static_cast<int>(floorf( log2f( depth ) * m_SliceScale + m_SliceBias ));
+	return min( max( slice, 0 ), NUM_SLICES - 1 );
+}
+
+
+/////////////////////////////
+// Benchmark
+
+// Time building clusters for a 1080p view of randomly placed point and spot lights (one in four is a spot light), repeated the given
+// number of times. The lists from the last build are compared with the first to check the results don't depend on the threads
+SLightClusterBenchmark CLightClusterGrid::Benchmark( unsigned int numLights, int numBuilds )
+{
+	const int Width = 1920;
+	const int Height = 1080;
+	const float NearClip = 0.1f;
+	const float FarClip = 1000.0f;
+
+	// Camera at the origin facing along z, lights scattered through the view
+	D3DXMATRIX viewMatrix, projMatrix;
+	D3DXMatrixIdentity( &viewMatrix );
+	D3DXMatrixPerspectiveFovLH( &projMatrix, D3DX_PI / 4, static_cast<float>(Width) / Height, NearClip, FarClip );
+
+	srand( 1 );
+	vector<SLightSource> lights( numLights );
+	for (unsigned int light = 0; light < numLights; ++light)
+	{
+		SLightSource& source = lights[light];
+		source.position = D3DXVECTOR3( RandomRange( -200.0f, 200.0f ), RandomRange( -20.0f, 50.0f ), RandomRange( 0.0f, 500.0f ) );
+		source.colour = D3DXVECTOR3( 1.0f, 1.0f, 1.0f );
+		source.range = RandomRange( 5.0f, 30.0f );
+		source.facing = D3DXVECTOR3( RandomRange( -1.0f, 1.0f ), -1.0f, RandomRange( -1.0f, 1.0f ) );
+		D3DXVec3Normalize( &source.facing, &source.facing );
+		source.cosHalfAngle = (light % 4 == 0) ? cosf( ToRadians( 30.0f ) ) : -2.0f;
+		source.shadow = -1;
+	}
+
+	CLightClusterGrid grid;
+	grid.SetView( viewMatrix, projMatrix, NearClip, FarClip, Width, Height );
+	grid.Build( &lights[0], numLights );
+	vector<SClusterRange> firstRanges = grid.GetClusterRanges();
+	vector<unsigned short> firstIndices = grid.GetLightIndices();
+
+	CTimer timer;
+	timer.Start();
+	for (int build = 0; build < numBuilds; ++build)
+	{
+		grid.Build( &lights[0], numLights );
+	}
+
+	SLightClusterBenchmark results;
+	results.numLights = numLights;
+	results.numClusters = grid.GetNumClusters();
+	results.numLightIndices = static_cast<unsigned int>(grid.GetLightIndices().size());
+	results.buildTime = (numBuilds > 0) ? timer.GetTime() / numBuilds : 0.0f;
+	results.deterministic = (grid.GetLightIndices() == firstIndices);
+	for (unsigned int cluster = 0; cluster < firstRanges.size() && results.deterministic; ++cluster)
+	{
+		results.deterministic = (grid.GetClusterRanges()[cluster].start == firstRanges[cluster].start &&
+		                         grid.GetClusterRanges()[cluster].count == firstRanges[cluster].count);
+	}
+	return results;
+}
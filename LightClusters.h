@@ -0,0 +1,210 @@
+//--------------------------------------------------------------------------------------
+//	LightClusters.h
+//
+//	Clustered light assignment - the view frustum is divided into a grid of small boxes
+//	(clusters) and each cluster is given a list of the lights that reach it. Runs on
+//	the CPU only, no GPU resources are used
+//--------------------------------------------------------------------------------------
+
+#ifndef LIGHT_CLUSTERS_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define LIGHT_CLUSTERS_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+#include <d3dx10.h>
+
+
+// A point or spot light as seen by the shaders and the cluster grid
+struct SLightSource
+{
+	D3DXVECTOR3 position;
+	D3DXVECTOR3 colour;
+	float       range;        // The light fades to nothing at this distance
+	D3DXVECTOR3 facing;       // Spot lights only
+	float       cosHalfAngle; // Cosine of half the cone angle, or -2 for point lights (every direction is in the "cone")
+	int         shadow;       // Index of the light's shadow matrix and atlas tile (see SShadowConstants), or -1 for no shadows
+};
+
+// A cluster's light list - a range of the grid's light indices
+struct SClusterRange
+{
+	UINT start;
+	UINT count;
+};
+
+// Results of CLightClusterGrid::Benchmark
+struct SLightClusterBenchmark
+{
+	unsigned int numLights;
+	unsigned int numClusters;
+	unsigned int numLightIndices; // Total length of the clusters' light lists
+	float        buildTime;       // Seconds per build, averaged
+	bool         deterministic;   // Did every build give exactly the same lists
+};
+
+
+// The screen is divided into square tiles of TILE_SIZE pixels, and the depth range of the view into NUM_SLICES slices, each slice
+// further away being thicker than the last (by a constant ratio). A cluster is the part of the view frustum in one tile and one
+// slice - a "froxel". A pixel finds its cluster from its screen position and view space depth, then loops over the cluster's
+// lights only. The shaders work out the cluster the same way as GetSlice and the tile scale below
+//
+// Each cluster's bounds are kept as a view space box, recalculated only when the projection or viewport changes. To build the
+// lists the lights are moved into view space and, for each slice, the lights overlapping the slice's depth range are found. Their
+// spheres are tested against each cluster box in the slice four at a time with SSE, and spot lights that pass are also tested
+// against their cone. Slices are shared out between threads by the job system, each writing its slice's lists separately. The
+// lists are then joined in slice order, so the results never depend on how the work was shared out - the same lights always give
+// the same lists
+class CLightClusterGrid
+{
+/////////////////////////////
+// Public types and constants
+public:
+
+	static const int TILE_SIZE = 64; // Pixels
+	static const int NUM_SLICES = 24;
+
+	// Depth where the logarithmic slices start - slice 0 also covers everything nearer than this
+	static const float MIN_SLICE_DEPTH;
+
+
+/////////////////////////////
+// Private types and member variables
+private:
+
+	// Grid layout
+	int   m_TilesX;
+	int   m_TilesY;
+	float m_SliceScale; // Slice = log2(depth) * scale + bias
+	float m_SliceBias;
+
+	// View the cluster bounds were last calculated for, to tell if they need recalculating
+	float m_ProjX;
+	float m_ProjY;
+	float m_NearClip;
+	float m_FarClip;
+	int   m_ViewportWidth;
+	int   m_ViewportHeight;
+
+	// View space bounds of each cluster, stored "structure of arrays" - mins and maxes for x and y per tile per slice - so that
+	// four lights can be tested against a cluster at once. Depth bounds are per slice
+	vector<float> m_MinX, m_MaxX, m_MinY, m_MaxY;
+	float         m_SliceNear[NUM_SLICES];
+	float         m_SliceFar[NUM_SLICES];
+
+	// Lights for the current build, in view space, structure of arrays. Padded to a multiple of four with lights that reach nothing
+	D3DXMATRIX    m_ViewMatrix;
+	vector<float> m_LightX, m_LightY, m_LightZ, m_LightRange;
+	vector<D3DXVECTOR3> m_LightFacing; // Spot lights only
+	vector<float> m_LightCosHalfAngle;
+	unsigned int  m_NumLights;
+
+	// Per-thread space for the lights overlapping the slice being processed, also structure of arrays. One set for each thread of
+	// the job system, indexed by CJobSystem::GetThreadIndex - sized by Build, as the job system may not exist yet
+	struct SSliceLights
+	{
+		vector<unsigned short> index;
+		vector<float> x, y, z, rangeSq;
+	};
+	vector<SSliceLights> m_SliceLights;
+
+	// Light lists for each slice, written by whichever thread processes the slice. Ranges start from 0 within the slice's list
+	vector<unsigned short> m_SliceIndices[NUM_SLICES];
+
+	// Results - the light list of every cluster, indices into the array of lights given to Build
+	vector<SClusterRange>  m_ClusterRanges;
+	vector<unsigned short> m_LightIndices;
+	float                  m_BuildTime;
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	// Constructor
+	CLightClusterGrid();
+
+
+	/////////////////////////////
+	// Building
+
+	// Set the view to build clusters for. The projection must be a symmetric perspective projection (e.g. from
+	// D3DXMatrixPerspectiveFovLH). The cluster bounds are only recalculated if the projection or viewport have changed
+	void SetView( const D3DXMATRIX& viewMatrix, const D3DXMATRIX& projMatrix, float nearClip, float farClip,
+	              int viewportWidth, int viewportHeight );
+
+	// Make the light list of every cluster from the given world space lights. The lists hold indices into this array
+	void Build( const SLightSource* lights, unsigned int numLights );
+
+
+	/////////////////////////////
+	// Results
+
+	// Number of clusters for a viewport of the given size
+	static int CountClusters( int viewportWidth, int viewportHeight );
+
+	// Slice containing the given view space depth - matches the shaders
+	int GetSlice( float depth ) const;
+
+	int GetTilesX() const
+	{
+		return m_TilesX;
+	}
+	int GetTilesY() const
+	{
+		return m_TilesY;
+	}
+	int GetNumClusters() const
+	{
+		return m_TilesX * m_TilesY * NUM_SLICES;
+	}
+	float GetSliceScale() const
+	{
+		return m_SliceScale;
+	}
+	float GetSliceBias() const
+	{
+		return m_SliceBias;
+	}
+
+	// Clusters are stored row by row within each slice, slice by slice: index = (slice * tilesY + tileY) * tilesX + tileX
+	const vector<SClusterRange>& GetClusterRanges() const
+	{
+		return m_ClusterRanges;
+	}
+	const vector<unsigned short>& GetLightIndices() const
+	{
+		return m_LightIndices;
+	}
+
+	// Time taken by the last build, in seconds
+	float GetBuildTime() const
+	{
+		return m_BuildTime;
+	}
+
+
+	/////////////////////////////
+	// Benchmark
+
+	// Time building clusters for a 1080p view of randomly placed point and spot lights, repeated the given number of times
+	static SLightClusterBenchmark Benchmark( unsigned int numLights, int numBuilds );
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	// Build the light lists of one slice
+	void ProcessSlice( int slice, SSliceLights& sliceLights );
+
+	// Disallow copying - the grid is large and only one is needed
+	CLightClusterGrid( const CLightClusterGrid& );
+	CLightClusterGrid& operator=( const CLightClusterGrid& );
+};
+
+
+#endif // End of header guard - see top of file
@@ -0,0 +1,222 @@
+//--------------------------------------------------------------------------------------
+//	LightManager.cpp
+//
+//	Collects the scene's lights each frame and packs those in view into GPU buffers,
+//	with a list of the lights reaching each light cluster of the view
+//--------------------------------------------------------------------------------------
+
+#include "Defines.h"      // General definitions shared by all source files
+#include "LightManager.h" // Declaration of this class
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+CLightManager::CLightManager()
+{
+	m_MaxLights = 0;
+	m_MaxLightIndices = 0;
+	m_MaxClusters = 0;
+	m_LightBuffer = NULL;
+	m_LightBufferView = NULL;
+	m_ClusterBuffer = NULL;
+	m_ClusterBufferView = NULL;
+	m_IndexBuffer = NULL;
+	m_IndexBufferView = NULL;
+}
+
+CLightManager::~CLightManager()
+{
+	ReleaseResources();
+}
+
+// Create buffers for the given number of lights in view, clusters in a view and total length of the clusters' light lists.
+// Returns false on failure
+bool CLightManager::Create( unsigned int maxLights, unsigned int maxClusters, unsigned int maxLightIndices )
+{
+	ReleaseResources();
+
+	// Light data - FLOAT4S_PER_LIGHT float4s for each light, read in the shader as a Buffer<float4>. D3D10 has no structured
+	// buffers, so the lights are laid out by hand (see the shader file)
+	D3D10_BUFFER_DESC bufferDesc;
+	bufferDesc.BindFlags = D3D10_BIND_SHADER_RESOURCE;
+	bufferDesc.Usage = D3D10_USAGE_DYNAMIC; // Rewritten for every view
+	bufferDesc.ByteWidth = maxLights * FLOAT4S_PER_LIGHT * sizeof(D3DXVECTOR4);
+	bufferDesc.CPUAccessFlags = D3D10_CPU_ACCESS_WRITE;
+	bufferDesc.MiscFlags = 0;
+	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &m_LightBuffer )))
+	{
+		return false;
+	}
+
+	D3D10_SHADER_RESOURCE_VIEW_DESC viewDesc;
+	viewDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	viewDesc.ViewDimension = D3D10_SRV_DIMENSION_BUFFER;
+	viewDesc.Buffer.ElementOffset = 0;
+	viewDesc.Buffer.ElementWidth = maxLights * FLOAT4S_PER_LIGHT;
+	if (FAILED( g_pd3dDevice->CreateShaderResourceView( m_LightBuffer, &viewDesc, &m_LightBufferView )))
+	{
+		return false;
+	}
+
+	// Cluster light lists - the start and length of each cluster's list, read in the shader as a Buffer<uint2>
+	bufferDesc.ByteWidth = maxClusters * sizeof(SClusterRange);
+	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &m_ClusterBuffer )))
+	{
+		return false;
+	}
+
+	viewDesc.Format = DXGI_FORMAT_R32G32_UINT;
+	viewDesc.Buffer.ElementWidth = maxClusters;
+	if (FAILED( g_pd3dDevice->CreateShaderResourceView( m_ClusterBuffer, &viewDesc, &m_ClusterBufferView )))
+	{
+		return false;
+	}
+
+	// The lists themselves - 16-bit indices into the light data, read in the shader as a Buffer<uint>
+	bufferDesc.ByteWidth = maxLightIndices * sizeof(unsigned short);
+	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &m_IndexBuffer )))
+	{
+		return false;
+	}
+
+	viewDesc.Format = DXGI_FORMAT_R16_UINT;
+	viewDesc.Buffer.ElementWidth = maxLightIndices;
+	if (FAILED( g_pd3dDevice->CreateShaderResourceView( m_IndexBuffer, &viewDesc, &m_IndexBufferView )))
+	{
+		return false;
+	}
+
+	m_MaxLights = maxLights;
+	m_MaxClusters = maxClusters;
+	m_MaxLightIndices = maxLightIndices;
+	m_Lights.reserve( maxLights );
+	m_VisibleLights.reserve( maxLights );
+	return true;
+}
+
+void CLightManager::ReleaseResources()
+{
+	SAFE_RELEASE( m_IndexBufferView );
+	SAFE_RELEASE( m_IndexBuffer );
+	SAFE_RELEASE( m_ClusterBufferView );
+	SAFE_RELEASE( m_ClusterBuffer );
+	SAFE_RELEASE( m_LightBufferView );
+	SAFE_RELEASE( m_LightBuffer );
+	m_MaxLights = 0;
+	m_MaxClusters = 0;
+	m_MaxLightIndices = 0;
+}
+
+
+/////////////////////////////
+// Lights
+
+// Remove all lights, ready to add this frame's
+void CLightManager::Clear()
+{
+	m_Lights.clear();
+	m_VisibleLights.clear();
+}
+
+void CLightManager::AddPointLight( const D3DXVECTOR3& position, const D3DXVECTOR3& colour, float range )
+{
+	SLightSource light;
+	light.position = position;
+	light.colour = colour;
+	light.range = range;
+	light.facing = D3DXVECTOR3( 0.0f, 0.0f, 1.0f );
+	light.cosHalfAngle = -2.0f;
+	light.shadow = -1;
+	m_Lights.push_back( light );
+}
+
+void CLightManager::AddSpotLight( const D3DXVECTOR3& position, const D3DXVECTOR3& facing, const D3DXVECTOR3& colour, float range,
+                                  float cosHalfAngle, int shadow /*= -1*/ )
+{
+	SLightSource light;
+	light.position = position;
+	light.colour = colour;
+	light.range = range;
+	D3DXVec3Normalize( &light.facing, &facing );
+	light.cosHalfAngle = cosHalfAngle;
+	light.shadow = shadow;
+	m_Lights.push_back( light );
+}
+
+
+/////////////////////////////
+// Views
+
+// Pack the lights whose range reaches into the given camera's view into the light buffer, then build the light lists of the view's
+// clusters and write them into the cluster buffers. Lights, clusters and list entries beyond the buffers' capacity are left out.
+// Returns false if the buffers can't be written
+bool CLightManager::PrepareView( CCamera* camera, int viewportWidth, int viewportHeight )
+{
+	m_VisibleLights.clear();
+	if (!m_LightBuffer) return false;
+
+	const CFrustum& frustum = camera->GetFrustum();
+	for (unsigned int light = 0; light < m_Lights.size() && m_VisibleLights.size() < m_MaxLights; ++light)
+	{
+		if (frustum.IsSphereVisible( m_Lights[light].position, m_Lights[light].range ))
+		{
+			m_VisibleLights.push_back( m_Lights[light] );
+		}
+	}
+
+	// Discard the previous contents - the GPU may still be reading them for an earlier view, the driver hands back fresh memory
+	if (!m_VisibleLights.empty())
+	{
+		D3DXVECTOR4* data;
+		if (FAILED( m_LightBuffer->Map( D3D10_MAP_WRITE_DISCARD, 0, reinterpret_cast<void**>(&data) )))
+		{
+			return false;
+		}
+		for (unsigned int visible = 0; visible < m_VisibleLights.size(); ++visible)
+		{
+			const SLightSource& light = m_VisibleLights[visible];
+			*data++ = D3DXVECTOR4( light.position, light.range );
+			*data++ = D3DXVECTOR4( light.colour, light.cosHalfAngle );
+			*data++ = D3DXVECTOR4( light.facing, static_cast<float>(light.shadow) );
+		}
+		m_LightBuffer->Unmap();
+	}
+
+	// Assign the packed lights to the view's clusters
+	m_Clusters.SetView( camera->GetViewMatrix(), camera->GetProjectionMatrix(), camera->GetNearClip(), camera->GetFarClip(),
+	                    viewportWidth, viewportHeight );
+	m_Clusters.Build( m_VisibleLights.empty() ? NULL : &m_VisibleLights[0], static_cast<unsigned int>(m_VisibleLights.size()) );
+
+	// Write the clusters' list ranges, cutting short any list that runs past the end of the index buffer
+	const vector<SClusterRange>& ranges = m_Clusters.GetClusterRanges();
+	SClusterRange* rangeData;
+	if (FAILED( m_ClusterBuffer->Map( D3D10_MAP_WRITE_DISCARD, 0, reinterpret_cast<void**>(&rangeData) )))
+	{
+		return false;
+	}
+	unsigned int numClusters = min( static_cast<unsigned int>(ranges.size()), m_MaxClusters );
+	for (unsigned int cluster = 0; cluster < numClusters; ++cluster)
+	{
+		SClusterRange range = ranges[cluster];
+		if (range.start + range.count > m_MaxLightIndices)
+		{
+			range.count = (range.start < m_MaxLightIndices) ? m_MaxLightIndices - range.start : 0;
+		}
+		rangeData[cluster] = range;
+	}
+	m_ClusterBuffer->Unmap();
+
+	const vector<unsigned short>& indices = m_Clusters.GetLightIndices();
+	if (!indices.empty())
+	{
+		unsigned short* indexData;
+		if (FAILED( m_IndexBuffer->Map( D3D10_MAP_WRITE_DISCARD, 0, reinterpret_cast<void**>(&indexData) )))
+		{
+			return false;
+		}
+		memcpy( indexData, &indices[0], min( static_cast<unsigned int>(indices.size()), m_MaxLightIndices ) * sizeof(unsigned short) );
+		m_IndexBuffer->Unmap();
+	}
+	return true;
+}
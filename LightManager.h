@@ -0,0 +1,129 @@
+//--------------------------------------------------------------------------------------
+//	LightManager.h
+//
+//	Collects the scene's lights each frame and packs those in view into GPU buffers,
+//	with a list of the lights reaching each light cluster of the view
+//--------------------------------------------------------------------------------------
+
+#ifndef LIGHT_MANAGER_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define LIGHT_MANAGER_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+#include <d3d10.h>
+#include <d3dx10.h>
+#include "Camera.h"
+#include "LightClusters.h"
+
+
+// Lights are added each frame. Then for each view the lights reaching into the view are packed into a buffer of float4s read by
+// the shaders' LightData (see the shader file for the layout), and assigned to the view's light clusters by a CLightClusterGrid.
+// The clusters' light lists are written into two more buffers - ClusterLights, the start and length of each cluster's list, and
+// LightIndices, the lists themselves. Pixels only loop over the lights in their cluster's list
+class CLightManager
+{
+/////////////////////////////
+// Private member variables
+private:
+
+	// Lights added this frame
+	vector<SLightSource>  m_Lights;
+
+	// Lights in the current view, in the order they are packed into the light buffer
+	vector<SLightSource>  m_VisibleLights;
+
+	// Assigns the lights in view to clusters
+	CLightClusterGrid     m_Clusters;
+
+	// Buffers read by the shaders and the shader resource views used to read them
+	unsigned int              m_MaxLights;
+	unsigned int              m_MaxLightIndices;
+	unsigned int              m_MaxClusters;
+	ID3D10Buffer*             m_LightBuffer;
+	ID3D10ShaderResourceView* m_LightBufferView;
+	ID3D10Buffer*             m_ClusterBuffer;
+	ID3D10ShaderResourceView* m_ClusterBufferView;
+	ID3D10Buffer*             m_IndexBuffer;
+	ID3D10ShaderResourceView* m_IndexBufferView;
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	// Number of float4s used by each light in the light buffer
+	static const unsigned int FLOAT4S_PER_LIGHT = 3;
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	CLightManager();
+	~CLightManager();
+
+	// Create buffers for the given number of lights in view, clusters in a view and total length of the clusters' light lists.
+	// Returns false on failure
+	bool Create( unsigned int maxLights, unsigned int maxClusters, unsigned int maxLightIndices );
+
+	void ReleaseResources();
+
+
+	/////////////////////////////
+	// Lights
+
+	// Remove all lights, ready to add this frame's
+	void Clear();
+
+	void AddPointLight( const D3DXVECTOR3& position, const D3DXVECTOR3& colour, float range );
+	void AddSpotLight( const D3DXVECTOR3& position, const D3DXVECTOR3& facing, const D3DXVECTOR3& colour, float range,
+	                   float cosHalfAngle, int shadow = -1 );
+
+
+	/////////////////////////////
+	// Views
+
+	// Pack the lights whose range reaches into the given camera's view into the light buffer, then build the light lists of the
+	// view's clusters and write them into the cluster buffers. Lights, clusters and list entries beyond the buffers' capacity are
+	// left out. Returns false if the buffers can't be written
+	bool PrepareView( CCamera* camera, int viewportWidth, int viewportHeight );
+
+
+	/////////////////////////////
+	// Data access
+
+	ID3D10ShaderResourceView* GetLightBufferView()
+	{
+		return m_LightBufferView;
+	}
+	ID3D10ShaderResourceView* GetClusterBufferView()
+	{
+		return m_ClusterBufferView;
+	}
+	ID3D10ShaderResourceView* GetIndexBufferView()
+	{
+		return m_IndexBufferView;
+	}
+	const vector<SLightSource>& GetLights()
+	{
+		return m_Lights;
+	}
+	const CLightClusterGrid& GetClusters()
+	{
+		return m_Clusters;
+	}
+	unsigned int GetNumLights()
+	{
+		return static_cast<unsigned int>(m_Lights.size());
+	}
+	unsigned int GetNumVisibleLights()
+	{
+		return static_cast<unsigned int>(m_VisibleLights.size());
+	}
+	unsigned int GetNumLightIndices()
+	{
+		return static_cast<unsigned int>(m_Clusters.GetLightIndices().size());
+	}
+};
+
+
+#endif // End of header guard - see top of file
@@ -6,9 +6,13 @@
 
 #include <windows.h>
 #include <windowsx.h>
+#include <stdio.h>
 #include "resource.h"
 #include "CTimer.h" // Timer class - not DirectX
 #include "Input.h"  // Input functions - not DirectX
+#include "JobSystem.h"     // Shares work out between threads
+#include "FramePipeline.h" // Runs the update and render of consecutive frames at the same time
+#include "Profiler.h"      // CPU profiler, in builds with PROFILE defined
 
 //--------------------------------------------------------------------------------------
 // Global Variables
@@ -18,9 +22,13 @@
 HINSTANCE g_hInst = NULL;
 HWND      g_hWnd = NULL;
 
-// Mouse position
-unsigned int g_MouseX = 0;
-unsigned int g_MouseY = 0;
+// Job system used by all code that shares work between threads - this is the main thread
+CJobSystem* g_JobSystem = NULL;
+
+// The scene is updated in fixed steps of this many seconds, however fast frames are rendered, with at most MaxUpdateSteps steps
+// in one frame (see FramePipeline.h)
+const float UpdateTimeStep = 1.0f / 60.0f;
+const int   MaxUpdateSteps = 5;
 
 
 //--------------------------------------------------------------------------------------
@@ -33,8 +41,12 @@ bool LoadEffectFile();
 bool InitScene();
 void RenderScene();
 void UpdateScene(float updateTime);
+void PublishScene(float blend);
+void GetSceneStatistics(wchar_t* text, int maxChars);
+void GetGPUTimings(vector<SProfileTiming>& timings);
 bool InitWindow(HINSTANCE hInstance, int nCmdShow);
 LRESULT CALLBACK WndProc(HWND, UINT, WPARAM, LPARAM);
+void ReportTimings(const char* heading, const vector<SProfileTiming>& timings);
 
 
 //--------------------------------------------------------------------------------------
@@ -43,24 +55,39 @@ LRESULT CALLBACK WndProc(HWND, UINT, WPARAM, LPARAM);
 //--------------------------------------------------------------------------------------
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLine, int nCmdShow)
 {
-	// Initialise everything in turn
+	PROFILE_THREAD_NAME("Main thread");
+
+	// Initialise everything in turn, starting with the job system's worker threads (one per core)
 	if (!InitWindow(hInstance, nCmdShow))
 	{
 		return 0;
 	}
+	g_JobSystem = new CJobSystem;
 	if (!InitDevice(g_hWnd) || !LoadEffectFile() || !InitScene())
 	{
 		ReleaseResources();
+		delete g_JobSystem;
 		return 0;
 	}
 
 	// Initialise simple input functions (in Input.cpp) - not DirectX
 	InitInput();
 
+	// Each frame the scene is updated, published for rendering and rendered by the frame pipeline (see FramePipeline.h). It starts
+	// pipelined - the update for the next frame runs as a job, on another thread, while this frame renders. Key 5 switches to
+	// running them one after another on this thread and back, to compare frame times. Key 6 switches between the fixed time step
+	// and one update per frame. The scene as set up is published for the first frame
+	CFramePipeline* FramePipeline = new CFramePipeline(UpdateScene, PublishScene, RenderScene, UpdateTimeStep, MaxUpdateSteps);
+	PublishScene(1.0f);
+
 	// Initialise a timer class (in CTimer.h/.cpp, not part of DirectX). It's like a stopwatch - start it counting now
 	CTimer Timer;
 	Timer.Start();
 
+	// Frame rate and scene statistics are shown in the window title, averaged over about a second
+	float statsTime = 0.0f;
+	int   statsFrames = 0;
+
 	// Main message loop
 	MSG msg = { 0 };
 	while (WM_QUIT != msg.message)
@@ -75,12 +102,67 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
 		}
 		else // Otherwise render
 		{
-			RenderScene();
-
 			// Get the time passed since the last frame (since the last time this line was reached) - used so the rendering and update can be
-			// synchronised to real time and won't be dependent on machine speed
+			// synchronised to real time and won't be dependent on machine speed. The update reads a snapshot of the input taken here, as
+			// it runs on another thread while messages may change the live input (see Input.h). The keys below read the same snapshot
 			float frameTime = Timer.GetLapTime();
-			UpdateScene(frameTime);
+			SnapshotInput();
+			FramePipeline->RunFrame(frameTime);
+
+			// Update window title with frame rate and statistics from the scene
+			statsTime += frameTime;
+			++statsFrames;
+			if (statsTime >= 1.0f)
+			{
+				wchar_t stats[1024];
+				wchar_t title[1280];
+				GetSceneStatistics(stats, 1024);
+				SFrameTimings timings = FramePipeline->GetTimings();
+				_snwprintf_s(title, 1280, _TRUNCATE, L"Direct3D 10: Texturing - %.1f fps - %s frames: update %.2fms (%.2f %s steps) render %.2fms frame %.2fms latency %.2fms - %s",
+				             statsFrames / statsTime, FramePipeline->IsPipelined() ? L"Pipelined" : L"Serial", timings.updateTime * 1000.0f,
+				             timings.updateSteps, FramePipeline->GetTimeStep() > 0.0f ? L"fixed" : L"variable", timings.renderTime * 1000.0f,
+				             timings.frameTime * 1000.0f, timings.latency * 1000.0f, stats);
+				SetWindowText(g_hWnd, title);
+				statsTime = 0.0f;
+				statsFrames = 0;
+			}
+
+			// Switch between pipelined and serial frames
+			if (KeyHit(Key_5))
+			{
+				FramePipeline->SetPipelined(!FramePipeline->IsPipelined());
+			}
+
+			// Switch between the fixed time step and one update per frame
+			if (KeyHit(Key_6))
+			{
+				FramePipeline->SetTimeStep(FramePipeline->GetTimeStep() > 0.0f ? 0.0f : UpdateTimeStep, MaxUpdateSteps);
+			}
+
+			// Write a trace of the recent frames from the CPU profiler, to open in Chrome (chrome://tracing), and output the average
+			// time in each profiled scope and the GPU time of each render pass since the last time. Only GPU times without PROFILE
+			if (KeyHit(Key_7))
+			{
+				vector<SProfileTiming> timings;
+#ifdef PROFILE
+				unsigned int numScopes = 0;
+				char text[256];
+				if (CProfiler::WriteTrace("Profile.json", &numScopes))
+				{
+					sprintf_s(text, "Profile trace of %u scopes written to Profile.json\n", numScopes);
+				}
+				else
+				{
+					sprintf_s(text, "Profile trace could not be written\n");
+				}
+				OutputDebugStringA(text);
+
+				CProfiler::GetTimings(timings);
+				ReportTimings("CPU", timings);
+#endif
+				GetGPUTimings(timings);
+				ReportTimings("GPU", timings);
+			}
 
 			// Allow user to quit with escape key
 			if (KeyHit(Key_Escape)) 
@@ -90,8 +172,12 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
 		}
 	}
 
-	// Release all the DirectX resources before leaving
+	// Finish the last update before the scene is released
+	delete FramePipeline;
+
+	// Release all the DirectX resources before leaving, then stop the worker threads
 	ReleaseResources();
+	delete g_JobSystem;
 
 	return (int)msg.wParam;
 }
@@ -187,8 +273,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 		break;
 
 	case WM_MOUSEMOVE:
-		g_MouseX = GET_X_LPARAM(lParam);
-		g_MouseY = GET_Y_LPARAM(lParam);
+		MouseMoveEvent(GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
 		break;
 
 	default:
@@ -197,3 +282,19 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
 	return 0;
 }
+
+
+//--------------------------------------------------------------------------------------
+// Output timings (e.g. from the profiler) to the debugger, one line each
+//--------------------------------------------------------------------------------------
+void ReportTimings(const char* heading, const vector<SProfileTiming>& timings)
+{
+	char text[256];
+	sprintf_s(text, "%s timings per frame:\n", heading);
+	OutputDebugStringA(text);
+	for (unsigned int i = 0; i < timings.size(); ++i)
+	{
+		sprintf_s(text, "  %-40s %8.3fms %6.1f calls\n", timings[i].name, timings[i].time * 1000.0f, timings[i].calls);
+		OutputDebugStringA(text);
+	}
+}
@@ -0,0 +1,339 @@
+//--------------------------------------------------------------------------------------
+//	MeshCache.cpp
+//
+//	Stores imported meshes in a binary cache file, so later loads can skip parsing the
+//	original mesh file. Index and vertex data are compressed with CMeshCodec
+//--------------------------------------------------------------------------------------
+
+#include <windows.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+using namespace std;
+
+#include "MeshCache.h" // Declaration of this class
+#include "MeshCodec.h"
+#include "CTimer.h"
+using namespace gen;
+
+
+// Cache file header, followed by the subsets, the clusters, the vertex data then the index data
+struct SMeshCacheHeader
+{
+	unsigned int    id;
+	unsigned int    version;
+	SMeshCacheStamp source;
+	unsigned int    node;
+	unsigned int    material;
+	unsigned int    flags;
+	unsigned int    numVertices;
+	unsigned int    vertexSize;
+	unsigned int    numIndices;
+	unsigned int    numSubsets;
+	unsigned int    numClusters;
+	unsigned int    vertexDataSize;
+	unsigned int    indexDataSize;
+};
+
+static const unsigned int CacheId = 0x4853454d; // "MESH"
+static const unsigned int CacheVersion = 3;
+
+// Header flags
+static const unsigned int HasSkinningData = 1 << 0;
+static const unsigned int HasNormals = 1 << 1;
+static const unsigned int HasTangents = 1 << 2;
+static const unsigned int HasTextureCoords = 1 << 3;
+static const unsigned int HasVertexColours = 1 << 4;
+static const unsigned int CompressedVertices = 1 << 8;
+static const unsigned int CompressedIndices = 1 << 9;
+
+
+/////////////////////////////
+// Cache files
+
+// Save a sub-mesh made from the given source file, and its clusters, to a cache file
+bool CMeshCache::Save( const string& cacheFileName, const string& sourceFileName, const SSubMesh& subMesh,
+                       const vector<SMeshCluster>& clusters, bool compress /*= true*/ )
+{
+	SMeshCacheStamp stamp;
+	if (!GetSourceStamp( sourceFileName, stamp )) return false;
+
+	vector<unsigned char> data;
+	Write( subMesh, clusters, stamp, compress, data );
+
+	FILE* file;
+	if (fopen_s( &file, cacheFileName.c_str(), "wb" ) != 0) return false;
+	bool written = (fwrite( &data[0], 1, data.size(), file ) == data.size());
+	fclose( file );
+	if (!written) remove( cacheFileName.c_str() ); // Don't leave a partial cache behind
+	return written;
+}
+
+// Load a sub-mesh from a cache file if it exists and was made from the current version of the source file
+bool CMeshCache::Load( const string& cacheFileName, const string& sourceFileName, SSubMesh& subMesh, SMeshCacheStorage& storage )
+{
+	SMeshCacheStamp stamp;
+	if (!GetSourceStamp( sourceFileName, stamp )) return false;
+
+	FILE* file;
+	if (fopen_s( &file, cacheFileName.c_str(), "rb" ) != 0) return false;
+	fseek( file, 0, SEEK_END );
+	long size = ftell( file );
+	fseek( file, 0, SEEK_SET );
+	vector<unsigned char> data( size > 0 ? size : 0 );
+	bool read = (size > 0 && fread( &data[0], 1, size, file ) == static_cast<size_t>(size));
+	fclose( file );
+
+	return read && Read( &data[0], static_cast<unsigned int>(size), &stamp, subMesh, storage );
+}
+
+// Copy a sub-mesh's data into the given storage, pointing the copy at it
+void CMeshCache::Copy( const SSubMesh& subMesh, SSubMesh& copy, SMeshCacheStorage& storage )
+{
+	storage.vertices.assign( subMesh.vertices, subMesh.vertices + subMesh.numVertices * subMesh.vertexSize );
+	storage.faces.assign( subMesh.faces, subMesh.faces + subMesh.numFaces );
+	storage.subsets.assign( subMesh.subsets, subMesh.subsets + subMesh.numSubsets );
+	storage.clusters.clear();
+	copy = subMesh;
+	copy.vertices = storage.vertices.empty() ? NULL : &storage.vertices[0];
+	copy.faces = storage.faces.empty() ? NULL : &storage.faces[0];
+	copy.subsets = storage.subsets.empty() ? NULL : &storage.subsets[0];
+}
+
+// Get the stamp of a source file, returns false if the file doesn't exist
+bool CMeshCache::GetSourceStamp( const string& fileName, SMeshCacheStamp& stamp )
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA( fileName.c_str(), GetFileExInfoStandard, &attributes )) return false;
+	stamp.sizeLow = attributes.nFileSizeLow;
+	stamp.sizeHigh = attributes.nFileSizeHigh;
+	stamp.timeLow = attributes.ftLastWriteTime.dwLowDateTime;
+	stamp.timeHigh = attributes.ftLastWriteTime.dwHighDateTime;
+	return true;
+}
+
+
+/////////////////////////////
+// Cache format
+
+// Write a sub-mesh in the cache file format to memory
+void CMeshCache::Write( const SSubMesh& subMesh, const vector<SMeshCluster>& clusters, const SMeshCacheStamp& stamp, bool compress,
+                        vector<unsigned char>& output )
+{
+	SMeshCacheHeader header;
+	header.id = CacheId;
+	header.version = CacheVersion;
+	header.source = stamp;
+	header.node = subMesh.node;
+	header.material = subMesh.material;
+	header.flags = (subMesh.hasSkinningData ? HasSkinningData : 0) | (subMesh.hasNormals ? HasNormals : 0) |
+	               (subMesh.hasTangents ? HasTangents : 0) | (subMesh.hasTextureCoords ? HasTextureCoords : 0) |
+	               (subMesh.hasVertexColours ? HasVertexColours : 0);
+	header.numVertices = subMesh.numVertices;
+	header.vertexSize = subMesh.vertexSize;
+	header.numIndices = subMesh.numFaces * 3;
+	header.numSubsets = subMesh.numSubsets;
+	header.numClusters = static_cast<unsigned int>(clusters.size());
+
+	const unsigned char* subsetBytes = reinterpret_cast<const unsigned char*>(subMesh.subsets);
+	output.assign( sizeof(header), 0 );
+	output.insert( output.end(), subsetBytes, subsetBytes + header.numSubsets * sizeof(SSubMeshSubset) );
+	if (!clusters.empty())
+	{
+		const unsigned char* clusterBytes = reinterpret_cast<const unsigned char*>(&clusters[0]);
+		output.insert( output.end(), clusterBytes, clusterBytes + header.numClusters * sizeof(SMeshCluster) );
+	}
+	unsigned int vertexStart = static_cast<unsigned int>(output.size());
+
+	// Each stream is compressed only if that makes it smaller - a mesh in a poor order can have indices that don't compress. The
+	// vertex codec works on 32-bit words, other vertex sizes are stored as they are
+	unsigned int rawVertexSize = header.numVertices * header.vertexSize;
+	if (compress && header.vertexSize % 4 == 0)
+	{
+		CMeshCodec::EncodeVertices( subMesh.vertices, header.numVertices, header.vertexSize, output );
+		header.flags |= CompressedVertices;
+	}
+	if (!(header.flags & CompressedVertices) || output.size() - vertexStart >= rawVertexSize)
+	{
+		output.resize( vertexStart );
+		output.insert( output.end(), subMesh.vertices, subMesh.vertices + rawVertexSize );
+		header.flags &= ~CompressedVertices;
+	}
+	header.vertexDataSize = static_cast<unsigned int>(output.size()) - vertexStart;
+
+	const unsigned short* indices = reinterpret_cast<const unsigned short*>(subMesh.faces);
+	unsigned int rawIndexSize = header.numIndices * sizeof(unsigned short);
+	unsigned int indexStart = static_cast<unsigned int>(output.size());
+	if (compress)
+	{
+		CMeshCodec::EncodeIndices( indices, header.numIndices, output );
+		header.flags |= CompressedIndices;
+	}
+	if (!compress || output.size() - indexStart >= rawIndexSize)
+	{
+		output.resize( indexStart );
+		const unsigned char* indexBytes = reinterpret_cast<const unsigned char*>(indices);
+		output.insert( output.end(), indexBytes, indexBytes + rawIndexSize );
+		header.flags &= ~CompressedIndices;
+	}
+	header.indexDataSize = static_cast<unsigned int>(output.size()) - indexStart;
+	memcpy( &output[0], &header, sizeof(header) );
+}
+
+// Read a sub-mesh in the cache file format from memory
+bool CMeshCache::Read( const unsigned char* data, unsigned int dataSize, const SMeshCacheStamp* stamp, SSubMesh& subMesh,
+                       SMeshCacheStorage& storage )
+{
+	SMeshCacheHeader header;
+	if (dataSize < sizeof(header)) return false;
+	memcpy( &header, data, sizeof(header) );
+	if (header.id != CacheId || header.version != CacheVersion) return false;
+	if (stamp && memcmp( &header.source, stamp, sizeof(SMeshCacheStamp) ) != 0) return false;
+	unsigned int subsetDataSize = header.numSubsets * sizeof(SSubMeshSubset);
+	unsigned int clusterDataSize = header.numClusters * sizeof(SMeshCluster);
+	if (header.numIndices % 3 != 0 || header.numSubsets > header.numIndices / 3 + 1 || header.numClusters > header.numIndices / 3 ||
+	    sizeof(header) + subsetDataSize + clusterDataSize + header.vertexDataSize + header.indexDataSize != dataSize) return false;
+
+	vector<unsigned char>& vertexStorage = storage.vertices;
+	vector<SMeshFace>& faceStorage = storage.faces;
+	vertexStorage.resize( header.numVertices * header.vertexSize );
+	faceStorage.resize( header.numIndices / 3 );
+	storage.subsets.resize( header.numSubsets );
+	if (header.numSubsets > 0) memcpy( &storage.subsets[0], data + sizeof(header), subsetDataSize );
+	storage.clusters.resize( header.numClusters );
+	if (header.numClusters > 0) memcpy( &storage.clusters[0], data + sizeof(header) + subsetDataSize, clusterDataSize );
+	for (unsigned int c = 0; c < header.numClusters; ++c)
+	{
+		const SMeshCluster& cluster = storage.clusters[c];
+		if (cluster.startIndex > header.numIndices || cluster.numIndices > header.numIndices - cluster.startIndex) return false;
+	}
+	const unsigned char* vertexData = data + sizeof(header) + subsetDataSize + clusterDataSize;
+	const unsigned char* indexData = vertexData + header.vertexDataSize;
+	unsigned short* indices = reinterpret_cast<unsigned short*>(faceStorage.empty() ? NULL : &faceStorage[0]);
+	if (header.flags & CompressedVertices)
+	{
+		if (vertexStorage.empty() || header.vertexSize % 4 != 0) return false;
+		if (!CMeshCodec::DecodeVertices( vertexData, header.vertexDataSize, &vertexStorage[0], header.numVertices, header.vertexSize )) return false;
+	}
+	else
+	{
+		if (header.vertexDataSize != vertexStorage.size()) return false;
+		if (!vertexStorage.empty()) memcpy( &vertexStorage[0], vertexData, header.vertexDataSize );
+	}
+	if (header.flags & CompressedIndices)
+	{
+		if (faceStorage.empty()) return false;
+		if (!CMeshCodec::DecodeIndices( indexData, header.indexDataSize, indices, header.numIndices )) return false;
+	}
+	else
+	{
+		if (header.indexDataSize != header.numIndices * sizeof(unsigned short)) return false;
+		if (!faceStorage.empty()) memcpy( indices, indexData, header.indexDataSize );
+	}
+
+	subMesh.node = header.node;
+	subMesh.material = header.material;
+	subMesh.numVertices = header.numVertices;
+	subMesh.vertices = vertexStorage.empty() ? NULL : &vertexStorage[0];
+	subMesh.vertexSize = header.vertexSize;
+	subMesh.hasSkinningData = (header.flags & HasSkinningData) != 0;
+	subMesh.hasNormals = (header.flags & HasNormals) != 0;
+	subMesh.hasTangents = (header.flags & HasTangents) != 0;
+	subMesh.hasTextureCoords = (header.flags & HasTextureCoords) != 0;
+	subMesh.hasVertexColours = (header.flags & HasVertexColours) != 0;
+	subMesh.numFaces = header.numIndices / 3;
+	subMesh.faces = faceStorage.empty() ? NULL : &faceStorage[0];
+	subMesh.numSubsets = header.numSubsets;
+	subMesh.subsets = storage.subsets.empty() ? NULL : &storage.subsets[0];
+	return true;
+}
+
+
+/////////////////////////////
+// Benchmark
+
+// Time reading a library of synthetic meshes from cache files in memory, compressed and uncompressed. Each mesh is a bumpy grid of
+// a random size with positions, normals and UVs, typical of imported models. Reading from memory measures only the cost of the
+// format - the time to read the files from disk would be in proportion to their total size
+SMeshCacheBenchmark CMeshCache::Benchmark( unsigned int numMeshes )
+{
+	SMeshCacheBenchmark results;
+	memset( &results, 0, sizeof(results) );
+	results.numMeshes = numMeshes;
+
+	const unsigned int VertexFloats = 8;
+	SMeshCacheStamp stamp = { 0, 0, 0, 0 };
+	vector< vector<unsigned char> > rawFiles( numMeshes ), compressedFiles( numMeshes );
+	srand( 1 );
+	for (unsigned int m = 0; m < numMeshes; ++m)
+	{
+		unsigned int gridX = 10 + rand() % 40;
+		unsigned int gridY = 10 + rand() % 40;
+		float phase = rand() / static_cast<float>(RAND_MAX) * 6.0f;
+		vector<float> vertices;
+		for (unsigned int y = 0; y <= gridY; ++y)
+		{
+			for (unsigned int x = 0; x <= gridX; ++x)
+			{
+				float height = sinf( x * 0.3f + phase ) * cosf( y * 0.2f );
+				float slopeX = 0.3f * cosf( x * 0.3f + phase ) * cosf( y * 0.2f );
+				float slopeY = -0.2f * sinf( x * 0.3f + phase ) * sinf( y * 0.2f );
+				float normalScale = 1.0f / sqrtf( slopeX * slopeX + slopeY * slopeY + 1.0f );
+				float vertex[VertexFloats] = { x * 0.5f, height, y * 0.5f, -slopeX * normalScale, normalScale, -slopeY * normalScale,
+				                               static_cast<float>(x) / gridX, static_cast<float>(y) / gridY };
+				vertices.insert( vertices.end(), vertex, vertex + VertexFloats );
+			}
+		}
+		vector<SMeshFace> faces;
+		for (unsigned int y = 0; y < gridY; ++y)
+		{
+			for (unsigned int x = 0; x < gridX; ++x)
+			{
+				TUInt16 corner = static_cast<TUInt16>(y * (gridX + 1) + x);
+				SMeshFace face1 = { { corner, static_cast<TUInt16>(corner + gridX + 1), static_cast<TUInt16>(corner + 1) } };
+				SMeshFace face2 = { { static_cast<TUInt16>(corner + 1), static_cast<TUInt16>(corner + gridX + 1), static_cast<TUInt16>(corner + gridX + 2) } };
+				faces.push_back( face1 );
+				faces.push_back( face2 );
+			}
+		}
+
+		SSubMeshSubset subset = { 0, 0, static_cast<TUInt32>(faces.size()) };
+		SSubMesh subMesh;
+		memset( &subMesh, 0, sizeof(subMesh) );
+		subMesh.numVertices = static_cast<TUInt32>(vertices.size() / VertexFloats);
+		subMesh.vertices = reinterpret_cast<TUInt8*>(&vertices[0]);
+		subMesh.vertexSize = VertexFloats * sizeof(float);
+		subMesh.hasNormals = subMesh.hasTextureCoords = true;
+		subMesh.numFaces = static_cast<TUInt32>(faces.size());
+		subMesh.faces = &faces[0];
+		subMesh.numSubsets = 1;
+		subMesh.subsets = &subset;
+		CMeshCodec::OptimiseVertexOrder( subMesh.vertices, subMesh.numVertices, subMesh.vertexSize,
+		                                 reinterpret_cast<unsigned short*>(subMesh.faces), subMesh.numFaces * 3 );
+
+		Write( subMesh, vector<SMeshCluster>(), stamp, false, rawFiles[m] );
+		Write( subMesh, vector<SMeshCluster>(), stamp, true, compressedFiles[m] );
+		results.numTriangles += subMesh.numFaces;
+		results.rawIndexBytes += subMesh.numFaces * 3 * sizeof(unsigned short);
+		results.compressedIndexBytes += reinterpret_cast<const SMeshCacheHeader*>(&compressedFiles[m][0])->indexDataSize;
+		results.rawTotalBytes += static_cast<unsigned int>(rawFiles[m].size());
+		results.compressedTotalBytes += static_cast<unsigned int>(compressedFiles[m].size());
+	}
+
+	// Read every file as a model load would, into new storage each time
+	for (int compressed = 0; compressed < 2; ++compressed)
+	{
+		vector< vector<unsigned char> >& files = compressed ? compressedFiles : rawFiles;
+		CTimer timer;
+		timer.Start();
+		for (unsigned int m = 0; m < numMeshes; ++m)
+		{
+			SSubMesh subMesh;
+			SMeshCacheStorage storage;
+			Read( &files[m][0], static_cast<unsigned int>(files[m].size()), &stamp, subMesh, storage );
+		}
+		(compressed ? results.compressedLoadTime : results.rawLoadTime) = timer.GetTime();
+	}
+	return results;
+}
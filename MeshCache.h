@@ -0,0 +1,88 @@
+//--------------------------------------------------------------------------------------
+//	MeshCache.h
+//
+//	Stores imported meshes in a binary cache file, so later loads can skip parsing the
+//	original mesh file. Index and vertex data are compressed with CMeshCodec
+//--------------------------------------------------------------------------------------
+
+#ifndef MESH_CACHE_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define MESH_CACHE_H_INCLUDED
+
+#include <vector>
+#include <string>
+using namespace std;
+
+#include "MeshData.h"     // Mesh structures from the import code
+#include "MeshClusters.h" // SMeshCluster
+
+
+// Identifies the version of a source file a cache was made from - its size and last write time
+struct SMeshCacheStamp
+{
+	unsigned int sizeLow, sizeHigh;
+	unsigned int timeLow, timeHigh;
+};
+
+// Memory for a sub-mesh loaded from a cache - the sub-mesh points into these
+struct SMeshCacheStorage
+{
+	vector<unsigned char>        vertices;
+	vector<gen::SMeshFace>       faces;
+	vector<gen::SSubMeshSubset>  subsets;
+	vector<SMeshCluster>         clusters; // Empty if the mesh was cached without clusters
+};
+
+// Results of CMeshCache::Benchmark
+struct SMeshCacheBenchmark
+{
+	unsigned int numMeshes;
+	unsigned int numTriangles;
+	unsigned int rawIndexBytes,  compressedIndexBytes;
+	unsigned int rawTotalBytes,  compressedTotalBytes; // Whole cache files
+	float        rawLoadTime,    compressedLoadTime;   // Seconds to read every cache file in memory into a sub-mesh
+};
+
+
+// A cache file holds a single sub-mesh: a header, the material subsets, the mesh's clusters (see MeshClusters.h), then the vertex
+// data, then the index data. The index data is in cluster order, so the clusters' index ranges can be used as they are. The vertex
+// and index data can each be stored compressed or as they are. The header records the source file's size and last write time, and
+// a cache that doesn't match the source is ignored
+class CMeshCache
+{
+/////////////////////////////
+// Public member functions
+public:
+
+	// Save a sub-mesh made from the given source file, and its clusters, to a cache file. The vertices compress best in the order the
+	// faces use them (see CMeshCodec::OptimiseVertexOrder)
+	static bool Save( const string& cacheFileName, const string& sourceFileName, const gen::SSubMesh& subMesh,
+	                  const vector<SMeshCluster>& clusters, bool compress = true );
+
+	// Load a sub-mesh from a cache file if it exists and was made from the current version of the source file. The sub-mesh's
+	// data and clusters are held in the given storage
+	static bool Load( const string& cacheFileName, const string& sourceFileName, gen::SSubMesh& subMesh, SMeshCacheStorage& storage );
+
+	// Copy a sub-mesh's data into the given storage, pointing the copy at it - keeps an imported sub-mesh until it can be saved
+	static void Copy( const gen::SSubMesh& subMesh, gen::SSubMesh& copy, SMeshCacheStorage& storage );
+
+	// Write a sub-mesh in the cache file format to memory, and the reverse. Reading fails if the data is not valid or, when a stamp
+	// is given, the data was made from a different version of the source
+	static void Write( const gen::SSubMesh& subMesh, const vector<SMeshCluster>& clusters, const SMeshCacheStamp& stamp, bool compress,
+	                   vector<unsigned char>& output );
+	static bool Read( const unsigned char* data, unsigned int dataSize, const SMeshCacheStamp* stamp, gen::SSubMesh& subMesh,
+	                  SMeshCacheStorage& storage );
+
+	// Time reading a library of synthetic meshes from cache files in memory, compressed and uncompressed
+	static SMeshCacheBenchmark Benchmark( unsigned int numMeshes );
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	// Get the stamp of a source file, returns false if the file doesn't exist
+	static bool GetSourceStamp( const string& fileName, SMeshCacheStamp& stamp );
+};
+
+
+#endif // End of header guard - see top of file
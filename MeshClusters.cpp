@@ -0,0 +1,197 @@
+//--------------------------------------------------------------------------------------
+//	MeshClusters.cpp
+//
+//	Splits a mesh into small clusters of neighbouring triangles, each with a bounding
+//	sphere and a cone around its triangles' normals. Clusters that are out of view or
+//	facing away from the camera can then be skipped on the CPU before drawing
+//--------------------------------------------------------------------------------------
+
+#include <cmath>
+using namespace std;
+
+#include "MeshClusters.h" // Declaration of this class
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+CMeshClusterBuilder::CMeshClusterBuilder( const void* vertices, unsigned int numVertices, unsigned int vertexSize,
+                                          const unsigned short* indices, unsigned int numIndices )
+{
+	const char* vertexData = static_cast<const char*>(vertices);
+	m_Positions.resize( numVertices );
+	for (unsigned int i = 0; i < numVertices; ++i)
+	{
+		m_Positions[i] = *reinterpret_cast<const D3DXVECTOR3*>(vertexData + i * vertexSize);
+	}
+	m_SourceIndices.assign( indices, indices + numIndices - numIndices % 3 );
+}
+
+
+/////////////////////////////
+// Building
+
+// Split the mesh into clusters with no more than the given number of vertices and triangles each
+void CMeshClusterBuilder::Build( unsigned int maxVertices /*= 64*/, unsigned int maxTriangles /*= 124*/ )
+{
+	unsigned int numVertices = static_cast<unsigned int>(m_Positions.size());
+	unsigned int numTriangles = static_cast<unsigned int>(m_SourceIndices.size() / 3);
+	m_Indices.clear();
+	m_Indices.reserve( m_SourceIndices.size() );
+	m_Clusters.clear();
+
+	// List the triangles using each vertex - the triangles for vertex v are vertexTriangles[firstTriangle[v]] up to
+	// vertexTriangles[firstTriangle[v + 1]]
+	vector<unsigned int> firstTriangle( numVertices + 1, 0 );
+	for (unsigned int i = 0; i < m_SourceIndices.size(); ++i)
+	{
+		++firstTriangle[m_SourceIndices[i] + 1];
+	}
+	for (unsigned int v = 0; v < numVertices; ++v)
+	{
+		firstTriangle[v + 1] += firstTriangle[v];
+	}
+	vector<unsigned int> vertexTriangles( m_SourceIndices.size() );
+	vector<unsigned int> fill( firstTriangle.begin(), firstTriangle.end() - 1 );
+	for (unsigned int i = 0; i < m_SourceIndices.size(); ++i)
+	{
+		vertexTriangles[fill[m_SourceIndices[i]]++] = i / 3;
+	}
+
+	// Which cluster (plus one) each vertex was last added to, so vertices already in the current cluster can be recognised without
+	// clearing anything between clusters
+	vector<unsigned int> vertexCluster( numVertices, 0 );
+	vector<bool>         used( numTriangles, false );
+	vector<unsigned int> candidates;
+	unsigned int nextSeed = 0;
+
+	while (true)
+	{
+		// Seed each cluster with the first unused triangle in the original order
+		while (nextSeed < numTriangles && used[nextSeed]) ++nextSeed;
+		if (nextSeed == numTriangles) break;
+
+		SMeshCluster cluster;
+		cluster.startIndex = static_cast<unsigned int>(m_Indices.size());
+		unsigned int clusterMark = static_cast<unsigned int>(m_Clusters.size()) + 1;
+		unsigned int clusterVertices = 0;
+		unsigned int clusterTriangles = 0;
+		candidates.clear();
+		candidates.push_back( nextSeed );
+
+		while (clusterTriangles < maxTriangles)
+		{
+			// Pick the candidate that adds the fewest new vertices, dropping any that have been used since they were found
+			int best = -1;
+			unsigned int bestNewVertices = 4;
+			for (unsigned int c = 0; c < candidates.size(); )
+			{
+				if (used[candidates[c]])
+				{
+					candidates[c] = candidates.back();
+					candidates.pop_back();
+					continue;
+				}
+				unsigned int newVertices = 0;
+				for (int v = 0; v < 3; ++v)
+				{
+					if (vertexCluster[m_SourceIndices[candidates[c] * 3 + v]] != clusterMark) ++newVertices;
+				}
+				if (newVertices < bestNewVertices)
+				{
+					bestNewVertices = newVertices;
+					best = c;
+				}
+				++c;
+			}
+			if (best < 0 || clusterVertices + bestNewVertices > maxVertices) break;
+
+			// Add the triangle and make its unused neighbours candidates
+			unsigned int triangle = candidates[best];
+			used[triangle] = true;
+			++clusterTriangles;
+			for (int v = 0; v < 3; ++v)
+			{
+				unsigned short index = m_SourceIndices[triangle * 3 + v];
+				m_Indices.push_back( index );
+				if (vertexCluster[index] != clusterMark)
+				{
+					vertexCluster[index] = clusterMark;
+					++clusterVertices;
+					for (unsigned int i = firstTriangle[index]; i < firstTriangle[index + 1]; ++i)
+					{
+						if (!used[vertexTriangles[i]]) candidates.push_back( vertexTriangles[i] );
+					}
+				}
+			}
+		}
+
+		cluster.numIndices = static_cast<unsigned int>(m_Indices.size()) - cluster.startIndex;
+		CalculateClusterBounds( cluster );
+		m_Clusters.push_back( cluster );
+	}
+}
+
+
+// Calculate the bounding sphere and normal cone of a cluster from its triangles in the reordered index list
+void CMeshClusterBuilder::CalculateClusterBounds( SMeshCluster& cluster )
+{
+	// Sphere centred on the box around the cluster's vertices
+	D3DXVECTOR3 minBounds = m_Positions[m_Indices[cluster.startIndex]];
+	D3DXVECTOR3 maxBounds = minBounds;
+	for (unsigned int i = cluster.startIndex; i < cluster.startIndex + cluster.numIndices; ++i)
+	{
+		D3DXVec3Minimize( &minBounds, &minBounds, &m_Positions[m_Indices[i]] );
+		D3DXVec3Maximize( &maxBounds, &maxBounds, &m_Positions[m_Indices[i]] );
+	}
+	cluster.centre = (minBounds + maxBounds) * 0.5f;
+	float radiusSq = 0.0f;
+	for (unsigned int i = cluster.startIndex; i < cluster.startIndex + cluster.numIndices; ++i)
+	{
+		D3DXVECTOR3 offset = m_Positions[m_Indices[i]] - cluster.centre;
+		float distanceSq = D3DXVec3LengthSq( &offset );
+		if (distanceSq > radiusSq) radiusSq = distanceSq;
+	}
+	cluster.radius = sqrtf( radiusSq );
+
+	// Cone axis is the average triangle normal, the cone is as wide as the normal furthest from it. The normals point out of the
+	// front faces (clockwise triangles, as DirectX uses). Degenerate triangles can't be seen from any direction so are ignored
+	D3DXVECTOR3 axis( 0.0f, 0.0f, 0.0f );
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		float minDot = 1.0f;
+		for (unsigned int i = cluster.startIndex; i < cluster.startIndex + cluster.numIndices; i += 3)
+		{
+			D3DXVECTOR3 edge1 = m_Positions[m_Indices[i + 1]] - m_Positions[m_Indices[i]];
+			D3DXVECTOR3 edge2 = m_Positions[m_Indices[i + 2]] - m_Positions[m_Indices[i]];
+			D3DXVECTOR3 normal;
+			D3DXVec3Cross( &normal, &edge1, &edge2 );
+			float length = D3DXVec3Length( &normal );
+			if (length <= 0.0f) continue;
+
+			normal /= length;
+			if (pass == 0)
+			{
+				axis += normal;
+			}
+			else
+			{
+				float dot = D3DXVec3Dot( &normal, &cluster.coneAxis );
+				if (dot < minDot) minDot = dot;
+			}
+		}
+
+		if (pass == 0)
+		{
+			// Without an average direction there is no useful cone
+			float axisLength = D3DXVec3Length( &axis );
+			cluster.coneAxis = (axisLength > 0.0f) ? axis / axisLength : D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+			cluster.coneCutoff = 1.0f;
+			if (axisLength <= 0.0f) return;
+		}
+		else if (minDot > 0.0f) // Otherwise the normals spread over more than a hemisphere - some triangles always face the camera
+		{
+			cluster.coneCutoff = sqrtf( 1.0f - minDot * minDot );
+		}
+	}
+}
@@ -0,0 +1,98 @@
+//--------------------------------------------------------------------------------------
+//	MeshClusters.h
+//
+//	Splits a mesh into small clusters of neighbouring triangles, each with a bounding
+//	sphere and a cone around its triangles' normals. Clusters that are out of view or
+//	facing away from the camera can then be skipped on the CPU before drawing
+//--------------------------------------------------------------------------------------
+
+#ifndef MESH_CLUSTERS_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define MESH_CLUSTERS_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+#include <d3d10.h>
+#include <d3dx10.h>
+
+
+// A cluster is a range of the mesh's (reordered) index list. All values are in model space. Every triangle normal in the cluster is
+// within an angle A of the cone axis, and the cone cutoff is sin(A). If the normals spread too far for the cone to be useful the
+// cutoff is 1, and the cluster is never treated as back-facing
+struct SMeshCluster
+{
+	unsigned int startIndex;
+	unsigned int numIndices;
+	D3DXVECTOR3  centre;
+	float        radius;
+	D3DXVECTOR3  coneAxis;
+	float        coneCutoff;
+};
+
+// Count of clusters drawn and rejected for a view
+struct SClusterStats
+{
+	int drawn;
+	int outsideFrustum;
+	int backFacing;
+};
+
+
+// Clusters are grown one triangle at a time from a seed triangle, always choosing the neighbouring triangle that adds the fewest new
+// vertices. This keeps clusters compact and their normals similar, which gives tight spheres and narrow cones. A cluster ends when it
+// reaches the vertex or triangle limit, or has no more neighbours
+class CMeshClusterBuilder
+{
+/////////////////////////////
+// Private member variables
+private:
+
+	// Vertex positions and the original index list
+	vector<D3DXVECTOR3>    m_Positions;
+	vector<unsigned short> m_SourceIndices;
+
+	// Index list reordered cluster by cluster, and the clusters
+	vector<unsigned short> m_Indices;
+	vector<SMeshCluster>   m_Clusters;
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	// Constructor - takes the raw vertex data (position must be the first element of each vertex) and the triangle list indices
+	CMeshClusterBuilder( const void* vertices, unsigned int numVertices, unsigned int vertexSize,
+	                     const unsigned short* indices, unsigned int numIndices );
+
+
+	/////////////////////////////
+	// Building
+
+	// Split the mesh into clusters with no more than the given number of vertices and triangles each
+	void Build( unsigned int maxVertices = 64, unsigned int maxTriangles = 124 );
+
+	// Index list reordered so each cluster's triangles are together - the same triangles as the original list
+	const vector<unsigned short>& GetIndices() const
+	{
+		return m_Indices;
+	}
+
+	const vector<SMeshCluster>& GetClusters() const
+	{
+		return m_Clusters;
+	}
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	// Calculate the bounding sphere and normal cone of a cluster from its triangles in the reordered index list
+	void CalculateClusterBounds( SMeshCluster& cluster );
+};
+
+
+#endif // End of header guard - see top of file
@@ -0,0 +1,220 @@
+//--------------------------------------------------------------------------------------
+//	MeshCodec.cpp
+//
+//	Compression of index and vertex data for storing meshes on disk. The encodings
+//	are byte aligned so that decoding is a simple, fast loop
+//--------------------------------------------------------------------------------------
+
+#include <cstring>
+using namespace std;
+
+#include "MeshCodec.h" // Declaration of this class
+
+
+// Index codes - see MeshCodec.h
+static const unsigned int CodeNewVertex = 0;
+static const unsigned int CodeEscape = 15;
+static const unsigned int FifoSize = 16;     // Power of two so positions can wrap with a mask
+static const unsigned int FifoCodes = 14;    // Only the 14 most recent entries have codes
+
+// Variable length integers: 7 bits per byte, lowest bits first, top bit set if more bytes follow
+static void WriteVarInt( unsigned int value, vector<unsigned char>& output )
+{
+	while (value >= 0x80)
+	{
+		output.push_back( static_cast<unsigned char>(value | 0x80) );
+		value >>= 7;
+	}
+	output.push_back( static_cast<unsigned char>(value) );
+}
+static bool ReadVarInt( const unsigned char*& data, const unsigned char* dataEnd, unsigned int& value )
+{
+	value = 0;
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		if (data == dataEnd) return false;
+		unsigned int byte = *data++;
+		value |= (byte & 0x7f) << shift;
+		if (byte < 0x80) return true;
+	}
+	return false;
+}
+
+// "Zigzag" encoding of signed values so that small negative numbers are small too: 0, -1, 1, -2, 2... become 0, 1, 2, 3, 4...
+static unsigned int ZigZag( int value )
+{
+	return (static_cast<unsigned int>(value) << 1) ^ static_cast<unsigned int>(value >> 31);
+}
+static int UnZigZag( unsigned int value )
+{
+	return static_cast<int>(value >> 1) ^ -static_cast<int>(value & 1);
+}
+
+
+/////////////////////////////
+// Vertex order
+
+// Reorder vertices into the order they are first used by the indices, updating the indices to match
+void CMeshCodec::OptimiseVertexOrder( void* vertices, unsigned int numVertices, unsigned int vertexSize,
+                                      unsigned short* indices, unsigned int numIndices )
+{
+	const unsigned short Unused = 0xffff;
+	vector<unsigned short> newIndex( numVertices, Unused );
+	unsigned short nextIndex = 0;
+	for (unsigned int i = 0; i < numIndices; ++i)
+	{
+		if (newIndex[indices[i]] == Unused) newIndex[indices[i]] = nextIndex++;
+		indices[i] = newIndex[indices[i]];
+	}
+	for (unsigned int v = 0; v < numVertices; ++v)
+	{
+		if (newIndex[v] == Unused) newIndex[v] = nextIndex++;
+	}
+
+	unsigned char* vertexData = static_cast<unsigned char*>(vertices);
+	vector<unsigned char> original( vertexData, vertexData + numVertices * vertexSize );
+	for (unsigned int v = 0; v < numVertices; ++v)
+	{
+		memcpy( vertexData + newIndex[v] * vertexSize, &original[v * vertexSize], vertexSize );
+	}
+}
+
+
+/////////////////////////////
+// Indices
+
+// Encode indices, appending to the output. The 4-bit codes are stored first, two per byte, then the escaped indices
+void CMeshCodec::EncodeIndices( const unsigned short* indices, unsigned int numIndices, vector<unsigned char>& output )
+{
+	vector<unsigned char> codes( (numIndices + 1) / 2, 0 );
+	vector<unsigned char> escapes;
+
+	unsigned short fifo[FifoSize] = { 0 };
+	unsigned int fifoPos = 0;
+	unsigned int nextVertex = 0;
+	unsigned int lastIndex = 0;
+	for (unsigned int i = 0; i < numIndices; ++i)
+	{
+		unsigned int index = indices[i];
+		unsigned int code = CodeEscape;
+		if (index == nextVertex)
+		{
+			code = CodeNewVertex;
+		}
+		else
+		{
+			for (unsigned int f = 0; f < FifoCodes; ++f)
+			{
+				if (fifo[(fifoPos - 1 - f) & (FifoSize - 1)] == index)
+				{
+					code = 1 + f;
+					break;
+				}
+			}
+		}
+		if (code == CodeEscape)
+		{
+			WriteVarInt( ZigZag( static_cast<int>(index) - static_cast<int>(lastIndex) ), escapes );
+		}
+		codes[i >> 1] |= static_cast<unsigned char>(code << ((i & 1) * 4));
+
+		// Update the state exactly as the decoder will
+		if (code == CodeNewVertex || code == CodeEscape)
+		{
+			fifo[fifoPos & (FifoSize - 1)] = static_cast<unsigned short>(index);
+			++fifoPos;
+		}
+		if (index >= nextVertex) nextVertex = index + 1;
+		lastIndex = index;
+	}
+
+	output.insert( output.end(), codes.begin(), codes.end() );
+	output.insert( output.end(), escapes.begin(), escapes.end() );
+}
+
+// Decode the given number of indices. Returns false if the data is not valid
+bool CMeshCodec::DecodeIndices( const unsigned char* data, unsigned int dataSize, unsigned short* indices, unsigned int numIndices )
+{
+	unsigned int codeBytes = (numIndices + 1) / 2;
+	if (dataSize < codeBytes) return false;
+	const unsigned char* escapes = data + codeBytes;
+	const unsigned char* dataEnd = data + dataSize;
+
+	unsigned short fifo[FifoSize] = { 0 };
+	unsigned int fifoPos = 0;
+	unsigned int nextVertex = 0;
+	unsigned int lastIndex = 0;
+	for (unsigned int i = 0; i < numIndices; ++i)
+	{
+		unsigned int code = (data[i >> 1] >> ((i & 1) * 4)) & 0xf;
+		unsigned int index;
+		if (code == CodeNewVertex)
+		{
+			index = nextVertex;
+		}
+		else if (code != CodeEscape)
+		{
+			index = fifo[(fifoPos - code) & (FifoSize - 1)];
+		}
+		else
+		{
+			unsigned int delta;
+			if (!ReadVarInt( escapes, dataEnd, delta )) return false;
+			index = (lastIndex + UnZigZag( delta )) & 0xffff;
+		}
+
+		if (code == CodeNewVertex || code == CodeEscape)
+		{
+			fifo[fifoPos & (FifoSize - 1)] = static_cast<unsigned short>(index);
+			++fifoPos;
+		}
+		if (index >= nextVertex) nextVertex = index + 1;
+		lastIndex = index;
+		indices[i] = static_cast<unsigned short>(index);
+	}
+	return escapes == dataEnd;
+}
+
+
+/////////////////////////////
+// Vertices
+
+// Encode vertices, appending to the output. Each 32-bit word is stored as the zigzag encoded difference from the same word of the
+// previous vertex. The difference of two float bit patterns is small when the floats are close, so this works for all vertex data
+void CMeshCodec::EncodeVertices( const void* vertices, unsigned int numVertices, unsigned int vertexSize, vector<unsigned char>& output )
+{
+	unsigned int numWords = vertexSize / 4;
+	const unsigned char* vertexData = static_cast<const unsigned char*>(vertices);
+	vector<unsigned int> previous( numWords, 0 );
+	for (unsigned int v = 0; v < numVertices; ++v)
+	{
+		for (unsigned int w = 0; w < numWords; ++w)
+		{
+			unsigned int word;
+			memcpy( &word, vertexData + v * vertexSize + w * 4, 4 );
+			WriteVarInt( ZigZag( static_cast<int>(word - previous[w]) ), output );
+			previous[w] = word;
+		}
+	}
+}
+
+// Decode the given number of vertices. Returns false if the data is not valid
+bool CMeshCodec::DecodeVertices( const unsigned char* data, unsigned int dataSize, void* vertices, unsigned int numVertices,
+                                 unsigned int vertexSize )
+{
+	unsigned int numWords = vertexSize / 4;
+	const unsigned char* dataEnd = data + dataSize;
+	unsigned int* words = static_cast<unsigned int*>(vertices);
+	vector<unsigned int> previous( numWords, 0 );
+	for (unsigned int v = 0; v < numVertices; ++v)
+	{
+		for (unsigned int w = 0; w < numWords; ++w)
+		{
+			unsigned int delta;
+			if (!ReadVarInt( data, dataEnd, delta )) return false;
+			previous[w] += static_cast<unsigned int>(UnZigZag( delta ));
+			*words++ = previous[w];
+		}
+	}
+	return data == dataEnd;
+}
@@ -0,0 +1,51 @@
+//--------------------------------------------------------------------------------------
+//	MeshCodec.h
+//
+//	Compression of index and vertex data for storing meshes on disk. The encodings
+//	are byte aligned so that decoding is a simple, fast loop
+//--------------------------------------------------------------------------------------
+
+#ifndef MESH_CODEC_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define MESH_CODEC_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+
+// Index data is encoded with a 4-bit code per index, taking advantage of the order that a cache-friendly mesh uses its vertices:
+//  - Code 0 means the index is the next vertex not yet used (vertices should be stored in the order they are first used - see
+//    OptimiseVertexOrder). Most new vertices are like this
+//  - Codes 1 to 14 mean the index is one of the 14 most recent new indices, kept in a FIFO like the GPU's vertex cache. The
+//    other two indices of most triangles are found here
+//  - Code 15 means the index is stored separately as a (variable length) difference from the previous index
+// Good meshes take 4 to 5 bits per index rather than 16.
+//
+// Vertex data is encoded as the difference of each 32-bit word from the same word in the previous vertex, stored in a variable
+// number of bytes. Neighbouring vertices have similar positions, normals and UVs so the differences are mostly small
+class CMeshCodec
+{
+/////////////////////////////
+// Public member functions
+public:
+
+	// Reorder vertices into the order they are first used by the indices, updating the indices to match. Vertices not used at all
+	// go at the end. This makes index and vertex data compress better, and helps the GPU fetch vertex data efficiently too
+	static void OptimiseVertexOrder( void* vertices, unsigned int numVertices, unsigned int vertexSize,
+	                                 unsigned short* indices, unsigned int numIndices );
+
+	// Encode indices, appending to the output
+	static void EncodeIndices( const unsigned short* indices, unsigned int numIndices, vector<unsigned char>& output );
+
+	// Decode the given number of indices. Returns false if the data is not valid
+	static bool DecodeIndices( const unsigned char* data, unsigned int dataSize, unsigned short* indices, unsigned int numIndices );
+
+	// Encode vertices, appending to the output. The vertex size must be a multiple of 4 bytes
+	static void EncodeVertices( const void* vertices, unsigned int numVertices, unsigned int vertexSize, vector<unsigned char>& output );
+
+	// Decode the given number of vertices. Returns false if the data is not valid
+	static bool DecodeVertices( const unsigned char* data, unsigned int dataSize, void* vertices, unsigned int numVertices,
+	                            unsigned int vertexSize );
+};
+
+
+#endif // End of header guard - see top of file
@@ -0,0 +1,339 @@
+//--------------------------------------------------------------------------------------
+//	MeshSimplifier.cpp
+//
+//	Mesh simplifier used to create lower levels of detail (LODs) for a model. Each LOD is
+//	a new index list that reuses the model's original vertices, so all the LODs can share
+//	one vertex buffer
+//--------------------------------------------------------------------------------------
+
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+#include "MeshSimplifier.h" // Declaration of this class
+
+// Cosine of the largest angle a triangle's normal may turn through in a collapse
+const float MinNormalCos = 0.25f;
+
+
+/////////////////////////////
+// Quadrics
+
+void CMeshSimplifier::SQuadric::Clear()
+{
+	a00 = a01 = a02 = a03 = a11 = a12 = a13 = a22 = a23 = a33 = 0.0;
+	weight = 0.0;
+}
+
+// Add the squared distance to the plane n.p + d = 0, weighted by area
+void CMeshSimplifier::SQuadric::AddPlane( const D3DXVECTOR3& normal, float d, float area )
+{
+	double a = normal.x, b = normal.y, c = normal.z;
+	a00 += area * a * a;  a01 += area * a * b;  a02 += area * a * c;  a03 += area * a * d;
+	a11 += area * b * b;  a12 += area * b * c;  a13 += area * b * d;
+	a22 += area * c * c;  a23 += area * c * d;
+	a33 += area * d * d;
+	weight += area;
+}
+
+void CMeshSimplifier::SQuadric::Add( const SQuadric& other )
+{
+	a00 += other.a00;  a01 += other.a01;  a02 += other.a02;  a03 += other.a03;
+	a11 += other.a11;  a12 += other.a12;  a13 += other.a13;
+	a22 += other.a22;  a23 += other.a23;
+	a33 += other.a33;
+	weight += other.weight;
+}
+
+// Weighted sum of squared distances from the point to all the planes - (x y z 1) Q (x y z 1)^T
+double CMeshSimplifier::SQuadric::Evaluate( const D3DXVECTOR3& point ) const
+{
+	double x = point.x, y = point.y, z = point.z;
+	return x * x * a00 + 2.0 * x * y * a01 + 2.0 * x * z * a02 + 2.0 * x * a03 +
+	       y * y * a11 + 2.0 * y * z * a12 + 2.0 * y * a13 +
+	       z * z * a22 + 2.0 * z * a23 +
+	       a33;
+}
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+CMeshSimplifier::CMeshSimplifier( const void* vertices, unsigned int numVertices, unsigned int vertexSize,
+                                  const unsigned short* indices, unsigned int numIndices )
+{
+	// Copy out the positions from the vertex data
+	const char* vertexData = static_cast<const char*>(vertices);
+	m_Positions.resize( numVertices );
+	for (unsigned int i = 0; i < numVertices; ++i)
+	{
+		m_Positions[i] = *reinterpret_cast<const D3DXVECTOR3*>(vertexData + i * vertexSize);
+	}
+
+	// Give vertices at exactly the same position the same position id. Sort the vertices by position so equal positions
+	// are next to each other, then each group takes the id of its first vertex
+	vector<unsigned int> sorted( numVertices );
+	for (unsigned int i = 0; i < numVertices; ++i)
+	{
+		sorted[i] = i;
+	}
+	const vector<D3DXVECTOR3>& positions = m_Positions;
+	sort( sorted.begin(), sorted.end(), [&positions]( unsigned int a, unsigned int b )
+	{
+		if (positions[a].x != positions[b].x) return positions[a].x < positions[b].x;
+		if (positions[a].y != positions[b].y) return positions[a].y < positions[b].y;
+		return positions[a].z < positions[b].z;
+	} );
+
+	m_PositionIds.resize( numVertices );
+	for (unsigned int i = 0; i < numVertices; ++i)
+	{
+		if (i > 0 && m_Positions[sorted[i]] == m_Positions[sorted[i - 1]])
+		{
+			m_PositionIds[sorted[i]] = m_PositionIds[sorted[i - 1]];
+		}
+		else
+		{
+			m_PositionIds[sorted[i]] = sorted[i];
+		}
+	}
+
+	m_Indices.assign( indices, indices + numIndices );
+	m_Error = 0.0f;
+
+	Analyse();
+}
+
+
+/////////////////////////////
+// Simplification
+
+// Find the seam and border vertices and build the quadrics from the original triangles
+void CMeshSimplifier::Analyse()
+{
+	unsigned int numVertices = static_cast<unsigned int>(m_Positions.size());
+	unsigned int numIndices = static_cast<unsigned int>(m_Indices.size());
+
+	// Seams - any position shared by more than one vertex
+	vector<unsigned int> positionCounts( numVertices, 0 );
+	for (unsigned int i = 0; i < numVertices; ++i)
+	{
+		++positionCounts[m_PositionIds[i]];
+	}
+	m_Locked.assign( numVertices, false );
+	for (unsigned int i = 0; i < numVertices; ++i)
+	{
+		if (positionCounts[m_PositionIds[i]] > 1) m_Locked[m_PositionIds[i]] = true;
+	}
+
+	// Borders - an edge between two positions used by a triangle in only one direction. Edges are matched by position rather
+	// than by vertex so that seams (which have different vertices each side) are not mistaken for borders
+	vector<unsigned long long> edges;
+	edges.reserve( numIndices );
+	for (unsigned int t = 0; t + 2 < numIndices; t += 3)
+	{
+		for (int e = 0; e < 3; ++e)
+		{
+			unsigned long long a = m_PositionIds[m_Indices[t + e]];
+			unsigned long long b = m_PositionIds[m_Indices[t + (e + 1) % 3]];
+			edges.push_back( (a << 32) | b );
+		}
+	}
+	sort( edges.begin(), edges.end() );
+	for (unsigned int i = 0; i < edges.size(); ++i)
+	{
+		unsigned long long reverse = (edges[i] << 32) | (edges[i] >> 32);
+		if (!binary_search( edges.begin(), edges.end(), reverse ))
+		{
+			m_Locked[static_cast<unsigned int>(edges[i] >> 32)] = true;
+			m_Locked[static_cast<unsigned int>(edges[i] & 0xffffffff)] = true;
+		}
+	}
+
+	// Quadrics - each position gets the planes of the triangles around it, weighted by triangle area so that small triangles
+	// don't count as much as large ones
+	m_Quadrics.resize( numVertices );
+	for (unsigned int i = 0; i < numVertices; ++i)
+	{
+		m_Quadrics[i].Clear();
+	}
+	for (unsigned int t = 0; t + 2 < numIndices; t += 3)
+	{
+		const D3DXVECTOR3& p0 = m_Positions[m_Indices[t]];
+		const D3DXVECTOR3& p1 = m_Positions[m_Indices[t + 1]];
+		const D3DXVECTOR3& p2 = m_Positions[m_Indices[t + 2]];
+		D3DXVECTOR3 edge1 = p1 - p0;
+		D3DXVECTOR3 edge2 = p2 - p0;
+		D3DXVECTOR3 normal;
+		D3DXVec3Cross( &normal, &edge1, &edge2 );
+		float length = D3DXVec3Length( &normal );
+		if (length <= 0.0f) continue;
+
+		normal /= length;
+		float d = -D3DXVec3Dot( &normal, &p0 );
+		for (int v = 0; v < 3; ++v)
+		{
+			m_Quadrics[m_PositionIds[m_Indices[t + v]]].AddPlane( normal, d, length * 0.5f );
+		}
+	}
+}
+
+
+// Simplify the mesh further until it has no more than the given number of indices or no more collapses are possible. The
+// collapses are made in passes - each pass sorts all possible collapses by cost and makes as many of the cheapest ones as it
+// can without two collapses touching the same triangles, then the index list is rebuilt and the next pass starts
+void CMeshSimplifier::Simplify( unsigned int targetNumIndices )
+{
+	unsigned int numVertices = static_cast<unsigned int>(m_Positions.size());
+	vector<unsigned int> firstTriangle;
+	vector<unsigned int> vertexTriangles;
+	vector<SCollapse>    collapses;
+	vector<unsigned int> remap( numVertices );
+	vector<bool>         touched( numVertices );
+
+	while (m_Indices.size() > targetNumIndices)
+	{
+		unsigned int numIndices = static_cast<unsigned int>(m_Indices.size());
+
+		// List the triangles using each vertex. The triangles for vertex v are vertexTriangles[firstTriangle[v]] up to
+		// vertexTriangles[firstTriangle[v + 1]] (each entry is the triangle's first index)
+		firstTriangle.assign( numVertices + 1, 0 );
+		for (unsigned int i = 0; i < numIndices; ++i)
+		{
+			++firstTriangle[m_Indices[i] + 1];
+		}
+		for (unsigned int v = 0; v < numVertices; ++v)
+		{
+			firstTriangle[v + 1] += firstTriangle[v];
+		}
+		vertexTriangles.resize( numIndices );
+		vector<unsigned int> fill( firstTriangle.begin(), firstTriangle.end() - 1 );
+		for (unsigned int i = 0; i < numIndices; ++i)
+		{
+			vertexTriangles[fill[m_Indices[i]]++] = i - i % 3;
+		}
+
+		// Cost of each possible collapse along each edge. Moving vertex i onto vertex j costs the combined quadrics of i and j
+		// measured at j, given as an average distance
+		collapses.clear();
+		for (unsigned int t = 0; t < numIndices; t += 3)
+		{
+			for (int e = 0; e < 3; ++e)
+			{
+				unsigned int a = m_Indices[t + e];
+				unsigned int b = m_Indices[t + (e + 1) % 3];
+				for (int direction = 0; direction < 2; ++direction)
+				{
+					unsigned int from = direction ? b : a;
+					unsigned int to   = direction ? a : b;
+					if (m_Locked[m_PositionIds[from]] || m_PositionIds[from] == m_PositionIds[to]) continue;
+
+					SQuadric quadric = m_Quadrics[m_PositionIds[from]];
+					quadric.Add( m_Quadrics[m_PositionIds[to]] );
+					double error = quadric.Evaluate( m_Positions[to] );
+					SCollapse collapse;
+					collapse.from = from;
+					collapse.to = to;
+					collapse.cost = (quadric.weight > 0.0 && error > 0.0) ? static_cast<float>(sqrt( error / quadric.weight )) : 0.0f;
+					collapses.push_back( collapse );
+				}
+			}
+		}
+		sort( collapses.begin(), collapses.end() );
+
+		// Make the cheapest collapses. A collapse changes all the triangles around the vertex that moves, so vertices around
+		// it are marked and are left alone until the next pass
+		for (unsigned int v = 0; v < numVertices; ++v)
+		{
+			remap[v] = v;
+			touched[v] = false;
+		}
+		unsigned int remainingIndices = numIndices;
+		int numCollapses = 0;
+		for (unsigned int c = 0; c < collapses.size() && remainingIndices > targetNumIndices; ++c)
+		{
+			const SCollapse& collapse = collapses[c];
+			if (touched[m_PositionIds[collapse.from]] || touched[m_PositionIds[collapse.to]]) continue;
+			if (!IsCollapseValid( collapse.from, collapse.to, firstTriangle, vertexTriangles )) continue;
+
+			remap[collapse.from] = collapse.to;
+			m_Quadrics[m_PositionIds[collapse.to]].Add( m_Quadrics[m_PositionIds[collapse.from]] );
+			if (collapse.cost > m_Error) m_Error = collapse.cost;
+			++numCollapses;
+
+			for (unsigned int i = firstTriangle[collapse.from]; i < firstTriangle[collapse.from + 1]; ++i)
+			{
+				unsigned int t = vertexTriangles[i];
+				bool removed = false;
+				for (int v = 0; v < 3; ++v)
+				{
+					touched[m_PositionIds[m_Indices[t + v]]] = true;
+					if (m_PositionIds[m_Indices[t + v]] == m_PositionIds[collapse.to]) removed = true;
+				}
+				if (removed) remainingIndices -= 3;
+			}
+		}
+		if (numCollapses == 0) break;
+
+		// Rebuild the index list, dropping triangles that have collapsed to a line
+		unsigned int numKept = 0;
+		for (unsigned int t = 0; t < numIndices; t += 3)
+		{
+			unsigned int i0 = remap[m_Indices[t]];
+			unsigned int i1 = remap[m_Indices[t + 1]];
+			unsigned int i2 = remap[m_Indices[t + 2]];
+			if (m_PositionIds[i0] == m_PositionIds[i1] || m_PositionIds[i1] == m_PositionIds[i2] ||
+			    m_PositionIds[i2] == m_PositionIds[i0]) continue;
+
+			m_Indices[numKept++] = static_cast<unsigned short>(i0);
+			m_Indices[numKept++] = static_cast<unsigned short>(i1);
+			m_Indices[numKept++] = static_cast<unsigned short>(i2);
+		}
+		m_Indices.resize( numKept );
+	}
+}
+
+
+// Check that moving vertex "from" onto "to" is safe - it must not flip any of the triangles that remain, and it must not join
+// triangles to a different seam vertex than the one along the edge
+bool CMeshSimplifier::IsCollapseValid( unsigned int from, unsigned int to, const vector<unsigned int>& firstTriangle,
+                                       const vector<unsigned int>& vertexTriangles ) const
+{
+	for (unsigned int i = firstTriangle[from]; i < firstTriangle[from + 1]; ++i)
+	{
+		unsigned int t = vertexTriangles[i];
+
+		// Triangles using the edge will disappear. If one of them uses another vertex at the target's position then the target
+		// is on a seam and the triangles on the far side of the seam would be given the wrong normals / UVs
+		bool usesEdge = false;
+		for (int v = 0; v < 3; ++v)
+		{
+			unsigned int index = m_Indices[t + v];
+			if (m_PositionIds[index] == m_PositionIds[to])
+			{
+				if (index != to) return false;
+				usesEdge = true;
+			}
+		}
+		if (usesEdge) continue;
+
+		// Other triangles must keep facing roughly the same way. A small turn is allowed, but a large one is likely to fold the
+		// triangle over its neighbours
+		D3DXVECTOR3 oldPoints[3], newPoints[3];
+		for (int v = 0; v < 3; ++v)
+		{
+			unsigned int index = m_Indices[t + v];
+			oldPoints[v] = m_Positions[index];
+			newPoints[v] = (index == from) ? m_Positions[to] : m_Positions[index];
+		}
+		D3DXVECTOR3 oldEdge1 = oldPoints[1] - oldPoints[0], oldEdge2 = oldPoints[2] - oldPoints[0];
+		D3DXVECTOR3 newEdge1 = newPoints[1] - newPoints[0], newEdge2 = newPoints[2] - newPoints[0];
+		D3DXVECTOR3 oldNormal, newNormal;
+		D3DXVec3Cross( &oldNormal, &oldEdge1, &oldEdge2 );
+		D3DXVec3Cross( &newNormal, &newEdge1, &newEdge2 );
+		float oldLength = D3DXVec3Length( &oldNormal );
+		float newLength = D3DXVec3Length( &newNormal );
+		if (D3DXVec3Dot( &oldNormal, &newNormal ) <= MinNormalCos * oldLength * newLength) return false;
+	}
+	return true;
+}
@@ -0,0 +1,118 @@
+//--------------------------------------------------------------------------------------
+//	MeshSimplifier.h
+//
+//	Mesh simplifier used to create lower levels of detail (LODs) for a model. Each LOD is
+//	a new index list that reuses the model's original vertices, so all the LODs can share
+//	one vertex buffer
+//--------------------------------------------------------------------------------------
+
+#ifndef MESH_SIMPLIFIER_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define MESH_SIMPLIFIER_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+#include <d3d10.h>
+#include <d3dx10.h>
+
+
+// The mesh is simplified by repeatedly collapsing edges: one vertex of an edge is moved onto the other and the triangles that
+// used the edge disappear. The cost of a collapse is measured with "quadric error metrics" (Garland & Heckbert) - each vertex keeps
+// a sum of the planes of the triangles it has absorbed, and the cost of moving it is its distance from those planes. The cheapest
+// collapses are made first. Vertices only ever move onto existing vertices, so no new vertex data is needed.
+//
+// Vertices on seams (several vertices at the same position with different normals or UVs) and on the open borders of the mesh are
+// never moved, so texture and lighting seams and the mesh outline are kept exactly
+class CMeshSimplifier
+{
+/////////////////////////////
+// Private types and member variables
+private:
+
+	// Symmetric 4x4 matrix holding a sum of squared distances to planes, weighted by triangle area. Only the ten unique values are stored
+	struct SQuadric
+	{
+		double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+		double weight; // Total area, used to turn the error into an average distance
+
+		void Clear();
+		void AddPlane( const D3DXVECTOR3& normal, float d, float area );
+		void Add( const SQuadric& other );
+		double Evaluate( const D3DXVECTOR3& point ) const;
+	};
+
+	// A possible collapse, vertex "from" moves onto vertex "to"
+	struct SCollapse
+	{
+		unsigned int from;
+		unsigned int to;
+		float        cost;
+
+		bool operator<( const SCollapse& other ) const
+		{
+			return cost < other.cost;
+		}
+	};
+
+	// Vertex positions, and for each vertex the first vertex at the same position (seam vertices share this "position id")
+	vector<D3DXVECTOR3>  m_Positions;
+	vector<unsigned int> m_PositionIds;
+
+	// Positions that must not move (seams and borders), indexed by position id
+	vector<bool>         m_Locked;
+
+	// Quadric for each position id
+	vector<SQuadric>     m_Quadrics;
+
+	// Current index list and the largest collapse cost used so far
+	vector<unsigned short> m_Indices;
+	float                  m_Error;
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	// Constructor - takes the raw vertex data (position must be the first element of each vertex) and the triangle list indices
+	CMeshSimplifier( const void* vertices, unsigned int numVertices, unsigned int vertexSize,
+	                 const unsigned short* indices, unsigned int numIndices );
+
+
+	/////////////////////////////
+	// Simplification
+
+	// Simplify the mesh further until it has no more than the given number of indices or no more collapses are possible. Each call
+	// continues from the result of the last, so a series of LODs can be made by calling with smaller and smaller targets
+	void Simplify( unsigned int targetNumIndices );
+
+	// Current index list
+	const vector<unsigned short>& GetIndices() const
+	{
+		return m_Indices;
+	}
+
+	// Approximate distance (model units) between the current mesh and the original - the largest collapse cost used so far
+	float GetError() const
+	{
+		return m_Error;
+	}
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	// Find the seam and border vertices and build the quadrics from the original triangles
+	void Analyse();
+
+	// Check that moving vertex "from" onto "to" is safe - it must not flip any of the triangles that remain, and it must not join
+	// triangles to a different seam vertex than the one along the edge. Triangles using a vertex are listed in the given ranges
+	bool IsCollapseValid( unsigned int from, unsigned int to, const vector<unsigned int>& firstTriangle,
+	                      const vector<unsigned int>& vertexTriangles ) const;
+};
+
+
+#endif // End of header guard - see top of file
@@ -5,12 +5,25 @@
 //	also manages it's positioning with a world matrix
 //--------------------------------------------------------------------------------------
 
+#include <algorithm>
+using namespace std;
+
 #include "Defines.h" // General definitions shared by all source files
 #include "Model.h"   // Declaration of this class
+#include "Camera.h"
+#include "MeshSimplifier.h"
 
 #include "CImportXFile.h"    // Class to load meshes (taken from a full graphics engine)
+#include "MeshCache.h"       // Binary cache of imported meshes
+#include "MeshCodec.h"       // Vertex order for the mesh cache
+#include "Profiler.h"        // Profiling scopes
 using namespace gen;
 
+// Constant block that models upload their vertex decoding into, shared by all models
+CConstantBlock<SPerObjectConstants>* CModel::s_PerObjectConstants = NULL;
+unsigned int CModel::s_NumDrawCalls = 0;
+
+
 ///////////////////////////////
 // Constructors / Destructors
 
@@ -20,18 +33,46 @@ CModel::CModel( D3DXVECTOR3 position, D3DXVECTOR3 rotation, float scale )
 	m_Position = position;
 	m_Rotation = rotation;
 	SetScale( scale );
-	UpdateMatrix();
 
 	// Good practice to ensure all private data is sensibly initialised
 	m_VertexBuffer = NULL;
 	m_NumVertices = 0;
 	m_VertexSize = 0;
 	m_VertexLayout = NULL;
+	m_NumVertexElts = 0;
+	m_InstancedLayout = NULL;
 
 	m_IndexBuffer = NULL;
 	m_NumIndices = 0;
 
+	m_GeometryPool = NULL;
+	m_PoolVertices = -1;
+	m_PoolIndices = -1;
+
+	m_NumLODs = 1;
+	m_LODStartIndex[0] = 0;
+	m_LODNumIndices[0] = 0;
+	m_LODError[0] = 0.0f;
+	m_CurrentLOD = 0;
+
 	m_HasGeometry = false;
+	m_UploadClusterIndices = false;
+	m_PositionDecode = D3DXVECTOR4( 0.0f, 0.0f, 0.0f, 1.0f );
+	m_OctahedralNormals = false;
+	memset( &m_EncodeStats, 0, sizeof(m_EncodeStats) );
+
+	// No bounds until geometry is loaded (bounds must be initialised before the world matrix is first updated)
+	m_HasBounds = false;
+	m_LocalMinBounds = m_LocalMaxBounds = m_LocalCentre = D3DXVECTOR3( 0, 0, 0 );
+	m_LocalRadius = 0.0f;
+	m_VisibleStamp = 0;
+	m_MatrixVersion = 0;
+	m_IsStatic = false;
+	D3DXMatrixIdentity( &m_WorldMatrix );
+	D3DXMatrixIdentity( &m_Next.worldMatrix );
+	D3DXMatrixIdentity( &m_PreviousMatrix );
+
+	UpdateMatrix();
 }
 
 // Model destructor
@@ -47,7 +88,30 @@ void CModel::ReleaseResources()
 	SAFE_RELEASE( m_IndexBuffer );  // Using a DirectX helper macro to simplify code here - look it up in Defines.h
 	SAFE_RELEASE( m_VertexBuffer );
 	SAFE_RELEASE( m_VertexLayout );
+	SAFE_RELEASE( m_InstancedLayout );
+	if (m_GeometryPool)
+	{
+		m_GeometryPool->FreeIndices( m_PoolIndices );
+		m_GeometryPool->FreeVertices( m_PoolVertices );
+		m_GeometryPool = NULL;
+	}
+	m_PoolVertices = -1;
+	m_PoolIndices = -1;
 	m_HasGeometry = false;
+	m_HasBounds = false;
+	m_NumLODs = 1;
+	m_LODNumIndices[0] = 0;
+	m_CurrentLOD = 0;
+	m_Clusters.clear();
+	m_UploadClusterIndices = false;
+	m_Subsets.clear();
+	m_CacheFileName.clear();
+	m_CacheSourceFileName.clear();
+	m_CacheStorage = SMeshCacheStorage();
+	m_CPUVertices.clear();
+	m_CPUNormals.clear();
+	m_CPUUVs.clear();
+	m_CPUIndices.clear();
 }
 
 
@@ -57,15 +121,35 @@ void CModel::ReleaseResources()
 // The loading and parsing of ".X" files is supported using a class taken from another application. We will not look at the process (more to do with parsing than graphics). Ultimately
 // we end up with arrays of data exactly as we have previously manually typed in
 
-// Load the model geometry from a file. This function only reads the geometry using the first material in the file, so multi-material
-// models will load but will have parts missing. May optionally request for tangents to be created for the model (for normal or parallax mapping)
+// Load the model geometry from a file. This function only reads the first mesh in the file. A mesh with several materials is loaded as one
+// set of vertices with a subset of the triangles for each material, each drawn separately (see RenderSubset). May optionally request
+// for tangents to be created for the model (for normal or parallax mapping)
 // We need to pass an example technique that the model will use to help DirectX understand how to connect this data with the vertex shaders
 // Returns true if the load was successful
-bool CModel::Load( const string& fileName, ID3D10EffectTechnique* exampleTechnique, bool tangents /*= false*/ ) // The commented out bit is the default parameter (can't write it here, only in the declaration)
+bool CModel::Load( const string& fileName, ID3D10EffectTechnique* exampleTechnique, bool tangents /*= false*/,
+                   EVertexFormat format /*= VertexFormat_Full*/ ) // The commented out bits are default parameters (can't write them here, only in the declaration)
 {
+	PROFILE_SCOPE( "CModel::Load" );
+
 	// Release any existing geometry in this object
 	ReleaseResources();
 
+	// Try the mesh cache first - it holds the sub-mesh as imported (compressed) and its clusters, so the file doesn't need to be parsed
+	// again and BuildClusters has nothing to do. The cache is ignored if the mesh file has changed since it was made. Meshes with and
+	// without tangents are cached separately
+	string cacheFileName = fileName + (tangents ? ".tangents.meshcache" : ".meshcache");
+	SSubMesh subMesh;
+	SMeshCacheStorage cacheStorage;
+	if (CMeshCache::Load( cacheFileName, fileName, subMesh, cacheStorage ))
+	{
+		if (!CreateGeometry( subMesh, exampleTechnique, format ))
+		{
+			return false;
+		}
+		m_Clusters = cacheStorage.clusters; // The cached indices are already in cluster order
+		return true;
+	}
+
 	// Use CImportXFile class (from another application) to load the given file. The import code is wrapped in the namespace 'gen'
 	CImportXFile mesh;
 	if (mesh.ImportFile( fileName.c_str() ) != kSuccess)
@@ -74,79 +158,59 @@ bool CModel::Load( const string& fileName, ID3D10EffectTechnique* exampleTechniq
 	}
 
 	// Get first sub-mesh from loaded file
-	SSubMesh subMesh;
 	if (mesh.GetSubMesh( 0, &subMesh, tangents ) != kSuccess)
 	{
 		return false;
 	}
 
+	// Put the vertices in the order the faces use them, which compresses best in the cache. Done before the geometry is created so
+	// the mesh loaded now matches the mesh loaded from the cache next time
+	CMeshCodec::OptimiseVertexOrder( subMesh.vertices, subMesh.numVertices, subMesh.vertexSize,
+	                                 reinterpret_cast<unsigned short*>(subMesh.faces), subMesh.numFaces * 3 );
+	if (!CreateGeometry( subMesh, exampleTechnique, format ))
+	{
+		return false;
+	}
 
+	// Keep the sub-mesh to write the cache for next time, once the clusters have been built (see SaveMeshCache)
+	CMeshCache::Copy( subMesh, m_CacheMesh, m_CacheStorage );
+	m_CacheFileName = cacheFileName;
+	m_CacheSourceFileName = fileName;
+	return true;
+}
+
+
+// Create the vertex and index buffers and vertex layout from an imported sub-mesh, converting the vertices to the given format
+bool CModel::CreateGeometry( const SSubMesh& subMesh, ID3D10EffectTechnique* exampleTechnique, EVertexFormat format )
+{
 	// Create vertex element list & layout. We need a vertex layout to say what data we have per vertex in this model (e.g. position, normal, uv, etc.)
-	// In previous projects the element list was a manually typed in array as we knew what data we would provide. However, as we can load models with
-	// different vertex data this time we need flexible code. The array is built up one element at a time: ask the import class if it loaded normals, 
-	// if so then add a normal line to the array, then ask if it loaded UVS...etc
-	unsigned int numElts = 0;
-	unsigned int offset = 0;
-	// Position is always required
-	m_VertexElts[numElts].SemanticName = "POSITION";   // Semantic in HLSL (what is this data for)
-	m_VertexElts[numElts].SemanticIndex = 0;           // Index to add to semantic (a count for this kind of data, when using multiple of the same type, e.g. TEXCOORD0, TEXCOORD1)
-	m_VertexElts[numElts].Format = DXGI_FORMAT_R32G32B32_FLOAT; // Type of data - this one will be a float3 in the shader. Most data communicated as though it were colours
-	m_VertexElts[numElts].AlignedByteOffset = offset;  // Offset of element from start of vertex data (e.g. if we have position (float3), uv (float2) then normal, the normal's offset is 5 floats = 5*4 = 20)
-	m_VertexElts[numElts].InputSlot = 0;               // For when using multiple vertex buffers (e.g. instancing - an advanced topic)
-	m_VertexElts[numElts].InputSlotClass = D3D10_INPUT_PER_VERTEX_DATA; // Use this value for most cases (only changed for instancing)
-	m_VertexElts[numElts].InstanceDataStepRate = 0;                     // --"--
-	offset += 12;
-	++numElts;
-	// Repeat for each kind of vertex data
-	if (subMesh.hasNormals)
-	{
-		m_VertexElts[numElts].SemanticName = "NORMAL";
-		m_VertexElts[numElts].SemanticIndex = 0;
-		m_VertexElts[numElts].Format = DXGI_FORMAT_R32G32B32_FLOAT;
-		m_VertexElts[numElts].AlignedByteOffset = offset;
-		m_VertexElts[numElts].InputSlot = 0;
-		m_VertexElts[numElts].InputSlotClass = D3D10_INPUT_PER_VERTEX_DATA;
-		m_VertexElts[numElts].InstanceDataStepRate = 0;
-		offset += 12;
-		++numElts;
-	}
-	if (subMesh.hasTangents)
-	{
-		m_VertexElts[numElts].SemanticName = "TANGENT";
-		m_VertexElts[numElts].SemanticIndex = 0;
-		m_VertexElts[numElts].Format = DXGI_FORMAT_R32G32B32_FLOAT;
-		m_VertexElts[numElts].AlignedByteOffset = offset;
-		m_VertexElts[numElts].InputSlot = 0;
-		m_VertexElts[numElts].InputSlotClass = D3D10_INPUT_PER_VERTEX_DATA;
-		m_VertexElts[numElts].InstanceDataStepRate = 0;
-		offset += 12;
-		++numElts;
-	}
-	if (subMesh.hasTextureCoords)
-	{
-		m_VertexElts[numElts].SemanticName = "TEXCOORD";
-		m_VertexElts[numElts].SemanticIndex = 0;
-		m_VertexElts[numElts].Format = DXGI_FORMAT_R32G32_FLOAT;
-		m_VertexElts[numElts].AlignedByteOffset = offset;
-		m_VertexElts[numElts].InputSlot = 0;
-		m_VertexElts[numElts].InputSlotClass = D3D10_INPUT_PER_VERTEX_DATA;
-		m_VertexElts[numElts].InstanceDataStepRate = 0;
-		offset += 8;
-		++numElts;
-	}
-	if (subMesh.hasVertexColours)
-	{
-		m_VertexElts[numElts].SemanticName = "COLOR";
-		m_VertexElts[numElts].SemanticIndex = 0;
-		m_VertexElts[numElts].Format = DXGI_FORMAT_R8G8B8A8_UNORM; // A RGBA colour with 1 byte (0-255) per component
-		m_VertexElts[numElts].AlignedByteOffset = offset;
-		m_VertexElts[numElts].InputSlot = 0;
-		m_VertexElts[numElts].InputSlotClass = D3D10_INPUT_PER_VERTEX_DATA;
-		m_VertexElts[numElts].InstanceDataStepRate = 0;
-		offset += 4;
-		++numElts;
-	}
-	m_VertexSize = offset;
+	// As we can load models with different vertex data we need flexible code. The encoder builds the element list up one element at a time:
+	// it is told if the import class loaded normals, if so it adds a normal line to the list, then if it loaded UVS...etc. The format of each
+	// element depends on the vertex format chosen - compact formats pack the data into fewer bytes (see VertexEncoder.h)
+	CVertexEncoder encoder( format, subMesh.hasNormals, subMesh.hasTangents, subMesh.hasTextureCoords, subMesh.hasVertexColours );
+	unsigned int numElts = encoder.GetNumElements();
+	for (unsigned int i = 0; i < numElts; ++i)
+	{
+		m_VertexElts[i] = encoder.GetElements()[i];
+	}
+	m_NumVertexElts = numElts;
+	m_VertexSize = encoder.GetVertexSize();
+
+	// Calculate bounding volumes from the vertex positions, used to cull the model when it is out of view. The imported vertices
+	// are used - they are all floats with position first
+	unsigned int sourceVertexSize = encoder.GetSourceVertexSize();
+	CalculateBounds( subMesh.vertices, subMesh.numVertices, sourceVertexSize );
+	// The imported vertex holds position, then normal, tangent and UVs if present
+	unsigned int normalOffset = subMesh.hasNormals ? 12 : 0;
+	unsigned int uvOffset = subMesh.hasTextureCoords ? 12 + (subMesh.hasNormals ? 12 : 0) + (subMesh.hasTangents ? 12 : 0) : 0;
+	StoreCPUGeometry( subMesh.vertices, subMesh.numVertices, sourceVertexSize, normalOffset, uvOffset,
+	                  reinterpret_cast<const unsigned short*>(subMesh.faces), subMesh.numFaces * 3 );
+
+	// Convert the vertices into the chosen format. Compact positions are stored within the model's bounds, so the shader is given
+	// values to decode them when the model is rendered
+	vector<unsigned char> vertexData;
+	encoder.Encode( subMesh.vertices, subMesh.numVertices, m_LocalMinBounds, m_LocalMaxBounds, vertexData, m_PositionDecode, m_EncodeStats );
+	m_OctahedralNormals = encoder.UsesOctahedralNormals();
 
 	// Given the vertex element list, pass it to DirectX to create a vertex layout. We also need to pass an example of a technique that will
 	// render this model. We will only be able to render this model with techniques that have the same vertex input as the example we use here
@@ -155,40 +219,231 @@ bool CModel::Load( const string& fileName, ID3D10EffectTechnique* exampleTechniq
 	g_pd3dDevice->CreateInputLayout( m_VertexElts, numElts, PassDesc.pIAInputSignature, PassDesc.IAInputSignatureSize, &m_VertexLayout );
 
 
-	// Create the vertex buffer and fill it with the loaded vertex data
+	// Add the converted vertex data to the geometry pool for this vertex layout, shared with other models (see GeometryPool.h)
 	m_NumVertices = subMesh.numVertices;
-	D3D10_BUFFER_DESC bufferDesc;
-	bufferDesc.BindFlags = D3D10_BIND_VERTEX_BUFFER;
-	bufferDesc.Usage = D3D10_USAGE_DEFAULT; // Not a dynamic buffer
-	bufferDesc.ByteWidth = m_NumVertices * m_VertexSize; // Buffer size
-	bufferDesc.CPUAccessFlags = 0;   // Indicates that CPU won't access this buffer at all after creation
-	bufferDesc.MiscFlags = 0;
-	D3D10_SUBRESOURCE_DATA initData; // Initial data
-	initData.pSysMem = subMesh.vertices;   
-	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, &initData, &m_VertexBuffer )))
+	m_GeometryPool = CGeometryPool::GetPool( m_VertexElts, numElts, m_VertexSize );
+	if (m_GeometryPool)
+	{
+		m_PoolVertices = m_GeometryPool->AddVertices( &vertexData[0], m_NumVertices );
+		if (m_PoolVertices < 0) m_GeometryPool = NULL;
+	}
+
+	// If the pool can't hold the vertices, create a vertex buffer for this model alone and fill it with the converted vertex data
+	if (!m_GeometryPool)
+	{
+		D3D10_BUFFER_DESC bufferDesc;
+		bufferDesc.BindFlags = D3D10_BIND_VERTEX_BUFFER;
+		bufferDesc.Usage = D3D10_USAGE_DEFAULT; // Not a dynamic buffer
+		bufferDesc.ByteWidth = m_NumVertices * m_VertexSize; // Buffer size
+		bufferDesc.CPUAccessFlags = 0;   // Indicates that CPU won't access this buffer at all after creation
+		bufferDesc.MiscFlags = 0;
+		D3D10_SUBRESOURCE_DATA initData; // Initial data
+		initData.pSysMem = &vertexData[0];
+		if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, &initData, &m_VertexBuffer )))
+		{
+			return false;
+		}
+	}
+
+
+	// Each material's triangles are a subset of the index list (the importer sorts the faces by material)
+	m_Subsets.clear();
+	for (unsigned int s = 0; s < subMesh.numSubsets; ++s)
+	{
+		SSubset subset;
+		subset.material = subMesh.subsets[s].material;
+		subset.startIndex[0] = subMesh.subsets[s].firstFace * 3;
+		subset.numIndices[0] = subMesh.subsets[s].numFaces * 3;
+		m_Subsets.push_back( subset );
+	}
+	if (m_Subsets.empty())
+	{
+		SSubset subset = { subMesh.material, { 0 }, { subMesh.numFaces * 3 } };
+		m_Subsets.push_back( subset );
+	}
+
+	// Create the index buffer - assuming 2-byte (WORD) index data. Also creates the LODs
+	if (!CreateIndexBuffer( reinterpret_cast<const unsigned short*>(subMesh.faces), subMesh.numFaces * 3 ))
 	{
 		return false;
 	}
 
+	m_HasGeometry = true;
+	return true;
+}
+
+
+// Create the index buffer from the given triangle list. Models with enough triangles also get simplified LODs, each made from the
+// one before with about half as many triangles. The simplifier leaves seams and borders alone, so some models stop simplifying
+// early - once a LOD no longer saves at least 10% of the triangles the series ends. The subsets must already be set up for LOD 0
+bool CModel::CreateIndexBuffer( const unsigned short* indices, unsigned int numIndices )
+{
+	vector<unsigned short> allIndices( indices, indices + numIndices );
+	m_NumLODs = 1;
+	m_LODStartIndex[0] = 0;
+	m_LODNumIndices[0] = numIndices;
+	m_LODError[0] = 0.0f;
+	m_CurrentLOD = 0;
+
+	if (numIndices / 3 >= MIN_LOD_TRIANGLES)
+	{
+		// Each subset is simplified on its own so its LOD triangles keep their material. Where subsets meet is a border to each
+		// subset's simplifier, so those edges are left alone and the subsets still join without gaps
+		vector<CMeshSimplifier> simplifiers;
+		simplifiers.reserve( m_Subsets.size() );
+		for (unsigned int s = 0; s < m_Subsets.size(); ++s)
+		{
+			simplifiers.push_back( CMeshSimplifier( &m_CPUVertices[0], static_cast<unsigned int>(m_CPUVertices.size()), sizeof(D3DXVECTOR3),
+			                                        indices + m_Subsets[s].startIndex[0], m_Subsets[s].numIndices[0] ) );
+		}
+		while (m_NumLODs < MAX_LODS)
+		{
+			unsigned int lodStartIndex = static_cast<unsigned int>(allIndices.size());
+			float lodError = 0.0f;
+			for (unsigned int s = 0; s < m_Subsets.size(); ++s)
+			{
+				SSubset& subset = m_Subsets[s];
+				unsigned int previousNumIndices = subset.numIndices[m_NumLODs - 1];
+				simplifiers[s].Simplify( (previousNumIndices / 6) * 3 );
+				const vector<unsigned short>& subsetIndices = simplifiers[s].GetIndices();
+
+				// A small subset could simplify away completely, leaving a hole - it keeps its previous triangles instead
+				subset.startIndex[m_NumLODs] = static_cast<unsigned int>(allIndices.size());
+				if (subsetIndices.empty() && previousNumIndices > 0)
+				{
+					unsigned int previousStart = subset.startIndex[m_NumLODs - 1];
+					allIndices.insert( allIndices.end(), allIndices.begin() + previousStart, allIndices.begin() + previousStart + previousNumIndices );
+					subset.numIndices[m_NumLODs] = previousNumIndices;
+				}
+				else
+				{
+					allIndices.insert( allIndices.end(), subsetIndices.begin(), subsetIndices.end() );
+					subset.numIndices[m_NumLODs] = static_cast<unsigned int>(subsetIndices.size());
+					if (simplifiers[s].GetError() > lodError) lodError = simplifiers[s].GetError();
+				}
+			}
+
+			unsigned int previousNumIndices = m_LODNumIndices[m_NumLODs - 1];
+			unsigned int lodNumIndices = static_cast<unsigned int>(allIndices.size()) - lodStartIndex;
+			if (lodNumIndices == 0 || lodNumIndices * 10 > previousNumIndices * 9)
+			{
+				allIndices.resize( lodStartIndex );
+				break;
+			}
+
+			m_LODStartIndex[m_NumLODs] = lodStartIndex;
+			m_LODNumIndices[m_NumLODs] = lodNumIndices;
+			m_LODError[m_NumLODs] = lodError;
+			++m_NumLODs;
+		}
+	}
 
-	// Create the index buffer - assuming 2-byte (WORD) index data
-	m_NumIndices = static_cast<unsigned int>(subMesh.numFaces) * 3;
+	// One index buffer holds all the LODs. Models using a geometry pool put their indices in the pool's index buffer
+	m_NumIndices = static_cast<unsigned int>(allIndices.size());
+	if (m_GeometryPool)
+	{
+		m_PoolIndices = m_GeometryPool->AddIndices( &allIndices[0], m_NumIndices );
+		return m_PoolIndices >= 0;
+	}
+	D3D10_BUFFER_DESC bufferDesc;
 	bufferDesc.BindFlags = D3D10_BIND_INDEX_BUFFER;
 	bufferDesc.Usage = D3D10_USAGE_DEFAULT;
 	bufferDesc.ByteWidth = m_NumIndices * sizeof(WORD);
 	bufferDesc.CPUAccessFlags = 0;
 	bufferDesc.MiscFlags = 0;
-	initData.pSysMem = subMesh.faces;   
+	D3D10_SUBRESOURCE_DATA initData;
+	initData.pSysMem = &allIndices[0];
 	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, &initData, &m_IndexBuffer )))
 	{
 		return false;
 	}
-
-	m_HasGeometry = true;
 	return true;
 }
 
 
+// Split the full detail geometry into clusters. The clusters are built from the system memory copy of the geometry, whose indices
+// are replaced with the reordered list (the same triangles, grouped by cluster). Each subset is split separately so every cluster
+// has a single material, and the subsets keep their place in the index list
+void CModel::BuildClusters()
+{
+	if (!m_Clusters.empty() || !m_HasGeometry || m_CPUIndices.empty() || m_CPUIndices.size() != m_LODNumIndices[0])
+	{
+		return; // Already built (or loaded from the mesh cache), or nothing to split
+	}
+
+	for (unsigned int s = 0; s < m_Subsets.size(); ++s)
+	{
+		const SSubset& subset = m_Subsets[s];
+		if (subset.numIndices[0] == 0) continue;
+
+		CMeshClusterBuilder builder( &m_CPUVertices[0], static_cast<unsigned int>(m_CPUVertices.size()), sizeof(D3DXVECTOR3),
+		                             &m_CPUIndices[subset.startIndex[0]], subset.numIndices[0] );
+		builder.Build();
+		const vector<unsigned short>& clusterIndices = builder.GetIndices();
+		copy( clusterIndices.begin(), clusterIndices.end(), m_CPUIndices.begin() + subset.startIndex[0] );
+		const vector<SMeshCluster>& clusters = builder.GetClusters();
+		for (unsigned int c = 0; c < clusters.size(); ++c)
+		{
+			m_Clusters.push_back( clusters[c] );
+			m_Clusters.back().startIndex += subset.startIndex[0];
+		}
+	}
+	m_UploadClusterIndices = !m_Clusters.empty();
+}
+
+// Copy the reordered indices made by BuildClusters into LOD 0's part of the index buffer, then write the mesh cache if the model was
+// imported
+void CModel::UploadClusterIndices()
+{
+	if (m_UploadClusterIndices)
+	{
+		if (m_GeometryPool)
+		{
+			m_GeometryPool->UpdateIndices( m_PoolIndices, 0, &m_CPUIndices[0], static_cast<unsigned int>(m_CPUIndices.size()) );
+		}
+		else
+		{
+			D3D10_BOX box;
+			box.left = 0;
+			box.right = static_cast<UINT>(m_CPUIndices.size() * sizeof(WORD));
+			box.top = 0;
+			box.bottom = 1;
+			box.front = 0;
+			box.back = 1;
+			g_pd3dDevice->UpdateSubresource( m_IndexBuffer, 0, &box, &m_CPUIndices[0], 0, 0 );
+		}
+		m_UploadClusterIndices = false;
+	}
+
+	SaveMeshCache();
+}
+
+// Write the sub-mesh kept by Load to the mesh cache, with the indices in cluster order and the clusters, then free it. Failing to
+// write the cache (e.g. a read-only folder) doesn't matter - the mesh will be imported again next time
+void CModel::SaveMeshCache()
+{
+	if (m_CacheFileName.empty())
+	{
+		return;
+	}
+
+	// The clusters only cover LOD 0, whose indices are the sub-mesh's triangles in cluster order
+	if (!m_Clusters.empty() && m_CPUIndices.size() == m_CacheMesh.numFaces * 3)
+	{
+		copy( m_CPUIndices.begin(), m_CPUIndices.end(), reinterpret_cast<unsigned short*>(m_CacheMesh.faces) );
+		CMeshCache::Save( m_CacheFileName, m_CacheSourceFileName, m_CacheMesh, m_Clusters );
+	}
+	else
+	{
+		CMeshCache::Save( m_CacheFileName, m_CacheSourceFileName, m_CacheMesh, vector<SMeshCluster>() );
+	}
+
+	m_CacheFileName.clear();
+	m_CacheSourceFileName.clear();
+	m_CacheStorage = SMeshCacheStorage();
+}
+
+
 /////////////////////////////
 // Model Usage
 
@@ -205,7 +460,165 @@ void CModel::UpdateMatrix()
 
 	// Multiply above matrices together to get the effect of them all combined - this makes the world matrix for the rendering pipeline
 	// Order of multiplication is important, get slightly different control mechanism depending on order
-	m_WorldMatrix = matrixScaling * matrixZRot * matrixXRot * matrixYRot * matrixTranslation;
+	m_Next.worldMatrix = matrixScaling * matrixZRot * matrixXRot * matrixYRot * matrixTranslation;
+
+	// Keep the world space bounding volumes in step with the matrix
+	UpdateWorldBounds();
+}
+
+// Make the world matrix and bounds last updated the ones rendered, blended with the previous update step's. The bounds of a
+// blended matrix are calculated again rather than blended, so they fit what is rendered
+void CModel::Publish( float blend )
+{
+	STransform blended;
+	const STransform* transform = &m_Next;
+	if (blend < 1.0f && m_PreviousMatrix != m_Next.worldMatrix)
+	{
+		BlendMatrices( &blended.worldMatrix, m_PreviousMatrix, m_Next.worldMatrix, blend );
+		CalculateWorldBounds( blended );
+		transform = &blended;
+	}
+
+	// Only count the matrix as changed if it actually has - most models are updated every frame whether they move or not
+	if (transform->worldMatrix != m_WorldMatrix)
+	{
+		m_WorldMatrix = transform->worldMatrix;
+		++m_MatrixVersion;
+	}
+	m_WorldMinBounds = transform->worldMinBounds;
+	m_WorldMaxBounds = transform->worldMaxBounds;
+	m_WorldCentre = transform->worldCentre;
+	m_WorldRadius = transform->worldRadius;
+}
+
+// Keep the world matrix last updated as the previous update step's
+void CModel::SaveStep()
+{
+	m_PreviousMatrix = m_Next.worldMatrix;
+}
+
+
+// Calculate the model space bounding volumes from raw vertex data. Position is always the first element of a vertex
+// so we can step through the data using the vertex size without knowing the rest of the layout
+void CModel::CalculateBounds( const void* vertices, unsigned int numVertices, unsigned int vertexSize )
+{
+	if (numVertices == 0)
+	{
+		m_HasBounds = false;
+		return;
+	}
+
+	const unsigned char* vertexData = static_cast<const unsigned char*>(vertices);
+	m_LocalMinBounds = m_LocalMaxBounds = *reinterpret_cast<const D3DXVECTOR3*>(vertexData);
+	for (unsigned int v = 1; v < numVertices; ++v)
+	{
+		const D3DXVECTOR3* position = reinterpret_cast<const D3DXVECTOR3*>(vertexData + v * vertexSize);
+		D3DXVec3Minimize( &m_LocalMinBounds, &m_LocalMinBounds, position );
+		D3DXVec3Maximize( &m_LocalMaxBounds, &m_LocalMaxBounds, position );
+	}
+
+	// Sphere is centred on the box, but the radius is taken from the vertices, which gives a tighter fit than the box corners
+	m_LocalCentre = (m_LocalMinBounds + m_LocalMaxBounds) * 0.5f;
+	float radiusSq = 0.0f;
+	for (unsigned int v = 0; v < numVertices; ++v)
+	{
+		D3DXVECTOR3 offset = *reinterpret_cast<const D3DXVECTOR3*>(vertexData + v * vertexSize) - m_LocalCentre;
+		float distanceSq = D3DXVec3LengthSq( &offset );
+		if (distanceSq > radiusSq)
+		{
+			radiusSq = distanceSq;
+		}
+	}
+	m_LocalRadius = sqrtf( radiusSq );
+
+	m_HasBounds = true;
+	UpdateWorldBounds();
+}
+
+
+// Keep a copy of the vertex positions and indices in system memory. As with the bounds, position is the first element of each vertex
+void CModel::StoreCPUGeometry( const void* vertices, unsigned int numVertices, unsigned int vertexSize, unsigned int normalOffset,
+                               unsigned int uvOffset, const unsigned short* indices, unsigned int numIndices )
+{
+	const unsigned char* vertexData = static_cast<const unsigned char*>(vertices);
+	m_CPUVertices.resize( numVertices );
+	m_CPUNormals.resize( normalOffset ? numVertices : 0 );
+	m_CPUUVs.resize( uvOffset ? numVertices : 0 );
+	for (unsigned int v = 0; v < numVertices; ++v)
+	{
+		const unsigned char* vertex = vertexData + v * vertexSize;
+		m_CPUVertices[v] = *reinterpret_cast<const D3DXVECTOR3*>(vertex);
+		if (normalOffset) m_CPUNormals[v] = *reinterpret_cast<const D3DXVECTOR3*>(vertex + normalOffset);
+		if (uvOffset) m_CPUUVs[v] = *reinterpret_cast<const D3DXVECTOR2*>(vertex + uvOffset);
+	}
+	m_CPUIndices.assign( indices, indices + numIndices );
+}
+
+
+// Transform the model space bounding volumes into world space using the next frame's world matrix, then mark the model to be
+// published
+void CModel::UpdateWorldBounds()
+{
+	CalculateWorldBounds( m_Next );
+	MarkForPublish();
+}
+
+// Transform the model space bounding volumes into world space using the world matrix of the given transform. Models without
+// bounds are given a point at their position
+void CModel::CalculateWorldBounds( STransform& transform ) const
+{
+	if (!m_HasBounds)
+	{
+		transform.worldCentre = D3DXVECTOR3( transform.worldMatrix._41, transform.worldMatrix._42, transform.worldMatrix._43 );
+		transform.worldMinBounds = transform.worldMaxBounds = transform.worldCentre;
+		transform.worldRadius = 0.0f;
+		return;
+	}
+
+	// Transform the box by taking each world axis in turn and adding the smallest and largest contribution from each matrix
+	// element. This gives the box around the rotated box without transforming all eight corners (J. Arvo, Graphics Gems)
+	const float* m = transform.worldMatrix;
+	const float* localMin = m_LocalMinBounds;
+	const float* localMax = m_LocalMaxBounds;
+	float* worldMin = transform.worldMinBounds;
+	float* worldMax = transform.worldMaxBounds;
+	for (int i = 0; i < 3; ++i)
+	{
+		worldMin[i] = worldMax[i] = m[12 + i]; // Translation row
+		for (int j = 0; j < 3; ++j)
+		{
+			float a = m[j * 4 + i] * localMin[j];
+			float b = m[j * 4 + i] * localMax[j];
+			worldMin[i] += (a < b) ? a : b;
+			worldMax[i] += (a < b) ? b : a;
+		}
+	}
+
+	// Transform the sphere centre and scale its radius by the largest scaling in the matrix
+	D3DXVec3TransformCoord( &transform.worldCentre, &m_LocalCentre, &transform.worldMatrix );
+	float maxScaleSq = 0.0f;
+	for (int j = 0; j < 3; ++j)
+	{
+		float rowLengthSq = m[j * 4] * m[j * 4] + m[j * 4 + 1] * m[j * 4 + 1] + m[j * 4 + 2] * m[j * 4 + 2];
+		if (rowLengthSq > maxScaleSq)
+		{
+			maxScaleSq = rowLengthSq;
+		}
+	}
+	transform.worldRadius = m_LocalRadius * sqrtf( maxScaleSq );
+}
+
+
+// Test the model's world bounding volumes against a view frustum. The sphere test is cheaper so it is done first, the
+// box test then catches most of the cases that the sphere lets through. Models without bounds are always visible
+bool CModel::IsVisible( const CFrustum& frustum )
+{
+	if (!m_HasBounds)
+	{
+		return true;
+	}
+	return frustum.IsSphereVisible( m_WorldCentre, m_WorldRadius ) &&
+	       frustum.IsBoxVisible( m_WorldMinBounds, m_WorldMaxBounds );
 }
 
 
@@ -241,15 +654,15 @@ void CModel::Control( float frameTime, EKeyCode turnUp, EKeyCode turnDown, EKeyC
 	// Local Z movement - move in the direction of the Z axis, get axis from world matrix
 	if (KeyHeld( moveForward ))
 	{
-		m_Position.x += m_WorldMatrix._31 * MoveSpeed * frameTime;
-		m_Position.y += m_WorldMatrix._32 * MoveSpeed * frameTime;
-		m_Position.z += m_WorldMatrix._33 * MoveSpeed * frameTime;
+		m_Position.x += m_Next.worldMatrix._31 * MoveSpeed * frameTime;
+		m_Position.y += m_Next.worldMatrix._32 * MoveSpeed * frameTime;
+		m_Position.z += m_Next.worldMatrix._33 * MoveSpeed * frameTime;
 	}
 	if (KeyHeld( moveBackward ))
 	{
-		m_Position.x -= m_WorldMatrix._31 * MoveSpeed * frameTime;
-		m_Position.y -= m_WorldMatrix._32 * MoveSpeed * frameTime;
-		m_Position.z -= m_WorldMatrix._33 * MoveSpeed * frameTime;
+		m_Position.x -= m_Next.worldMatrix._31 * MoveSpeed * frameTime;
+		m_Position.y -= m_Next.worldMatrix._32 * MoveSpeed * frameTime;
+		m_Position.z -= m_Next.worldMatrix._33 * MoveSpeed * frameTime;
 	}
 }
 
@@ -260,6 +673,29 @@ void CModel::FacePoint(D3DXVECTOR3 point) {
 }
 
 
+// Select the LOD to render for the given camera. The LOD errors are in model space, so they are scaled into world space and then
+// into pixels at the nearest point of the model's bounding sphere. The most simplified LOD whose error stays within the allowed
+// number of pixels is used
+int CModel::SelectLOD( CCamera* camera, float maxPixelError /*= 1.0f*/ )
+{
+	m_CurrentLOD = 0;
+	if (m_NumLODs == 1 || !m_HasBounds)
+	{
+		return m_CurrentLOD;
+	}
+
+	D3DXVECTOR3 toModel = m_WorldCentre - camera->GetWorldPosition();
+	float distance = D3DXVec3Length( &toModel ) - m_WorldRadius;
+	float worldScale = (m_LocalRadius > 0.0f) ? m_WorldRadius / m_LocalRadius : 1.0f;
+	float pixelsPerUnit = camera->GetPixelsPerUnit( distance ) * worldScale;
+	while (m_CurrentLOD + 1 < m_NumLODs && m_LODError[m_CurrentLOD + 1] * pixelsPerUnit <= maxPixelError)
+	{
+		++m_CurrentLOD;
+	}
+	return m_CurrentLOD;
+}
+
+
 // Render the model with the given technique. Assumes any shader variables for the technique have already been set up (e.g. matrices and textures)
 void CModel::Render( ID3D10EffectTechnique* technique )
 {
@@ -269,12 +705,123 @@ void CModel::Render( ID3D10EffectTechnique* technique )
 		return;
 	}
 
-	// Select vertex and index buffer - assuming all data will be as triangle lists
-	UINT offset = 0;
-	g_pd3dDevice->IASetVertexBuffers( 0, 1, &m_VertexBuffer, &m_VertexSize, &offset );
+	// One draw call per subset
+	m_DrawRanges.clear();
+	for (unsigned int s = 0; s < m_Subsets.size(); ++s)
+	{
+		SIndexRange range = { m_Subsets[s].startIndex[m_CurrentLOD], m_Subsets[s].numIndices[m_CurrentLOD] };
+		if (range.numIndices > 0) m_DrawRanges.push_back( range );
+	}
+	if (!m_DrawRanges.empty())
+	{
+		DrawIndexRanges( technique, &m_DrawRanges[0], static_cast<unsigned int>(m_DrawRanges.size()) );
+	}
+}
+
+
+// Render a single subset of the model (the triangles using one material), so material settings can be changed between subsets
+void CModel::RenderSubset( ID3D10EffectTechnique* technique, int subset )
+{
+	if (!m_HasGeometry || subset < 0 || subset >= static_cast<int>(m_Subsets.size()))
+	{
+		return;
+	}
+
+	SIndexRange range = { m_Subsets[subset].startIndex[m_CurrentLOD], m_Subsets[subset].numIndices[m_CurrentLOD] };
+	if (range.numIndices > 0)
+	{
+		DrawIndexRanges( technique, &range, 1 );
+	}
+}
+
+
+// Render only the clusters that may be visible to the given camera. Each cluster's sphere is tested against the camera's frustum,
+// then its normal cone is tested against the direction to the camera. The cone holds every triangle normal in the cluster, so if
+// the camera is behind all the triangles' planes wherever it looks at the sphere from, the whole cluster faces away. Neighbouring
+// visible clusters are next to each other in the index buffer, so they are joined into one draw call (even across subsets, as the
+// whole model is drawn with the same settings)
+void CModel::RenderClusters( ID3D10EffectTechnique* technique, CCamera* camera, bool cullBackFaces, SClusterStats& stats )
+{
+	if (!m_HasGeometry)
+	{
+		return;
+	}
+	if (m_Clusters.empty() || m_CurrentLOD != 0)
+	{
+		Render( technique );
+		return;
+	}
+
+	// Clusters are in model space. The sphere radii are scaled by the largest scaling in the world matrix. The cone test needs
+	// the matrix to keep angles, so it is only used if the scaling is the same on every axis
+	const float* m = m_WorldMatrix;
+	float minScaleSq = 0.0f, maxScaleSq = 0.0f;
+	for (int j = 0; j < 3; ++j)
+	{
+		float rowLengthSq = m[j * 4] * m[j * 4] + m[j * 4 + 1] * m[j * 4 + 1] + m[j * 4 + 2] * m[j * 4 + 2];
+		if (j == 0 || rowLengthSq < minScaleSq) minScaleSq = rowLengthSq;
+		if (j == 0 || rowLengthSq > maxScaleSq) maxScaleSq = rowLengthSq;
+	}
+	float scale = sqrtf( maxScaleSq );
+	bool testCones = cullBackFaces && minScaleSq > 0.98f * maxScaleSq;
+
+	const CFrustum& frustum = camera->GetFrustum();
+	D3DXVECTOR3 cameraPosition = camera->GetWorldPosition();
+	m_DrawRanges.clear();
+	for (unsigned int c = 0; c < m_Clusters.size(); ++c)
+	{
+		const SMeshCluster& cluster = m_Clusters[c];
+		D3DXVECTOR3 centre;
+		D3DXVec3TransformCoord( &centre, &cluster.centre, &m_WorldMatrix );
+		float radius = cluster.radius * scale;
+		if (!frustum.IsSphereVisible( centre, radius ))
+		{
+			++stats.outsideFrustum;
+			continue;
+		}
+
+		// Back-facing if the angle between the cone axis and the direction to the cluster, plus the cone's own angle, plus the
+		// angle the sphere covers from the camera is less than 90 degrees. That is tested conservatively with sines
+		if (testCones && cluster.coneCutoff < 1.0f)
+		{
+			D3DXVECTOR3 axis;
+			D3DXVec3TransformNormal( &axis, &cluster.coneAxis, &m_WorldMatrix );
+			D3DXVec3Normalize( &axis, &axis );
+			D3DXVECTOR3 toCluster = centre - cameraPosition;
+			float distance = D3DXVec3Length( &toCluster );
+			if (D3DXVec3Dot( &toCluster, &axis ) > cluster.coneCutoff * distance + radius)
+			{
+				++stats.backFacing;
+				continue;
+			}
+		}
+
+		++stats.drawn;
+		if (!m_DrawRanges.empty() && m_DrawRanges.back().startIndex + m_DrawRanges.back().numIndices == cluster.startIndex)
+		{
+			m_DrawRanges.back().numIndices += cluster.numIndices;
+		}
+		else
+		{
+			SIndexRange range = { cluster.startIndex, cluster.numIndices };
+			m_DrawRanges.push_back( range );
+		}
+	}
+
+	if (!m_DrawRanges.empty())
+	{
+		DrawIndexRanges( technique, &m_DrawRanges[0], static_cast<unsigned int>(m_DrawRanges.size()) );
+	}
+}
+
+
+// Draw the given ranges of the index buffer with each pass of the technique
+void CModel::DrawIndexRanges( ID3D10EffectTechnique* technique, const SIndexRange* ranges, unsigned int numRanges )
+{
+	unsigned int poolStartIndex;
+	int poolBaseVertex;
+	BindGeometry( poolStartIndex, poolBaseVertex );
 	g_pd3dDevice->IASetInputLayout( m_VertexLayout );
-	g_pd3dDevice->IASetIndexBuffer( m_IndexBuffer, DXGI_FORMAT_R16_UINT, 0 );
-	g_pd3dDevice->IASetPrimitiveTopology( D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
 
 	// Render the model. All the data and shader variables are prepared, now select the technique to use and draw.
 	// The loop is for advanced techniques that need multiple passes - we will only use techniques with one pass
@@ -283,7 +830,99 @@ void CModel::Render( ID3D10EffectTechnique* technique )
 	for( UINT p = 0; p < techDesc.Passes; ++p )
 	{
 		technique->GetPassByIndex( p )->Apply( 0 );
-		g_pd3dDevice->DrawIndexed( m_NumIndices, 0, 0 );
+		for (unsigned int r = 0; r < numRanges; ++r)
+		{
+			g_pd3dDevice->DrawIndexed( ranges[r].numIndices, poolStartIndex + ranges[r].startIndex, poolBaseVertex );
+		}
+		s_NumDrawCalls += numRanges;
+	}
+}
+
+
+// Create the input layout used by RenderInstanced - the model's vertex elements followed by the given per-instance elements, which
+// must be in input slot 1. The technique must be one RenderInstanced will be used with
+bool CModel::CreateInstancedLayout( ID3D10EffectTechnique* technique, const D3D10_INPUT_ELEMENT_DESC* instanceElts, unsigned int numInstanceElts )
+{
+	SAFE_RELEASE( m_InstancedLayout );
+
+	unsigned int numVertexElts = m_NumVertexElts;
+	if (numVertexElts + numInstanceElts > MAX_VERTEX_ELTS) return false;
+
+	D3D10_INPUT_ELEMENT_DESC elts[MAX_VERTEX_ELTS];
+	for (unsigned int i = 0; i < numVertexElts; ++i)
+	{
+		elts[i] = m_VertexElts[i];
+	}
+	for (unsigned int i = 0; i < numInstanceElts; ++i)
+	{
+		elts[numVertexElts + i] = instanceElts[i];
+	}
+
+	D3D10_PASS_DESC PassDesc;
+	technique->GetPassByIndex( 0 )->GetDesc( &PassDesc );
+	return SUCCEEDED( g_pd3dDevice->CreateInputLayout( elts, numVertexElts + numInstanceElts, PassDesc.pIAInputSignature,
+	                                                   PassDesc.IAInputSignatureSize, &m_InstancedLayout ) );
+}
+
+// Render copies of the model with one draw call per subset, using the current LOD. Each copy's instance data is read from the given
+// buffer, starting at the given byte offset
+void CModel::RenderInstanced( ID3D10EffectTechnique* technique, ID3D10Buffer* instanceBuffer, unsigned int instanceSize,
+                              unsigned int instanceOffset, unsigned int numInstances )
+{
+	if (!m_HasGeometry || !m_InstancedLayout || numInstances == 0) return;
+
+	unsigned int poolStartIndex;
+	int poolBaseVertex;
+	BindGeometry( poolStartIndex, poolBaseVertex );
+	g_pd3dDevice->IASetVertexBuffers( 1, 1, &instanceBuffer, &instanceSize, &instanceOffset );
+	g_pd3dDevice->IASetInputLayout( m_InstancedLayout );
+
+	D3D10_TECHNIQUE_DESC techDesc;
+	technique->GetDesc( &techDesc );
+	for (UINT p = 0; p < techDesc.Passes; ++p)
+	{
+		technique->GetPassByIndex( p )->Apply( 0 );
+		for (unsigned int s = 0; s < m_Subsets.size(); ++s)
+		{
+			const SSubset& subset = m_Subsets[s];
+			if (subset.numIndices[m_CurrentLOD] == 0) continue;
+			g_pd3dDevice->DrawIndexedInstanced( subset.numIndices[m_CurrentLOD], numInstances,
+			                                    poolStartIndex + subset.startIndex[m_CurrentLOD], poolBaseVertex, 0 );
+			++s_NumDrawCalls;
+		}
+	}
+}
+
+
+// Bind the model's vertex and index buffers and tell the shaders how its vertex data is stored. Gets the offsets to add to the
+// index ranges and indices of the model when drawing
+void CModel::BindGeometry( unsigned int& poolStartIndex, int& poolBaseVertex )
+{
+	// Select vertex and index buffer - assuming all data will be as triangle lists. A pooled model's buffers are often still bound from
+	// the previous model. Its geometry is found by offsetting the index ranges and adding a base vertex to every index
+	poolStartIndex = 0;
+	poolBaseVertex = 0;
+	if (m_GeometryPool)
+	{
+		m_GeometryPool->Bind();
+		poolStartIndex = m_GeometryPool->GetIndexOffset( m_PoolIndices );
+		poolBaseVertex = static_cast<int>(m_GeometryPool->GetVertexOffset( m_PoolVertices ));
+	}
+	else
+	{
+		UINT offset = 0;
+		g_pd3dDevice->IASetVertexBuffers( 0, 1, &m_VertexBuffer, &m_VertexSize, &offset );
+		g_pd3dDevice->IASetIndexBuffer( m_IndexBuffer, DXGI_FORMAT_R16_UINT, 0 );
+		CGeometryPool::ForgetBinding();
+	}
+	g_pd3dDevice->IASetPrimitiveTopology( D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
+
+	// Tell the shaders how this model's vertex data is stored, sending it with the other per-object constants
+	if (s_PerObjectConstants)
+	{
+		SPerObjectConstants& constants = s_PerObjectConstants->Edit();
+		constants.positionDecode = m_PositionDecode;
+		constants.octahedralNormals = m_OctahedralNormals;
+		s_PerObjectConstants->Upload();
 	}
-	g_pd3dDevice->DrawIndexed( m_NumIndices, 0, 0 );
 }
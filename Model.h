@@ -9,14 +9,24 @@
 #define MODEL_H_INCLUDED
 
 #include <string>
+#include <vector>
 using namespace std;
 
 #include <d3d10.h>
 #include <d3dx10.h>
 #include "Input.h"
+#include "Frustum.h"
+#include "MeshClusters.h"
+#include "MeshCache.h"
+#include "VertexEncoder.h"
+#include "GeometryPool.h"
+#include "ShaderConstants.h"
+#include "FramePipeline.h" // CPublishable
 
+class CCamera;
 
-class CModel
+
+class CModel : public CPublishable
 {
 /////////////////////////////
 // Private member variables
@@ -29,13 +39,11 @@ protected:
 	D3DXVECTOR3   m_Rotation;
 	D3DXVECTOR3   m_Scale;
 
-	// World matrix for the model - built from the above
+	// World matrix for the model - built from the above. This, the world bounding volumes and the matrix version are the values
+	// rendered. The scene update builds the next frame's values in m_Next, which are copied over them when published (see
+	// FramePipeline.h)
 	D3DXMATRIX m_WorldMatrix;
 
-	// Effect variable data
-	ID3D10EffectVectorVariable* m_PosVar = 0;
-	ID3D10EffectVectorVariable* m_ColourVar = 0;
-
 	//-----------------
 	// Geometry data
 
@@ -49,13 +57,163 @@ protected:
 	// Description of the elements in a single vertex (position, normal, UVs etc.)
 	static const int         MAX_VERTEX_ELTS = 64;
 	D3D10_INPUT_ELEMENT_DESC m_VertexElts[MAX_VERTEX_ELTS];
+	unsigned int             m_NumVertexElts;
 	ID3D10InputLayout*       m_VertexLayout; // Layout of a vertex (derived from above)
+	ID3D10InputLayout*       m_InstancedLayout; // Layout with extra per-instance data, for RenderInstanced (see CreateInstancedLayout)
 	unsigned int             m_VertexSize;   // Size of vertex calculated from contained elements
 
+	// How the vertex data is stored. Compact formats store positions within the model's bounds, decoded in the shader as
+	// position * w + xyz, and may store normals and tangents with octahedral encoding (see VertexEncoder.h)
+	D3DXVECTOR4              m_PositionDecode;
+	bool                     m_OctahedralNormals;
+	SVertexEncodeStats       m_EncodeStats;
+
+	// Constant block that the above is uploaded in with the rest of the per-object constants, shared by all models
+	static CConstantBlock<SPerObjectConstants>* s_PerObjectConstants;
+
+	// Number of draw calls made by all models since the count was last reset
+	static unsigned int      s_NumDrawCalls;
+
 	// Index data for the model stored in a index buffer and the number of indices in the buffer
 	ID3D10Buffer*            m_IndexBuffer;
 	unsigned int             m_NumIndices;
 
+	// Models normally store their vertices and indices in the geometry pool for their vertex layout, shared with other models, rather
+	// than in their own buffers (which are then NULL). These are the pool and the handles of the model's allocations in it
+	CGeometryPool*           m_GeometryPool;
+	int                      m_PoolVertices;
+	int                      m_PoolIndices;
+
+	//-----------------
+	// Levels of detail
+
+	// Simplified versions of the geometry to render when the model is far away. All levels of detail (LODs) use the same vertex buffer,
+	// their index lists are stored one after another in the index buffer with LOD 0 (the full geometry) first. The error of each LOD is
+	// roughly how far its surface strays from the full geometry, in model space units
+	static const int         MAX_LODS = 4;
+	static const unsigned int MIN_LOD_TRIANGLES = 256; // Smaller models are cheap enough to always render in full
+	int                      m_NumLODs;
+	unsigned int             m_LODStartIndex[MAX_LODS];
+	unsigned int             m_LODNumIndices[MAX_LODS];
+	float                    m_LODError[MAX_LODS];
+	int                      m_CurrentLOD;
+
+	//-----------------
+	// Subsets
+
+	// The triangles are sorted by material into subsets, each a range of the indices in every LOD. All subsets share the vertex
+	// buffer. Each subset is drawn with its own DrawIndexed call so material settings can be changed between them (see RenderSubset)
+	struct SSubset
+	{
+		unsigned int material;             // Index of the subset's material in the mesh file
+		unsigned int startIndex[MAX_LODS];
+		unsigned int numIndices[MAX_LODS];
+	};
+	vector<SSubset>          m_Subsets;
+
+	//-----------------
+	// Clusters
+
+	// The full detail geometry (LOD 0) split into small clusters of triangles, each with a bounding sphere and normal cone. LOD 0's
+	// indices are stored cluster by cluster, so each cluster is a range of the index buffer that can be drawn or skipped on its own
+	vector<SMeshCluster>     m_Clusters;
+	bool                     m_UploadClusterIndices; // Clusters built since the index buffer was created, see UploadClusterIndices
+
+	// Ranges of the index buffer to draw, reused each time clusters are rendered to avoid allocating memory
+	struct SIndexRange
+	{
+		unsigned int startIndex;
+		unsigned int numIndices;
+	};
+	vector<SIndexRange>      m_DrawRanges;
+
+	//-----------------
+	// Mesh cache
+
+	// A sub-mesh imported by Load, kept until the model is split into clusters so the mesh cache can hold them too. Written to the
+	// cache by UploadClusterIndices. The file name is empty when there is nothing to write
+	string                   m_CacheFileName;
+	string                   m_CacheSourceFileName;
+	gen::SSubMesh            m_CacheMesh;
+	SMeshCacheStorage        m_CacheStorage;
+
+	//-----------------
+	// Bounding volumes
+
+	// Axis-aligned box and sphere around the geometry in model space, calculated when the model is loaded
+	bool                     m_HasBounds;
+	D3DXVECTOR3              m_LocalMinBounds;
+	D3DXVECTOR3              m_LocalMaxBounds;
+	D3DXVECTOR3              m_LocalCentre;
+	float                    m_LocalRadius;
+
+	// The same volumes in world space, updated along with the world matrix
+	D3DXVECTOR3              m_WorldMinBounds;
+	D3DXVECTOR3              m_WorldMaxBounds;
+	D3DXVECTOR3              m_WorldCentre;
+	float                    m_WorldRadius;
+
+	// Static models are not expected to move, so work done with them (e.g. their contribution to shadow maps) can be kept between frames
+	bool                     m_IsStatic;
+
+	// Increased every time the world matrix changes, so other code can tell if the model has moved since it last looked
+	unsigned int             m_MatrixVersion;
+
+	// The world matrix and world bounding volumes being prepared for the next frame, and the world matrix of the previous update
+	// step - what is rendered is blended between the two (see FramePipeline.h)
+	struct STransform
+	{
+		D3DXMATRIX   worldMatrix;
+		D3DXVECTOR3  worldMinBounds;
+		D3DXVECTOR3  worldMaxBounds;
+		D3DXVECTOR3  worldCentre;
+		float        worldRadius;
+	};
+	STransform               m_Next;
+	D3DXMATRIX               m_PreviousMatrix;
+
+	// Identifies the last view query that found this model visible (see MarkVisible below)
+	unsigned int             m_VisibleStamp;
+
+	// Copy of the vertex positions and indices kept in system memory. The GPU buffers can't be read back, but the positions are
+	// needed on the CPU to render the model as an occluder for software occlusion culling. Normals and UVs are kept too (if the model
+	// has them) so static models can be merged into static batches (see StaticBatch.h)
+	vector<D3DXVECTOR3>      m_CPUVertices;
+	vector<D3DXVECTOR3>      m_CPUNormals;
+	vector<D3DXVECTOR2>      m_CPUUVs;
+	vector<unsigned short>   m_CPUIndices;
+
+	// Calculate the model space bounding volumes from raw vertex data (position must be the first element of each vertex)
+	void CalculateBounds( const void* vertices, unsigned int numVertices, unsigned int vertexSize );
+
+	// Transform the model space bounding volumes into world space using the next frame's world matrix
+	void UpdateWorldBounds();
+
+	// Transform the model space bounding volumes into world space using the world matrix of the given transform
+	void CalculateWorldBounds( STransform& transform ) const;
+
+	// Keep a copy of the vertex positions (first element of each vertex), normals, UVs and the indices in system memory. Normals and UVs
+	// are at the given byte offsets in each vertex, an offset of zero means the vertices don't have them
+	void StoreCPUGeometry( const void* vertices, unsigned int numVertices, unsigned int vertexSize, unsigned int normalOffset,
+	                       unsigned int uvOffset, const unsigned short* indices, unsigned int numIndices );
+
+	// Draw the given ranges of the index buffer with each pass of the technique
+	void DrawIndexRanges( ID3D10EffectTechnique* technique, const SIndexRange* ranges, unsigned int numRanges );
+
+	// Bind the model's vertex and index buffers and upload the per-object constants with its vertex decoding. Gets the offsets to add to its index
+	// ranges and indices (non-zero for models in a geometry pool). The input layout is not set
+	void BindGeometry( unsigned int& poolStartIndex, int& poolBaseVertex );
+
+	// Create the vertex and index buffers and vertex layout from an imported sub-mesh, converting the vertices to the given format
+	bool CreateGeometry( const gen::SSubMesh& subMesh, ID3D10EffectTechnique* exampleTechnique, EVertexFormat format );
+
+	// Create the index buffer from the given triangle list, along with simplified LODs for larger models. The system memory copy
+	// of the geometry must already be stored
+	bool CreateIndexBuffer( const unsigned short* indices, unsigned int numIndices );
+
+	// Write the sub-mesh kept by Load to the mesh cache, with the indices in cluster order and the clusters, then free it
+	void SaveMeshCache();
+
 
 /////////////////////////////
 // Public member functions
@@ -94,13 +252,89 @@ public:
 	{
 		return m_WorldMatrix;
 	}
-	ID3D10EffectVectorVariable* GetPosVar()
+	D3DXVECTOR3 GetWorldPosition() // Position rendered at - GetPosition may already be a frame ahead (see FramePipeline.h)
+	{
+		return D3DXVECTOR3( m_WorldMatrix._41, m_WorldMatrix._42, m_WorldMatrix._43 );
+	}
+	bool HasBounds()
+	{
+		return m_HasBounds;
+	}
+	D3DXVECTOR3 GetWorldMinBounds()
+	{
+		return m_WorldMinBounds;
+	}
+	D3DXVECTOR3 GetWorldMaxBounds()
+	{
+		return m_WorldMaxBounds;
+	}
+	D3DXVECTOR3 GetWorldCentre()
+	{
+		return m_WorldCentre;
+	}
+	float GetWorldRadius()
+	{
+		return m_WorldRadius;
+	}
+	unsigned int GetMatrixVersion()
+	{
+		return m_MatrixVersion;
+	}
+	bool IsStatic()
+	{
+		return m_IsStatic;
+	}
+	const vector<D3DXVECTOR3>& GetCPUVertices()
 	{
-		return m_PosVar;
+		return m_CPUVertices;
 	}
-	ID3D10EffectVectorVariable* GetColourVar()
+	const vector<D3DXVECTOR3>& GetCPUNormals() // Empty if the model has no normals
 	{
-		return m_ColourVar;
+		return m_CPUNormals;
+	}
+	const vector<D3DXVECTOR2>& GetCPUUVs() // Empty if the model has no UVs
+	{
+		return m_CPUUVs;
+	}
+	const vector<unsigned short>& GetCPUIndices()
+	{
+		return m_CPUIndices;
+	}
+	int GetNumLODs()
+	{
+		return m_NumLODs;
+	}
+	int GetLOD()
+	{
+		return m_CurrentLOD;
+	}
+	float GetLODError( int lod )
+	{
+		return m_LODError[lod];
+	}
+	int GetLODNumTriangles( int lod )
+	{
+		return m_LODNumIndices[lod] / 3;
+	}
+	int GetNumTriangles() // Triangles rendered with the current LOD
+	{
+		return m_LODNumIndices[m_CurrentLOD] / 3;
+	}
+	int GetNumClusters()
+	{
+		return static_cast<int>(m_Clusters.size());
+	}
+	int GetNumSubsets()
+	{
+		return static_cast<int>(m_Subsets.size());
+	}
+	unsigned int GetSubsetMaterial( int subset ) // Index of the material in the mesh file
+	{
+		return m_Subsets[subset].material;
+	}
+	const SVertexEncodeStats& GetVertexEncodeStats()
+	{
+		return m_EncodeStats;
 	}
 
 
@@ -121,30 +355,77 @@ public:
 	{
 		m_Scale = D3DXVECTOR3( scale, scale, scale );
 	}
-	void SetPosVar(ID3D10EffectVectorVariable* posVar)
+	void SetStatic( bool isStatic )
 	{
-		m_PosVar = posVar;
+		m_IsStatic = isStatic;
 	}
-	void SetColourVar(ID3D10EffectVectorVariable* colourVar)
+	// Set the per-object constant block. Models set how their vertex data is stored in it, then upload it just before drawing - so
+	// the rest of the block (world matrix etc.) must be set before rendering a model
+	static void SetPerObjectConstants( CConstantBlock<SPerObjectConstants>* perObjectConstants )
 	{
-		m_ColourVar = colourVar;
+		s_PerObjectConstants = perObjectConstants;
+	}
+	// Tell the shaders that the vertex data about to be drawn is stored in full, for geometry that isn't drawn by a model. Uploads
+	// the per-object constants
+	static void SetFullVertexDecode()
+	{
+		if (!s_PerObjectConstants) return;
+		SPerObjectConstants& constants = s_PerObjectConstants->Edit();
+		constants.positionDecode = D3DXVECTOR4( 0.0f, 0.0f, 0.0f, 1.0f );
+		constants.octahedralNormals = false;
+		s_PerObjectConstants->Upload();
+	}
+
+	// Count of draw calls made since the last reset - by models, and by other code that reports its draws with AddDrawCalls
+	static unsigned int GetNumDrawCalls()
+	{
+		return s_NumDrawCalls;
+	}
+	static void AddDrawCalls( unsigned int numDrawCalls )
+	{
+		s_NumDrawCalls += numDrawCalls;
+	}
+	static void ResetDrawCalls()
+	{
+		s_NumDrawCalls = 0;
+	}
+	void SetLOD( int lod )
+	{
+		m_CurrentLOD = (lod < 0) ? 0 : ((lod < m_NumLODs) ? lod : m_NumLODs - 1);
 	}
 
 	/////////////////////////////
 	// Model Loading
 
-	// Load the model geometry from a file. This function only reads the geometry using the first material in the file, so multi-material
-	// models will load but will have parts missing. May optionally request for tangents to be created for the model (for normal or parallax mapping)
+	// Load the model geometry from a file. This function only reads the first mesh in the file. A mesh with several materials is loaded
+	// as one set of vertices with a subset of the triangles for each material. May optionally request for tangents to be created for the
+	// model (for normal or parallax mapping)
 	// We need to pass an example technique that the model will use to help DirectX understand how to connect this data with the vertex shaders
-	// Returns true if the load was successful
-	bool Load( const string& fileName, ID3D10EffectTechnique* shaderCode, bool tangents = false );
+	// The vertex data can be stored in a compact format to save memory (see VertexEncoder.h). Returns true if the load was successful
+	bool Load( const string& fileName, ID3D10EffectTechnique* shaderCode, bool tangents = false, EVertexFormat format = VertexFormat_Full );
+
+
+	// Split the full detail geometry into clusters, reordering the system memory copy of its indices to match. Uses no DirectX calls,
+	// so can be run for several models at once on different threads. UploadClusterIndices must be called afterwards. Does nothing
+	// if the clusters were loaded from the mesh cache
+	void BuildClusters();
+
+	// Copy the reordered indices made by BuildClusters into the index buffer. If the model was imported rather than loaded from the
+	// mesh cache, the cache is written now, so it holds the clusters too. Must be called on the main thread
+	void UploadClusterIndices();
 
 
 	/////////////////////////////
 	// Model Usage
 
-	// Update the world matrix of the model from its position, rotation and scaling
+	// Update the world matrix of the model from its position, rotation and scaling. The new matrix is rendered once published
 	void UpdateMatrix();
+
+	// Make the world matrix and bounds last updated the ones rendered, blended with the previous update step's
+	void Publish( float blend );
+
+	// Keep the world matrix last updated as the previous update step's
+	void SaveStep();
 	
 	// Control the model's position and rotation using keys provided. Amount of motion performed depends on frame time
 	void Control( float frameTime, EKeyCode turnUp, EKeyCode turnDown, EKeyCode turnLeft, EKeyCode turnRight,  
@@ -152,8 +433,43 @@ public:
 
 	void CModel::FacePoint(D3DXVECTOR3 point);
 
+	// Test the model's world bounding volumes against a view frustum. Models without bounds are always visible
+	bool IsVisible( const CFrustum& frustum );
+
+	// Record that the model was found visible by a view query. Each query uses a new stamp value, so there is no need to clear
+	// marks from previous queries - a model is visible in a query only if it holds that query's stamp
+	void MarkVisible( unsigned int stamp )
+	{
+		m_VisibleStamp = stamp;
+	}
+	bool IsMarkedVisible( unsigned int stamp )
+	{
+		return m_VisibleStamp == stamp;
+	}
+
+	// Select the LOD to render for the given camera - the most simplified LOD whose error would cover no more than the given number of
+	// pixels on screen. Returns the LOD selected
+	int SelectLOD( CCamera* camera, float maxPixelError = 1.0f );
+
 	// Render the model with the given technique. Assumes any shader variables for the technique have already been set up (e.g. matrices and textures)
 	void Render( ID3D10EffectTechnique* technique );
+
+	// Render a single subset of the model (the triangles using one material), so material settings can be changed between subsets
+	void RenderSubset( ID3D10EffectTechnique* technique, int subset );
+
+	// Create the input layout used by RenderInstanced - the model's vertex elements followed by the given per-instance elements, which
+	// must be in input slot 1. The technique must have the same vertex input as those RenderInstanced will be used with
+	bool CreateInstancedLayout( ID3D10EffectTechnique* technique, const D3D10_INPUT_ELEMENT_DESC* instanceElts, unsigned int numInstanceElts );
+
+	// Render copies of the model with one draw call per subset, each copy with its own instance data (e.g. world matrix) read from the
+	// given buffer starting at the given byte offset. CreateInstancedLayout must have been called first
+	void RenderInstanced( ID3D10EffectTechnique* technique, ID3D10Buffer* instanceBuffer, unsigned int instanceSize,
+	                      unsigned int instanceOffset, unsigned int numInstances );
+
+	// Render only the clusters that may be visible to the given camera - those outside the camera's frustum are skipped, and so are
+	// those facing away from the camera if the technique culls back faces. Renders the whole model if it has no clusters or a
+	// simplified LOD is selected. Counts of clusters drawn and skipped are added to the given statistics
+	void RenderClusters( ID3D10EffectTechnique* technique, CCamera* camera, bool cullBackFaces, SClusterStats& stats );
 };
 
 
@@ -25,7 +25,7 @@ void CModelHierarchy::ReleaseResources()
 	CModel::ReleaseResources();
 }
 
-bool CModelHierarchy::Load(const string& fileName, ID3D10EffectTechnique* exampleTechnique, bool tangents)
+bool CModelHierarchy::Load(const string& fileName, ID3D10EffectTechnique* exampleTechnique, bool tangents, EVertexFormat format)
 {
 	// Use CImportXFile class (from another application) to load the given file. The import code is wrapped in the namespace 'gen'
 	gen::CImportXFile mesh;
@@ -43,7 +43,7 @@ bool CModelHierarchy::Load(const string& fileName, ID3D10EffectTechnique* exampl
 		{
 			return false;
 		}
-		if (!CreateFromSubMesh(&subMesh, exampleTechnique))
+		if (!CreateFromSubMesh(&subMesh, exampleTechnique, format))
 		{
 			ReleaseResources();
 			return false;
@@ -106,7 +106,7 @@ bool CModelHierarchy::Load(const string& fileName, ID3D10EffectTechnique* exampl
 				if (subMesh.node == node)
 				{
 					// Create the geometry for this node
-					if (!pNodeModel->CreateFromSubMesh(&subMesh, exampleTechnique))
+					if (!pNodeModel->CreateFromSubMesh(&subMesh, exampleTechnique, format))
 					{
 						ReleaseResources();
 						delete[] nodeModels;
@@ -133,119 +133,83 @@ bool CModelHierarchy::Load(const string& fileName, ID3D10EffectTechnique* exampl
 		delete[] nodeModels;
 	}
 
+	CalculateHierarchyBounds();
 	return true;
 }
 
-bool CModelHierarchy::CreateFromSubMesh(const SSubMesh* subMesh, ID3D10EffectTechnique* exampleTechnique)
+bool CModelHierarchy::CreateFromSubMesh(const SSubMesh* subMesh, ID3D10EffectTechnique* exampleTechnique, EVertexFormat format)
 {
 	// Release any existing geometry in this object
 	ReleaseResources();
 
-	// Create vertex element list & layout. We need a vertex layout to say what data we have per vertex in this model (e.g. position, normal, uv, etc.)
-	// In previous projects the element list was a manually typed in array as we knew what data we would provide. However, as we can load models with
-	// different vertex data this time we need flexible code. The array is built up one element at a time: ask the import class if it loaded normals, 
-	// if so then add a normal line to the array, then ask if it loaded UVS...etc
-	unsigned int numElts = 0;
-	unsigned int offset = 0;
-	// Position is always required
-	m_VertexElts[numElts].SemanticName = "POSITION";   // Semantic in HLSL (what is this data for)
-	m_VertexElts[numElts].SemanticIndex = 0;           // Index to add to semantic (a count for this kind of data, when using multiple of the same type, e.g. TEXCOORD0, TEXCOORD1)
-	m_VertexElts[numElts].Format = DXGI_FORMAT_R32G32B32_FLOAT; // Type of data - this one will be a float3 in the shader. Most data communicated as though it were colours
-	m_VertexElts[numElts].AlignedByteOffset = offset;  // Offset of element from start of vertex data (e.g. if we have position (float3), uv (float2) then normal, the normal's offset is 5 floats = 5*4 = 20)
-	m_VertexElts[numElts].InputSlot = 0;               // For when using multiple vertex buffers (e.g. instancing - an advanced topic)
-	m_VertexElts[numElts].InputSlotClass = D3D10_INPUT_PER_VERTEX_DATA; // Use this value for most cases (only changed for instancing)
-	m_VertexElts[numElts].InstanceDataStepRate = 0;                     // --"--
-	offset += 12;
-	++numElts;
-	// Repeat for each kind of vertex data
-	if (subMesh->hasNormals)
-	{
-		m_VertexElts[numElts].SemanticName = "NORMAL";
-		m_VertexElts[numElts].SemanticIndex = 0;
-		m_VertexElts[numElts].Format = DXGI_FORMAT_R32G32B32_FLOAT;
-		m_VertexElts[numElts].AlignedByteOffset = offset;
-		m_VertexElts[numElts].InputSlot = 0;
-		m_VertexElts[numElts].InputSlotClass = D3D10_INPUT_PER_VERTEX_DATA;
-		m_VertexElts[numElts].InstanceDataStepRate = 0;
-		offset += 12;
-		++numElts;
-	}
-	if (subMesh->hasTangents)
-	{
-		m_VertexElts[numElts].SemanticName = "TANGENT";
-		m_VertexElts[numElts].SemanticIndex = 0;
-		m_VertexElts[numElts].Format = DXGI_FORMAT_R32G32B32_FLOAT;
-		m_VertexElts[numElts].AlignedByteOffset = offset;
-		m_VertexElts[numElts].InputSlot = 0;
-		m_VertexElts[numElts].InputSlotClass = D3D10_INPUT_PER_VERTEX_DATA;
-		m_VertexElts[numElts].InstanceDataStepRate = 0;
-		offset += 12;
-		++numElts;
-	}
-	if (subMesh->hasTextureCoords)
+	// Vertex layout, buffers, bounds and LODs are all created the same way as for a single model
+	return CreateGeometry(*subMesh, exampleTechnique, format);
+}
+
+// Grow the bounding volumes of this model to also cover all of its children. Children are stored relative to their parent, so
+// each child's volume is brought into this model's space with its relative matrix. Instead of the child's exact box, use a
+// sphere about the child's origin that reaches its furthest point - this stays valid however the child is rotated later
+void CModelHierarchy::CalculateHierarchyBounds()
+{
+	D3DXVECTOR3 childCentres[MaxChildren];
+	float childReach[MaxChildren];
+	int numBoundedChildren = 0;
+	for (int i = 0; i < m_NumChildren; i++)
 	{
-		m_VertexElts[numElts].SemanticName = "TEXCOORD";
-		m_VertexElts[numElts].SemanticIndex = 0;
-		m_VertexElts[numElts].Format = DXGI_FORMAT_R32G32_FLOAT;
-		m_VertexElts[numElts].AlignedByteOffset = offset;
-		m_VertexElts[numElts].InputSlot = 0;
-		m_VertexElts[numElts].InputSlotClass = D3D10_INPUT_PER_VERTEX_DATA;
-		m_VertexElts[numElts].InstanceDataStepRate = 0;
-		offset += 8;
-		++numElts;
+		CModelHierarchy* child = m_Children[i];
+		child->CalculateHierarchyBounds();
+		child->UpdateMatrix(); // Relative matrix and relative bounds
+		if (!child->m_HasBounds) continue;
+
+		D3DXVECTOR3 centreOffset = child->m_Next.worldCentre - child->m_Position;
+		float reach = D3DXVec3Length(&centreOffset) + child->m_Next.worldRadius;
+		D3DXVECTOR3 childMin = child->m_Position - D3DXVECTOR3(reach, reach, reach);
+		D3DXVECTOR3 childMax = child->m_Position + D3DXVECTOR3(reach, reach, reach);
+		if (m_HasBounds || numBoundedChildren > 0)
+		{
+			D3DXVec3Minimize(&m_LocalMinBounds, &m_LocalMinBounds, &childMin);
+			D3DXVec3Maximize(&m_LocalMaxBounds, &m_LocalMaxBounds, &childMax);
+		}
+		else
+		{
+			m_LocalMinBounds = childMin;
+			m_LocalMaxBounds = childMax;
+		}
+		childCentres[numBoundedChildren] = child->m_Position;
+		childReach[numBoundedChildren] = reach;
+		++numBoundedChildren;
 	}
-	if (subMesh->hasVertexColours)
+	if (numBoundedChildren == 0) return;
+
+	// Re-centre the sphere on the combined box and make it enclose this model's own sphere and each child's sphere
+	D3DXVECTOR3 newCentre = (m_LocalMinBounds + m_LocalMaxBounds) * 0.5f;
+	float newRadius = 0.0f;
+	if (m_HasBounds)
 	{
-		m_VertexElts[numElts].SemanticName = "COLOR";
-		m_VertexElts[numElts].SemanticIndex = 0;
-		m_VertexElts[numElts].Format = DXGI_FORMAT_R8G8B8A8_UNORM; // A RGBA colour with 1 byte (0-255) per component
-		m_VertexElts[numElts].AlignedByteOffset = offset;
-		m_VertexElts[numElts].InputSlot = 0;
-		m_VertexElts[numElts].InputSlotClass = D3D10_INPUT_PER_VERTEX_DATA;
-		m_VertexElts[numElts].InstanceDataStepRate = 0;
-		offset += 4;
-		++numElts;
+		D3DXVECTOR3 offset = m_LocalCentre - newCentre;
+		newRadius = D3DXVec3Length(&offset) + m_LocalRadius;
 	}
-	m_VertexSize = offset;
-
-	// Given the vertex element list, pass it to DirectX to create a vertex layout. We also need to pass an example of a technique that will
-	// render this model. We will only be able to render this model with techniques that have the same vertex input as the example we use here
-	D3D10_PASS_DESC PassDesc;
-	exampleTechnique->GetPassByIndex(0)->GetDesc(&PassDesc);
-	g_pd3dDevice->CreateInputLayout(m_VertexElts, numElts, PassDesc.pIAInputSignature, PassDesc.IAInputSignatureSize, &m_VertexLayout);
-
-
-	// Create the vertex buffer and fill it with the loaded vertex data
-	m_NumVertices = subMesh->numVertices;
-	D3D10_BUFFER_DESC bufferDesc;
-	bufferDesc.BindFlags = D3D10_BIND_VERTEX_BUFFER;
-	bufferDesc.Usage = D3D10_USAGE_DEFAULT; // Not a dynamic buffer
-	bufferDesc.ByteWidth = m_NumVertices * m_VertexSize; // Buffer size
-	bufferDesc.CPUAccessFlags = 0;   // Indicates that CPU won't access this buffer at all after creation
-	bufferDesc.MiscFlags = 0;
-	D3D10_SUBRESOURCE_DATA initData; // Initial data
-	initData.pSysMem = subMesh->vertices;
-	if (FAILED(g_pd3dDevice->CreateBuffer(&bufferDesc, &initData, &m_VertexBuffer)))
+	for (int i = 0; i < numBoundedChildren; i++)
 	{
-		return false;
+		D3DXVECTOR3 offset = childCentres[i] - newCentre;
+		float radius = D3DXVec3Length(&offset) + childReach[i];
+		if (radius > newRadius) newRadius = radius;
 	}
+	m_LocalCentre = newCentre;
+	m_LocalRadius = newRadius;
+	m_HasBounds = true;
+	UpdateWorldBounds();
+}
 
-
-	// Create the index buffer - assuming 2-byte (WORD) index data
-	m_NumIndices = static_cast<unsigned int>(subMesh->numFaces) * 3;
-	bufferDesc.BindFlags = D3D10_BIND_INDEX_BUFFER;
-	bufferDesc.Usage = D3D10_USAGE_DEFAULT;
-	bufferDesc.ByteWidth = m_NumIndices * sizeof(WORD);
-	bufferDesc.CPUAccessFlags = 0;
-	bufferDesc.MiscFlags = 0;
-	initData.pSysMem = subMesh->faces;
-	if (FAILED(g_pd3dDevice->CreateBuffer(&bufferDesc, &initData, &m_IndexBuffer)))
+// Update the world matrices of this model and all its descendants. Done in the scene update rather than while rendering the
+// hierarchy, as the matrices are only rendered once published
+void CModelHierarchy::UpdateHierarchyMatrices()
+{
+	UpdateMatrix();
+	for (int i = 0; i < m_NumChildren; i++)
 	{
-		return false;
+		m_Children[i]->UpdateHierarchyMatrices();
 	}
-
-	m_HasGeometry = true;
-	return true;
 }
 
 // Control the model's position and rotation using keys provided. Amount of motion performed depends on frame time
@@ -257,9 +221,9 @@ void CModelHierarchy::Control(float frameTime, EKeyCode moveForward, EKeyCode mo
 	// Local Z movement - move in the direction of the Z axis, get axis from world matrix
 	if (KeyHeld(moveForward))
 	{
-		m_Position.x += m_WorldMatrix._31 * (MoveSpeed / 2)* frameTime;
-		m_Position.y +=m_WorldMatrix._32 * (MoveSpeed / 2) * frameTime;
-		m_Position.z += m_WorldMatrix._33 * (MoveSpeed / 2) * frameTime;
+		m_Position.x += m_Next.worldMatrix._31 * (MoveSpeed / 2)* frameTime;
+		m_Position.y +=m_Next.worldMatrix._32 * (MoveSpeed / 2) * frameTime;
+		m_Position.z += m_Next.worldMatrix._33 * (MoveSpeed / 2) * frameTime;
 
 		m_Rotation.y += RotSpeed * (rotationY * 2) * frameTime;
 		
@@ -270,9 +234,9 @@ void CModelHierarchy::Control(float frameTime, EKeyCode moveForward, EKeyCode mo
 	}
 	if (KeyHeld(moveBackward))
 	{
-		m_Position.x -= m_WorldMatrix._31 * (MoveSpeed / 2) * frameTime;
-		m_Position.y -= m_WorldMatrix._32 * (MoveSpeed / 2) * frameTime;
-		m_Position.z -= m_WorldMatrix._33 * (MoveSpeed / 2) * frameTime;
+		m_Position.x -= m_Next.worldMatrix._31 * (MoveSpeed / 2) * frameTime;
+		m_Position.y -= m_Next.worldMatrix._32 * (MoveSpeed / 2) * frameTime;
+		m_Position.z -= m_Next.worldMatrix._33 * (MoveSpeed / 2) * frameTime;
 
 		m_Rotation.y -= RotSpeed * (rotationY * 2) * frameTime;
 		// Rotate wheels
@@ -27,10 +27,19 @@ public:
 	// Returns a pointer to the new child model
 	CModelHierarchy* CModelHierarchy::CreateNewChild();
 	
-	bool CModelHierarchy::Load(const string& fileName, ID3D10EffectTechnique* exampleTechnique, bool tangents = false);
+	bool CModelHierarchy::Load(const string& fileName, ID3D10EffectTechnique* exampleTechnique, bool tangents = false,
+	                          EVertexFormat format = VertexFormat_Full);
 
 	// Create this model using a CMesh class sub-mesh. Helper function for LoadModel above
-	bool CModelHierarchy::CreateFromSubMesh(const gen::SSubMesh* subMesh, ID3D10EffectTechnique* exampleTechnique);
+	bool CModelHierarchy::CreateFromSubMesh(const gen::SSubMesh* subMesh, ID3D10EffectTechnique* exampleTechnique,
+	                                       EVertexFormat format = VertexFormat_Full);
+	// Grow the bounding volumes of this model to also cover all of its children, so the whole hierarchy can be culled as one.
+	// The children's volumes are expanded to allow for them rotating about their own origin (e.g. wheels and steering)
+	void CModelHierarchy::CalculateHierarchyBounds();
+
+	// Update the world matrices of this model and all its descendants - each child's matrix is relative to its parent
+	void CModelHierarchy::UpdateHierarchyMatrices();
+
 	void CModelHierarchy::ReleaseResources();
 	void CModelHierarchy::Control(float frameTime, EKeyCode moveForward, EKeyCode moveBackward, EKeyCode turnLeft, EKeyCode turnRight);
 	CModelHierarchy::~CModelHierarchy();
@@ -0,0 +1,330 @@
+//--------------------------------------------------------------------------------------
+//	OcclusionCuller.cpp
+//
+//	Software occlusion culling. A few large models near the camera (the occluders) are
+//	rendered on the CPU into a small depth buffer, then the bounding boxes of other
+//	models are tested against it. Models hidden behind the occluders need not be drawn
+//--------------------------------------------------------------------------------------
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <xmmintrin.h> // SSE intrinsics
+
+#include "Defines.h"         // General definitions shared by all source files
+#include "CTimer.h"          // Timer class - not DirectX
+#include "OcclusionCuller.h" // Declaration of this class
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+// Constructor
+COcclusionCuller::COcclusionCuller()
+{
+	D3DXMatrixIdentity( &m_ViewProjMatrix );
+	m_FrameNumber = 0;
+	m_HasResults = false;
+	for (int band = 0; band < NUM_BANDS; ++band)
+	{
+		m_BandTimes[band] = 0.0f;
+	}
+}
+
+// Destructor waits for any jobs still running
+COcclusionCuller::~COcclusionCuller()
+{
+	g_JobSystem->Wait( m_Jobs );
+}
+
+
+/////////////////////////////
+// Rendering occluders
+
+// Start a new depth buffer for the given camera. Waits for any previous frame's work to finish first
+void COcclusionCuller::BeginFrame( const D3DXMATRIX& viewProjMatrix )
+{
+	WaitForResults();
+	m_HasResults = false;
+	m_ViewProjMatrix = viewProjMatrix;
+	m_Occluders.clear();
+}
+
+// Add an occluder to the frame. The vertex and index data must stay unchanged until the results have been used
+void COcclusionCuller::AddOccluder( const D3DXMATRIX& worldMatrix, const D3DXVECTOR3* vertices, unsigned int numVertices,
+                                    const unsigned short* indices, unsigned int numIndices )
+{
+	if (numVertices == 0 || numIndices == 0)
+	{
+		return;
+	}
+
+	SOccluder occluder;
+	occluder.worldViewProjMatrix = worldMatrix * m_ViewProjMatrix;
+	occluder.vertices = vertices;
+	occluder.numVertices = numVertices;
+	occluder.indices = indices;
+	occluder.numIndices = numIndices;
+	m_Occluders.push_back( occluder );
+}
+
+// Start the jobs rendering the occluders, one per band. Returns immediately
+void COcclusionCuller::StartRendering()
+{
+	++m_FrameNumber;
+	for (int band = 0; band < NUM_BANDS; ++band)
+	{
+		g_JobSystem->Run( [this, band]()
+		{
+			CTimer timer;
+			timer.Start();
+			RenderBand( band );
+			m_BandTimes[band] = timer.GetTime();
+		}, m_Jobs );
+	}
+}
+
+// Wait until the jobs have finished, helping to run them. Must be called before testing boxes
+void COcclusionCuller::WaitForResults()
+{
+	g_JobSystem->Wait( m_Jobs );
+	m_HasResults = (m_FrameNumber > 0);
+}
+
+
+// Render all occluders into one band of the depth buffer and build the band's part of the hierarchical Z buffer
+void COcclusionCuller::RenderBand( int band )
+{
+	int firstRow = band * BAND_HEIGHT;
+	int lastRow = firstRow + BAND_HEIGHT;
+
+	// Clear the band to the far depth
+	float* bandDepths = m_Depths + firstRow * WIDTH;
+	for (int i = 0; i < BAND_HEIGHT * WIDTH; ++i)
+	{
+		bandDepths[i] = 1.0f;
+	}
+
+	// Transform each occluder's vertices into clip space, then render its triangles
+	vector<D3DXVECTOR4>& clipVertices = m_BandVertices[band];
+	for (size_t o = 0; o < m_Occluders.size(); ++o)
+	{
+		const SOccluder& occluder = m_Occluders[o];
+		clipVertices.resize( occluder.numVertices );
+		D3DXVec3TransformArray( &clipVertices[0], sizeof(D3DXVECTOR4), occluder.vertices, sizeof(D3DXVECTOR3),
+		                        &occluder.worldViewProjMatrix, occluder.numVertices );
+
+		for (unsigned int i = 0; i + 2 < occluder.numIndices; i += 3)
+		{
+			RenderTriangle( clipVertices[occluder.indices[i]], clipVertices[occluder.indices[i + 1]],
+			                clipVertices[occluder.indices[i + 2]], firstRow, lastRow );
+		}
+	}
+
+	// Find the furthest depth in each tile of the band, a row of four pixels at a time
+	for (int tileY = firstRow / TILE_SIZE; tileY < lastRow / TILE_SIZE; ++tileY)
+	{
+		for (int tileX = 0; tileX < TILES_X; ++tileX)
+		{
+			__m128 maxDepth = _mm_setzero_ps();
+			const float* tileDepths = m_Depths + tileY * TILE_SIZE * WIDTH + tileX * TILE_SIZE;
+			for (int y = 0; y < TILE_SIZE; ++y)
+			{
+				for (int x = 0; x < TILE_SIZE; x += 4)
+				{
+					maxDepth = _mm_max_ps( maxDepth, _mm_loadu_ps( tileDepths + y * WIDTH + x ) );
+				}
+			}
+			maxDepth = _mm_max_ps( maxDepth, _mm_shuffle_ps( maxDepth, maxDepth, _MM_SHUFFLE(1, 0, 3, 2) ) );
+			maxDepth = _mm_max_ps( maxDepth, _mm_shuffle_ps( maxDepth, maxDepth, _MM_SHUFFLE(2, 3, 0, 1) ) );
+			_mm_store_ss( &m_TileDepths[tileY * TILES_X + tileX], maxDepth );
+		}
+	}
+}
+
+
+// Render a triangle in clip space. Points with z < 0 are in front of the near plane (behind the camera when w < 0) and
+// cannot be projected, so the triangle is clipped to the near plane first. Clipping a triangle by one plane gives a
+// polygon of up to four points, rendered as one or two triangles
+void COcclusionCuller::RenderTriangle( const D3DXVECTOR4& v0, const D3DXVECTOR4& v1, const D3DXVECTOR4& v2, int firstRow, int lastRow )
+{
+	const D3DXVECTOR4* input[3] = { &v0, &v1, &v2 };
+	D3DXVECTOR4 clipped[4];
+	int numClipped = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		const D3DXVECTOR4& current = *input[i];
+		const D3DXVECTOR4& next = *input[(i + 1) % 3];
+		if (current.z >= 0.0f)
+		{
+			clipped[numClipped++] = current;
+		}
+		if ((current.z >= 0.0f) != (next.z >= 0.0f))
+		{
+			float t = current.z / (current.z - next.z);
+			clipped[numClipped++] = current + (next - current) * t;
+		}
+	}
+	if (numClipped < 3)
+	{
+		return;
+	}
+
+	// Project to pixels - x and y from -1->1 to the buffer size (y flipped), z is already 0->1 depth
+	D3DXVECTOR3 screen[4];
+	for (int i = 0; i < numClipped; ++i)
+	{
+		float invW = 1.0f / clipped[i].w;
+		screen[i].x = (clipped[i].x * invW * 0.5f + 0.5f) * WIDTH;
+		screen[i].y = (0.5f - clipped[i].y * invW * 0.5f) * HEIGHT;
+		screen[i].z = clipped[i].z * invW;
+	}
+	RasteriseTriangle( screen[0], screen[1], screen[2], firstRow, lastRow );
+	if (numClipped == 4)
+	{
+		RasteriseTriangle( screen[0], screen[2], screen[3], firstRow, lastRow );
+	}
+}
+
+
+// Render a triangle in screen space into the given rows. Uses "edge functions": for each edge a value that is positive on the
+// inside of the edge and changes linearly across the screen. A pixel is in the triangle if all three are positive. The edge
+// values and the depth (which is also linear across the screen after projection) are calculated for four pixels at once
+void COcclusionCuller::RasteriseTriangle( const D3DXVECTOR3& v0, const D3DXVECTOR3& v1, const D3DXVECTOR3& v2, int firstRow, int lastRow )
+{
+	// Twice the area of the triangle, positive for clockwise triangles. Models are drawn with back face culling and clockwise
+	// front faces, so triangles facing away can be skipped - they would be hidden by the front of the model anyway
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (area <= 0.0f)
+	{
+		return;
+	}
+
+	// Bounding rectangle of the triangle, clipped to the band. Start on a multiple of four pixels
+	float minX = min( v0.x, min( v1.x, v2.x ) ), maxX = max( v0.x, max( v1.x, v2.x ) );
+	float minY = min( v0.y, min( v1.y, v2.y ) ), maxY = max( v0.y, max( v1.y, v2.y ) );
+	int startX = max( static_cast<int>(floorf( minX )), 0 ) & ~3;
+	int endX   = min( static_cast<int>(ceilf( maxX )), WIDTH );
+	int startY = max( static_cast<int>(floorf( minY )), firstRow );
+	int endY   = min( static_cast<int>(ceilf( maxY )), lastRow );
+	if (startX >= endX || startY >= endY)
+	{
+		return;
+	}
+
+	// Edge function for the edge a->b: (b.x - a.x)(p.y - a.y) - (b.y - a.y)(p.x - a.x) = A p.x + B p.y + C
+	const D3DXVECTOR3* corners[3] = { &v0, &v1, &v2 };
+	__m128 edgeA[3], edgeB[3], edgeC[3];
+	for (int e = 0; e < 3; ++e)
+	{
+		const D3DXVECTOR3& a = *corners[e];
+		const D3DXVECTOR3& b = *corners[(e + 1) % 3];
+		float A = a.y - b.y;
+		float B = b.x - a.x;
+		edgeA[e] = _mm_set1_ps( A );
+		edgeB[e] = _mm_set1_ps( B );
+		edgeC[e] = _mm_set1_ps( -(A * a.x + B * a.y) );
+	}
+
+	// Depth plane: z = v0.z + dzdx (x - v0.x) + dzdy (y - v0.y)
+	float dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+	float dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+	__m128 depthX = _mm_set1_ps( dzdx );
+	__m128 depthY = _mm_set1_ps( dzdy );
+	__m128 depthC = _mm_set1_ps( v0.z - dzdx * v0.x - dzdy * v0.y );
+
+	// Sample at pixel centres
+	__m128 zero = _mm_setzero_ps();
+	__m128 pixelOffsets = _mm_set_ps( 3.5f, 2.5f, 1.5f, 0.5f );
+	for (int y = startY; y < endY; ++y)
+	{
+		__m128 pixelY = _mm_set1_ps( y + 0.5f );
+		float* rowDepths = m_Depths + y * WIDTH;
+		for (int x = startX; x < endX; x += 4)
+		{
+			__m128 pixelX = _mm_add_ps( _mm_set1_ps( static_cast<float>(x) ), pixelOffsets );
+
+			__m128 inside = _mm_cmpge_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( edgeA[0], pixelX ), _mm_mul_ps( edgeB[0], pixelY ) ), edgeC[0] ), zero );
+			inside = _mm_and_ps( inside, _mm_cmpge_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( edgeA[1], pixelX ), _mm_mul_ps( edgeB[1], pixelY ) ), edgeC[1] ), zero ) );
+			inside = _mm_and_ps( inside, _mm_cmpge_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( edgeA[2], pixelX ), _mm_mul_ps( edgeB[2], pixelY ) ), edgeC[2] ), zero ) );
+			if (_mm_movemask_ps( inside ) == 0)
+			{
+				continue;
+			}
+
+			// Keep the nearer of the existing and new depth in the covered pixels
+			__m128 depth = _mm_add_ps( _mm_add_ps( _mm_mul_ps( depthX, pixelX ), _mm_mul_ps( depthY, pixelY ) ), depthC );
+			__m128 oldDepth = _mm_loadu_ps( rowDepths + x );
+			__m128 newDepth = _mm_min_ps( oldDepth, depth );
+			_mm_storeu_ps( rowDepths + x, _mm_or_ps( _mm_and_ps( inside, newDepth ), _mm_andnot_ps( inside, oldDepth ) ) );
+		}
+	}
+}
+
+
+/////////////////////////////
+// Occlusion tests
+
+// Test if a world space box may be visible. The box corners are projected to find the rectangle the box covers on screen
+// and its nearest depth. The box is hidden if that depth is further than the furthest occluder depth in every tile it covers
+bool COcclusionCuller::IsBoxVisible( const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds ) const
+{
+	if (!m_HasResults || m_Occluders.empty())
+	{
+		return true;
+	}
+
+	float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		D3DXVECTOR3 point( (corner & 1) ? maxBounds.x : minBounds.x,
+		                   (corner & 2) ? maxBounds.y : minBounds.y,
+		                   (corner & 4) ? maxBounds.z : minBounds.z );
+		D3DXVECTOR4 clipPoint;
+		D3DXVec3Transform( &clipPoint, &point, &m_ViewProjMatrix );
+		if (clipPoint.z < 0.0f)
+		{
+			return true; // Box crosses the near plane, so it is right in front of the camera
+		}
+		float invW = 1.0f / clipPoint.w;
+		float x = (clipPoint.x * invW * 0.5f + 0.5f) * WIDTH;
+		float y = (0.5f - clipPoint.y * invW * 0.5f) * HEIGHT;
+		minX = min( minX, x );  maxX = max( maxX, x );
+		minY = min( minY, y );  maxY = max( maxY, y );
+		minZ = min( minZ, clipPoint.z * invW );
+	}
+
+	// Tiles covered by the box, clipped to the screen
+	if (maxX < 0.0f || maxY < 0.0f || minX >= WIDTH || minY >= HEIGHT)
+	{
+		return true; // Off screen - leave that to the frustum test
+	}
+	int startTileX = max( static_cast<int>(minX), 0 ) / TILE_SIZE;
+	int endTileX   = min( static_cast<int>(maxX), WIDTH - 1 ) / TILE_SIZE;
+	int startTileY = max( static_cast<int>(minY), 0 ) / TILE_SIZE;
+	int endTileY   = min( static_cast<int>(maxY), HEIGHT - 1 ) / TILE_SIZE;
+
+	for (int tileY = startTileY; tileY <= endTileY; ++tileY)
+	{
+		for (int tileX = startTileX; tileX <= endTileX; ++tileX)
+		{
+			if (minZ <= m_TileDepths[tileY * TILES_X + tileX])
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+
+// Time the jobs spent rendering the last depth buffer, in seconds
+float COcclusionCuller::GetRenderTime() const
+{
+	float slowest = 0.0f;
+	for (int band = 0; band < NUM_BANDS; ++band)
+	{
+		slowest = max( slowest, m_BandTimes[band] );
+	}
+	return slowest;
+}
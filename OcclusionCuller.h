@@ -0,0 +1,144 @@
+//--------------------------------------------------------------------------------------
+//	OcclusionCuller.h
+//
+//	Software occlusion culling. A few large models near the camera (the occluders) are
+//	rendered on the CPU into a small depth buffer, then the bounding boxes of other
+//	models are tested against it. Models hidden behind the occluders need not be drawn
+//--------------------------------------------------------------------------------------
+
+#ifndef OCCLUSION_CULLER_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define OCCLUSION_CULLER_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+#include <d3d10.h>
+#include <d3dx10.h>
+
+#include "JobSystem.h"
+
+
+// The depth buffer is rendered by jobs while the main thread carries on with other work (updating the scene). The screen is
+// split into horizontal bands, one job each, so jobs running at the same time never write to the same pixels. Each band of the depth
+// buffer is then reduced to a "hierarchical Z" buffer holding the furthest depth in each 8x8 tile. A box is hidden if its
+// nearest point is further away than the furthest depth in every tile it covers - only one test per tile rather than per pixel
+class COcclusionCuller
+{
+/////////////////////////////
+// Private types and member variables
+private:
+
+	// Size of the depth buffer and its tiles in pixels. The width must be a multiple of 4 (pixels are processed four at a time
+	// with SSE) and the sizes must be multiples of the tile size
+	static const int WIDTH = 256;
+	static const int HEIGHT = 128;
+	static const int TILE_SIZE = 8;
+	static const int TILES_X = WIDTH / TILE_SIZE;
+	static const int TILES_Y = HEIGHT / TILE_SIZE;
+
+	// Number of horizontal bands / jobs. The band height must be a multiple of the tile size
+	static const int NUM_BANDS = 4;
+	static const int BAND_HEIGHT = HEIGHT / NUM_BANDS;
+
+	// An occluder to render - the geometry is owned by the model and is not changed after loading, so only pointers are kept
+	struct SOccluder
+	{
+		D3DXMATRIX            worldViewProjMatrix;
+		const D3DXVECTOR3*    vertices;
+		unsigned int          numVertices;
+		const unsigned short* indices;
+		unsigned int          numIndices;
+	};
+
+	// Occluders and view for the frame being rendered
+	vector<SOccluder> m_Occluders;
+	D3DXMATRIX        m_ViewProjMatrix;
+
+	// Depth buffer and hierarchical Z buffer (furthest depth in each tile). Depths are 0 (near) to 1 (far)
+	float m_Depths[WIDTH * HEIGHT];
+	float m_TileDepths[TILES_X * TILES_Y];
+
+	// Transformed vertices for each band's job (each job transforms the occluders itself to avoid waiting for the others)
+	vector<D3DXVECTOR4> m_BandVertices[NUM_BANDS];
+
+	// Counts the band jobs still running, and the number of frames started
+	CJobCounter  m_Jobs;
+	unsigned int m_FrameNumber;
+
+	// Is there a completed depth buffer to test against
+	bool m_HasResults;
+
+	// Time taken by the jobs to render the depth buffer for the last frame (seconds)
+	float m_BandTimes[NUM_BANDS];
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	// Constructor
+	COcclusionCuller();
+
+	// Destructor waits for any jobs still running
+	~COcclusionCuller();
+
+
+	/////////////////////////////
+	// Rendering occluders
+
+	// Start a new depth buffer for the given camera. Waits for any previous frame's work to finish first
+	void BeginFrame( const D3DXMATRIX& viewProjMatrix );
+
+	// Add an occluder to the frame. The vertex and index data must stay unchanged until the results have been used
+	void AddOccluder( const D3DXMATRIX& worldMatrix, const D3DXVECTOR3* vertices, unsigned int numVertices,
+	                  const unsigned short* indices, unsigned int numIndices );
+
+	// Start the jobs rendering the occluders. Returns immediately
+	void StartRendering();
+
+	// Wait until the jobs have finished, helping to run them. Must be called before testing boxes
+	void WaitForResults();
+
+
+	/////////////////////////////
+	// Occlusion tests
+
+	// Test if a world space box may be visible. Returns false only if the box is certainly hidden behind the occluders rendered
+	// for the current frame. If there are no results yet, or the box is partly behind the camera, it is treated as visible
+	bool IsBoxVisible( const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds ) const;
+
+	// Number of occluders rendered this frame
+	int GetNumOccluders() const
+	{
+		return static_cast<int>(m_Occluders.size());
+	}
+
+	// Time the jobs spent rendering the last depth buffer, in seconds. Taken from the slowest job, which is how long the work
+	// takes when the jobs run in parallel
+	float GetRenderTime() const;
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	// Render all occluders into one band of the depth buffer and build the band's part of the hierarchical Z buffer
+	void RenderBand( int band );
+
+	// Render a triangle already transformed into clip space (x, y, z, w) into the rows firstRow to lastRow - 1. The triangle is
+	// clipped against the near plane first as points behind the camera cannot be projected
+	void RenderTriangle( const D3DXVECTOR4& v0, const D3DXVECTOR4& v1, const D3DXVECTOR4& v2, int firstRow, int lastRow );
+
+	// Render a triangle in screen space (x, y in pixels, z depth) into the given rows
+	void RasteriseTriangle( const D3DXVECTOR3& v0, const D3DXVECTOR3& v1, const D3DXVECTOR3& v2, int firstRow, int lastRow );
+
+	// Disallow copying - jobs keep a pointer to the object
+	COcclusionCuller( const COcclusionCuller& );
+	COcclusionCuller& operator=( const COcclusionCuller& );
+};
+
+
+#endif // End of header guard - see top of file
@@ -0,0 +1,329 @@
+//--------------------------------------------------------------------------------------
+//	Portal.cpp
+//
+//	A portal is a model showing the view from another camera, rendered into a texture.
+//	Portals can be seen through other portals up to a fixed depth. The maths that finds
+//	the part of a portal in view and the culling frustum behind it is CPU only
+//--------------------------------------------------------------------------------------
+
+#include <cfloat>
+
+#include "Defines.h" // General definitions shared by all source files
+#include "Portal.h"  // Declaration of this class
+
+
+// A vertex of a portal quad being clipped - clip space position and portal texture coordinate
+struct SClipVertex
+{
+	D3DXVECTOR4 position;
+	D3DXVECTOR2 uv;
+};
+
+// Most vertices a quad can have after clipping by five planes
+static const int MAX_CLIP_VERTICES = 4 + 5;
+
+// Clip a convex polygon to the side of a clip space plane where plane.x * x + plane.y * y + plane.z * z + plane.w * w >= 0. Each
+// edge is kept, cut or dropped in turn (Sutherland-Hodgman). Clip space is linear in world space, so texture coordinates can be
+// interpolated directly. Returns the number of vertices left
+static int ClipPolygon( const SClipVertex* input, int numInput, const D3DXVECTOR4& plane, SClipVertex* output )
+{
+	int numOutput = 0;
+	for (int i = 0; i < numInput; ++i)
+	{
+		const SClipVertex& start = input[i];
+		const SClipVertex& end = input[(i + 1) % numInput];
+		float startDistance = plane.x * start.position.x + plane.y * start.position.y + plane.z * start.position.z + plane.w * start.position.w;
+		float endDistance = plane.x * end.position.x + plane.y * end.position.y + plane.z * end.position.z + plane.w * end.position.w;
+		if (startDistance >= 0.0f)
+		{
+			output[numOutput++] = start;
+		}
+		if ((startDistance >= 0.0f) != (endDistance >= 0.0f))
+		{
+			float t = startDistance / (startDistance - endDistance);
+			SClipVertex& crossing = output[numOutput++];
+			crossing.position = start.position + (end.position - start.position) * t;
+			crossing.uv = D3DXVECTOR2( start.uv.x + (end.uv.x - start.uv.x) * t, start.uv.y + (end.uv.y - start.uv.y) * t );
+		}
+	}
+	return numOutput;
+}
+
+
+//-----------------------------------------------------------------------------
+// Portal maths
+//-----------------------------------------------------------------------------
+
+// Find the part of a portal quad seen within a rectangle of a view. The quad is given by its four world space corners, in order
+// around its edge, and the portal texture coordinates at each. The quad is clipped to the view's near plane and the rectangle, and
+// the bounds of what is left are returned in the view (screen rect) and in the portal texture (UV rect). Returns false if none of
+// the quad is in the rectangle
+bool ClipPortalToView( const D3DXVECTOR3 corners[4], const D3DXVECTOR2 cornerUVs[4], const D3DXMATRIX& viewProjMatrix,
+                       const SPortalRect& viewRect, SPortalRect& screenRect, SPortalRect& uvRect )
+{
+	SClipVertex polygon[2][MAX_CLIP_VERTICES];
+	for (int corner = 0; corner < 4; ++corner)
+	{
+		D3DXVec3Transform( &polygon[0][corner].position, &corners[corner], &viewProjMatrix );
+		polygon[0][corner].uv = cornerUVs[corner];
+	}
+
+	// Near plane first - everything left has w > 0 so can be divided by w. Then the sides of the rectangle, e.g. left: x >= minX * w
+	const D3DXVECTOR4 planes[] =
+	{
+		D3DXVECTOR4( 0.0f, 0.0f, 1.0f, 0.0f ),
+		D3DXVECTOR4( 1.0f, 0.0f, 0.0f, -viewRect.minX ),
+		D3DXVECTOR4( -1.0f, 0.0f, 0.0f, viewRect.maxX ),
+		D3DXVECTOR4( 0.0f, 1.0f, 0.0f, -viewRect.minY ),
+		D3DXVECTOR4( 0.0f, -1.0f, 0.0f, viewRect.maxY ),
+	};
+	int numVertices = 4;
+	int current = 0;
+	for (int plane = 0; plane < sizeof(planes) / sizeof(planes[0]) && numVertices > 0; ++plane)
+	{
+		numVertices = ClipPolygon( polygon[current], numVertices, planes[plane], polygon[1 - current] );
+		current = 1 - current;
+	}
+	if (numVertices < 3) return false;
+
+	screenRect.minX = screenRect.minY = uvRect.minX = uvRect.minY = FLT_MAX;
+	screenRect.maxX = screenRect.maxY = uvRect.maxX = uvRect.maxY = -FLT_MAX;
+	for (int i = 0; i < numVertices; ++i)
+	{
+		const SClipVertex& vertex = polygon[current][i];
+		float x = vertex.position.x / vertex.position.w;
+		float y = vertex.position.y / vertex.position.w;
+		screenRect.minX = min( screenRect.minX, x );
+		screenRect.maxX = max( screenRect.maxX, x );
+		screenRect.minY = min( screenRect.minY, y );
+		screenRect.maxY = max( screenRect.maxY, y );
+		uvRect.minX = min( uvRect.minX, vertex.uv.x );
+		uvRect.maxX = max( uvRect.maxX, vertex.uv.x );
+		uvRect.minY = min( uvRect.minY, vertex.uv.y );
+		uvRect.maxY = max( uvRect.maxY, vertex.uv.y );
+	}
+
+	// A quad seen edge on clips down to a line
+	return screenRect.maxX > screenRect.minX && screenRect.maxY > screenRect.minY;
+}
+
+// A portal texture shows the whole view of the portal's camera, so a rectangle of the texture is the same rectangle of the camera's
+// view. Convert a rectangle of texture coordinates (y down, 0 to 1) to the view rectangle it shows
+SPortalRect PortalUVToViewRect( const SPortalRect& uvRect )
+{
+	SPortalRect viewRect;
+	viewRect.minX = uvRect.minX * 2.0f - 1.0f;
+	viewRect.maxX = uvRect.maxX * 2.0f - 1.0f;
+	viewRect.minY = 1.0f - uvRect.maxY * 2.0f;
+	viewRect.maxY = 1.0f - uvRect.minY * 2.0f;
+	return viewRect;
+}
+
+// Matrix that stretches the given rectangle of a view out to fill the whole view. Multiply a view-projection matrix by this to get
+// one whose frustum only covers the rectangle. In clip space x' = scale * x + offset * w, so that x = minX * w maps to x' = -w and
+// x = maxX * w to x' = w, and the same for y
+D3DXMATRIX CalculateRectCropMatrix( const SPortalRect& rect )
+{
+	float scaleX = 2.0f / (rect.maxX - rect.minX);
+	float scaleY = 2.0f / (rect.maxY - rect.minY);
+	D3DXMATRIX crop;
+	D3DXMatrixIdentity( &crop );
+	crop._11 = scaleX;
+	crop._22 = scaleY;
+	crop._41 = -(rect.maxX + rect.minX) / (rect.maxX - rect.minX);
+	crop._42 = -(rect.maxY + rect.minY) / (rect.maxY - rect.minY);
+	return crop;
+}
+
+// Frustum of the part of a view within the given rectangle - used to cull everything not seen through a portal
+CFrustum CalculateRectFrustum( const D3DXMATRIX& viewProjMatrix, const SPortalRect& rect )
+{
+	CFrustum frustum;
+	frustum.ExtractFromMatrix( viewProjMatrix * CalculateRectCropMatrix( rect ) );
+	return frustum;
+}
+
+// Does one rectangle contain another
+bool RectContains( const SPortalRect& outer, const SPortalRect& inner )
+{
+	return inner.minX >= outer.minX && inner.maxX <= outer.maxX && inner.minY >= outer.minY && inner.maxY <= outer.maxY;
+}
+
+
+//-----------------------------------------------------------------------------
+// Portal class
+//-----------------------------------------------------------------------------
+
+///////////////////////////////
+// Constructors / Destructors
+
+// The model should already be loaded, its quad is found from its geometry - the corners are the vertices with texture coordinates
+// nearest each corner of the texture, taken in order around the texture. The side it faces is the average of its vertex normals
+CPortal::CPortal( CModel* model, CCamera* camera )
+{
+	m_Model = model;
+	m_Camera = camera;
+
+	const D3DXVECTOR2 TextureCorners[4] =
+	{
+		D3DXVECTOR2( 0.0f, 0.0f ), D3DXVECTOR2( 1.0f, 0.0f ), D3DXVECTOR2( 1.0f, 1.0f ), D3DXVECTOR2( 0.0f, 1.0f )
+	};
+	const vector<D3DXVECTOR3>& vertices = model->GetCPUVertices();
+	const vector<D3DXVECTOR2>& uvs = model->GetCPUUVs();
+	for (int corner = 0; corner < 4; ++corner)
+	{
+		m_CornerUVs[corner] = TextureCorners[corner];
+		m_Corners[corner] = D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+		float nearest = FLT_MAX;
+		for (unsigned int vertex = 0; vertex < uvs.size(); ++vertex)
+		{
+			float distanceX = uvs[vertex].x - TextureCorners[corner].x;
+			float distanceY = uvs[vertex].y - TextureCorners[corner].y;
+			float distanceSq = distanceX * distanceX + distanceY * distanceY;
+			if (distanceSq < nearest)
+			{
+				nearest = distanceSq;
+				m_Corners[corner] = vertices[vertex];
+			}
+		}
+	}
+
+	m_Normal = D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+	const vector<D3DXVECTOR3>& normals = model->GetCPUNormals();
+	for (unsigned int vertex = 0; vertex < normals.size(); ++vertex)
+	{
+		m_Normal += normals[vertex];
+	}
+
+	m_MaxSize = 0;
+	for (int depth = 0; depth < MAX_DEPTH; ++depth)
+	{
+		for (int size = 0; size < NUM_SIZES; ++size)
+		{
+			m_Textures[depth][size] = NULL;
+			m_RenderTargets[depth][size] = NULL;
+			m_TextureViews[depth][size] = NULL;
+			m_DepthStencils[depth][size] = NULL;
+			m_DepthStencilViews[depth][size] = NULL;
+		}
+		m_Caches[depth].valid = false;
+		m_Caches[depth].size = min( depth, NUM_SIZES - 1 );
+	}
+}
+
+CPortal::~CPortal()
+{
+	ReleaseResources();
+}
+
+// Create the portal's textures, the largest being maxSize texels square. Each is cleared to the given colour until rendered.
+// Returns false on failure
+bool CPortal::Create( int maxSize, const float clearColour[4] )
+{
+	ReleaseResources();
+	m_MaxSize = maxSize;
+
+	for (int depth = 0; depth < MAX_DEPTH; ++depth)
+	{
+		for (int size = min( depth, NUM_SIZES - 1 ); size < NUM_SIZES; ++size)
+		{
+			// Texture to render the portal camera's view into and show on the portal
+			D3D10_TEXTURE2D_DESC textureDesc;
+			textureDesc.Width = GetTextureSize( size );
+			textureDesc.Height = GetTextureSize( size );
+			textureDesc.MipLevels = 1; // No mip-maps when rendering to textures (or we would have to render every level)
+			textureDesc.ArraySize = 1;
+			textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+			textureDesc.SampleDesc.Count = 1;
+			textureDesc.SampleDesc.Quality = 0;
+			textureDesc.Usage = D3D10_USAGE_DEFAULT;
+			textureDesc.BindFlags = D3D10_BIND_RENDER_TARGET | D3D10_BIND_SHADER_RESOURCE;
+			textureDesc.CPUAccessFlags = 0;
+			textureDesc.MiscFlags = 0;
+			if (FAILED( g_pd3dDevice->CreateTexture2D( &textureDesc, NULL, &m_Textures[depth][size] ))) return false;
+			if (FAILED( g_pd3dDevice->CreateRenderTargetView( m_Textures[depth][size], NULL, &m_RenderTargets[depth][size] ))) return false;
+
+			D3D10_SHADER_RESOURCE_VIEW_DESC viewDesc;
+			viewDesc.Format = textureDesc.Format;
+			viewDesc.ViewDimension = D3D10_SRV_DIMENSION_TEXTURE2D;
+			viewDesc.Texture2D.MostDetailedMip = 0;
+			viewDesc.Texture2D.MipLevels = 1;
+			if (FAILED( g_pd3dDevice->CreateShaderResourceView( m_Textures[depth][size], &viewDesc, &m_TextureViews[depth][size] )))
+			{
+				return false;
+			}
+			g_pd3dDevice->ClearRenderTargetView( m_RenderTargets[depth][size], clearColour );
+
+			// Depth buffer of the same size
+			textureDesc.Format = DXGI_FORMAT_D32_FLOAT;
+			textureDesc.BindFlags = D3D10_BIND_DEPTH_STENCIL;
+			if (FAILED( g_pd3dDevice->CreateTexture2D( &textureDesc, NULL, &m_DepthStencils[depth][size] ))) return false;
+
+			D3D10_DEPTH_STENCIL_VIEW_DESC depthDesc;
+			depthDesc.Format = textureDesc.Format;
+			depthDesc.ViewDimension = D3D10_DSV_DIMENSION_TEXTURE2D;
+			depthDesc.Texture2D.MipSlice = 0;
+			if (FAILED( g_pd3dDevice->CreateDepthStencilView( m_DepthStencils[depth][size], &depthDesc, &m_DepthStencilViews[depth][size] )))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void CPortal::ReleaseResources()
+{
+	for (int depth = 0; depth < MAX_DEPTH; ++depth)
+	{
+		for (int size = 0; size < NUM_SIZES; ++size)
+		{
+			SAFE_RELEASE( m_DepthStencilViews[depth][size] );
+			SAFE_RELEASE( m_DepthStencils[depth][size] );
+			SAFE_RELEASE( m_TextureViews[depth][size] );
+			SAFE_RELEASE( m_RenderTargets[depth][size] );
+			SAFE_RELEASE( m_Textures[depth][size] );
+		}
+		m_Caches[depth].valid = false;
+	}
+}
+
+
+/////////////////////////////
+// Views
+
+// Find the part of the portal seen within a rectangle of a view, in the view (screen rect) and in the portal camera's view (camera
+// rect). Returns false if the portal is not in the rectangle or its back is towards the viewer
+bool CPortal::FindInView( const D3DXMATRIX& viewProjMatrix, const D3DXVECTOR3& viewPosition, const SPortalRect& viewRect,
+                          SPortalRect& screenRect, SPortalRect& cameraRect )
+{
+	D3DXMATRIX worldMatrix = m_Model->GetWorldMatrix();
+	D3DXVECTOR3 corners[4];
+	for (int corner = 0; corner < 4; ++corner)
+	{
+		D3DXVec3TransformCoord( &corners[corner], &m_Corners[corner], &worldMatrix );
+	}
+
+	// The quad is flat so one corner is enough to tell which side the viewer is on
+	D3DXVECTOR3 normal;
+	D3DXVec3TransformNormal( &normal, &m_Normal, &worldMatrix );
+	D3DXVECTOR3 toViewer = viewPosition - corners[0];
+	if (D3DXVec3Dot( &normal, &toViewer ) < 0.0f) return false;
+
+	SPortalRect uvRect;
+	if (!ClipPortalToView( corners, m_CornerUVs, viewProjMatrix, viewRect, screenRect, uvRect )) return false;
+	cameraRect = PortalUVToViewRect( uvRect );
+	return true;
+}
+
+// Choose the texture size for the portal at the given depth from the number of texels needed across it. The smallest size with at
+// least that many is chosen, but never one larger than the depth allows
+int CPortal::ChooseSize( int depth, float texels ) const
+{
+	int size = min( depth, NUM_SIZES - 1 );
+	while (size + 1 < NUM_SIZES && GetTextureSize( size + 1 ) >= texels)
+	{
+		++size;
+	}
+	return size;
+}
@@ -0,0 +1,201 @@
+//--------------------------------------------------------------------------------------
+//	Portal.h
+//
+//	A portal is a model showing the view from another camera, rendered into a texture.
+//	Portals can be seen through other portals up to a fixed depth. The maths that finds
+//	the part of a portal in view and the culling frustum behind it is CPU only
+//--------------------------------------------------------------------------------------
+
+#ifndef PORTAL_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define PORTAL_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+#include <d3d10.h>
+#include <d3dx10.h>
+#include "Model.h"
+#include "Camera.h"
+#include "Frustum.h"
+#include "LightClusters.h" // SLightSource
+
+
+//-----------------------------------------------------------------------------
+// Portal maths
+//-----------------------------------------------------------------------------
+// None of these use the GPU
+
+// A rectangle of a view in normalised device coordinates - x and y from -1 to 1, y up
+struct SPortalRect
+{
+	float minX;
+	float minY;
+	float maxX;
+	float maxY;
+};
+
+// The whole of a view
+const SPortalRect FullViewRect = { -1.0f, -1.0f, 1.0f, 1.0f };
+
+// Find the part of a portal quad seen within a rectangle of a view. The quad is given by its four world space corners, in order
+// around its edge, and the portal texture coordinates at each. The quad is clipped to the view's near plane and the rectangle, and
+// the bounds of what is left are returned in the view (screen rect) and in the portal texture (UV rect). Returns false if none of
+// the quad is in the rectangle
+bool ClipPortalToView( const D3DXVECTOR3 corners[4], const D3DXVECTOR2 cornerUVs[4], const D3DXMATRIX& viewProjMatrix,
+                       const SPortalRect& viewRect, SPortalRect& screenRect, SPortalRect& uvRect );
+
+// A portal texture shows the whole view of the portal's camera, so a rectangle of the texture is the same rectangle of the camera's
+// view. Convert a rectangle of texture coordinates (y down, 0 to 1) to the view rectangle it shows
+SPortalRect PortalUVToViewRect( const SPortalRect& uvRect );
+
+// Matrix that stretches the given rectangle of a view out to fill the whole view. Multiply a view-projection matrix by this to get
+// one whose frustum only covers the rectangle
+D3DXMATRIX CalculateRectCropMatrix( const SPortalRect& rect );
+
+// Frustum of the part of a view within the given rectangle - used to cull everything not seen through a portal
+CFrustum CalculateRectFrustum( const D3DXMATRIX& viewProjMatrix, const SPortalRect& rect );
+
+// Does one rectangle contain another
+bool RectContains( const SPortalRect& outer, const SPortalRect& inner );
+
+
+//-----------------------------------------------------------------------------
+// Portal class
+//-----------------------------------------------------------------------------
+
+// What was seen through a portal when its texture was last rendered - if all of this is the same, so is the texture. See
+// RenderPortalView in the main file
+struct SPortalViewCache
+{
+	bool                 valid;
+	int                  size;           // Index of the texture size rendered
+	float                renderTime;     // Seconds, from the clock used by the caller
+	D3DXMATRIX           viewProjMatrix; // Of the portal camera
+	SPortalRect          viewRect;       // Part of the portal camera's view that was rendered
+	bool                 parallax;
+	vector<CModel*>      models;         // Models in view and their matrix versions
+	vector<unsigned int> versions;
+	vector<SLightSource> lights;         // Lights reaching into the view
+};
+
+
+// A model that shows another camera's view. The model must be a single quad whose texture coordinates cover the portal texture from
+// 0 to 1 (such as Portal.x). The portal is drawn in a view using a texture rendered from its camera. That texture may itself show
+// other portals (or this one), which are rendered first into textures of their own, one level deeper. There is a set of textures for
+// each depth so a portal can be seen at several depths at once, and a range of sizes at each depth so a portal that covers a small
+// part of the screen is rendered into a small texture. Deeper portals never get the largest textures
+class CPortal
+{
+/////////////////////////////
+// Public types and constants
+public:
+
+	static const int MAX_DEPTH = 3; // Depth 0 is a portal seen from the main camera, depth 1 a portal seen through that and so on
+	static const int NUM_SIZES = 4; // Each half the size of the one before
+
+
+/////////////////////////////
+// Private member variables
+private:
+
+	CModel*  m_Model;
+	CCamera* m_Camera;
+
+	// The quad's corners in model space, in order around its edge, and their texture coordinates. The normal is the side the
+	// portal is seen from (its back faces are culled), or zero if the model has no normals
+	D3DXVECTOR3 m_Corners[4];
+	D3DXVECTOR2 m_CornerUVs[4];
+	D3DXVECTOR3 m_Normal;
+
+	// Render target textures with their depth buffers for each depth and size. Sizes below a depth's first size are not created
+	int                       m_MaxSize;
+	ID3D10Texture2D*          m_Textures[MAX_DEPTH][NUM_SIZES];
+	ID3D10RenderTargetView*   m_RenderTargets[MAX_DEPTH][NUM_SIZES];
+	ID3D10ShaderResourceView* m_TextureViews[MAX_DEPTH][NUM_SIZES];
+	ID3D10Texture2D*          m_DepthStencils[MAX_DEPTH][NUM_SIZES];
+	ID3D10DepthStencilView*   m_DepthStencilViews[MAX_DEPTH][NUM_SIZES];
+
+	// What each depth's texture was last rendered with
+	SPortalViewCache m_Caches[MAX_DEPTH];
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	// The model should already be loaded, its quad is found from its geometry
+	CPortal( CModel* model, CCamera* camera );
+	~CPortal();
+
+	// Create the portal's textures, the largest being maxSize texels square. Each is cleared to the given colour until rendered.
+	// Returns false on failure
+	bool Create( int maxSize, const float clearColour[4] );
+
+	void ReleaseResources();
+
+
+	/////////////////////////////
+	// Views
+
+	// Find the part of the portal seen within a rectangle of a view, in the view (screen rect) and in the portal camera's view
+	// (camera rect). Returns false if the portal is not in the rectangle or its back is towards the viewer
+	bool FindInView( const D3DXMATRIX& viewProjMatrix, const D3DXVECTOR3& viewPosition, const SPortalRect& viewRect,
+	                 SPortalRect& screenRect, SPortalRect& cameraRect );
+
+	// Choose the texture size for the portal at the given depth from the number of texels needed across it. The smallest size with
+	// at least that many is chosen, but never one larger than the depth allows
+	int ChooseSize( int depth, float texels ) const;
+
+	// Width and height of textures of the given size index
+	int GetTextureSize( int size ) const
+	{
+		return m_MaxSize >> size;
+	}
+
+
+	/////////////////////////////
+	// Data access
+
+	CModel* GetModel()
+	{
+		return m_Model;
+	}
+	CCamera* GetCamera()
+	{
+		return m_Camera;
+	}
+	ID3D10RenderTargetView* GetRenderTarget( int depth, int size )
+	{
+		return m_RenderTargets[depth][size];
+	}
+	ID3D10DepthStencilView* GetDepthStencilView( int depth, int size )
+	{
+		return m_DepthStencilViews[depth][size];
+	}
+
+	// Texture to draw the portal with at the given depth - whichever size was last rendered
+	ID3D10ShaderResourceView* GetTexture( int depth )
+	{
+		return m_TextureViews[depth][m_Caches[depth].size];
+	}
+
+	SPortalViewCache& GetCache( int depth )
+	{
+		return m_Caches[depth];
+	}
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	// Disallow copying - the class owns GPU resources
+	CPortal( const CPortal& );
+	CPortal& operator=( const CPortal& );
+};
+
+
+#endif // End of header guard - see top of file
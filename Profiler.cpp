@@ -0,0 +1,269 @@
+//--------------------------------------------------------------------------------------
+//	Profiler.cpp
+//
+//	CPU profiler - named scopes are timed on every thread and kept in a buffer per
+//	thread, to be written out as a trace that can be viewed in Chrome (chrome://tracing)
+//	or averaged per frame. Only built when PROFILE is defined (debug builds)
+//--------------------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <mutex>
+#include <algorithm>
+
+#include "Profiler.h" // Declaration of this class
+
+#ifdef PROFILE
+
+
+// Time all scopes are measured from
+static const chrono::steady_clock::time_point s_StartTime = chrono::steady_clock::now();
+
+// A finished scope, times in nanoseconds
+struct SProfileScope
+{
+	const char* name;
+	long long   startTime;
+	long long   endTime;
+};
+
+// Running total for one scope name
+struct SProfileTotal
+{
+	const char*  name;
+	long long    time;
+	unsigned int calls;
+};
+
+// Scopes recorded by one thread. Only the thread itself adds scopes, so the lock is only waited for while the trace is written
+// or the timings are read
+struct SThreadProfile
+{
+	mutex                 lock;
+	unsigned int          id;
+	string                name;
+	vector<SProfileScope> scopes;    // Ring buffer, allocated when the first scope is added
+	unsigned int          numScopes; // Scopes added in total, the next goes at numScopes % BUFFER_SIZE
+	vector<SProfileTotal> totals;
+};
+
+// Every thread's profile and the frames counted. Profiles are kept after their threads end so their scopes stay in the trace
+struct SThreadProfileList
+{
+	mutex                   lock;
+	vector<SThreadProfile*> profiles;
+	unsigned int            numFrames;
+
+	SThreadProfileList() : numFrames( 0 ) {}
+	~SThreadProfileList()
+	{
+		for (unsigned int i = 0; i < profiles.size(); ++i)
+		{
+			delete profiles[i];
+		}
+	}
+};
+static SThreadProfileList s_Profiles;
+
+// Profile of the calling thread, created when first needed
+static thread_local SThreadProfile* s_ThreadProfile = NULL;
+
+static SThreadProfile& GetThreadProfile()
+{
+	if (!s_ThreadProfile)
+	{
+		SThreadProfile* profile = new SThreadProfile;
+		profile->numScopes = 0;
+
+		unique_lock<mutex> lock( s_Profiles.lock );
+		profile->id = static_cast<unsigned int>(s_Profiles.profiles.size());
+		profile->name = "Thread " + to_string( profile->id );
+		s_Profiles.profiles.push_back( profile );
+		s_ThreadProfile = profile;
+	}
+	return *s_ThreadProfile;
+}
+
+// Write a string to a JSON file in quotes, escaping the characters JSON requires
+static void WriteJSONString( FILE* file, const char* text )
+{
+	fputc( '"', file );
+	for (; *text; ++text)
+	{
+		if (*text == '"' || *text == '\\')
+		{
+			fputc( '\\', file );
+		}
+		if (static_cast<unsigned char>(*text) >= ' ')
+		{
+			fputc( *text, file );
+		}
+	}
+	fputc( '"', file );
+}
+
+
+/////////////////////////////
+// Recording
+
+// Time since the program started in nanoseconds
+long long CProfiler::GetTime()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - s_StartTime).count();
+}
+
+// Record a finished scope for the calling thread, in its ring buffer and its total for the scope name. Names are compared by
+// pointer here, as the same literal always has the same address within a source file - totals with equal names from different
+// files are joined when the timings are read
+void CProfiler::AddScope( const char* name, long long startTime, long long endTime )
+{
+	SThreadProfile& profile = GetThreadProfile();
+	unique_lock<mutex> lock( profile.lock );
+
+	if (profile.scopes.empty())
+	{
+		profile.scopes.resize( BUFFER_SIZE );
+	}
+	SProfileScope& scope = profile.scopes[profile.numScopes % BUFFER_SIZE];
+	scope.name = name;
+	scope.startTime = startTime;
+	scope.endTime = endTime;
+	++profile.numScopes;
+
+	for (unsigned int i = 0; i < profile.totals.size(); ++i)
+	{
+		if (profile.totals[i].name == name)
+		{
+			profile.totals[i].time += endTime - startTime;
+			++profile.totals[i].calls;
+			return;
+		}
+	}
+	SProfileTotal total = { name, endTime - startTime, 1 };
+	profile.totals.push_back( total );
+}
+
+// Name the calling thread in the trace
+void CProfiler::SetThreadName( const char* name )
+{
+	SThreadProfile& profile = GetThreadProfile();
+	unique_lock<mutex> lock( profile.lock );
+	profile.name = name;
+}
+
+// Count the end of a frame, for the per-frame averages
+void CProfiler::EndFrame()
+{
+	unique_lock<mutex> lock( s_Profiles.lock );
+	++s_Profiles.numFrames;
+}
+
+
+/////////////////////////////
+// Results
+
+// Get the time spent in each scope name per frame, averaged over the frames since the last call and added up over all threads.
+// The slowest scopes come first
+void CProfiler::GetTimings( vector<SProfileTiming>& timings )
+{
+	timings.clear();
+	vector<SProfileTotal> totals;
+
+	unique_lock<mutex> listLock( s_Profiles.lock );
+	for (unsigned int p = 0; p < s_Profiles.profiles.size(); ++p)
+	{
+		SThreadProfile& profile = *s_Profiles.profiles[p];
+		unique_lock<mutex> lock( profile.lock );
+		for (unsigned int i = 0; i < profile.totals.size(); ++i)
+		{
+			unsigned int t = 0;
+			while (t < totals.size() && strcmp( totals[t].name, profile.totals[i].name ) != 0)
+			{
+				++t;
+			}
+			if (t == totals.size())
+			{
+				SProfileTotal total = { profile.totals[i].name, 0, 0 };
+				totals.push_back( total );
+			}
+			totals[t].time += profile.totals[i].time;
+			totals[t].calls += profile.totals[i].calls;
+		}
+		profile.totals.clear();
+	}
+	float frames = static_cast<float>(max( s_Profiles.numFrames, 1u ));
+	s_Profiles.numFrames = 0;
+	listLock.unlock();
+
+	for (unsigned int t = 0; t < totals.size(); ++t)
+	{
+		SProfileTiming timing;
+		timing.name = totals[t].name;
+		timing.time = totals[t].time * 1e-9f / frames;
+		timing.calls = totals[t].calls / frames;
+		timings.push_back( timing );
+	}
+	sort( timings.begin(), timings.end(), []( const SProfileTiming& a, const SProfileTiming& b ) { return a.time > b.time; } );
+}
+
+// Write the scopes held by every thread's buffer to a file in the Chrome trace event format (JSON) - a "complete" event for each
+// scope with its start and duration in microseconds, and a metadata event naming each thread. The viewer nests scopes on the same
+// thread by their times. Each buffer is copied while locked and written after, so threads are only held up briefly
+bool CProfiler::WriteTrace( const char* fileName, unsigned int* numScopes /*= NULL*/ )
+{
+	FILE* file;
+	if (fopen_s( &file, fileName, "w" ) != 0) return false;
+
+	fprintf( file, "{\"traceEvents\":[\n" );
+	bool firstEvent = true;
+	unsigned int scopesWritten = 0;
+
+	unique_lock<mutex> listLock( s_Profiles.lock );
+	vector<SThreadProfile*> profiles = s_Profiles.profiles;
+	listLock.unlock();
+
+	vector<SProfileScope> scopes;
+	for (unsigned int p = 0; p < profiles.size(); ++p)
+	{
+		// Copy the thread's scopes, oldest first
+		string threadName;
+		{
+			unique_lock<mutex> lock( profiles[p]->lock );
+			unsigned int first = (profiles[p]->numScopes > BUFFER_SIZE) ? profiles[p]->numScopes - BUFFER_SIZE : 0;
+			scopes.clear();
+			for (unsigned int i = first; i < profiles[p]->numScopes; ++i)
+			{
+				scopes.push_back( profiles[p]->scopes[i % BUFFER_SIZE] );
+			}
+			threadName = profiles[p]->name;
+		}
+		if (scopes.empty()) continue;
+
+		fprintf( file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", firstEvent ? "" : ",\n",
+		         profiles[p]->id );
+		WriteJSONString( file, threadName.c_str() );
+		fprintf( file, "}}" );
+		firstEvent = false;
+
+		for (unsigned int i = 0; i < scopes.size(); ++i)
+		{
+			fprintf( file, ",\n{\"name\":" );
+			WriteJSONString( file, scopes[i].name );
+			fprintf( file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", profiles[p]->id,
+			         scopes[i].startTime * 0.001, (scopes[i].endTime - scopes[i].startTime) * 0.001 );
+		}
+		scopesWritten += static_cast<unsigned int>(scopes.size());
+	}
+
+	fprintf( file, "\n],\"displayTimeUnit\":\"ms\"}\n" );
+	bool written = (ferror( file ) == 0);
+	fclose( file );
+
+	if (numScopes) *numScopes = scopesWritten;
+	return written;
+}
+
+
+#endif // PROFILE
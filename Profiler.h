@@ -0,0 +1,103 @@
+//--------------------------------------------------------------------------------------
+//	Profiler.h
+//
+//	CPU profiler - named scopes are timed on every thread and kept in a buffer per
+//	thread, to be written out as a trace that can be viewed in Chrome (chrome://tracing)
+//	or averaged per frame. Only built when PROFILE is defined (debug builds)
+//--------------------------------------------------------------------------------------
+
+#ifndef PROFILER_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define PROFILER_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+
+// Average time spent in one named scope or pass each frame, from CProfiler::GetTimings (or another source of timings)
+struct SProfileTiming
+{
+	const char* name;
+	float       time;  // Seconds per frame, all calls together
+	float       calls; // Calls per frame
+};
+
+
+#ifdef PROFILE
+
+// Time the rest of the enclosing block under the given name. The name must be a string literal (or last as long as the program)
+#define PROFILE_SCOPE( name ) CProfileScope PROFILE_JOIN( profileScope, __LINE__ )( name )
+
+// Name the calling thread in the trace
+#define PROFILE_THREAD_NAME( name ) CProfiler::SetThreadName( name )
+
+// Count the end of a frame, for the per-frame averages
+#define PROFILE_END_FRAME() CProfiler::EndFrame()
+
+#define PROFILE_JOIN( a, b ) PROFILE_JOIN_INNER( a, b )
+#define PROFILE_JOIN_INNER( a, b ) a##b
+
+
+// Each thread records the scopes it finishes into its own ring buffer, so threads don't wait for each other and only the most
+// recent scopes are kept. A buffer is created the first time a thread records a scope. Each thread also keeps running totals for
+// each scope name, used for per-frame averages. Times are read from the steady clock (the high resolution performance counter on
+// Windows), which is the same on every core, unlike the processor's own time stamp counter on older CPUs
+class CProfiler
+{
+/////////////////////////////
+// Public member functions
+public:
+
+	// Number of scopes each thread's buffer holds - older scopes are overwritten
+	static const unsigned int BUFFER_SIZE = 65536;
+
+	// Time since the program started in nanoseconds
+	static long long GetTime();
+
+	// Record a finished scope for the calling thread
+	static void AddScope( const char* name, long long startTime, long long endTime );
+
+	// Name the calling thread in the trace
+	static void SetThreadName( const char* name );
+
+	// Count the end of a frame, for the per-frame averages
+	static void EndFrame();
+
+	// Get the time spent in each scope name per frame, averaged over the frames since the last call and added up over all threads
+	static void GetTimings( vector<SProfileTiming>& timings );
+
+	// Write the scopes held by every thread's buffer to a file in the Chrome trace event format (JSON). Scopes still open are not
+	// included. Returns false if the file couldn't be written
+	static bool WriteTrace( const char* fileName, unsigned int* numScopes = NULL );
+};
+
+
+// Times its own lifetime - create one at the start of a block to time the block (see PROFILE_SCOPE)
+class CProfileScope
+{
+private:
+	const char* m_Name;
+	long long   m_StartTime;
+
+public:
+	CProfileScope( const char* name ) : m_Name( name ), m_StartTime( CProfiler::GetTime() ) {}
+	~CProfileScope()
+	{
+		CProfiler::AddScope( m_Name, m_StartTime, CProfiler::GetTime() );
+	}
+
+private:
+	// Disallow copying - a scope is timed once
+	CProfileScope( const CProfileScope& );
+	CProfileScope& operator=( const CProfileScope& );
+};
+
+#else // PROFILE not defined - profiling is removed
+
+#define PROFILE_SCOPE( name )
+#define PROFILE_THREAD_NAME( name )
+#define PROFILE_END_FRAME()
+
+#endif // PROFILE
+
+
+#endif // End of header guard - see top of file
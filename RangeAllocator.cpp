@@ -0,0 +1,179 @@
+//--------------------------------------------------------------------------------------
+//	RangeAllocator.cpp
+//
+//	Allocates ranges from a fixed size space, e.g. vertices or indices in a large buffer
+//	shared by many models. Only does the bookkeeping - no memory is touched
+//--------------------------------------------------------------------------------------
+
+#include <algorithm>
+using namespace std;
+
+#include "RangeAllocator.h" // Declaration of this class
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+// Constructor - takes the size of the space to allocate from
+CRangeAllocator::CRangeAllocator( unsigned int capacity /*= 0*/ )
+{
+	m_Capacity = 0;
+	m_Used = 0;
+	Grow( capacity );
+}
+
+
+/////////////////////////////
+// Allocation
+
+// Allocate a range of the given size, returns a handle for it or -1 if there is no free block large enough
+int CRangeAllocator::Allocate( unsigned int size )
+{
+	if (size == 0) return -1;
+
+	// Best fit - the smallest free block the allocation fits in
+	int best = -1;
+	for (unsigned int b = 0; b < m_FreeBlocks.size(); ++b)
+	{
+		if (m_FreeBlocks[b].size >= size && (best < 0 || m_FreeBlocks[b].size < m_FreeBlocks[best].size))
+		{
+			best = b;
+			if (m_FreeBlocks[b].size == size) break; // Can't do better than an exact fit
+		}
+	}
+	if (best < 0) return -1;
+
+	// Take the start of the block
+	SRange range = { m_FreeBlocks[best].offset, size };
+	m_FreeBlocks[best].offset += size;
+	m_FreeBlocks[best].size -= size;
+	if (m_FreeBlocks[best].size == 0)
+	{
+		m_FreeBlocks.erase( m_FreeBlocks.begin() + best );
+	}
+
+	int handle;
+	if (!m_FreeHandles.empty())
+	{
+		handle = m_FreeHandles.back();
+		m_FreeHandles.pop_back();
+		m_Allocations[handle] = range;
+	}
+	else
+	{
+		handle = static_cast<int>(m_Allocations.size());
+		m_Allocations.push_back( range );
+	}
+	m_Used += size;
+	return handle;
+}
+
+// Free an allocation, merging its range with any free blocks either side
+void CRangeAllocator::Free( int handle )
+{
+	if (handle < 0 || handle >= static_cast<int>(m_Allocations.size()) || m_Allocations[handle].size == 0) return;
+
+	SRange range = m_Allocations[handle];
+	m_Allocations[handle].size = 0;
+	m_FreeHandles.push_back( handle );
+	m_Used -= range.size;
+
+	// Find the first free block after the range
+	unsigned int next = 0;
+	while (next < m_FreeBlocks.size() && m_FreeBlocks[next].offset < range.offset) ++next;
+
+	bool joinsPrevious = (next > 0 && m_FreeBlocks[next - 1].offset + m_FreeBlocks[next - 1].size == range.offset);
+	bool joinsNext = (next < m_FreeBlocks.size() && range.offset + range.size == m_FreeBlocks[next].offset);
+	if (joinsPrevious && joinsNext)
+	{
+		m_FreeBlocks[next - 1].size += range.size + m_FreeBlocks[next].size;
+		m_FreeBlocks.erase( m_FreeBlocks.begin() + next );
+	}
+	else if (joinsPrevious)
+	{
+		m_FreeBlocks[next - 1].size += range.size;
+	}
+	else if (joinsNext)
+	{
+		m_FreeBlocks[next].offset = range.offset;
+		m_FreeBlocks[next].size += range.size;
+	}
+	else
+	{
+		m_FreeBlocks.insert( m_FreeBlocks.begin() + next, range );
+	}
+}
+
+// Increase the size of the space. The new space is added to the end
+void CRangeAllocator::Grow( unsigned int newCapacity )
+{
+	if (newCapacity <= m_Capacity) return;
+
+	unsigned int added = newCapacity - m_Capacity;
+	if (!m_FreeBlocks.empty() && m_FreeBlocks.back().offset + m_FreeBlocks.back().size == m_Capacity)
+	{
+		m_FreeBlocks.back().size += added;
+	}
+	else
+	{
+		SRange block = { m_Capacity, added };
+		m_FreeBlocks.push_back( block );
+	}
+	m_Capacity = newCapacity;
+}
+
+// Move all the allocations down to the start of the space, in their current order, leaving a single free block at the end
+void CRangeAllocator::Defragment( vector<SMove>& moves )
+{
+	moves.clear();
+
+	// Live allocations in offset order
+	vector< pair<unsigned int, int> > order;
+	for (unsigned int h = 0; h < m_Allocations.size(); ++h)
+	{
+		if (m_Allocations[h].size > 0) order.push_back( make_pair( m_Allocations[h].offset, static_cast<int>(h) ) );
+	}
+	sort( order.begin(), order.end() );
+
+	unsigned int nextOffset = 0;
+	for (unsigned int i = 0; i < order.size(); ++i)
+	{
+		SRange& range = m_Allocations[order[i].second];
+		if (range.offset != nextOffset)
+		{
+			SMove move = { range.offset, nextOffset, range.size };
+			moves.push_back( move );
+			range.offset = nextOffset;
+		}
+		nextOffset += range.size;
+	}
+
+	m_FreeBlocks.clear();
+	if (nextOffset < m_Capacity)
+	{
+		SRange block = { nextOffset, m_Capacity - nextOffset };
+		m_FreeBlocks.push_back( block );
+	}
+}
+
+
+/////////////////////////////
+// Data access
+
+// Size of the largest free block - the largest allocation that can currently succeed
+unsigned int CRangeAllocator::GetLargestFreeBlock() const
+{
+	unsigned int largest = 0;
+	for (unsigned int b = 0; b < m_FreeBlocks.size(); ++b)
+	{
+		if (m_FreeBlocks[b].size > largest) largest = m_FreeBlocks[b].size;
+	}
+	return largest;
+}
+
+// Fragmentation of the free space - the fraction of it that is not in the largest free block
+float CRangeAllocator::GetFragmentation() const
+{
+	unsigned int free = m_Capacity - m_Used;
+	return (free > 0) ? 1.0f - static_cast<float>(GetLargestFreeBlock()) / free : 0.0f;
+}
@@ -0,0 +1,116 @@
+//--------------------------------------------------------------------------------------
+//	RangeAllocator.h
+//
+//	Allocates ranges from a fixed size space, e.g. vertices or indices in a large buffer
+//	shared by many models. Only does the bookkeeping - no memory is touched
+//--------------------------------------------------------------------------------------
+
+#ifndef RANGE_ALLOCATOR_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define RANGE_ALLOCATOR_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+
+// Allocations are identified by a handle rather than their offset, so that the allocator can move them when it defragments - the
+// current offset of an allocation is looked up from its handle. The free space is kept as a list of blocks sorted by offset. A
+// freed range is merged with any free neighbours, so the free blocks are always separated by allocations. An allocation takes the
+// smallest free block it fits in (best fit), which leaves the large blocks for large allocations
+class CRangeAllocator
+{
+/////////////////////////////
+// Public types
+public:
+
+	// A range moved by Defragment, from one offset to another
+	struct SMove
+	{
+		unsigned int from;
+		unsigned int to;
+		unsigned int size;
+	};
+
+
+/////////////////////////////
+// Private member variables
+private:
+
+	struct SRange
+	{
+		unsigned int offset;
+		unsigned int size;
+	};
+
+	unsigned int   m_Capacity;
+	unsigned int   m_Used;
+
+	// Allocations indexed by handle, and handles no longer in use (their range has zero size) to reuse
+	vector<SRange> m_Allocations;
+	vector<int>    m_FreeHandles;
+
+	// Free blocks sorted by offset
+	vector<SRange> m_FreeBlocks;
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	// Constructor - takes the size of the space to allocate from
+	CRangeAllocator( unsigned int capacity = 0 );
+
+
+	/////////////////////////////
+	// Allocation
+
+	// Allocate a range of the given size, returns a handle for it or -1 if there is no free block large enough
+	int Allocate( unsigned int size );
+
+	// Free an allocation
+	void Free( int handle );
+
+	// Increase the size of the space. The new space is added to the end
+	void Grow( unsigned int newCapacity );
+
+	// Move all the allocations down to the start of the space, in their current order, leaving a single free block at the end.
+	// Fills in the moves needed to update the data that the allocations refer to. Moves are listed in increasing offset order and
+	// a range never moves to a higher offset, so they can be made one at a time in the same space
+	void Defragment( vector<SMove>& moves );
+
+
+	/////////////////////////////
+	// Data access
+
+	unsigned int GetOffset( int handle ) const
+	{
+		return m_Allocations[handle].offset;
+	}
+	unsigned int GetSize( int handle ) const
+	{
+		return m_Allocations[handle].size;
+	}
+	unsigned int GetCapacity() const
+	{
+		return m_Capacity;
+	}
+	unsigned int GetUsed() const
+	{
+		return m_Used;
+	}
+	unsigned int GetNumFreeBlocks() const
+	{
+		return static_cast<unsigned int>(m_FreeBlocks.size());
+	}
+
+	// Size of the largest free block - the largest allocation that can currently succeed
+	unsigned int GetLargestFreeBlock() const;
+
+	// Fragmentation of the free space from 0 (all in one block) towards 1 (split into many small blocks)
+	float GetFragmentation() const;
+};
+
+
+#endif // End of header guard - see top of file
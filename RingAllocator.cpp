@@ -0,0 +1,119 @@
+//--------------------------------------------------------------------------------------
+//	RingAllocator.cpp
+//
+//	Allocates short-lived ranges from a fixed size space used as a ring, e.g. per-frame
+//	data uploaded to the GPU. Only does the bookkeeping - no memory is touched
+//--------------------------------------------------------------------------------------
+
+#include "RingAllocator.h" // Declaration of this class
+#include "CTimer.h"
+
+
+// Constructor - takes the size of the space
+CRingAllocator::CRingAllocator( unsigned int capacity /*= 0*/ )
+{
+	Reset( capacity );
+}
+
+// Forget all allocations and frames, and optionally change the size of the space
+void CRingAllocator::Reset( unsigned int capacity )
+{
+	m_Capacity = capacity;
+	m_Head = 0;
+	m_Used = 0;
+	m_FrameUsed = 0;
+	m_Frames.clear();
+}
+
+
+/////////////////////////////
+// Allocation
+
+// Allocate a range of the given size and alignment (a power of two) for the current frame. Returns false if the space that isn't
+// held by frames in flight is too small
+bool CRingAllocator::Allocate( unsigned int size, unsigned int alignment, unsigned int& offset )
+{
+	if (size == 0 || size > m_Capacity) return false;
+
+	// Nothing in use - start from the beginning again, so large allocations are less likely to need to wrap
+	if (m_Used == 0) m_Head = 0;
+
+	// Skip bytes to align the allocation. If it would then run past the end, skip the rest of the space and start at the beginning
+	unsigned int start = (m_Head + alignment - 1) & ~(alignment - 1);
+	unsigned int skipped;
+	if (start < m_Head || start > m_Capacity - size) // First test catches overflow
+	{
+		start = 0;
+		skipped = m_Capacity - m_Head;
+	}
+	else
+	{
+		skipped = start - m_Head;
+	}
+
+	// The space in use is one run ending at the head, so the allocation fits if the skipped bytes and the allocation fit in what's left
+	if (m_Used + skipped + size > m_Capacity) return false;
+
+	m_Used += skipped + size;
+	m_FrameUsed += skipped + size;
+	m_Head = start + size;
+	offset = start;
+	return true;
+}
+
+// End the current frame, tagging its allocations with the given fence value
+void CRingAllocator::EndFrame( unsigned int fence )
+{
+	SFrame frame = { fence, m_FrameUsed };
+	m_Frames.push_back( frame );
+	m_FrameUsed = 0;
+}
+
+// Free the space of every ended frame with a fence value up to and including the given one. Fence values are compared by their
+// difference, so they can wrap around
+void CRingAllocator::Retire( unsigned int completedFence )
+{
+	while (!m_Frames.empty() && static_cast<int>(m_Frames.front().fence - completedFence) <= 0)
+	{
+		m_Used -= m_Frames.front().used;
+		m_Frames.pop_front();
+	}
+}
+
+
+/////////////////////////////
+// Benchmark
+
+// Time the given number of allocations of typical per-object sizes (64 to 256 bytes, 16 byte aligned). A frame ends every 256
+// allocations, and frames are retired three frames after they end
+SRingAllocatorBenchmark CRingAllocator::Benchmark( unsigned int numAllocations )
+{
+	const unsigned int AllocationsPerFrame = 256;
+	const unsigned int FrameLatency = 3;
+	CRingAllocator allocator( 1024 * 1024 );
+
+	SRingAllocatorBenchmark results;
+	results.numAllocations = numAllocations;
+	results.numFailed = 0;
+
+	CTimer timer;
+	timer.Start();
+	unsigned int frame = 0;
+	for (unsigned int a = 0; a < numAllocations; ++a)
+	{
+		unsigned int offset;
+		if (!allocator.Allocate( 64 + (a & 3) * 64, 16, offset ))
+		{
+			++results.numFailed;
+		}
+
+		if ((a + 1) % AllocationsPerFrame == 0)
+		{
+			allocator.EndFrame( ++frame );
+			if (frame > FrameLatency) allocator.Retire( frame - FrameLatency );
+		}
+	}
+	results.time = timer.GetTime();
+	results.allocationsPerSecond = (results.time > 0.0f) ? numAllocations / results.time : 0.0f;
+	return results;
+}
@@ -0,0 +1,105 @@
+//--------------------------------------------------------------------------------------
+//	RingAllocator.h
+//
+//	Allocates short-lived ranges from a fixed size space used as a ring, e.g. per-frame
+//	data uploaded to the GPU. Only does the bookkeeping - no memory is touched
+//--------------------------------------------------------------------------------------
+
+#ifndef RING_ALLOCATOR_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define RING_ALLOCATOR_H_INCLUDED
+
+#include <deque>
+using namespace std;
+
+
+// Results of CRingAllocator::Benchmark
+struct SRingAllocatorBenchmark
+{
+	unsigned int numAllocations;
+	unsigned int numFailed;       // Allocations that found the ring full
+	float        time;            // Seconds
+	float        allocationsPerSecond;
+};
+
+
+// Allocations are made one after another, wrapping around to the start of the space when they reach the end - an allocation never
+// straddles the end. Nothing is freed individually. Instead each frame's allocations are tagged with a fence value when the frame
+// ends, and once the user knows a fence has been passed (e.g. the GPU has finished the frame) all the space allocated up to that
+// fence is reused. Since space is freed in the order it was allocated, the space in use is always one run from the oldest live
+// allocation to the newest, so it is enough to count how many bytes are in use
+class CRingAllocator
+{
+/////////////////////////////
+// Private member variables
+private:
+
+	unsigned int  m_Capacity;
+	unsigned int  m_Head;       // Where the next allocation starts looking for space
+	unsigned int  m_Used;       // Bytes in use, including any skipped for alignment or when wrapping
+	unsigned int  m_FrameUsed;  // Bytes used by the current frame so far
+
+	// Frames that have ended but whose space is not yet free, oldest first
+	struct SFrame
+	{
+		unsigned int fence;
+		unsigned int used;
+	};
+	deque<SFrame> m_Frames;
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	// Constructor - takes the size of the space
+	CRingAllocator( unsigned int capacity = 0 );
+
+	// Forget all allocations and frames, and optionally change the size of the space
+	void Reset( unsigned int capacity );
+
+
+	/////////////////////////////
+	// Allocation
+
+	// Allocate a range of the given size and alignment (a power of two) for the current frame. Returns false if the space that isn't
+	// held by frames in flight is too small
+	bool Allocate( unsigned int size, unsigned int alignment, unsigned int& offset );
+
+	// End the current frame, tagging its allocations with the given fence value. Fence values must increase from frame to frame
+	void EndFrame( unsigned int fence );
+
+	// Free the space of every ended frame with a fence value up to and including the given one
+	void Retire( unsigned int completedFence );
+
+
+	/////////////////////////////
+	// Data access
+
+	unsigned int GetCapacity() const
+	{
+		return m_Capacity;
+	}
+	unsigned int GetUsed() const
+	{
+		return m_Used;
+	}
+	unsigned int GetNumFramesInFlight() const
+	{
+		return static_cast<unsigned int>(m_Frames.size());
+	}
+	unsigned int GetOldestFence() const // Only valid if there are frames in flight
+	{
+		return m_Frames.front().fence;
+	}
+
+
+	/////////////////////////////
+	// Benchmark
+
+	// Time the given number of allocations of typical per-object sizes, with frames retired a few frames after they end as the
+	// GPU would
+	static SRingAllocatorBenchmark Benchmark( unsigned int numAllocations );
+};
+
+
+#endif // End of header guard - see top of file
@@ -0,0 +1,73 @@
+//--------------------------------------------------------------------------------------
+//	ShaderConstants.cpp
+//
+//	C++ mirrors of the constant buffers declared in GraphicsAssign1.fx, and a class that
+//	uploads each buffer in one go from its mirror struct
+//--------------------------------------------------------------------------------------
+
+#include "Defines.h"         // General definitions shared by all source files
+#include "ShaderConstants.h" // Declaration of this class
+
+
+unsigned int CConstantBlockBase::s_NumUploads = 0;
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+CConstantBlockBase::CConstantBlockBase()
+{
+	m_Buffer = NULL;
+	m_Changed = false;
+}
+
+CConstantBlockBase::~CConstantBlockBase()
+{
+	ReleaseResources();
+}
+
+// Create a buffer of the given size and have the named cbuffer in the effect use it. Returns false on failure
+bool CConstantBlockBase::Create( ID3D10Effect* effect, const char* name, unsigned int size )
+{
+	ReleaseResources();
+
+	ID3D10EffectConstantBuffer* constantBuffer = effect->GetConstantBufferByName( name );
+	if (!constantBuffer->IsValid()) return false;
+
+	D3D10_BUFFER_DESC bufferDesc;
+	bufferDesc.BindFlags = D3D10_BIND_CONSTANT_BUFFER;
+	bufferDesc.Usage = D3D10_USAGE_DEFAULT; // Updated whole with UpdateSubresource
+	bufferDesc.ByteWidth = size;
+	bufferDesc.CPUAccessFlags = 0;
+	bufferDesc.MiscFlags = 0;
+	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &m_Buffer )))
+	{
+		return false;
+	}
+
+	// From now on the effect binds this buffer when a pass using the cbuffer is applied, instead of its own
+	if (FAILED( constantBuffer->SetConstantBuffer( m_Buffer )))
+	{
+		return false;
+	}
+	return true;
+}
+
+void CConstantBlockBase::ReleaseResources()
+{
+	SAFE_RELEASE( m_Buffer );
+}
+
+
+/////////////////////////////
+// Usage
+
+// Copy the given data into the whole buffer
+void CConstantBlockBase::Upload( const void* data )
+{
+	if (!m_Buffer) return;
+
+	g_pd3dDevice->UpdateSubresource( m_Buffer, 0, NULL, data, 0, 0 );
+	m_Changed = false;
+	++s_NumUploads;
+}
@@ -0,0 +1,183 @@
+//--------------------------------------------------------------------------------------
+//	ShaderConstants.h
+//
+//	C++ mirrors of the constant buffers declared in GraphicsAssign1.fx, and a class that
+//	uploads each buffer in one go from its mirror struct
+//--------------------------------------------------------------------------------------
+
+#ifndef SHADER_CONSTANTS_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define SHADER_CONSTANTS_H_INCLUDED
+
+#include <cstddef> // offsetof
+#include <d3d10.h>
+#include <d3dx10.h>
+
+
+//-----------------------------------------------------------------------------
+// Mirror structs
+//-----------------------------------------------------------------------------
+// Each struct has exactly the layout of the matching cbuffer in the shader file. HLSL packs constants into 16 byte registers and
+// a value never straddles two registers, so padding is added where a value would. Matrices are declared row_major in the shader
+// so D3DX matrices can be copied in without transposing. The static_asserts below check every offset against the shader's
+// packing - if one fails, the struct and the cbuffer no longer match
+
+// Values that change at most once a frame
+struct SPerFrameConstants
+{
+	D3DXVECTOR3 ambientColour;
+	float       specularPower;
+	float       parallaxDepth;
+	float       wiggle;
+	float       padding[2];
+};
+
+// The camera (or light "camera") being rendered from
+struct SPerViewConstants
+{
+	D3DXMATRIX  viewMatrix;
+	D3DXMATRIX  projMatrix;
+	D3DXVECTOR3 cameraPos;
+	float       padding;
+	D3DXVECTOR4 clusterScale;  // Light clusters (see CLightClusterGrid) - tiles per pixel in xy, slice scale and bias in zw
+	UINT        clusterTilesX;
+	UINT        clusterTilesY;
+	UINT        clusterSlices;
+	float       padding2;
+};
+
+// The model being drawn
+struct SPerObjectConstants
+{
+	D3DXMATRIX  worldMatrix;
+	D3DXVECTOR4 positionDecode;    // See CModel::Load - (0,0,0,1) for full vertex data
+	D3DXVECTOR3 modelColour;
+	int         octahedralNormals; // HLSL bools are 4 bytes
+	D3DXVECTOR3 tintColour;
+	float       padding;
+};
+
+// Lights with shadows, each with a tile in the shadow atlas. This is the number of spot lights in the scene, and is passed to the
+// effect file as NUM_SHADOW_LIGHTS to size the shader's arrays, so changing it here is all that is needed
+const int NumShadowConstants = 2;
+struct SShadowConstants
+{
+	D3DXMATRIX  shadowMatrices[NumShadowConstants];   // View * projection matrix of each light (as a camera)
+	D3DXVECTOR4 shadowAtlasRects[NumShadowConstants]; // Where each light's shadow map is in the atlas - UV offset in xy, UV scale in zw
+};
+
+// Offsets of each constant in the shader's cbuffers
+static_assert(offsetof(SPerFrameConstants, ambientColour) == 0,  "PerFrame: AmbientColour");
+static_assert(offsetof(SPerFrameConstants, specularPower) == 12, "PerFrame: SpecularPower");
+static_assert(offsetof(SPerFrameConstants, parallaxDepth) == 16, "PerFrame: ParallaxDepth");
+static_assert(offsetof(SPerFrameConstants, wiggle) == 20,        "PerFrame: Wiggle");
+static_assert(sizeof(SPerFrameConstants) == 32,                  "PerFrame: size");
+
+static_assert(offsetof(SPerViewConstants, viewMatrix) == 0,      "PerView: ViewMatrix");
+static_assert(offsetof(SPerViewConstants, projMatrix) == 64,     "PerView: ProjMatrix");
+static_assert(offsetof(SPerViewConstants, cameraPos) == 128,     "PerView: CameraPos");
+static_assert(offsetof(SPerViewConstants, clusterScale) == 144,  "PerView: ClusterScale");
+static_assert(offsetof(SPerViewConstants, clusterTilesX) == 160, "PerView: ClusterTilesX");
+static_assert(offsetof(SPerViewConstants, clusterTilesY) == 164, "PerView: ClusterTilesY");
+static_assert(offsetof(SPerViewConstants, clusterSlices) == 168, "PerView: ClusterSlices");
+static_assert(sizeof(SPerViewConstants) == 176,                  "PerView: size");
+
+static_assert(offsetof(SPerObjectConstants, worldMatrix) == 0,        "PerObject: WorldMatrix");
+static_assert(offsetof(SPerObjectConstants, positionDecode) == 64,    "PerObject: PositionDecode");
+static_assert(offsetof(SPerObjectConstants, modelColour) == 80,       "PerObject: ModelColour");
+static_assert(offsetof(SPerObjectConstants, octahedralNormals) == 92, "PerObject: OctahedralNormals");
+static_assert(offsetof(SPerObjectConstants, tintColour) == 96,        "PerObject: TintColour");
+static_assert(sizeof(SPerObjectConstants) == 112,                     "PerObject: size");
+
+static_assert(offsetof(SShadowConstants, shadowMatrices) == 0,      "Shadows: ShadowMatrices");
+static_assert(offsetof(SShadowConstants, shadowAtlasRects) == 64 * NumShadowConstants, "Shadows: ShadowAtlasRects");
+static_assert(sizeof(SShadowConstants) == 80 * NumShadowConstants,                    "Shadows: size");
+
+
+//-----------------------------------------------------------------------------
+// Constant blocks
+//-----------------------------------------------------------------------------
+
+// A cbuffer in the effect that is given its own GPU buffer, filled from a mirror struct with one update rather than by setting
+// each of its variables through the effect. Setting effect variables one by one after the buffer is replaced has no effect
+class CConstantBlockBase
+{
+/////////////////////////////
+// Protected member variables
+protected:
+
+	ID3D10Buffer* m_Buffer;
+	bool          m_Changed; // Has the mirror struct changed since the last upload
+
+	// Number of buffer updates made by all blocks since the last reset
+	static unsigned int s_NumUploads;
+
+
+/////////////////////////////
+// Protected member functions
+protected:
+
+	CConstantBlockBase();
+	~CConstantBlockBase();
+
+	// Create a buffer of the given size and have the named cbuffer in the effect use it. Returns false on failure
+	bool Create( ID3D10Effect* effect, const char* name, unsigned int size );
+
+	// Copy the given data into the whole buffer
+	void Upload( const void* data );
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	void ReleaseResources();
+
+	static unsigned int GetNumUploads()
+	{
+		return s_NumUploads;
+	}
+	static void ResetUploads()
+	{
+		s_NumUploads = 0;
+	}
+};
+
+
+// Constant block with its mirror struct. Change the struct through Edit, then call Upload once all the changes for the block's
+// scope are made, before drawing. Upload does nothing if nothing was edited
+template <class TConstants>
+class CConstantBlock : public CConstantBlockBase
+{
+private:
+	TConstants m_Constants;
+
+public:
+	CConstantBlock()
+	{
+		ZeroMemory( &m_Constants, sizeof(TConstants) );
+	}
+
+	bool Create( ID3D10Effect* effect, const char* name )
+	{
+		m_Changed = true;
+		return CConstantBlockBase::Create( effect, name, sizeof(TConstants) );
+	}
+
+	TConstants& Edit()
+	{
+		m_Changed = true;
+		return m_Constants;
+	}
+	const TConstants& Get() const
+	{
+		return m_Constants;
+	}
+
+	void Upload()
+	{
+		if (m_Changed) CConstantBlockBase::Upload( &m_Constants );
+	}
+};
+
+
+#endif // End of header guard - see top of file
@@ -0,0 +1,130 @@
+//--------------------------------------------------------------------------------------
+//	ShadowAtlas.cpp
+//
+//	The shadow atlas class shares out one large shadow map texture between any number
+//	of shadow casting lights. Each light gets a square tile sized by how important it
+//	is on screen. This class only decides the tile layout, it does no rendering
+//--------------------------------------------------------------------------------------
+
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+#include "ShadowAtlas.h" // Declaration of this class
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+CShadowAtlas::CShadowAtlas( int atlasSize, int minTileSize, int maxTileSize )
+{
+	m_AtlasSize = atlasSize;
+	m_MinTileSize = minTileSize;
+	m_MaxTileSize = (maxTileSize < atlasSize) ? maxTileSize : atlasSize;
+}
+
+
+/////////////////////////////
+// Allocation
+
+// Share out the atlas between lights. Tile sizes are all powers of two, so if tiles are placed largest first along a
+// "Z-order" curve (a quadtree walk: top-left, top-right, bottom-left, bottom-right, recursively) each tile always starts on
+// a position aligned to its own size and the tiles pack together with no gaps. That means the tiles fit if and only if
+// their total area is no more than the atlas area, so the fitting step below only needs to compare areas
+int CShadowAtlas::Allocate( const float* importance, int numLights, SShadowAtlasTile* tiles )
+{
+	// Lights beyond the maximum get no tile
+	for (int i = MAX_LIGHTS; i < numLights; ++i)
+	{
+		tiles[i].x = tiles[i].y = tiles[i].size = 0;
+	}
+	if (numLights > MAX_LIGHTS) numLights = MAX_LIGHTS;
+
+	// Requested size of each light's tile - the largest power of two not more than maxTileSize * sqrt(importance)
+	int order[MAX_LIGHTS];
+	int sizes[MAX_LIGHTS];
+	int totalArea = 0;
+	for (int i = 0; i < numLights; ++i)
+	{
+		float lightImportance = (importance[i] > 0.0f) ? ((importance[i] < 1.0f) ? importance[i] : 1.0f) : 0.0f;
+		float wantedSize = m_MaxTileSize * sqrtf( lightImportance );
+		int size = m_MaxTileSize;
+		while (size > m_MinTileSize && size > wantedSize)
+		{
+			size /= 2;
+		}
+		sizes[i] = size;
+		order[i] = i;
+		totalArea += size * size;
+	}
+
+	// Order lights from least to most important, ties broken by index so the order is always the same
+	sort( order, order + numLights, [importance]( int a, int b )
+	{
+		return (importance[a] != importance[b]) ? (importance[a] < importance[b]) : (a > b);
+	} );
+
+	// Shrink the least important lights until the tiles fit. Take one size step off the least important light that can
+	// still shrink, then start again from the least important light. Lights at the minimum size are dropped only if shrinking
+	// everything isn't enough
+	const int atlasArea = m_AtlasSize * m_AtlasSize;
+	while (totalArea > atlasArea)
+	{
+		int shrink = -1;
+		for (int i = 0; i < numLights && shrink < 0; ++i)
+		{
+			if (sizes[order[i]] > m_MinTileSize) shrink = order[i];
+		}
+		if (shrink >= 0)
+		{
+			totalArea -= sizes[shrink] * sizes[shrink] - (sizes[shrink] / 2) * (sizes[shrink] / 2);
+			sizes[shrink] /= 2;
+		}
+		else
+		{
+			for (int i = 0; i < numLights && totalArea > atlasArea; ++i)
+			{
+				if (sizes[order[i]] > 0)
+				{
+					totalArea -= sizes[order[i]] * sizes[order[i]];
+					sizes[order[i]] = 0;
+				}
+			}
+		}
+	}
+
+	// Place tiles largest first (most important first for equal sizes) along the Z-order curve. The curve position is
+	// measured in units of the minimum tile area, and is converted to x/y by separating out its alternate bits
+	stable_sort( order, order + numLights, [&sizes, importance]( int a, int b )
+	{
+		if (sizes[a] != sizes[b]) return sizes[a] > sizes[b];
+		return (importance[a] != importance[b]) ? (importance[a] > importance[b]) : (a < b);
+	} );
+
+	int curvePosition = 0;
+	int numAllocated = 0;
+	for (int i = 0; i < numLights; ++i)
+	{
+		SShadowAtlasTile& tile = tiles[order[i]];
+		tile.size = sizes[order[i]];
+		if (tile.size == 0)
+		{
+			tile.x = tile.y = 0;
+			continue;
+		}
+
+		int cellX = 0, cellY = 0;
+		for (int bit = 0; (curvePosition >> (2 * bit)) != 0; ++bit)
+		{
+			cellX |= ((curvePosition >> (2 * bit))     & 1) << bit;
+			cellY |= ((curvePosition >> (2 * bit + 1)) & 1) << bit;
+		}
+		tile.x = cellX * m_MinTileSize;
+		tile.y = cellY * m_MinTileSize;
+
+		int tileCells = tile.size / m_MinTileSize;
+		curvePosition += tileCells * tileCells;
+		++numAllocated;
+	}
+	return numAllocated;
+}
@@ -0,0 +1,82 @@
+//--------------------------------------------------------------------------------------
+//	ShadowAtlas.h
+//
+//	The shadow atlas class shares out one large shadow map texture between any number
+//	of shadow casting lights. Each light gets a square tile sized by how important it
+//	is on screen. This class only decides the tile layout, it does no rendering
+//--------------------------------------------------------------------------------------
+
+#ifndef SHADOW_ATLAS_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define SHADOW_ATLAS_H_INCLUDED
+
+
+// Position and size of a light's tile in the atlas, in pixels. A size of 0 means the light did not get a tile
+struct SShadowAtlasTile
+{
+	int x;
+	int y;
+	int size;
+
+	bool operator==( const SShadowAtlasTile& other ) const
+	{
+		return x == other.x && y == other.y && size == other.size;
+	}
+	bool operator!=( const SShadowAtlasTile& other ) const
+	{
+		return !(*this == other);
+	}
+};
+
+
+class CShadowAtlas
+{
+/////////////////////////////
+// Private member variables
+private:
+
+	// Size of the whole atlas and the range of tile sizes, in pixels. All must be powers of two
+	int m_AtlasSize;
+	int m_MinTileSize;
+	int m_MaxTileSize;
+
+	// Maximum number of lights that can be given tiles at once
+	static const int MAX_LIGHTS = 256;
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	// Constructor - atlas size and tile size range in pixels, all must be powers of two
+	CShadowAtlas( int atlasSize = 2048, int minTileSize = 128, int maxTileSize = 1024 );
+
+
+	/////////////////////////////
+	// Data access
+
+	int GetAtlasSize()
+	{
+		return m_AtlasSize;
+	}
+	int GetMaxLights()
+	{
+		return MAX_LIGHTS;
+	}
+
+
+	/////////////////////////////
+	// Allocation
+
+	// Share out the atlas between lights. Importance is the fraction of the screen (0->1) each light affects - a light
+	// covering the whole screen asks for the largest tile, the tile's side shrinks with the square root of the importance.
+	// If the requested tiles don't fit then the least important lights have their tiles reduced first, and at the minimum
+	// size are dropped (tile size 0). The same importances always give the same layout, so tiles only move when the
+	// importances change enough to change the tile sizes. Returns the number of lights that were given a tile
+	int Allocate( const float* importance, int numLights, SShadowAtlasTile* tiles );
+};
+
+
+#endif // End of header guard - see top of file
@@ -0,0 +1,183 @@
+//--------------------------------------------------------------------------------------
+//	StaticBatch.cpp
+//
+//	Merges the geometry of several static models into one vertex and index buffer, so
+//	they can be drawn with a single draw call
+//--------------------------------------------------------------------------------------
+
+#include "Defines.h"      // General definitions shared by all source files
+#include "StaticBatch.h"  // Declaration of this class
+#include "Model.h"
+#include "GeometryPool.h"
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+// Constructor - takes the technique and texture shared by the models in the batch
+CStaticBatch::CStaticBatch( ID3D10EffectTechnique* technique, ID3D10ShaderResourceView* texture )
+{
+	m_Technique = technique;
+	m_Texture = texture;
+	m_VertexBuffer = NULL;
+	m_IndexBuffer = NULL;
+	m_VertexLayout = NULL;
+	m_NumIndices = 0;
+}
+
+// Destructor
+CStaticBatch::~CStaticBatch()
+{
+	ReleaseResources();
+}
+
+// Release the merged geometry. The models stay in the batch so it can be built again
+void CStaticBatch::ReleaseResources()
+{
+	SAFE_RELEASE( m_IndexBuffer );
+	SAFE_RELEASE( m_VertexBuffer );
+	SAFE_RELEASE( m_VertexLayout );
+	m_NumIndices = 0;
+	m_MatrixVersions.clear();
+}
+
+
+/////////////////////////////
+// Building
+
+// Add a model to the batch - it must be static and have system memory geometry. Call before Build
+void CStaticBatch::AddModel( CModel* model )
+{
+	if (!model->IsStatic() || model->GetCPUIndices().empty() || Contains( model )) return;
+	m_Models.push_back( model );
+}
+
+// Merge the models added into the batch's buffers. Each model's vertices are transformed by its world matrix, its normals by the
+// same matrix and renormalised (correct for rotations and uniform scales, which is all the models use). Models without normals or
+// UVs get zeros, techniques that use them shouldn't be batched with such models
+bool CStaticBatch::Build()
+{
+	ReleaseResources();
+	if (m_Models.empty()) return false;
+
+	vector<SVertex> vertices;
+	vector<unsigned int> indices;
+	for (unsigned int m = 0; m < m_Models.size(); ++m)
+	{
+		CModel* model = m_Models[m];
+		D3DXMATRIX worldMatrix = model->GetWorldMatrix();
+		const vector<D3DXVECTOR3>& positions = model->GetCPUVertices();
+		const vector<D3DXVECTOR3>& normals = model->GetCPUNormals();
+		const vector<D3DXVECTOR2>& uvs = model->GetCPUUVs();
+		const vector<unsigned short>& modelIndices = model->GetCPUIndices();
+
+		unsigned int firstVertex = static_cast<unsigned int>(vertices.size());
+		for (unsigned int v = 0; v < positions.size(); ++v)
+		{
+			SVertex vertex;
+			D3DXVec3TransformCoord( &vertex.position, &positions[v], &worldMatrix );
+			vertex.normal = D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+			if (!normals.empty())
+			{
+				D3DXVec3TransformNormal( &vertex.normal, &normals[v], &worldMatrix );
+				D3DXVec3Normalize( &vertex.normal, &vertex.normal );
+			}
+			vertex.uv = uvs.empty() ? D3DXVECTOR2( 0.0f, 0.0f ) : uvs[v];
+			vertices.push_back( vertex );
+		}
+		for (unsigned int i = 0; i < modelIndices.size(); ++i)
+		{
+			indices.push_back( firstVertex + modelIndices[i] );
+		}
+		m_MatrixVersions.push_back( model->GetMatrixVersion() );
+	}
+
+	// Vertex layout matching VS_BASIC_INPUT in the shader file
+	D3D10_INPUT_ELEMENT_DESC vertexElts[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0,  D3D10_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT,    0, 24, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+	};
+	D3D10_PASS_DESC PassDesc;
+	m_Technique->GetPassByIndex( 0 )->GetDesc( &PassDesc );
+	if (FAILED( g_pd3dDevice->CreateInputLayout( vertexElts, 3, PassDesc.pIAInputSignature, PassDesc.IAInputSignatureSize, &m_VertexLayout )))
+	{
+		return false;
+	}
+
+	D3D10_BUFFER_DESC bufferDesc;
+	bufferDesc.BindFlags = D3D10_BIND_VERTEX_BUFFER;
+	bufferDesc.Usage = D3D10_USAGE_IMMUTABLE; // Never changes - the batch is rebuilt instead
+	bufferDesc.ByteWidth = static_cast<UINT>(vertices.size() * sizeof(SVertex));
+	bufferDesc.CPUAccessFlags = 0;
+	bufferDesc.MiscFlags = 0;
+	D3D10_SUBRESOURCE_DATA initData;
+	initData.pSysMem = &vertices[0];
+	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, &initData, &m_VertexBuffer )))
+	{
+		return false;
+	}
+
+	bufferDesc.BindFlags = D3D10_BIND_INDEX_BUFFER;
+	bufferDesc.ByteWidth = static_cast<UINT>(indices.size() * sizeof(unsigned int));
+	initData.pSysMem = &indices[0];
+	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, &initData, &m_IndexBuffer )))
+	{
+		return false;
+	}
+	m_NumIndices = static_cast<unsigned int>(indices.size());
+	return true;
+}
+
+
+/////////////////////////////
+// Data access
+
+// Is the model one of those in the batch
+bool CStaticBatch::Contains( CModel* model )
+{
+	for (unsigned int m = 0; m < m_Models.size(); ++m)
+	{
+		if (m_Models[m] == model) return true;
+	}
+	return false;
+}
+
+// Has the batch been built, and are all its models still static and in the place they were when it was built
+bool CStaticBatch::IsValid()
+{
+	if (m_NumIndices == 0) return false;
+	for (unsigned int m = 0; m < m_Models.size(); ++m)
+	{
+		if (!m_Models[m]->IsStatic() || m_Models[m]->GetMatrixVersion() != m_MatrixVersions[m]) return false;
+	}
+	return true;
+}
+
+
+/////////////////////////////
+// Usage
+
+// Draw the whole batch with its technique
+void CStaticBatch::Render()
+{
+	UINT vertexSize = sizeof(SVertex);
+	UINT offset = 0;
+	g_pd3dDevice->IASetVertexBuffers( 0, 1, &m_VertexBuffer, &vertexSize, &offset );
+	g_pd3dDevice->IASetIndexBuffer( m_IndexBuffer, DXGI_FORMAT_R32_UINT, 0 );
+	g_pd3dDevice->IASetInputLayout( m_VertexLayout );
+	g_pd3dDevice->IASetPrimitiveTopology( D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
+	CGeometryPool::ForgetBinding(); // The geometry pools' buffers are no longer bound
+
+	CModel::SetFullVertexDecode();
+
+	D3D10_TECHNIQUE_DESC techDesc;
+	m_Technique->GetDesc( &techDesc );
+	for (UINT p = 0; p < techDesc.Passes; ++p)
+	{
+		m_Technique->GetPassByIndex( p )->Apply( 0 );
+		g_pd3dDevice->DrawIndexed( m_NumIndices, 0, 0 );
+	}
+	CModel::AddDrawCalls( techDesc.Passes );
+}
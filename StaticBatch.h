@@ -0,0 +1,121 @@
+//--------------------------------------------------------------------------------------
+//	StaticBatch.h
+//
+//	Merges the geometry of several static models into one vertex and index buffer, so
+//	they can be drawn with a single draw call
+//--------------------------------------------------------------------------------------
+
+#ifndef STATIC_BATCH_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define STATIC_BATCH_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+#include <d3d10.h>
+#include <d3dx10.h>
+
+class CModel;
+
+
+// A batch holds models that are drawn with the same technique and texture. Their vertices are transformed into world space when
+// the batch is built, so the batch is drawn with an identity world matrix and needs no per-model shader settings. The models'
+// full detail geometry (LOD 0) is used, taken from their system memory copies. Vertices are stored in full with position,
+// normal and UV, so the batch can be drawn with any technique whose vertex shader takes VS_BASIC_INPUT.
+// A batch only stays correct while its models stay where they were when it was built - if one of them moves or stops being
+// static the batch becomes invalid (IsValid) and the models should be drawn individually again
+class CStaticBatch
+{
+/////////////////////////////
+// Private member variables
+private:
+
+	// What the models in the batch share
+	ID3D10EffectTechnique*     m_Technique;
+	ID3D10ShaderResourceView*  m_Texture;
+
+	// Models in the batch and their matrix versions (CModel::GetMatrixVersion) when the batch was built
+	vector<CModel*>            m_Models;
+	vector<unsigned int>       m_MatrixVersions;
+
+	// Merged geometry. Indices are 32-bit as the batch may have more vertices than 16-bit indices can reach
+	ID3D10Buffer*              m_VertexBuffer;
+	ID3D10Buffer*              m_IndexBuffer;
+	ID3D10InputLayout*         m_VertexLayout;
+	unsigned int               m_NumIndices;
+
+	struct SVertex
+	{
+		D3DXVECTOR3 position;
+		D3DXVECTOR3 normal;
+		D3DXVECTOR2 uv;
+	};
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	// Constructor - takes the technique and texture shared by the models in the batch. The technique is used to create the
+	// vertex layout, the texture is only used to match models to batches (the caller sets it before rendering)
+	CStaticBatch( ID3D10EffectTechnique* technique, ID3D10ShaderResourceView* texture );
+
+	// Destructor
+	~CStaticBatch();
+
+	// Release the merged geometry. The models stay in the batch so it can be built again
+	void ReleaseResources();
+
+
+	/////////////////////////////
+	// Building
+
+	// Add a model to the batch - it must be static and have system memory geometry. Call before Build
+	void AddModel( CModel* model );
+
+	// Merge the models added into the batch's buffers, using their current world matrices. Returns false on failure
+	bool Build();
+
+
+	/////////////////////////////
+	// Data access
+
+	ID3D10EffectTechnique* GetTechnique()
+	{
+		return m_Technique;
+	}
+	ID3D10ShaderResourceView* GetTexture()
+	{
+		return m_Texture;
+	}
+	int GetNumModels()
+	{
+		return static_cast<int>(m_Models.size());
+	}
+	CModel* GetModel( int model )
+	{
+		return m_Models[model];
+	}
+	int GetNumTriangles()
+	{
+		return m_NumIndices / 3;
+	}
+
+	// Is the model one of those in the batch
+	bool Contains( CModel* model );
+
+	// Has the batch been built, and are all its models still static and in the place they were when it was built
+	bool IsValid();
+
+
+	/////////////////////////////
+	// Usage
+
+	// Draw the whole batch with its technique. The world matrix must be set to identity first, and the texture if the technique uses one
+	void Render();
+};
+
+
+#endif // End of header guard - see top of file
@@ -0,0 +1,162 @@
+//--------------------------------------------------------------------------------------
+//	BoundingVolumeTreeTests.cpp
+//
+//	Tests that CBoundingVolumeTree's queries find exactly the objects that testing every
+//	object's box would, as objects are added, moved and removed, and that the tree stays
+//	balanced
+//--------------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "Test.h"
+#include "BoundingVolumeTree.h"
+
+
+static float RandomFloat( float min, float max )
+{
+	return min + (max - min) * rand() / static_cast<float>(RAND_MAX);
+}
+
+// Does a box overlap a sphere
+static bool BoxOverlapsSphere( const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds, const D3DXVECTOR3& centre, float radius )
+{
+	D3DXVECTOR3 closest( max( minBounds.x, min( centre.x, maxBounds.x ) ), max( minBounds.y, min( centre.y, maxBounds.y ) ),
+	                     max( minBounds.z, min( centre.z, maxBounds.z ) ) );
+	D3DXVECTOR3 offset = closest - centre;
+	return D3DXVec3LengthSq( &offset ) <= radius * radius;
+}
+
+// Objects in the test - each is given its index as user data
+struct STestObjects
+{
+	CBoundingVolumeTree tree;
+	vector<int>         proxies; // -1 for removed objects
+};
+
+// Add an object with a random box from 1 to 5 units across within the cube (-100, -100, -100) to (100, 100, 100)
+static void AddRandomObject( STestObjects& objects )
+{
+	D3DXVECTOR3 centre( RandomFloat( -100.0f, 100.0f ), RandomFloat( -100.0f, 100.0f ), RandomFloat( -100.0f, 100.0f ) );
+	D3DXVECTOR3 halfSize( RandomFloat( 0.5f, 2.5f ), RandomFloat( 0.5f, 2.5f ), RandomFloat( 0.5f, 2.5f ) );
+	size_t index = objects.proxies.size();
+	objects.proxies.push_back( objects.tree.CreateProxy( centre - halfSize, centre + halfSize, reinterpret_cast<void*>(index) ) );
+}
+
+// Sort the objects found by a query, so the order they were found doesn't matter
+static vector<void*> Sorted( vector<void*> found )
+{
+	sort( found.begin(), found.end() );
+	return found;
+}
+
+// Make frustum, ray and sphere queries from random points, and compare the objects found with those found by testing every
+// object's fattened box (the boxes the tree tests). Returns the number of queries that matched, and adds up the objects found
+static int CountMatchingQueries( const STestObjects& objects, int numQueries, int& numFound )
+{
+	D3DXMATRIX projMatrix;
+	D3DXMatrixPerspectiveFovLH( &projMatrix, D3DX_PI / 3, 1.0f, 1.0f, 80.0f );
+
+	int numMatching = 0;
+	for (int q = 0; q < numQueries; ++q)
+	{
+		// Camera facing along z, so the view matrix is just a translation
+		D3DXVECTOR3 position( RandomFloat( -100.0f, 100.0f ), RandomFloat( -100.0f, 100.0f ), RandomFloat( -100.0f, 0.0f ) );
+		D3DXMATRIX viewMatrix;
+		D3DXMatrixIdentity( &viewMatrix );
+		viewMatrix._41 = -position.x;
+		viewMatrix._42 = -position.y;
+		viewMatrix._43 = -position.z;
+		CFrustum frustum;
+		frustum.ExtractFromMatrix( viewMatrix * projMatrix );
+
+		D3DXVECTOR3 direction( RandomFloat( -1.0f, 1.0f ), RandomFloat( -1.0f, 1.0f ), 1.0f );
+		float radius = RandomFloat( 1.0f, 30.0f );
+
+		vector<void*> frustumFound, rayFound, sphereFound;
+		objects.tree.QueryFrustum( frustum, frustumFound );
+		objects.tree.QueryRay( position, direction, 150.0f, rayFound );
+		objects.tree.QuerySphere( position, radius, sphereFound );
+
+		vector<void*> frustumExpected, rayExpected, sphereExpected;
+		for (size_t i = 0; i < objects.proxies.size(); ++i)
+		{
+			if (objects.proxies[i] < 0) continue;
+			D3DXVECTOR3 minBounds, maxBounds;
+			objects.tree.GetFatBounds( objects.proxies[i], &minBounds, &maxBounds );
+			void* userData = reinterpret_cast<void*>(i);
+			if (frustum.ClassifyBox( minBounds, maxBounds ) != Frustum_Outside) frustumExpected.push_back( userData );
+			if (RayIntersectsBox( position, direction, 150.0f, minBounds, maxBounds, 0 )) rayExpected.push_back( userData );
+			if (BoxOverlapsSphere( minBounds, maxBounds, position, radius )) sphereExpected.push_back( userData );
+		}
+
+		if (Sorted( frustumFound ) == frustumExpected && Sorted( rayFound ) == rayExpected && Sorted( sphereFound ) == sphereExpected)
+		{
+			++numMatching;
+		}
+		numFound += static_cast<int>(frustumFound.size() + rayFound.size() + sphereFound.size());
+	}
+	return numMatching;
+}
+
+
+// Queries find the same objects as brute force after adding objects, after moving them (some within their fattened boxes, some
+// far enough to be reinserted) and after removing some
+TEST( BoundingVolumeTree_QueriesMatchBruteForce )
+{
+	const int NumObjects = 2000;
+	const int NumQueries = 200;
+	srand( 1 );
+	STestObjects objects;
+	for (int i = 0; i < NumObjects; ++i)
+	{
+		AddRandomObject( objects );
+	}
+	CHECK( objects.tree.GetNumProxies() == NumObjects );
+	int numFound = 0;
+	CHECK( CountMatchingQueries( objects, NumQueries, numFound ) == NumQueries );
+	CHECK( numFound > NumQueries ); // Queries find something
+
+	int numReinserted = 0;
+	for (int i = 0; i < NumObjects; ++i)
+	{
+		D3DXVECTOR3 minBounds, maxBounds;
+		objects.tree.GetFatBounds( objects.proxies[i], &minBounds, &maxBounds );
+		D3DXVECTOR3 displacement( RandomFloat( -3.0f, 3.0f ), RandomFloat( -3.0f, 3.0f ), RandomFloat( -3.0f, 3.0f ) );
+		D3DXVECTOR3 margin( 1.0f, 1.0f, 1.0f ); // The default margin
+		if (objects.tree.MoveProxy( objects.proxies[i], minBounds + margin + displacement, maxBounds - margin + displacement, displacement ))
+		{
+			++numReinserted;
+		}
+	}
+	CHECK( numReinserted > 0 && numReinserted < NumObjects );
+	CHECK( CountMatchingQueries( objects, NumQueries, numFound ) == NumQueries );
+
+	for (int i = 0; i < NumObjects; i += 3)
+	{
+		objects.tree.DestroyProxy( objects.proxies[i] );
+		objects.proxies[i] = -1;
+	}
+	for (int i = 0; i < 500; ++i)
+	{
+		AddRandomObject( objects );
+	}
+	CHECK( objects.tree.GetNumProxies() == NumObjects - (NumObjects + 2) / 3 + 500 );
+	CHECK( CountMatchingQueries( objects, NumQueries, numFound ) == NumQueries );
+}
+
+// Objects added in order along a line, which would make a chain without balancing, still give a tree of about log2 of their
+// number in height
+TEST( BoundingVolumeTree_StaysBalanced )
+{
+	const int NumObjects = 4096;
+	CBoundingVolumeTree tree;
+	for (int i = 0; i < NumObjects; ++i)
+	{
+		D3DXVECTOR3 minBounds( i * 10.0f, 0.0f, 0.0f );
+		tree.CreateProxy( minBounds, minBounds + D3DXVECTOR3( 1.0f, 1.0f, 1.0f ), 0 );
+	}
+	CHECK( tree.GetHeight() >= 12 );
+	CHECK( tree.GetHeight() <= 24 );
+}
@@ -0,0 +1,50 @@
+//--------------------------------------------------------------------------------------
+//	GPUTimerTests.cpp
+//
+//	Tests that CGPUTimer without a device still counts passes and reports them with zero
+//	time, so the code reading the timings works the same without a GPU
+//--------------------------------------------------------------------------------------
+
+#include <cstring>
+
+#include "Test.h"
+#include "GPUTimer.h"
+
+
+// Frames with repeated passes, one given by a different copy of its name. Timings come back in the order the passes were first seen,
+// with zero time and the calls averaged per frame. Reading the timings resets the totals
+TEST( GPUTimer_CountsPassesWithoutDevice )
+{
+	const int NumFrames = 4;
+	char sceneName[] = "Scene"; // Not the same pointer as the literal below
+
+	CGPUTimer timer;
+	CHECK( !timer.Create() ); // No device in the tests
+	timer.BeginPass( "Outside a frame" ); // Ignored
+	for (int frame = 0; frame < NumFrames; ++frame)
+	{
+		timer.BeginFrame();
+		timer.BeginPass( "Scene" );
+		timer.EndPass();
+		timer.BeginPass( "Shadows" );
+		timer.BeginPass( sceneName ); // Ends the shadows pass
+		timer.EndFrame();
+	}
+
+	vector<SProfileTiming> timings;
+	timer.GetTimings( timings );
+	CHECK( timings.size() == 2 );
+	if (timings.size() == 2)
+	{
+		CHECK( strcmp( timings[0].name, "Scene" ) == 0 && timings[0].time == 0.0f && timings[0].calls == 2.0f );
+		CHECK( strcmp( timings[1].name, "Shadows" ) == 0 && timings[1].time == 0.0f && timings[1].calls == 1.0f );
+	}
+	CHECK( timer.GetDroppedFrames() == 0 );
+
+	timer.GetTimings( timings );
+	CHECK( timings.size() == 2 );
+	if (timings.size() == 2)
+	{
+		CHECK( timings[0].calls == 0.0f && timings[1].calls == 0.0f );
+	}
+}
@@ -0,0 +1,139 @@
+//--------------------------------------------------------------------------------------
+//	LightAnimatorTests.cpp
+//
+//	Tests that CLightAnimator's batched animations give exactly the same colours and
+//	positions as animating each CLight on its own
+//--------------------------------------------------------------------------------------
+
+#include <cstring>
+#include <cmath>
+
+#include "Test.h"
+#include "Light.h"
+#include "LightAnimator.h"
+
+
+// Bit for bit comparison, as the animator promises identical results rather than close ones
+static bool Identical( const D3DXVECTOR3& a, const D3DXVECTOR3& b )
+{
+	return memcmp( &a, &b, sizeof(D3DXVECTOR3) ) == 0;
+}
+
+
+// Pulsing and cycling colours match CLight::Pulsate and CLight::ChangeColour on every frame, through all the states. The number of
+// lights is not a multiple of four, so the padding of the last batch is included
+TEST( LightAnimator_ColoursMatchLights )
+{
+	const D3DXVECTOR3 MinColour( 0.0f, 0.0f, 0.0f );
+	const D3DXVECTOR3 MaxColour( 5.0f, 0.0f, 3.5f );
+	const int NumLights = 11;
+	const int NumFrames = 2000;
+
+	CLight lights[NumLights];
+	CLightAnimator animator;
+	int colours[NumLights];
+	for (int light = 0; light < NumLights; ++light)
+	{
+		D3DXVECTOR3 colour( 0.4f * light, 5.0f - 0.3f * light, 0.25f * light );
+		lights[light].SetColour( colour );
+		if (light % 3 == 0)
+		{
+			colours[light] = animator.AddPulse( colour, MinColour, MaxColour );
+		}
+		else
+		{
+			colours[light] = animator.AddCycle( colour, (light % 3 == 1) ? 1.0f : 2.0f );
+		}
+	}
+
+	int firstDifference = -1;
+	for (int frame = 0; frame < NumFrames && firstDifference < 0; ++frame)
+	{
+		float frameTime = 0.005f + 0.001f * (frame % 37); // Uneven frame times
+		float colourUpdateSpeed = 5.0f * frameTime;
+		animator.Update( colourUpdateSpeed, frameTime );
+		for (int light = 0; light < NumLights; ++light)
+		{
+			switch (light % 3)
+			{
+			case 0:
+				lights[light].Pulsate( MinColour, MaxColour, colourUpdateSpeed );
+				break;
+			case 1:
+				lights[light].ChangeColour( colourUpdateSpeed );
+				break;
+			default:
+				lights[light].ChangeColour( colourUpdateSpeed * 2 );
+				break;
+			}
+
+			D3DXVECTOR3 colour = (light % 3 == 0) ? animator.GetPulseColour( colours[light] ) : animator.GetCycleColour( colours[light] );
+			if (!Identical( colour, lights[light].GetColour() ))
+			{
+				firstDifference = frame;
+			}
+		}
+	}
+	CHECK( firstDifference == -1 );
+}
+
+// Orbit positions match CLight::OrbitAround on every frame, including when the centre moves between frames
+TEST( LightAnimator_OrbitsMatchLights )
+{
+	const float OrbitHeight = 5.0f; // As used by CLight::OrbitAround
+	const int NumLights = 6;
+	const int NumFrames = 500;
+
+	CModel centres[2];
+	centres[0].SetPosition( D3DXVECTOR3( 10.0f, 0.0f, -20.0f ) );
+	centres[1].SetPosition( D3DXVECTOR3( -35.0f, 2.0f, 50.0f ) );
+
+	CLight lights[NumLights];
+	CLightAnimator animator;
+	int orbits[NumLights];
+	for (int light = 0; light < NumLights; ++light)
+	{
+		orbits[light] = animator.AddOrbit( centres[light % 2].GetPosition(), lights[light].GetOrbitRadius(), OrbitHeight,
+		                                   lights[light].GetOrbitSpeed() );
+	}
+
+	int firstDifference = -1;
+	for (int frame = 0; frame < NumFrames && firstDifference < 0; ++frame)
+	{
+		float frameTime = 0.005f + 0.001f * (frame % 23);
+
+		// The first centre moves every frame, as a light following a model would
+		centres[0].SetPosition( centres[0].GetPosition() + D3DXVECTOR3( 0.1f, 0.0f, 0.05f ) );
+		for (int light = 0; light < NumLights; light += 2)
+		{
+			animator.SetOrbitCentre( orbits[light], centres[0].GetPosition() );
+		}
+
+		animator.Update( 0.0f, frameTime );
+		for (int light = 0; light < NumLights; ++light)
+		{
+			lights[light].OrbitAround( &centres[light % 2], frameTime );
+			if (!Identical( animator.GetOrbitPosition( orbits[light] ), lights[light].GetPosition() ))
+			{
+				firstDifference = frame;
+			}
+		}
+	}
+	CHECK( firstDifference == -1 );
+}
+
+// The blended orbit position runs from the previous update's position to the last one's
+TEST( LightAnimator_OrbitBlend )
+{
+	CLightAnimator animator;
+	int orbit = animator.AddOrbit( D3DXVECTOR3( 0.0f, 0.0f, 0.0f ), 15.0f, 5.0f, 0.7f );
+	animator.Update( 0.0f, 0.1f );
+	D3DXVECTOR3 previous = animator.GetOrbitPosition( orbit );
+	animator.Update( 0.0f, 0.1f );
+	D3DXVECTOR3 last = animator.GetOrbitPosition( orbit );
+
+	CHECK( !Identical( previous, last ) );
+	CHECK( Identical( animator.GetOrbitPosition( orbit, 0.0f ), previous ) );
+	D3DXVECTOR3 blended = animator.GetOrbitPosition( orbit, 1.0f ); // Rounding may differ from the last position in the final bit
+	CHECK( fabs( blended.x - last.x ) < 0.0001f && fabs( blended.y - last.y ) < 0.0001f && fabs( blended.z - last.z ) < 0.0001f );
+}
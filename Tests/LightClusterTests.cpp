@@ -0,0 +1,182 @@
+//--------------------------------------------------------------------------------------
+//	LightClusterTests.cpp
+//
+//	Tests of CLightClusterGrid's light lists - point and spot lights reach the clusters
+//	they should, and the same lights always give the same lists
+//--------------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <cmath>
+
+#include "Test.h"
+#include "Defines.h"
+#include "JobSystem.h"
+#include "LightClusters.h"
+
+
+// 256x256 viewport (4x4 tiles) with a 90 degree field of view, so a view space point (x, y, z) is at ndc (x / z, y / z). The camera
+// is at the origin facing along z
+static void SetTestView( CLightClusterGrid& grid )
+{
+	D3DXMATRIX viewMatrix, projMatrix;
+	D3DXMatrixIdentity( &viewMatrix );
+	D3DXMatrixPerspectiveFovLH( &projMatrix, D3DX_PI / 2, 1.0f, 1.0f, 1000.0f );
+	grid.SetView( viewMatrix, projMatrix, 1.0f, 1000.0f, 256, 256 );
+}
+
+static int ClusterIndex( const CLightClusterGrid& grid, int slice, int tileX, int tileY )
+{
+	return (slice * grid.GetTilesY() + tileY) * grid.GetTilesX() + tileX;
+}
+
+// Is the given light in the given cluster's list
+static bool ListsLight( const CLightClusterGrid& grid, int cluster, unsigned short light )
+{
+	const SClusterRange& range = grid.GetClusterRanges()[cluster];
+	for (UINT i = range.start; i < range.start + range.count; ++i)
+	{
+		if (grid.GetLightIndices()[i] == light) return true;
+	}
+	return false;
+}
+
+static SLightSource PointLight( const D3DXVECTOR3& position, float range )
+{
+	SLightSource light;
+	light.position = position;
+	light.colour = D3DXVECTOR3( 1.0f, 1.0f, 1.0f );
+	light.range = range;
+	light.facing = D3DXVECTOR3( 0.0f, 0.0f, 1.0f );
+	light.cosHalfAngle = -2.0f;
+	light.shadow = -1;
+	return light;
+}
+
+
+// Small point lights are listed in the clusters around them and nowhere else
+TEST( LightClusters_PointLightsReachNearbyClusters )
+{
+	CLightClusterGrid grid;
+	SetTestView( grid );
+	SLightSource lights[2] =
+	{
+		PointLight( D3DXVECTOR3( -15.0f, 15.0f, 20.0f ), 2.0f ), // ndc (-0.75, 0.75) - top left tile
+		PointLight( D3DXVECTOR3( 50.0f, -50.0f, 500.0f ), 1.0f ) // ndc (0.1, -0.1) - tile (2, 2)
+	};
+	grid.Build( lights, 2 );
+	CHECK( grid.GetTilesX() == 4 && grid.GetTilesY() == 4 );
+
+	int nearCluster = ClusterIndex( grid, grid.GetSlice( 20.0f ), 0, 0 );
+	int farCluster = ClusterIndex( grid, grid.GetSlice( 500.0f ), 2, 2 );
+	CHECK( ListsLight( grid, nearCluster, 0 ) );
+	CHECK( !ListsLight( grid, nearCluster, 1 ) );
+	CHECK( ListsLight( grid, farCluster, 1 ) );
+	CHECK( !ListsLight( grid, farCluster, 0 ) );
+	CHECK( !ListsLight( grid, ClusterIndex( grid, grid.GetSlice( 20.0f ), 3, 3 ), 0 ) );
+
+	// Every cluster listing a light is within the slices its sphere reaches
+	int numListed[2] = { 0, 0 };
+	for (int cluster = 0; cluster < grid.GetNumClusters(); ++cluster)
+	{
+		int slice = cluster / (grid.GetTilesX() * grid.GetTilesY());
+		for (unsigned short light = 0; light < 2; ++light)
+		{
+			if (!ListsLight( grid, cluster, light )) continue;
+			++numListed[light];
+			CHECK( slice >= grid.GetSlice( lights[light].position.z - lights[light].range ) &&
+			       slice <= grid.GetSlice( lights[light].position.z + lights[light].range ) );
+		}
+	}
+	CHECK( numListed[0] > 0 && numListed[0] < 8 );
+	CHECK( numListed[1] > 0 && numListed[1] < 8 );
+}
+
+// A spot light is only listed in clusters its cone reaches, where a point light with the same position and range reaches the
+// clusters all around it
+TEST( LightClusters_SpotLightsSkipClustersOutsideCone )
+{
+	CLightClusterGrid grid;
+	SetTestView( grid );
+	SLightSource lights[2] =
+	{
+		PointLight( D3DXVECTOR3( 0.0f, 0.0f, 20.0f ), 200.0f ),
+		PointLight( D3DXVECTOR3( 0.0f, 0.0f, 20.0f ), 200.0f )
+	};
+	lights[0].cosHalfAngle = cosf( 20.0f * D3DX_PI / 180.0f ); // Spot light facing away from the camera
+	grid.Build( lights, 2 );
+
+	// Ahead of the light, near the axis and off to the side
+	int ahead = grid.GetSlice( 100.0f );
+	CHECK( ListsLight( grid, ClusterIndex( grid, ahead, 1, 1 ), 0 ) );
+	CHECK( ListsLight( grid, ClusterIndex( grid, ahead, 1, 1 ), 1 ) );
+	CHECK( !ListsLight( grid, ClusterIndex( grid, ahead, 0, 0 ), 0 ) );
+	CHECK( ListsLight( grid, ClusterIndex( grid, ahead, 0, 0 ), 1 ) );
+
+	// Behind the light
+	int behind = grid.GetSlice( 5.0f );
+	CHECK( !ListsLight( grid, ClusterIndex( grid, behind, 0, 0 ), 0 ) );
+	CHECK( ListsLight( grid, ClusterIndex( grid, behind, 0, 0 ), 1 ) );
+
+	// The spot light's clusters are a subset of the point light's
+	int numSpot = 0, numPoint = 0;
+	for (int cluster = 0; cluster < grid.GetNumClusters(); ++cluster)
+	{
+		bool spot = ListsLight( grid, cluster, 0 );
+		bool point = ListsLight( grid, cluster, 1 );
+		CHECK( !spot || point );
+		numSpot += spot ? 1 : 0;
+		numPoint += point ? 1 : 0;
+	}
+	CHECK( numSpot > 0 && numSpot < numPoint );
+}
+
+// Building again, in a new grid or sharing the slices over several threads gives exactly the same lists
+TEST( LightClusters_RepeatBuildsMatch )
+{
+	const unsigned int NumLights = 300;
+	srand( 1 );
+	SLightSource lights[NumLights];
+	for (unsigned int light = 0; light < NumLights; ++light)
+	{
+		float x = (rand() % 2001 - 1000) * 0.2f;
+		float y = (rand() % 2001 - 1000) * 0.2f;
+		float z = (rand() % 1001) * 0.5f;
+		lights[light] = PointLight( D3DXVECTOR3( x, y, z ), 5.0f + (rand() % 100) * 0.3f );
+		if (light % 4 == 0)
+		{
+			D3DXVECTOR3 facing( (rand() % 201 - 100) * 0.01f, -1.0f, (rand() % 201 - 100) * 0.01f );
+			D3DXVec3Normalize( &lights[light].facing, &facing );
+			lights[light].cosHalfAngle = cosf( 30.0f * D3DX_PI / 180.0f );
+		}
+	}
+
+	CLightClusterGrid grid;
+	SetTestView( grid );
+	grid.Build( lights, NumLights );
+	vector<SClusterRange> firstRanges = grid.GetClusterRanges();
+	vector<unsigned short> firstIndices = grid.GetLightIndices();
+	CHECK( !firstIndices.empty() );
+
+	grid.Build( lights, NumLights );
+	CHECK( grid.GetLightIndices() == firstIndices );
+
+	CJobSystem* savedJobSystem = g_JobSystem;
+	g_JobSystem = new CJobSystem( 4 );
+	CLightClusterGrid threadedGrid;
+	SetTestView( threadedGrid );
+	threadedGrid.Build( lights, NumLights );
+	delete g_JobSystem;
+	g_JobSystem = savedJobSystem;
+	CHECK( threadedGrid.GetLightIndices() == firstIndices );
+
+	bool sameRanges = (grid.GetClusterRanges().size() == firstRanges.size() &&
+	                   threadedGrid.GetClusterRanges().size() == firstRanges.size());
+	for (size_t cluster = 0; sameRanges && cluster < firstRanges.size(); ++cluster)
+	{
+		sameRanges = grid.GetClusterRanges()[cluster].start == firstRanges[cluster].start &&
+		             grid.GetClusterRanges()[cluster].count == firstRanges[cluster].count &&
+		             threadedGrid.GetClusterRanges()[cluster].start == firstRanges[cluster].start &&
+		             threadedGrid.GetClusterRanges()[cluster].count == firstRanges[cluster].count;
+	}
+	CHECK( sameRanges );
+}
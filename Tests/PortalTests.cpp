@@ -0,0 +1,128 @@
+//--------------------------------------------------------------------------------------
+//	PortalTests.cpp
+//
+//	Tests of the portal maths - clipping a portal quad to the near plane and a rectangle
+//	of the view, and the frustum of the part of a view within a rectangle
+//--------------------------------------------------------------------------------------
+
+#include <cmath>
+
+#include "Test.h"
+#include "Portal.h"
+
+
+// Camera at the origin facing along z with a 90 degree field of view, so a point (x, y, z) in front of the camera is at (x / z, y / z)
+// in the view. The near clip is at z = 1
+static D3DXMATRIX TestViewProj()
+{
+	D3DXMATRIX projMatrix;
+	D3DXMatrixPerspectiveFovLH( &projMatrix, D3DX_PI / 2, 1.0f, 1.0f, 1000.0f );
+	return projMatrix;
+}
+
+static bool RectNear( const SPortalRect& rect, float minX, float minY, float maxX, float maxY )
+{
+	const float Tolerance = 0.001f;
+	return fabsf( rect.minX - minX ) < Tolerance && fabsf( rect.minY - minY ) < Tolerance &&
+	       fabsf( rect.maxX - maxX ) < Tolerance && fabsf( rect.maxY - maxY ) < Tolerance;
+}
+
+// Texture coordinates of a quad's corners, starting top-left and going clockwise as seen from the camera
+static const D3DXVECTOR2 QuadUVs[4] =
+{
+	D3DXVECTOR2( 0.0f, 0.0f ), D3DXVECTOR2( 1.0f, 0.0f ), D3DXVECTOR2( 1.0f, 1.0f ), D3DXVECTOR2( 0.0f, 1.0f )
+};
+
+
+// A quad facing the camera gives the screen rect it covers and the part of its texture seen, cut down to the view rectangle
+TEST( Portal_ScreenRectOfQuad )
+{
+	D3DXMATRIX viewProj = TestViewProj();
+	SPortalRect screenRect, uvRect;
+
+	// Wholly in view
+	const D3DXVECTOR3 quad[4] =
+	{
+		D3DXVECTOR3( -5.0f, 5.0f, 10.0f ), D3DXVECTOR3( 5.0f, 5.0f, 10.0f ), D3DXVECTOR3( 5.0f, -5.0f, 10.0f ), D3DXVECTOR3( -5.0f, -5.0f, 10.0f )
+	};
+	CHECK( ClipPortalToView( quad, QuadUVs, viewProj, FullViewRect, screenRect, uvRect ) );
+	CHECK( RectNear( screenRect, -0.5f, -0.5f, 0.5f, 0.5f ) );
+	CHECK( RectNear( uvRect, 0.0f, 0.0f, 1.0f, 1.0f ) );
+
+	// Half off the right of the view
+	const D3DXVECTOR3 rightQuad[4] =
+	{
+		D3DXVECTOR3( 5.0f, 5.0f, 10.0f ), D3DXVECTOR3( 15.0f, 5.0f, 10.0f ), D3DXVECTOR3( 15.0f, -5.0f, 10.0f ), D3DXVECTOR3( 5.0f, -5.0f, 10.0f )
+	};
+	CHECK( ClipPortalToView( rightQuad, QuadUVs, viewProj, FullViewRect, screenRect, uvRect ) );
+	CHECK( RectNear( screenRect, 0.5f, -0.5f, 1.0f, 0.5f ) );
+	CHECK( RectNear( uvRect, 0.0f, 0.0f, 0.5f, 1.0f ) );
+
+	// Within a smaller rectangle, as when seen through another portal. The part of the texture seen is the same part of the portal
+	// camera's view
+	const SPortalRect viewRect = { -0.25f, 0.0f, 0.5f, 0.5f };
+	CHECK( ClipPortalToView( quad, QuadUVs, viewProj, viewRect, screenRect, uvRect ) );
+	CHECK( RectNear( screenRect, -0.25f, 0.0f, 0.5f, 0.5f ) );
+	CHECK( RectNear( uvRect, 0.25f, 0.0f, 1.0f, 0.5f ) );
+	CHECK( RectNear( PortalUVToViewRect( uvRect ), -0.5f, 0.0f, 1.0f, 1.0f ) );
+
+	// Outside the rectangle
+	CHECK( !ClipPortalToView( rightQuad, QuadUVs, viewProj, viewRect, screenRect, uvRect ) );
+}
+
+// A quad crossing the near plane is cut off there - the part behind the near plane would otherwise project to the wrong place. A quad
+// wholly behind the camera is not seen
+TEST( Portal_ClipsQuadAtNearPlane )
+{
+	D3DXMATRIX viewProj = TestViewProj();
+	SPortalRect screenRect, uvRect;
+
+	// Tilted quad from z = 0.5 (bottom) to z = 3 (top). It crosses the near plane a fifth of the way up, at y = -0.3
+	const D3DXVECTOR3 quad[4] =
+	{
+		D3DXVECTOR3( -0.5f, 0.5f, 3.0f ), D3DXVECTOR3( 0.5f, 0.5f, 3.0f ), D3DXVECTOR3( 0.5f, -0.5f, 0.5f ), D3DXVECTOR3( -0.5f, -0.5f, 0.5f )
+	};
+	CHECK( ClipPortalToView( quad, QuadUVs, viewProj, FullViewRect, screenRect, uvRect ) );
+	CHECK( RectNear( screenRect, -0.5f, -0.3f, 0.5f, 0.5f / 3.0f ) );
+	CHECK( RectNear( uvRect, 0.0f, 0.0f, 1.0f, 0.8f ) );
+
+	const D3DXVECTOR3 behindQuad[4] =
+	{
+		D3DXVECTOR3( -5.0f, 5.0f, -10.0f ), D3DXVECTOR3( 5.0f, 5.0f, -10.0f ), D3DXVECTOR3( 5.0f, -5.0f, -10.0f ), D3DXVECTOR3( -5.0f, -5.0f, -10.0f )
+	};
+	CHECK( !ClipPortalToView( behindQuad, QuadUVs, viewProj, FullViewRect, screenRect, uvRect ) );
+}
+
+// The crop matrix stretches a rectangle to fill the view, and the frustum made with it only contains what is seen in the rectangle
+TEST( Portal_RectFrustumCoversRect )
+{
+	D3DXMATRIX viewProj = TestViewProj();
+	const SPortalRect rect = { -0.25f, 0.0f, 0.5f, 0.5f };
+
+	D3DXMATRIX crop = CalculateRectCropMatrix( rect );
+	D3DXVECTOR4 minCorner, maxCorner;
+	D3DXVECTOR3 rectMin( rect.minX, rect.minY, 0.0f ), rectMax( rect.maxX, rect.maxY, 0.0f );
+	D3DXVec3Transform( &minCorner, &rectMin, &crop );
+	D3DXVec3Transform( &maxCorner, &rectMax, &crop );
+	CHECK( fabsf( minCorner.x + 1.0f ) < 0.001f && fabsf( minCorner.y + 1.0f ) < 0.001f );
+	CHECK( fabsf( maxCorner.x - 1.0f ) < 0.001f && fabsf( maxCorner.y - 1.0f ) < 0.001f );
+
+	// Points at depth 20 across the view, clear of the rectangle's edges
+	CFrustum frustum = CalculateRectFrustum( viewProj, rect );
+	const float Margin = 0.01f;
+	bool allCorrect = true;
+	for (float x = -1.2f; x <= 1.2f; x += 0.05f)
+	{
+		for (float y = -1.2f; y <= 1.2f; y += 0.05f)
+		{
+			bool inside = x > rect.minX + Margin && x < rect.maxX - Margin && y > rect.minY + Margin && y < rect.maxY - Margin;
+			bool outside = x < rect.minX - Margin || x > rect.maxX + Margin || y < rect.minY - Margin || y > rect.maxY + Margin;
+			bool visible = frustum.IsSphereVisible( D3DXVECTOR3( x * 20.0f, y * 20.0f, 20.0f ), 0.0f );
+			if ((inside && !visible) || (outside && visible)) allCorrect = false;
+		}
+	}
+	CHECK( allCorrect );
+
+	CHECK( RectContains( FullViewRect, rect ) );
+	CHECK( !RectContains( rect, FullViewRect ) );
+}
@@ -0,0 +1,174 @@
+//--------------------------------------------------------------------------------------
+//	RangeAllocatorTests.cpp
+//
+//	Tests for CRangeAllocator - best fit, merging of freed ranges, growing and
+//	defragmenting
+//--------------------------------------------------------------------------------------
+
+#include <cmath>
+
+#include "Test.h"
+#include "RangeAllocator.h"
+
+
+// An allocation is placed in the smallest free block it fits in, not the first
+TEST( RangeAllocator_BestFitReusesSmallestBlock )
+{
+	// Leave free blocks of 30 at 0 and 10 at 40, separated by allocations
+	CRangeAllocator allocator( 100 );
+	int a = allocator.Allocate( 30 );
+	int b = allocator.Allocate( 10 );
+	int c = allocator.Allocate( 10 );
+	int d = allocator.Allocate( 50 );
+	allocator.Free( a );
+	allocator.Free( c );
+	CHECK( allocator.GetNumFreeBlocks() == 2 );
+	CHECK( b >= 0 && d >= 0 );
+
+	int e = allocator.Allocate( 8 );
+	CHECK( allocator.GetOffset( e ) == 40 ); // The block of 10, though the block of 30 comes first
+	int f = allocator.Allocate( 25 );
+	CHECK( allocator.GetOffset( f ) == 0 );
+	CHECK( allocator.Allocate( 6 ) == -1 ); // Only 5 + 2 left, in two blocks
+	CHECK( allocator.GetUsed() == 93 );
+}
+
+// A freed range next to a free block before it joins that block
+TEST( RangeAllocator_FreeMergesWithPrevious )
+{
+	CRangeAllocator allocator( 40 );
+	int a = allocator.Allocate( 10 );
+	int b = allocator.Allocate( 10 );
+	allocator.Allocate( 10 );
+	allocator.Allocate( 10 );
+	allocator.Free( a );
+	allocator.Free( b );
+	CHECK( allocator.GetNumFreeBlocks() == 1 );
+	CHECK( allocator.GetLargestFreeBlock() == 20 );
+	CHECK( allocator.GetOffset( allocator.Allocate( 20 ) ) == 0 );
+}
+
+// A freed range next to a free block after it joins that block
+TEST( RangeAllocator_FreeMergesWithNext )
+{
+	CRangeAllocator allocator( 40 );
+	allocator.Allocate( 10 );
+	int b = allocator.Allocate( 10 );
+	int c = allocator.Allocate( 10 );
+	allocator.Allocate( 10 );
+	allocator.Free( c );
+	allocator.Free( b );
+	CHECK( allocator.GetNumFreeBlocks() == 1 );
+	CHECK( allocator.GetLargestFreeBlock() == 20 );
+	CHECK( allocator.GetOffset( allocator.Allocate( 20 ) ) == 10 );
+}
+
+// A freed range between two free blocks joins them into one
+TEST( RangeAllocator_FreeMergesWithBoth )
+{
+	CRangeAllocator allocator( 50 );
+	allocator.Allocate( 10 );
+	int b = allocator.Allocate( 10 );
+	int c = allocator.Allocate( 10 );
+	int d = allocator.Allocate( 10 );
+	allocator.Allocate( 10 );
+	allocator.Free( b );
+	allocator.Free( d );
+	CHECK( allocator.GetNumFreeBlocks() == 2 );
+	allocator.Free( c );
+	CHECK( allocator.GetNumFreeBlocks() == 1 );
+	CHECK( allocator.GetLargestFreeBlock() == 30 );
+	CHECK( allocator.GetUsed() == 20 );
+	CHECK( allocator.GetOffset( allocator.Allocate( 30 ) ) == 10 );
+}
+
+// Growing extends a free block at the end of the space rather than adding another
+TEST( RangeAllocator_GrowExtendsTrailingFreeBlock )
+{
+	CRangeAllocator allocator( 30 );
+	allocator.Allocate( 20 );
+	CHECK( allocator.GetNumFreeBlocks() == 1 );
+	allocator.Grow( 50 );
+	CHECK( allocator.GetCapacity() == 50 );
+	CHECK( allocator.GetNumFreeBlocks() == 1 );
+	CHECK( allocator.GetLargestFreeBlock() == 30 );
+	CHECK( allocator.GetOffset( allocator.Allocate( 30 ) ) == 20 );
+
+	// With the space full, growing adds a new block
+	CHECK( allocator.GetNumFreeBlocks() == 0 );
+	allocator.Grow( 60 );
+	CHECK( allocator.GetNumFreeBlocks() == 1 );
+	CHECK( allocator.GetOffset( allocator.Allocate( 10 ) ) == 50 );
+}
+
+// Defragmenting moves the allocations down in order, listing each move, and leaves one free block at the end. Handles still refer
+// to the same allocations afterwards
+TEST( RangeAllocator_DefragmentMovesAndKeepsHandles )
+{
+	CRangeAllocator allocator( 100 );
+	int a = allocator.Allocate( 10 );
+	int b = allocator.Allocate( 20 );
+	int c = allocator.Allocate( 15 );
+	int d = allocator.Allocate( 25 );
+	int e = allocator.Allocate( 5 );
+	allocator.Free( a );
+	allocator.Free( d );
+
+	vector<CRangeAllocator::SMove> moves;
+	allocator.Defragment( moves );
+
+	CHECK( moves.size() == 3 );
+	if (moves.size() == 3)
+	{
+		CHECK( moves[0].from == 10 && moves[0].to == 0  && moves[0].size == 20 );
+		CHECK( moves[1].from == 30 && moves[1].to == 20 && moves[1].size == 15 );
+		CHECK( moves[2].from == 70 && moves[2].to == 35 && moves[2].size == 5 );
+	}
+
+	CHECK( allocator.GetOffset( b ) == 0  && allocator.GetSize( b ) == 20 );
+	CHECK( allocator.GetOffset( c ) == 20 && allocator.GetSize( c ) == 15 );
+	CHECK( allocator.GetOffset( e ) == 35 && allocator.GetSize( e ) == 5 );
+	CHECK( allocator.GetUsed() == 40 );
+	CHECK( allocator.GetNumFreeBlocks() == 1 );
+	CHECK( allocator.GetLargestFreeBlock() == 60 );
+
+	// Nothing to move a second time
+	allocator.Defragment( moves );
+	CHECK( moves.empty() );
+
+	// Handles freed before defragmenting are reused as normal
+	allocator.Free( c );
+	int f = allocator.Allocate( 15 );
+	CHECK( allocator.GetOffset( f ) == 20 );
+}
+
+// Fragmentation is 0 with the free space in one block (or none), rising as it is split up
+TEST( RangeAllocator_Fragmentation )
+{
+	CRangeAllocator allocator( 100 );
+	CHECK( allocator.GetFragmentation() == 0.0f );
+
+	int a = allocator.Allocate( 25 );
+	allocator.Allocate( 25 );
+	allocator.Allocate( 25 );
+	allocator.Allocate( 25 );
+	CHECK( allocator.GetFragmentation() == 0.0f ); // No free space at all
+
+	allocator.Free( a );
+	CHECK( allocator.GetFragmentation() == 0.0f ); // One free block
+
+	// Two free blocks of 25 and 10: largest 25 of 35 free
+	CRangeAllocator split( 100 );
+	split.Allocate( 40 );
+	int b = split.Allocate( 25 );
+	split.Allocate( 25 );
+	split.Allocate( 10 );
+	split.Free( b );
+	split.Grow( 110 );
+	CHECK( split.GetNumFreeBlocks() == 2 );
+	CHECK( fabs( split.GetFragmentation() - (1.0f - 25.0f / 35.0f) ) < 0.0001f );
+
+	vector<CRangeAllocator::SMove> moves;
+	split.Defragment( moves );
+	CHECK( split.GetFragmentation() == 0.0f );
+}
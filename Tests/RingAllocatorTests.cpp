@@ -0,0 +1,113 @@
+//--------------------------------------------------------------------------------------
+//	RingAllocatorTests.cpp
+//
+//	Tests for CRingAllocator - wrapping at the end of the space, and space held until
+//	its frame's fence is retired
+//--------------------------------------------------------------------------------------
+
+#include "Test.h"
+#include "RingAllocator.h"
+
+
+// Allocations follow each other with the requested alignment
+TEST( RingAllocator_AllocatesInOrderWithAlignment )
+{
+	CRingAllocator allocator( 256 );
+	unsigned int offset;
+	CHECK( allocator.Allocate( 10, 16, offset ) && offset == 0 );
+	CHECK( allocator.Allocate( 10, 16, offset ) && offset == 16 );
+	CHECK( allocator.Allocate( 4, 4, offset ) && offset == 28 );
+	CHECK( allocator.GetUsed() == 32 ); // Including the 6 bytes skipped for alignment
+}
+
+// An allocation that would run past the end of the space starts at the beginning instead, once the beginning has been retired. The
+// skipped bytes at the end are held until the frame that skipped them is retired
+TEST( RingAllocator_WrapsPastTheEnd )
+{
+	CRingAllocator allocator( 100 );
+	unsigned int offset;
+	CHECK( allocator.Allocate( 40, 1, offset ) && offset == 0 );
+	allocator.EndFrame( 1 );
+	CHECK( allocator.Allocate( 40, 1, offset ) && offset == 40 );
+	allocator.EndFrame( 2 );
+	allocator.Retire( 1 );
+	CHECK( allocator.GetUsed() == 40 );
+
+	// 20 bytes left at the end - too few, so the allocation wraps to the start, which frame 1 has freed
+	CHECK( allocator.Allocate( 30, 1, offset ) && offset == 0 );
+	CHECK( allocator.GetUsed() == 40 + 20 + 30 );
+	allocator.EndFrame( 3 );
+
+	// Retiring frame 2 leaves only frame 3 in flight, and frees its skipped bytes with it when it is retired
+	allocator.Retire( 2 );
+	CHECK( allocator.GetUsed() == 50 );
+	CHECK( allocator.Allocate( 50, 1, offset ) && offset == 30 );
+	allocator.EndFrame( 4 );
+	allocator.Retire( 4 );
+	CHECK( allocator.GetUsed() == 0 );
+	CHECK( allocator.GetNumFramesInFlight() == 0 );
+}
+
+// Space allocated by a frame can't be reused until its fence is retired - allocations fail rather than overwriting it
+TEST( RingAllocator_FullUntilFenceRetired )
+{
+	CRingAllocator allocator( 100 );
+	unsigned int offset;
+	CHECK( allocator.Allocate( 60, 1, offset ) );
+	allocator.EndFrame( 1 );
+	CHECK( allocator.Allocate( 30, 1, offset ) && offset == 60 );
+	allocator.EndFrame( 2 );
+
+	// 10 bytes free at the end, and the start is held by frame 1
+	CHECK( !allocator.Allocate( 20, 1, offset ) );
+	CHECK( allocator.GetNumFramesInFlight() == 2 );
+	CHECK( allocator.GetOldestFence() == 1 );
+
+	// Retiring an older fence than any frame's frees nothing
+	allocator.Retire( 0 );
+	CHECK( !allocator.Allocate( 20, 1, offset ) );
+	CHECK( allocator.GetUsed() == 90 );
+
+	// A failed allocation takes no space, so a small one still fits at the end
+	CHECK( allocator.Allocate( 10, 1, offset ) && offset == 90 );
+	CHECK( allocator.GetUsed() == 100 );
+}
+
+// Once a frame's fence is retired its space is used again
+TEST( RingAllocator_ReusesSpaceAfterRetire )
+{
+	CRingAllocator allocator( 100 );
+	unsigned int offset;
+	CHECK( allocator.Allocate( 50, 1, offset ) && offset == 0 );
+	allocator.EndFrame( 1 );
+	CHECK( allocator.Allocate( 50, 1, offset ) && offset == 50 );
+	allocator.EndFrame( 2 );
+	CHECK( !allocator.Allocate( 50, 1, offset ) );
+
+	allocator.Retire( 1 );
+	CHECK( allocator.GetNumFramesInFlight() == 1 );
+	CHECK( allocator.GetOldestFence() == 2 );
+	CHECK( allocator.Allocate( 50, 1, offset ) && offset == 0 );
+	allocator.EndFrame( 3 );
+
+	// Retiring a later fence frees every frame up to it
+	allocator.Retire( 3 );
+	CHECK( allocator.GetUsed() == 0 );
+	CHECK( allocator.Allocate( 100, 1, offset ) && offset == 0 );
+}
+
+// Fences are compared by their difference, so retiring still works when the fence values wrap around
+TEST( RingAllocator_RetireAcrossFenceWrap )
+{
+	CRingAllocator allocator( 100 );
+	unsigned int offset;
+	CHECK( allocator.Allocate( 40, 1, offset ) );
+	allocator.EndFrame( 0xFFFFFFFFu );
+	CHECK( allocator.Allocate( 40, 1, offset ) );
+	allocator.EndFrame( 0 );
+
+	allocator.Retire( 0xFFFFFFFFu );
+	CHECK( allocator.GetUsed() == 40 );
+	allocator.Retire( 0 );
+	CHECK( allocator.GetUsed() == 0 );
+}
@@ -0,0 +1,124 @@
+//--------------------------------------------------------------------------------------
+//	ShadowAtlasTests.cpp
+//
+//	Tests of CShadowAtlas's tile layouts - tiles stay inside the atlas without overlapping,
+//	the least important lights give up space first and layouts are repeatable
+//--------------------------------------------------------------------------------------
+
+#include <cstdlib>
+
+#include "Test.h"
+#include "ShadowAtlas.h"
+
+
+// Do any two of the given tiles overlap
+static bool AnyOverlap( const SShadowAtlasTile* tiles, int numTiles )
+{
+	for (int i = 0; i < numTiles; ++i)
+	{
+		for (int j = i + 1; j < numTiles; ++j)
+		{
+			const SShadowAtlasTile& a = tiles[i];
+			const SShadowAtlasTile& b = tiles[j];
+			if (a.size > 0 && b.size > 0 && a.x < b.x + b.size && b.x < a.x + a.size && a.y < b.y + b.size && b.y < a.y + a.size)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+
+// Random importances for many different numbers of lights, including more than the atlas can take. Every tile is a power of two in
+// the allowed range, inside the atlas and clear of the others, and the count returned is the number of lights given a tile
+TEST( ShadowAtlas_TilesInBoundsWithoutOverlaps )
+{
+	const int MaxLights = 300;
+	CShadowAtlas atlas( 2048, 128, 1024 );
+	float importance[MaxLights];
+	SShadowAtlasTile tiles[MaxLights];
+	int numLightCounts[] = { 1, 2, 5, 20, 64, 255, 256, 257, MaxLights };
+	for (int test = 0; test < sizeof(numLightCounts) / sizeof(numLightCounts[0]); ++test)
+	{
+		int numLights = numLightCounts[test];
+		srand( numLights );
+		for (int i = 0; i < numLights; ++i)
+		{
+			importance[i] = rand() / static_cast<float>(RAND_MAX);
+		}
+		int numAllocated = atlas.Allocate( importance, numLights, tiles );
+
+		int numWithTiles = 0;
+		bool sizesValid = true, inBounds = true;
+		for (int i = 0; i < numLights; ++i)
+		{
+			if (tiles[i].size == 0) continue;
+			++numWithTiles;
+			sizesValid = sizesValid && tiles[i].size >= 128 && tiles[i].size <= 1024 && (tiles[i].size & (tiles[i].size - 1)) == 0;
+			inBounds = inBounds && tiles[i].x >= 0 && tiles[i].y >= 0 && tiles[i].x + tiles[i].size <= atlas.GetAtlasSize() &&
+			           tiles[i].y + tiles[i].size <= atlas.GetAtlasSize();
+		}
+		CHECK( sizesValid );
+		CHECK( inBounds );
+		CHECK( !AnyOverlap( tiles, numLights ) );
+		CHECK( numAllocated == numWithTiles );
+		CHECK( numAllocated <= atlas.GetMaxLights() );
+	}
+}
+
+// When the requested tiles don't fit, the least important light shrinks all the way to the minimum size before the next one shrinks
+// at all, and equally important lights give way in reverse index order. Once every light is at the minimum size the least important
+// are dropped
+TEST( ShadowAtlas_ShrinksLeastImportantFirst )
+{
+	// Four full size tiles fill the atlas exactly, so light 0 (asking for 256) must shrink first, then light 4
+	CShadowAtlas atlas( 2048, 128, 1024 );
+	float importance[5] = { 0.2f, 1.0f, 1.0f, 1.0f, 1.0f };
+	SShadowAtlasTile tiles[5];
+	CHECK( atlas.Allocate( importance, 5, tiles ) == 5 );
+	CHECK( tiles[0].size == 128 );
+	CHECK( tiles[1].size == 1024 && tiles[2].size == 1024 && tiles[3].size == 1024 );
+	CHECK( tiles[4].size == 512 );
+
+	// A 512 atlas holds 16 minimum size tiles, the four least important of 20 lights are dropped
+	CShadowAtlas smallAtlas( 512, 128, 256 );
+	float manyImportance[20];
+	SShadowAtlasTile manyTiles[20];
+	for (int i = 0; i < 20; ++i)
+	{
+		manyImportance[i] = 0.1f + 0.01f * i;
+	}
+	CHECK( smallAtlas.Allocate( manyImportance, 20, manyTiles ) == 16 );
+	for (int i = 0; i < 20; ++i)
+	{
+		CHECK( manyTiles[i].size == ((i < 4) ? 0 : 128) );
+	}
+}
+
+// The same importances give the same layout, in any atlas of the same size. Small changes in importance that don't change any tile
+// sizes or the order of the lights don't move any tiles
+TEST( ShadowAtlas_LayoutIsDeterministic )
+{
+	const int NumLights = 12;
+	float importance[NumLights] = { 0.9f, 0.05f, 0.4f, 0.4f, 0.7f, 0.01f, 0.2f, 0.6f, 0.3f, 0.02f, 0.8f, 0.1f };
+	SShadowAtlasTile tiles[NumLights], repeatTiles[NumLights], movedTiles[NumLights];
+
+	CShadowAtlas atlas( 2048, 128, 1024 );
+	atlas.Allocate( importance, NumLights, tiles );
+	CShadowAtlas otherAtlas( 2048, 128, 1024 );
+	otherAtlas.Allocate( importance, NumLights, repeatTiles );
+
+	importance[0] = 0.91f;
+	importance[8] = 0.31f;
+	atlas.Allocate( importance, NumLights, movedTiles );
+
+	bool same = true, notMoved = true;
+	for (int i = 0; i < NumLights; ++i)
+	{
+		same = same && tiles[i] == repeatTiles[i];
+		notMoved = notMoved && tiles[i] == movedTiles[i];
+	}
+	CHECK( same );
+	CHECK( notMoved );
+}
@@ -0,0 +1,34 @@
+//--------------------------------------------------------------------------------------
+//	Test.h
+//
+//	Minimal unit test support for the Tests project - tests are functions declared
+//	with TEST, each checking its results with CHECK. TestMain.cpp runs them all
+//--------------------------------------------------------------------------------------
+
+#ifndef TEST_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define TEST_H_INCLUDED
+
+
+// Declare a test function. Tests in any source file of the project are run by TestMain.cpp, in no particular order
+#define TEST( name ) \
+	static void name(); \
+	static CTestRegistration name##Registration( #name, name ); \
+	static void name()
+
+// Check a condition is true, recording a failure (with the condition's text and where it is) if not. The test carries on either way
+#define CHECK( condition ) CheckResult( (condition), #condition, __FILE__, __LINE__ )
+
+// Record the result of a check - use CHECK rather than calling this directly
+void CheckResult( bool passed, const char* condition, const char* file, int line );
+
+
+// Adds a test to the list run by TestMain.cpp when created - TEST creates one for each test
+class CTestRegistration
+{
+public:
+	typedef void (*TestFunction)();
+	CTestRegistration( const char* name, TestFunction function );
+};
+
+
+#endif // End of header guard - see top of file
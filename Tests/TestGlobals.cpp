@@ -0,0 +1,13 @@
+//--------------------------------------------------------------------------------------
+//	TestGlobals.cpp
+//
+//	The globals from Defines.h, normally defined by GraphicsAssign1.cpp and Main.cpp,
+//	which aren't part of the Tests project. Tests run without a device or job system
+//--------------------------------------------------------------------------------------
+
+#include "Defines.h"
+
+ID3D10Device* g_pd3dDevice = NULL;
+int g_ViewportWidth = 1280;
+int g_ViewportHeight = 960;
+CJobSystem* g_JobSystem = NULL;
@@ -0,0 +1,64 @@
+//--------------------------------------------------------------------------------------
+//	TestMain.cpp
+//
+//	Runs every test in the Tests project and reports the results. Returns the number of
+//	tests that failed, so the build (which runs the tests after linking) fails with them
+//--------------------------------------------------------------------------------------
+
+#include <cstdio>
+#include <vector>
+using namespace std;
+
+#include "Test.h"
+
+
+// Every registered test, filled in before main by the CTestRegistration objects TEST creates. A function returning a static list
+// ensures it exists before any registration uses it, whichever source file is initialised first
+struct STest
+{
+	const char*                    name;
+	CTestRegistration::TestFunction function;
+};
+static vector<STest>& GetTests()
+{
+	static vector<STest> tests;
+	return tests;
+}
+
+// Checks failed by the test being run
+static int s_NumFailedChecks = 0;
+
+
+// Add a test to the list
+CTestRegistration::CTestRegistration( const char* name, TestFunction function )
+{
+	STest test = { name, function };
+	GetTests().push_back( test );
+}
+
+// Record the result of a check, reporting it if it failed
+void CheckResult( bool passed, const char* condition, const char* file, int line )
+{
+	if (!passed)
+	{
+		printf( "  %s(%d): CHECK( %s ) failed\n", file, line, condition );
+		++s_NumFailedChecks;
+	}
+}
+
+
+// Run every test, listing each with its result
+int main()
+{
+	vector<STest>& tests = GetTests();
+	int numFailedTests = 0;
+	for (unsigned int t = 0; t < tests.size(); ++t)
+	{
+		s_NumFailedChecks = 0;
+		tests[t].function();
+		printf( "%-50s %s\n", tests[t].name, (s_NumFailedChecks == 0) ? "passed" : "FAILED" );
+		if (s_NumFailedChecks > 0) ++numFailedTests;
+	}
+	printf( "%d of %d tests passed\n", static_cast<int>(tests.size()) - numFailedTests, static_cast<int>(tests.size()) );
+	return numFailedTests;
+}
@@ -0,0 +1,178 @@
+//--------------------------------------------------------------------------------------
+//	VertexEncoderTests.cpp
+//
+//	Tests that CVertexEncoder's compact formats decode (as the GPU would read them) to
+//	within the precision of each format
+//--------------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "Test.h"
+#include "VertexEncoder.h"
+
+
+// Imported vertex with every component but colour: position, normal, tangent, UV
+struct STestVertex
+{
+	D3DXVECTOR3 position;
+	D3DXVECTOR3 normal;
+	D3DXVECTOR3 tangent;
+	float       uv[2];
+};
+
+static float RandomFloat( float min, float max )
+{
+	return min + (max - min) * rand() / static_cast<float>(RAND_MAX);
+}
+
+static D3DXVECTOR3 RandomDirection()
+{
+	D3DXVECTOR3 direction;
+	do
+	{
+		direction = D3DXVECTOR3( RandomFloat( -1.0f, 1.0f ), RandomFloat( -1.0f, 1.0f ), RandomFloat( -1.0f, 1.0f ) );
+	} while (D3DXVec3LengthSq( &direction ) < 0.01f);
+	D3DXVec3Normalize( &direction, &direction );
+	return direction;
+}
+
+// Read a 16-bit signed normalised value as the GPU does
+static float SNorm16ToFloat( short value )
+{
+	float result = value / 32767.0f;
+	return (result < -1.0f) ? -1.0f : result;
+}
+
+// Angle in degrees between two unit vectors, from the distance between them - acos of the dot product loses too much precision for
+// the tiny angles measured here
+static float AngleBetween( const D3DXVECTOR3& a, const D3DXVECTOR3& b )
+{
+	D3DXVECTOR3 difference = a - b;
+	float halfDistance = min( D3DXVec3Length( &difference ) * 0.5f, 1.0f );
+	return 2.0f * asinf( halfDistance ) * 180.0f / D3DX_PI;
+}
+
+// Random vertices within the box (-5, -5, -5) to (15, 15, 15) - a decode scale of 10
+static void MakeTestVertices( vector<STestVertex>& vertices )
+{
+	srand( 1 );
+	for (unsigned int i = 0; i < vertices.size(); ++i)
+	{
+		STestVertex& vertex = vertices[i];
+		vertex.position = D3DXVECTOR3( RandomFloat( -5.0f, 15.0f ), RandomFloat( -5.0f, 15.0f ), RandomFloat( -5.0f, 15.0f ) );
+		vertex.normal = RandomDirection();
+		vertex.tangent = RandomDirection();
+		vertex.uv[0] = RandomFloat( 0.0f, 1.0f );
+		vertex.uv[1] = RandomFloat( 0.0f, 1.0f );
+	}
+}
+
+// Decode each vertex of a compact format and find the largest errors in position (model space units), normal and tangent
+// (degrees) and UV
+static void MeasureDecodedErrors( EVertexFormat format, const vector<STestVertex>& vertices, float& positionError, float& normalError,
+                                  float& uvError, SVertexEncodeStats& stats )
+{
+	CVertexEncoder encoder( format, true, true, true, false );
+	vector<unsigned char> encoded;
+	D3DXVECTOR4 decode;
+	encoder.Encode( &vertices[0], static_cast<unsigned int>(vertices.size()), D3DXVECTOR3( -5.0f, -5.0f, -5.0f ),
+	                D3DXVECTOR3( 15.0f, 15.0f, 15.0f ), encoded, decode, stats );
+
+	const D3D10_INPUT_ELEMENT_DESC* elts = encoder.GetElements();
+	positionError = normalError = uvError = 0.0f;
+	for (unsigned int i = 0; i < vertices.size(); ++i)
+	{
+		const unsigned char* encodedVertex = &encoded[i * encoder.GetVertexSize()];
+
+		float relative[4];
+		if (format == VertexFormat_Half)
+		{
+			D3DXFloat16To32Array( relative, reinterpret_cast<const D3DXFLOAT16*>(encodedVertex + elts[0].AlignedByteOffset), 4 );
+		}
+		else
+		{
+			const short* packed = reinterpret_cast<const short*>(encodedVertex + elts[0].AlignedByteOffset);
+			for (int c = 0; c < 4; ++c) relative[c] = SNorm16ToFloat( packed[c] );
+		}
+		D3DXVECTOR3 position( relative[0] * decode.w + decode.x, relative[1] * decode.w + decode.y, relative[2] * decode.w + decode.z );
+		D3DXVECTOR3 difference = position - vertices[i].position;
+		positionError = max( positionError, D3DXVec3Length( &difference ) );
+
+		for (int n = 0; n < 2; ++n)
+		{
+			const short* packed = reinterpret_cast<const short*>(encodedVertex + elts[1 + n].AlignedByteOffset);
+			D3DXVECTOR3 direction = CVertexEncoder::DecodeOctahedral( SNorm16ToFloat( packed[0] ), SNorm16ToFloat( packed[1] ) );
+			normalError = max( normalError, AngleBetween( direction, (n == 0) ? vertices[i].normal : vertices[i].tangent ) );
+		}
+
+		float uv[2];
+		D3DXFloat16To32Array( uv, reinterpret_cast<const D3DXFLOAT16*>(encodedVertex + elts[3].AlignedByteOffset), 2 );
+		uvError = max( uvError, max( fabsf( uv[0] - vertices[i].uv[0] ), fabsf( uv[1] - vertices[i].uv[1] ) ) );
+	}
+}
+
+
+// 16-bit signed normalised positions are within half a step (scale / 32767) on each axis. Normals and tangents are within a hundredth
+// of a degree, half-float UVs from 0 to 1 within half a step of 2^-11. The encoder's own stats agree
+TEST( VertexEncoder_SNorm16WithinPrecision )
+{
+	vector<STestVertex> vertices( 5000 );
+	MakeTestVertices( vertices );
+	float positionError, normalError, uvError;
+	SVertexEncodeStats stats;
+	MeasureDecodedErrors( VertexFormat_SNorm16, vertices, positionError, normalError, uvError, stats );
+
+	float positionStep = 10.0f / 32767.0f;
+	CHECK( positionError <= 0.5f * positionStep * sqrtf( 3.0f ) * 1.01f );
+	CHECK( normalError < 0.01f );
+	CHECK( uvError <= 1.0f / 4096.0f );
+	CHECK( fabsf( stats.maxPositionError - positionError ) < 1e-5f );
+	CHECK( stats.encodedBytes == 5000 * 20 && stats.sourceBytes == 5000 * sizeof(STestVertex) );
+}
+
+// Half-float positions from -1 to 1 across the bounds are within half a step of 2^-11 (relative) on each axis - scaled by 10 here
+TEST( VertexEncoder_HalfWithinPrecision )
+{
+	vector<STestVertex> vertices( 5000 );
+	MakeTestVertices( vertices );
+	float positionError, normalError, uvError;
+	SVertexEncodeStats stats;
+	MeasureDecodedErrors( VertexFormat_Half, vertices, positionError, normalError, uvError, stats );
+
+	CHECK( positionError <= 10.0f / 4096.0f * sqrtf( 3.0f ) * 1.01f );
+	CHECK( normalError < 0.01f );
+	CHECK( uvError <= 1.0f / 4096.0f );
+	CHECK( fabsf( stats.maxPositionError - positionError ) < 1e-5f );
+}
+
+// Octahedral encoding (before it is quantised) round trips every direction to within a thousandth of a degree, including the axes and
+// the folded corners of the lower half, and stays in the -1 to 1 square
+TEST( VertexEncoder_OctahedralRoundTrip )
+{
+	const D3DXVECTOR3 specialDirections[] =
+	{
+		D3DXVECTOR3( 1.0f, 0.0f, 0.0f ), D3DXVECTOR3( -1.0f, 0.0f, 0.0f ), D3DXVECTOR3( 0.0f, 1.0f, 0.0f ), D3DXVECTOR3( 0.0f, -1.0f, 0.0f ),
+		D3DXVECTOR3( 0.0f, 0.0f, 1.0f ), D3DXVECTOR3( 0.0f, 0.0f, -1.0f ), D3DXVECTOR3( 0.577f, -0.577f, -0.577f ), D3DXVECTOR3( -0.6f, 0.0f, -0.8f )
+	};
+	const int NumSpecial = sizeof(specialDirections) / sizeof(specialDirections[0]);
+
+	srand( 2 );
+	float maxError = 0.0f;
+	bool inSquare = true;
+	for (int i = 0; i < NumSpecial + 10000; ++i)
+	{
+		D3DXVECTOR3 direction;
+		if (i < NumSpecial) D3DXVec3Normalize( &direction, &specialDirections[i] );
+		else                direction = RandomDirection();
+
+		float u, v;
+		CVertexEncoder::EncodeOctahedral( direction, u, v );
+		inSquare = inSquare && fabsf( u ) <= 1.0f && fabsf( v ) <= 1.0f;
+		maxError = max( maxError, AngleBetween( CVertexEncoder::DecodeOctahedral( u, v ), direction ) );
+	}
+	CHECK( inSquare );
+	CHECK( maxError < 0.001f );
+}
@@ -0,0 +1,147 @@
+//--------------------------------------------------------------------------------------
+//	UploadRing.cpp
+//
+//	A dynamic GPU buffer that per-frame data (e.g. instance data) is written into in
+//	bulk, with the space recycled once the GPU has finished with each frame
+//--------------------------------------------------------------------------------------
+
+#include "Defines.h"    // General definitions shared by all source files
+#include "UploadRing.h" // Declaration of this class
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+CUploadRing::CUploadRing()
+{
+	m_Buffer = NULL;
+	m_Mapped = false;
+	m_Discarded = false;
+	for (unsigned int q = 0; q < MAX_FRAMES_IN_FLIGHT; ++q)
+	{
+		m_FrameQueries[q] = NULL;
+	}
+	m_Frame = 1;
+	m_CompletedFrame = 0;
+}
+
+CUploadRing::~CUploadRing()
+{
+	ReleaseResources();
+}
+
+// Create the buffer with the given size in bytes, and the frame queries. Returns false on failure
+bool CUploadRing::Create( unsigned int capacity )
+{
+	ReleaseResources();
+
+	D3D10_BUFFER_DESC bufferDesc;
+	bufferDesc.BindFlags = D3D10_BIND_VERTEX_BUFFER;
+	bufferDesc.Usage = D3D10_USAGE_DYNAMIC; // Written by the CPU every frame
+	bufferDesc.ByteWidth = capacity;
+	bufferDesc.CPUAccessFlags = D3D10_CPU_ACCESS_WRITE;
+	bufferDesc.MiscFlags = 0;
+	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &m_Buffer )))
+	{
+		return false;
+	}
+
+	D3D10_QUERY_DESC queryDesc;
+	queryDesc.Query = D3D10_QUERY_EVENT;
+	queryDesc.MiscFlags = 0;
+	for (unsigned int q = 0; q < MAX_FRAMES_IN_FLIGHT; ++q)
+	{
+		if (FAILED( g_pd3dDevice->CreateQuery( &queryDesc, &m_FrameQueries[q] )))
+		{
+			return false;
+		}
+	}
+
+	m_Allocator.Reset( capacity );
+	m_Frame = 1;
+	m_CompletedFrame = 0;
+	return true;
+}
+
+// Release the buffer and queries
+void CUploadRing::ReleaseResources()
+{
+	if (m_Mapped) Unmap();
+	for (unsigned int q = 0; q < MAX_FRAMES_IN_FLIGHT; ++q)
+	{
+		SAFE_RELEASE( m_FrameQueries[q] );
+	}
+	SAFE_RELEASE( m_Buffer );
+	m_Allocator.Reset( 0 );
+	m_Discarded = false;
+}
+
+
+/////////////////////////////
+// Usage
+
+// Check (or wait) for the GPU to finish the oldest frame in flight, retiring its space if it has. Returns true if it has finished.
+// Only S_FALSE means the query is still pending. An error (e.g. the device has been removed) means it will never complete, so the
+// frame is treated as finished rather than waiting forever - the GPU will not be reading its data
+bool CUploadRing::PollOldestFrame( bool wait )
+{
+	if (m_CompletedFrame + 1 >= m_Frame) return false; // No frames in flight
+
+	ID3D10Query* query = m_FrameQueries[(m_CompletedFrame + 1) % MAX_FRAMES_IN_FLIGHT];
+	while (query->GetData( NULL, 0, wait ? 0 : D3D10_ASYNC_GETDATA_DONOTFLUSH ) == S_FALSE)
+	{
+		if (!wait) return false;
+	}
+	++m_CompletedFrame;
+	m_Allocator.Retire( m_CompletedFrame );
+	return true;
+}
+
+// Retire frames the GPU has finished with. If every query is still in use the CPU is too far ahead, so wait for the oldest frame
+void CUploadRing::BeginFrame()
+{
+	if (!m_Buffer) return;
+
+	while (PollOldestFrame( false )) {}
+	if (m_Frame - m_CompletedFrame > MAX_FRAMES_IN_FLIGHT)
+	{
+		PollOldestFrame( true );
+	}
+}
+
+// Mark the end of the frame's GPU work with a fence
+void CUploadRing::EndFrame()
+{
+	if (!m_Buffer) return;
+
+	m_FrameQueries[m_Frame % MAX_FRAMES_IN_FLIGHT]->End();
+	m_Allocator.EndFrame( m_Frame );
+	++m_Frame;
+}
+
+// Allocate space for the current frame, and map the buffer to write it. If the ring is full, wait for frames in flight to finish
+// until there is room
+void* CUploadRing::Map( unsigned int size, unsigned int alignment, unsigned int& offset )
+{
+	if (!m_Buffer || m_Mapped) return NULL;
+
+	while (!m_Allocator.Allocate( size, alignment, offset ))
+	{
+		if (!PollOldestFrame( true )) return NULL; // Nothing in flight to wait for - the current frame has filled the ring
+	}
+
+	void* data;
+	if (FAILED( m_Buffer->Map( m_Discarded ? D3D10_MAP_WRITE_NO_OVERWRITE : D3D10_MAP_WRITE_DISCARD, 0, &data )))
+	{
+		return NULL;
+	}
+	m_Discarded = true;
+	m_Mapped = true;
+	return static_cast<unsigned char*>(data) + offset;
+}
+
+void CUploadRing::Unmap()
+{
+	m_Buffer->Unmap();
+	m_Mapped = false;
+}
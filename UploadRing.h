@@ -0,0 +1,92 @@
+//--------------------------------------------------------------------------------------
+//	UploadRing.h
+//
+//	A dynamic GPU buffer that per-frame data (e.g. instance data) is written into in
+//	bulk, with the space recycled once the GPU has finished with each frame
+//--------------------------------------------------------------------------------------
+
+#ifndef UPLOAD_RING_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define UPLOAD_RING_H_INCLUDED
+
+#include <d3d10.h>
+#include "RingAllocator.h"
+
+
+// Space in the buffer is handed out by a CRingAllocator. The buffer is mapped with "no overwrite", a promise that the CPU won't touch
+// data the GPU may still be reading, so the driver doesn't need to wait or make a copy of the buffer. To keep that promise, each frame
+// ends with an event query - a fence that the GPU passes when it has finished all the frame's work. Space used by a frame is only
+// reused once its fence has been passed. If the CPU gets too far ahead (all queries in use, or the ring is full) it waits for the
+// oldest frame to finish. D3D10 only allows "no overwrite" for vertex and index buffers, so the ring is a vertex buffer
+class CUploadRing
+{
+/////////////////////////////
+// Private member variables
+private:
+
+	ID3D10Buffer*       m_Buffer;
+	CRingAllocator      m_Allocator;
+	bool                m_Mapped;
+	bool                m_Discarded; // The buffer must be mapped with "discard" once before "no overwrite" can be used
+
+	// One event query per frame that may be in flight, used in turn. Frame numbers start at 1, the current frame is not yet ended
+	static const unsigned int MAX_FRAMES_IN_FLIGHT = 3;
+	ID3D10Query*        m_FrameQueries[MAX_FRAMES_IN_FLIGHT];
+	unsigned int        m_Frame;
+	unsigned int        m_CompletedFrame;
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	// Check (or wait) for the GPU to finish the oldest frame in flight. Returns true if it has finished
+	bool PollOldestFrame( bool wait );
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	CUploadRing();
+	~CUploadRing();
+
+	// Create the buffer with the given size in bytes, and the frame queries. Returns false on failure
+	bool Create( unsigned int capacity );
+
+	// Release the buffer and queries, waiting for nothing - only call when the GPU is idle or shutting down
+	void ReleaseResources();
+
+
+	/////////////////////////////
+	// Usage
+
+	// Retire frames the GPU has finished with. Call at the start of each frame
+	void BeginFrame();
+
+	// Mark the end of the frame's GPU work with a fence. Call after the frame's last draw call
+	void EndFrame();
+
+	// Allocate space for the current frame, and map the buffer to write it. Returns a pointer to the space and its byte offset in the
+	// buffer, or NULL if the space can't be found. Unmap must be called before drawing with the data
+	void* Map( unsigned int size, unsigned int alignment, unsigned int& offset );
+	void Unmap();
+
+
+	/////////////////////////////
+	// Data access
+
+	ID3D10Buffer* GetBuffer()
+	{
+		return m_Buffer;
+	}
+	const CRingAllocator& GetAllocator()
+	{
+		return m_Allocator;
+	}
+};
+
+
+#endif // End of header guard - see top of file
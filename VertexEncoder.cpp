@@ -0,0 +1,257 @@
+//--------------------------------------------------------------------------------------
+//	VertexEncoder.cpp
+//
+//	Converts imported vertex data (all floats) into the layout used in a model's vertex
+//	buffer, optionally packing it into compact formats to save memory, and describes
+//	the result as a list of vertex elements for DirectX
+//--------------------------------------------------------------------------------------
+
+#include <cmath>
+#include <cstring>
+using namespace std;
+
+#include "VertexEncoder.h" // Declaration of this class
+#include "CTimer.h"
+
+
+// Conversion between floats and 16-bit signed normalised integers, matching the GPU's conversion when reading the vertex data
+static short FloatToSNorm16( float value )
+{
+	float scaled = floorf( value * 32767.0f + 0.5f );
+	if (scaled > 32767.0f) scaled = 32767.0f;
+	if (scaled < -32767.0f) scaled = -32767.0f;
+	return static_cast<short>(scaled);
+}
+static float SNorm16ToFloat( short value )
+{
+	float result = value / 32767.0f;
+	return (result < -1.0f) ? -1.0f : result;
+}
+
+// Angle in degrees between two unit vectors
+static float AngleBetween( const D3DXVECTOR3& a, const D3DXVECTOR3& b )
+{
+	float dot = D3DXVec3Dot( &a, &b );
+	dot = (dot > 1.0f) ? 1.0f : ((dot < -1.0f) ? -1.0f : dot);
+	return acosf( dot ) * 180.0f / D3DX_PI;
+}
+
+
+///////////////////////////////
+// Constructors / Destructors
+
+// Constructor - builds the vertex layout for the format and the components the imported vertices have
+CVertexEncoder::CVertexEncoder( EVertexFormat format, bool hasNormals, bool hasTangents, bool hasUVs, bool hasColours )
+{
+	m_Format = format;
+	m_HasNormals = hasNormals;
+	m_HasTangents = hasTangents;
+	m_HasUVs = hasUVs;
+	m_HasColours = hasColours;
+
+	m_NumElts = 0;
+	m_VertexSize = 0;
+	m_SourceVertexSize = 12 + (hasNormals ? 12 : 0) + (hasTangents ? 12 : 0) + (hasUVs ? 8 : 0) + (hasColours ? 4 : 0);
+
+	// DirectX has no three component 16-bit formats, so compact positions use four components (the shader ignores the last)
+	bool compact = (format != VertexFormat_Full);
+	if (!compact)                           AddElement( "POSITION", DXGI_FORMAT_R32G32B32_FLOAT, 12 );
+	else if (format == VertexFormat_Half)   AddElement( "POSITION", DXGI_FORMAT_R16G16B16A16_FLOAT, 8 );
+	else                                    AddElement( "POSITION", DXGI_FORMAT_R16G16B16A16_SNORM, 8 );
+	if (hasNormals)  AddElement( "NORMAL",   compact ? DXGI_FORMAT_R16G16_SNORM : DXGI_FORMAT_R32G32B32_FLOAT, compact ? 4 : 12 );
+	if (hasTangents) AddElement( "TANGENT",  compact ? DXGI_FORMAT_R16G16_SNORM : DXGI_FORMAT_R32G32B32_FLOAT, compact ? 4 : 12 );
+	if (hasUVs)      AddElement( "TEXCOORD", compact ? DXGI_FORMAT_R16G16_FLOAT : DXGI_FORMAT_R32G32_FLOAT, compact ? 4 : 8 );
+	if (hasColours)  AddElement( "COLOR",    DXGI_FORMAT_R8G8B8A8_UNORM, 4 ); // A RGBA colour with 1 byte (0-255) per component
+}
+
+// Add an element to the vertex layout. See CModel::Load for a description of each field
+void CVertexEncoder::AddElement( const char* semantic, DXGI_FORMAT format, unsigned int size )
+{
+	m_Elts[m_NumElts].SemanticName = semantic;
+	m_Elts[m_NumElts].SemanticIndex = 0;
+	m_Elts[m_NumElts].Format = format;
+	m_Elts[m_NumElts].AlignedByteOffset = m_VertexSize;
+	m_Elts[m_NumElts].InputSlot = 0;
+	m_Elts[m_NumElts].InputSlotClass = D3D10_INPUT_PER_VERTEX_DATA;
+	m_Elts[m_NumElts].InstanceDataStepRate = 0;
+	m_VertexSize += size;
+	++m_NumElts;
+}
+
+
+/////////////////////////////
+// Encoding
+
+// Octahedral encoding of a direction. The direction is scaled so |x| + |y| + |z| = 1, which puts it on the surface of an octahedron.
+// The top half of the octahedron (z >= 0) is flattened straight down onto a diamond in the xy plane. The bottom half is folded out
+// over the diamond's edges to fill the corners of the square -1 to 1
+void CVertexEncoder::EncodeOctahedral( const D3DXVECTOR3& direction, float& u, float& v )
+{
+	float sum = fabsf( direction.x ) + fabsf( direction.y ) + fabsf( direction.z );
+	if (sum <= 0.0f)
+	{
+		u = v = 0.0f;
+		return;
+	}
+	u = direction.x / sum;
+	v = direction.y / sum;
+	if (direction.z < 0.0f)
+	{
+		float foldedU = (1.0f - fabsf( v )) * ((u >= 0.0f) ? 1.0f : -1.0f);
+		float foldedV = (1.0f - fabsf( u )) * ((v >= 0.0f) ? 1.0f : -1.0f);
+		u = foldedU;
+		v = foldedV;
+	}
+}
+
+// Reverse of the above - the same calculation is made in the shader (DecodeNormal in the .fx file)
+D3DXVECTOR3 CVertexEncoder::DecodeOctahedral( float u, float v )
+{
+	D3DXVECTOR3 direction( u, v, 1.0f - fabsf( u ) - fabsf( v ) );
+	if (direction.z < 0.0f)
+	{
+		direction.x = (1.0f - fabsf( v )) * ((u >= 0.0f) ? 1.0f : -1.0f);
+		direction.y = (1.0f - fabsf( u )) * ((v >= 0.0f) ? 1.0f : -1.0f);
+	}
+	D3DXVec3Normalize( &direction, &direction );
+	return direction;
+}
+
+
+// Encode imported vertices into the output data
+void CVertexEncoder::Encode( const void* sourceVertices, unsigned int numVertices, const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds,
+                             vector<unsigned char>& output, D3DXVECTOR4& positionDecode, SVertexEncodeStats& stats )
+{
+	CTimer timer;
+	timer.Start();
+
+	const unsigned char* source = static_cast<const unsigned char*>(sourceVertices);
+	output.resize( numVertices * m_VertexSize );
+	if (m_Format == VertexFormat_Full)
+	{
+		// Already in the right layout
+		positionDecode = D3DXVECTOR4( 0.0f, 0.0f, 0.0f, 1.0f );
+		if (numVertices > 0) memcpy( &output[0], source, numVertices * m_VertexSize );
+	}
+	else
+	{
+		// Positions are stored relative to the centre of the bounds, scaled by the largest half-size so every axis uses the
+		// same scale (then normals transformed by the world matrix only change length, which the shaders correct)
+		D3DXVECTOR3 centre = (minBounds + maxBounds) * 0.5f;
+		D3DXVECTOR3 halfSize = (maxBounds - minBounds) * 0.5f;
+		float scale = (halfSize.x > halfSize.y) ? halfSize.x : halfSize.y;
+		scale = (halfSize.z > scale) ? halfSize.z : scale;
+		if (scale <= 0.0f) scale = 1.0f;
+		positionDecode = D3DXVECTOR4( centre.x, centre.y, centre.z, scale );
+
+		for (unsigned int i = 0; i < numVertices; ++i)
+		{
+			const unsigned char* in = source + i * m_SourceVertexSize;
+			unsigned char* out = &output[i * m_VertexSize];
+
+			const D3DXVECTOR3* position = reinterpret_cast<const D3DXVECTOR3*>(in);
+			float relative[4] = { (position->x - centre.x) / scale, (position->y - centre.y) / scale, (position->z - centre.z) / scale, 0.0f };
+			if (m_Format == VertexFormat_Half)
+			{
+				D3DXFloat32To16Array( reinterpret_cast<D3DXFLOAT16*>(out), relative, 4 );
+			}
+			else
+			{
+				short* packed = reinterpret_cast<short*>(out);
+				for (int c = 0; c < 4; ++c) packed[c] = FloatToSNorm16( relative[c] );
+			}
+			in += 12;
+			out += 8;
+
+			// Normal then tangent
+			for (int n = 0; n < 2; ++n)
+			{
+				if ((n == 0) ? !m_HasNormals : !m_HasTangents) continue;
+				float u, v;
+				EncodeOctahedral( *reinterpret_cast<const D3DXVECTOR3*>(in), u, v );
+				short* packed = reinterpret_cast<short*>(out);
+				packed[0] = FloatToSNorm16( u );
+				packed[1] = FloatToSNorm16( v );
+				in += 12;
+				out += 4;
+			}
+
+			if (m_HasUVs)
+			{
+				D3DXFloat32To16Array( reinterpret_cast<D3DXFLOAT16*>(out), reinterpret_cast<const float*>(in), 2 );
+				in += 8;
+				out += 4;
+			}
+			if (m_HasColours)
+			{
+				memcpy( out, in, 4 );
+			}
+		}
+	}
+
+	stats.encodeTime = timer.GetTime();
+	stats.sourceBytes = numVertices * m_SourceVertexSize;
+	stats.encodedBytes = numVertices * m_VertexSize;
+	MeasureErrors( sourceVertices, numVertices, output, positionDecode, stats );
+}
+
+
+// Measure the errors in encoded vertex data by decoding it as the GPU and shaders would
+void CVertexEncoder::MeasureErrors( const void* sourceVertices, unsigned int numVertices, const vector<unsigned char>& encoded,
+                                    const D3DXVECTOR4& positionDecode, SVertexEncodeStats& stats )
+{
+	stats.maxPositionError = 0.0f;
+	stats.maxNormalError = 0.0f;
+	stats.maxUVError = 0.0f;
+	if (m_Format == VertexFormat_Full) return; // Exact copy
+
+	const unsigned char* source = static_cast<const unsigned char*>(sourceVertices);
+	for (unsigned int i = 0; i < numVertices; ++i)
+	{
+		const unsigned char* in = source + i * m_SourceVertexSize;
+		const unsigned char* out = &encoded[i * m_VertexSize];
+
+		float relative[4];
+		if (m_Format == VertexFormat_Half)
+		{
+			D3DXFloat16To32Array( relative, reinterpret_cast<const D3DXFLOAT16*>(out), 4 );
+		}
+		else
+		{
+			const short* packed = reinterpret_cast<const short*>(out);
+			for (int c = 0; c < 4; ++c) relative[c] = SNorm16ToFloat( packed[c] );
+		}
+		D3DXVECTOR3 decoded( relative[0] * positionDecode.w + positionDecode.x, relative[1] * positionDecode.w + positionDecode.y,
+		                     relative[2] * positionDecode.w + positionDecode.z );
+		D3DXVECTOR3 difference = decoded - *reinterpret_cast<const D3DXVECTOR3*>(in);
+		float error = D3DXVec3Length( &difference );
+		if (error > stats.maxPositionError) stats.maxPositionError = error;
+		in += 12;
+		out += 8;
+
+		for (int n = 0; n < 2; ++n)
+		{
+			if ((n == 0) ? !m_HasNormals : !m_HasTangents) continue;
+			const short* packed = reinterpret_cast<const short*>(out);
+			D3DXVECTOR3 direction = DecodeOctahedral( SNorm16ToFloat( packed[0] ), SNorm16ToFloat( packed[1] ) );
+			D3DXVECTOR3 original;
+			D3DXVec3Normalize( &original, reinterpret_cast<const D3DXVECTOR3*>(in) );
+			float angle = AngleBetween( direction, original );
+			if (angle > stats.maxNormalError) stats.maxNormalError = angle;
+			in += 12;
+			out += 4;
+		}
+
+		if (m_HasUVs)
+		{
+			float uv[2];
+			D3DXFloat16To32Array( uv, reinterpret_cast<const D3DXFLOAT16*>(out), 2 );
+			const float* originalUV = reinterpret_cast<const float*>(in);
+			for (int c = 0; c < 2; ++c)
+			{
+				float error = fabsf( uv[c] - originalUV[c] );
+				if (error > stats.maxUVError) stats.maxUVError = error;
+			}
+		}
+	}
+}
@@ -0,0 +1,131 @@
+//--------------------------------------------------------------------------------------
+//	VertexEncoder.h
+//
+//	Converts imported vertex data (all floats) into the layout used in a model's vertex
+//	buffer, optionally packing it into compact formats to save memory, and describes
+//	the result as a list of vertex elements for DirectX
+//--------------------------------------------------------------------------------------
+
+#ifndef VERTEX_ENCODER_H_INCLUDED // Header guard - prevents file being included more than once (would cause errors)
+#define VERTEX_ENCODER_H_INCLUDED
+
+#include <vector>
+using namespace std;
+
+#include <d3d10.h>
+#include <d3dx10.h>
+
+
+// Ways of storing vertex data in a vertex buffer
+//  - Full:    float3 position, normal and tangent, float2 UV (as imported)
+//  - Half:    half-float positions within the model's bounds, 16-bit octahedral normals and tangents, half-float UVs
+//  - SNorm16: as Half, but positions are 16-bit signed normalised integers within the bounds - more even precision than halfs
+// Vertex colours are always 4 bytes
+enum EVertexFormat
+{
+	VertexFormat_Full,
+	VertexFormat_Half,
+	VertexFormat_SNorm16,
+};
+
+
+// Results of encoding a model's vertices, for reporting. Errors are measured by decoding the data again the same way the GPU will
+struct SVertexEncodeStats
+{
+	unsigned int sourceBytes;      // Size of the imported vertex data
+	unsigned int encodedBytes;     // Size of the vertex buffer data
+	float        encodeTime;       // Seconds
+	float        maxPositionError; // Model space units
+	float        maxNormalError;   // Degrees, normals and tangents
+	float        maxUVError;
+};
+
+
+// Compact positions are stored as -1 to 1 across the model's bounds, so the shader needs a decode scale and offset to get model space
+// positions back. Compact normals and tangents use "octahedral" encoding: a unit vector is projected onto an octahedron, and the
+// octahedron is unfolded into a square, so two values hold a direction with even precision in all directions
+class CVertexEncoder
+{
+/////////////////////////////
+// Private member variables
+private:
+
+	EVertexFormat m_Format;
+
+	// Which components the vertices have (position always)
+	bool m_HasNormals;
+	bool m_HasTangents;
+	bool m_HasUVs;
+	bool m_HasColours;
+
+	// Description of the encoded vertex layout, and size of an encoded and an imported vertex
+	static const int         MAX_ELTS = 5;
+	D3D10_INPUT_ELEMENT_DESC m_Elts[MAX_ELTS];
+	unsigned int             m_NumElts;
+	unsigned int             m_VertexSize;
+	unsigned int             m_SourceVertexSize;
+
+
+/////////////////////////////
+// Public member functions
+public:
+
+	///////////////////////////////
+	// Constructors / Destructors
+
+	// Constructor - takes the format to encode into and the components that the imported vertices have. Builds the vertex layout
+	CVertexEncoder( EVertexFormat format, bool hasNormals, bool hasTangents, bool hasUVs, bool hasColours );
+
+
+	/////////////////////////////
+	// Data access
+
+	const D3D10_INPUT_ELEMENT_DESC* GetElements()
+	{
+		return m_Elts;
+	}
+	unsigned int GetNumElements()
+	{
+		return m_NumElts;
+	}
+	unsigned int GetVertexSize()
+	{
+		return m_VertexSize;
+	}
+	unsigned int GetSourceVertexSize()
+	{
+		return m_SourceVertexSize;
+	}
+	bool UsesOctahedralNormals()
+	{
+		return m_Format != VertexFormat_Full;
+	}
+
+
+	/////////////////////////////
+	// Encoding
+
+	// Encode imported vertices into the output data. Positions are fitted to the given model space bounds. The decode values for the
+	// shader are returned: model position = stored position * w + xyz. The stats are filled in, including the errors after decoding
+	void Encode( const void* sourceVertices, unsigned int numVertices, const D3DXVECTOR3& minBounds, const D3DXVECTOR3& maxBounds,
+	             vector<unsigned char>& output, D3DXVECTOR4& positionDecode, SVertexEncodeStats& stats );
+
+	// Octahedral encoding of a direction into two values from -1 to 1, and the reverse
+	static void EncodeOctahedral( const D3DXVECTOR3& direction, float& u, float& v );
+	static D3DXVECTOR3 DecodeOctahedral( float u, float v );
+
+
+/////////////////////////////
+// Private member functions
+private:
+
+	// Add an element to the vertex layout
+	void AddElement( const char* semantic, DXGI_FORMAT format, unsigned int size );
+
+	// Measure the errors in encoded vertex data by decoding it as the GPU and shaders would
+	void MeasureErrors( const void* sourceVertices, unsigned int numVertices, const vector<unsigned char>& encoded,
+	                    const D3DXVECTOR4& positionDecode, SVertexEncodeStats& stats );
+};
+
+
+#endif // End of header guard - see top of file